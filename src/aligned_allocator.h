@@ -0,0 +1,59 @@
+#ifndef __ALIGNED_ALLOCATOR__
+#define __ALIGNED_ALLOCATOR__
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+// std::allocator ignores alignas beyond 16 before c++17, use this to keep SIMD / cache line
+// sized elements aligned in std::vector
+template<class T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template<class U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() {}
+    template<class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n)
+    {
+        size_t size = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+#if defined(_MSC_VER)
+        void* p = _aligned_malloc(size, Alignment);
+#else
+        void* p = nullptr;
+        if(posix_memalign(&p, Alignment, size) != 0)
+            p = nullptr;
+#endif
+        if(!p)
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t)
+    {
+#if defined(_MSC_VER)
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+
+    template<class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template<class U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+
+#endif // __ALIGNED_ALLOCATOR__
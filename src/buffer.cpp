@@ -0,0 +1,42 @@
+#include <iostream>
+
+#include "buffer.h"
+
+Buffer::Buffer(size_t size, const void* data, GLbitfield flags):
+    m_id(0),
+    m_size(size)
+{
+    glCreateBuffers(1, &m_id);
+    // zero sized storage is not allowed, keep a placeholder so the buffer can always be bound
+    glNamedBufferStorage(m_id, size ? size : 4, size ? data : nullptr, flags);
+}
+
+Buffer::~Buffer()
+{
+    glDeleteBuffers(1, &m_id);
+}
+
+void Buffer::bind_base(GLenum target, unsigned index) const
+{
+    glBindBufferBase(target, index, m_id);
+}
+
+bool Buffer::set_data(const void* data, size_t size, size_t offset)
+{
+    if(offset + size > m_size)
+    {
+        std::cerr << "Buffer set data out of range: " << offset << " + " << size
+            << " > " << m_size << "\n";
+        return false;
+    }
+    glNamedBufferSubData(m_id, offset, size, data);
+    return true;
+}
+
+void* Buffer::map(GLbitfield access)
+{
+    void* data = glMapNamedBufferRange(m_id, 0, m_size ? m_size : 4, access);
+    if(!data)
+        std::cerr << "Buffer map failed: " << m_id << "\n";
+    return data;
+}
@@ -0,0 +1,34 @@
+#ifndef __BUFFER__
+#define __BUFFER__
+
+#include <cstddef>
+#include <GL/glew.h>
+
+// immutable storage OpenGL buffer, mostly used as shader storage buffer
+class Buffer
+{
+public:
+    // flags is passed to glNamedBufferStorage, size 0 is allowed and creates an empty buffer
+    Buffer(size_t size, const void* data = nullptr, GLbitfield flags = GL_DYNAMIC_STORAGE_BIT);
+    ~Buffer();
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    unsigned get_id() const { return m_id; }
+    size_t get_size() const { return m_size; }
+    // bind to indexed target, such as GL_SHADER_STORAGE_BUFFER / GL_UNIFORM_BUFFER
+    void bind_base(GLenum target, unsigned index) const;
+    // need GL_DYNAMIC_STORAGE_BIT
+    bool set_data(const void* data, size_t size, size_t offset = 0);
+    // map the whole buffer, access must be a subset of the storage flags,
+    // a persistent mapping stays valid until the buffer is destroyed
+    void* map(GLbitfield access);
+
+private:
+    GLuint m_id;
+    size_t m_size;
+};
+
+
+#endif // __BUFFER__
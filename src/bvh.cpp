@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <thread>
+#include <limits>
+#include <cmath>
+#include <glm/common.hpp>
+
+#include "bvh.h"
+#include "scene.h"
+
+static const int bin_count = 16;
+static const unsigned max_leaf_size = 4;  // leaves may be bigger if SAH prefers it
+static const unsigned max_sah_leaf_size = 16;  // larger ranges are always split
+static const unsigned parallel_threshold = 16 * 1024;  // smaller subtrees are built on the spawning thread
+static const float traversal_cost = 1.0f;  // relative to one primitive intersection
+// an instance costs a whole mesh traversal, so the top level splits down to single instances
+static const unsigned tlas_max_leaf_size = 1;
+static const float tlas_traversal_cost = 0.1f;
+
+struct Aabb
+{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    Aabb():
+        min(std::numeric_limits<float>::max()),
+        max(-std::numeric_limits<float>::max())
+    {
+    }
+
+    void grow(const glm::vec3& p)
+    {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void grow(const Aabb& b)
+    {
+        min = glm::min(min, b.min);
+        max = glm::max(max, b.max);
+    }
+
+    float area() const
+    {
+        glm::vec3 d = max - min;
+        if(d.x < 0.0f)
+            return 0.0f;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+// append a tree built on its own, rebasing interior nodes by the nodes before it
+// and leaves by prim_base, the indices before its own in the prim index array
+static void append_nodes(BvhNodeArray& nodes, const BvhNodeArray& sub_nodes, unsigned prim_base)
+{
+    const unsigned base = unsigned(nodes.size());
+    nodes.insert(nodes.end(), sub_nodes.begin(), sub_nodes.end());
+    for(unsigned i = base; i < nodes.size(); ++i)
+    {
+        if(nodes[i].count == 0)
+            nodes[i].offset += base;
+        else
+            nodes[i].offset += prim_base;
+    }
+}
+
+class BvhBuilder
+{
+public:
+    BvhBuilder(const std::vector<Aabb>& bounds, const std::vector<glm::vec3>& centroids,
+        std::vector<unsigned>& indices, int parallel_depth,
+        unsigned leaf_size = max_leaf_size, unsigned sah_leaf_size = max_sah_leaf_size,
+        float node_cost = traversal_cost):
+        m_bounds(bounds),
+        m_centroids(centroids),
+        m_indices(indices),
+        m_parallel_depth(parallel_depth),
+        m_leaf_size(leaf_size),
+        m_sah_leaf_size(sah_leaf_size),
+        m_node_cost(node_cost)
+    {
+    }
+
+    // append the subtree of indices [begin, end) to nodes in depth first order,
+    // interior nodes' offset is relative to the start of nodes
+    void build(BvhNodeArray& nodes, unsigned begin, unsigned end, int depth)
+    {
+        Aabb box, centroid_box;
+        for(unsigned i = begin; i < end; ++i)
+        {
+            box.grow(m_bounds[m_indices[i]]);
+            centroid_box.grow(m_centroids[m_indices[i]]);
+        }
+
+        const unsigned node_index = unsigned(nodes.size());
+        BvhNode node;
+        node.bounds_min = box.min;
+        node.bounds_max = box.max;
+        node.offset = begin;
+        node.count = end - begin;
+        nodes.push_back(node);
+
+        const unsigned count = end - begin;
+        if(count <= m_leaf_size || depth >= bvh_max_depth - 1)
+            return;
+
+        unsigned mid = split(box, centroid_box, begin, end);
+        if(mid == begin)
+            return;  // SAH says a leaf is cheaper
+
+        if(depth < m_parallel_depth && count > parallel_threshold)
+        {
+            BvhNodeArray left_nodes, right_nodes;
+            std::thread left_thread([&]() { build(left_nodes, begin, mid, depth + 1); });
+            build(right_nodes, mid, end, depth + 1);
+            left_thread.join();
+
+            append_nodes(nodes, left_nodes, 0);
+            nodes[node_index].offset = unsigned(nodes.size());
+            append_nodes(nodes, right_nodes, 0);
+        }
+        else
+        {
+            build(nodes, begin, mid, depth + 1);
+            nodes[node_index].offset = unsigned(nodes.size());
+            build(nodes, mid, end, depth + 1);
+        }
+        nodes[node_index].count = 0;
+    }
+
+private:
+    // partition [begin, end) by the cheapest binned SAH plane, return the first index of the
+    // right part, or begin if it is cheaper to keep a leaf
+    unsigned split(const Aabb& box, const Aabb& centroid_box, unsigned begin, unsigned end)
+    {
+        const unsigned count = end - begin;
+        float best_cost = std::numeric_limits<float>::max();
+        int best_axis = -1;
+        int best_bin = 0;
+
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            const float extent = centroid_box.max[axis] - centroid_box.min[axis];
+            if(extent <= 0.0f)
+                continue;
+            const float scale = bin_count / extent;
+
+            Aabb bin_bounds[bin_count];
+            unsigned bin_counts[bin_count] = {0};
+            for(unsigned i = begin; i < end; ++i)
+            {
+                unsigned prim = m_indices[i];
+                int bin = std::min(bin_count - 1, int((m_centroids[prim][axis] - centroid_box.min[axis]) * scale));
+                bin_counts[bin]++;
+                bin_bounds[bin].grow(m_bounds[prim]);
+            }
+
+            // sweep from the right to get area * count of every right part
+            float right_cost[bin_count];
+            Aabb right_box;
+            unsigned right_count = 0;
+            for(int b = bin_count - 1; b > 0; --b)
+            {
+                right_box.grow(bin_bounds[b]);
+                right_count += bin_counts[b];
+                right_cost[b] = right_box.area() * right_count;
+            }
+            Aabb left_box;
+            unsigned left_count = 0;
+            for(int b = 0; b < bin_count - 1; ++b)
+            {
+                left_box.grow(bin_bounds[b]);
+                left_count += bin_counts[b];
+                if(left_count == 0 || left_count == count)
+                    continue;
+                float cost = left_box.area() * left_count + right_cost[b + 1];
+                if(cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        if(best_axis < 0)
+        {
+            // all centroids at the same point, split by index if the range is too large
+            return count > m_sah_leaf_size ? begin + count / 2 : begin;
+        }
+
+        const float area = box.area();
+        const float split_cost = m_node_cost + (area > 0.0f ? best_cost / area : 0.0f);
+        if(split_cost >= float(count) && count <= m_sah_leaf_size)
+            return begin;
+
+        const float min = centroid_box.min[best_axis];
+        const float scale = bin_count / (centroid_box.max[best_axis] - min);
+        unsigned* mid = std::partition(m_indices.data() + begin, m_indices.data() + end,
+            [&](unsigned prim) {
+                return std::min(bin_count - 1, int((m_centroids[prim][best_axis] - min) * scale)) <= best_bin;
+            });
+        return unsigned(mid - m_indices.data());
+    }
+
+private:
+    const std::vector<Aabb>& m_bounds;
+    const std::vector<glm::vec3>& m_centroids;
+    std::vector<unsigned>& m_indices;
+    int m_parallel_depth;
+    unsigned m_leaf_size;  // ranges this small are leaves
+    unsigned m_sah_leaf_size;  // larger ones are always split
+    float m_node_cost;  // of a traversal step relative to a primitive
+};
+
+// bounds and centroids of every primitive, split among threads by contiguous ranges
+static void compute_prim_bounds(const Scene& scene, std::vector<Aabb>& bounds,
+    std::vector<glm::vec3>& centroids, unsigned thread_count)
+{
+    const size_t sphere_count = scene.spheres.size();
+    const size_t prim_count = sphere_count + scene.triangles.size();
+    bounds.resize(prim_count);
+    centroids.resize(prim_count);
+
+    auto work = [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; ++i)
+        {
+            Aabb b;
+            if(i < sphere_count)
+            {
+                const Sphere& s = scene.spheres[i];
+                b.grow(s.center - glm::vec3(s.radius));
+                b.grow(s.center + glm::vec3(s.radius));
+            }
+            else
+            {
+                const Triangle& tri = scene.triangles[i - sphere_count];
+                b.grow(glm::vec3(scene.vertices[tri.v0]));
+                b.grow(glm::vec3(scene.vertices[tri.v1]));
+                b.grow(glm::vec3(scene.vertices[tri.v2]));
+            }
+            bounds[i] = b;
+            centroids[i] = (b.min + b.max) * 0.5f;
+        }
+    };
+
+    if(prim_count < parallel_threshold || thread_count <= 1)
+    {
+        work(0, prim_count);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for(unsigned t = 1; t < thread_count; ++t)
+        threads.emplace_back(work, prim_count * t / thread_count, prim_count * (t + 1) / thread_count);
+    work(0, prim_count / thread_count);
+    for(std::thread& t : threads)
+        t.join();
+}
+
+// spawn tasks a few levels deeper than log2(threads), so uneven subtrees still balance
+static int get_parallel_depth(unsigned thread_count)
+{
+    if(thread_count == 1)
+        return 0;
+    int parallel_depth = 2;
+    while((1u << parallel_depth) < thread_count * 4)
+        ++parallel_depth;
+    return parallel_depth;
+}
+
+void build_bvh(const Scene& scene, BvhNodeArray& nodes, std::vector<unsigned>& prim_indices,
+    std::vector<unsigned>& mesh_roots, unsigned thread_count)
+{
+    if(thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<Aabb> bounds;
+    std::vector<glm::vec3> centroids;
+    compute_prim_bounds(scene, bounds, centroids, thread_count);
+
+    // mesh triangles are only reached through their instances
+    const unsigned sphere_count = unsigned(scene.spheres.size());
+    const unsigned prim_count = unsigned(bounds.size());
+    std::vector<bool> in_mesh(prim_count, false);
+    for(const Mesh& mesh : scene.meshes)
+        for(unsigned i = 0; i < mesh.triangle_count; ++i)
+            in_mesh[sphere_count + mesh.first_triangle + i] = true;
+    prim_indices.clear();
+    prim_indices.reserve(prim_count);
+    for(unsigned i = 0; i < prim_count; ++i)
+        if(!in_mesh[i])
+            prim_indices.push_back(i);
+
+    const int parallel_depth = get_parallel_depth(thread_count);
+    nodes.clear();
+    nodes.reserve(prim_count * 2 / max_leaf_size + 1);
+    {
+        BvhBuilder builder(bounds, centroids, prim_indices, parallel_depth);
+        // an empty scene still gets a root, its empty bounds are never hit
+        builder.build(nodes, 0, unsigned(prim_indices.size()), 0);
+    }
+
+    mesh_roots.resize(scene.meshes.size());
+    for(size_t m = 0; m < scene.meshes.size(); ++m)
+    {
+        const Mesh& mesh = scene.meshes[m];
+        std::vector<unsigned> indices(mesh.triangle_count);
+        for(unsigned i = 0; i < mesh.triangle_count; ++i)
+            indices[i] = sphere_count + mesh.first_triangle + i;
+        BvhNodeArray mesh_nodes;
+        BvhBuilder builder(bounds, centroids, indices, parallel_depth);
+        builder.build(mesh_nodes, 0, mesh.triangle_count, 0);
+
+        mesh_roots[m] = unsigned(nodes.size());
+        append_nodes(nodes, mesh_nodes, unsigned(prim_indices.size()));
+        prim_indices.insert(prim_indices.end(), indices.begin(), indices.end());
+    }
+}
+
+// world box of the mesh tree root moved by the instance transform, the center moves
+// and the half extent grows by the absolute transform
+static Aabb get_instance_bounds(const Scene& scene, const Instance& instance)
+{
+    const BvhNode& root = scene.bvh_nodes[instance.root];
+    Aabb b;
+    if(root.bounds_min.x > root.bounds_max.x)
+        return b;  // empty mesh
+    const glm::vec3 center = (root.bounds_min + root.bounds_max) * 0.5f;
+    const glm::vec3 extent = (root.bounds_max - root.bounds_min) * 0.5f;
+    glm::vec3 world_center, world_extent;
+    for(int r = 0; r < 3; ++r)
+    {
+        const glm::vec4& row = instance.object_to_world[r];
+        world_center[r] = row.x * center.x + row.y * center.y + row.z * center.z + row.w;
+        world_extent[r] = std::abs(row.x) * extent.x + std::abs(row.y) * extent.y + std::abs(row.z) * extent.z;
+    }
+    b.min = world_center - world_extent;
+    b.max = world_center + world_extent;
+    return b;
+}
+
+static float get_nodes_area(const BvhNodeArray& nodes)
+{
+    float area = 0.0f;
+    for(const BvhNode& node : nodes)
+    {
+        Aabb b;
+        b.min = node.bounds_min;
+        b.max = node.bounds_max;
+        area += b.area();
+    }
+    return area;
+}
+
+float build_tlas(const Scene& scene, BvhNodeArray& nodes, std::vector<unsigned>& instance_indices,
+    unsigned thread_count)
+{
+    if(thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    const unsigned instance_count = unsigned(scene.instances.size());
+    nodes.clear();
+    instance_indices.clear();
+    if(instance_count == 0)
+        return 0.0f;  // no tree at all, the kernels skip it
+
+    std::vector<Aabb> bounds(instance_count);
+    std::vector<glm::vec3> centroids(instance_count);
+    instance_indices.resize(instance_count);
+    for(unsigned i = 0; i < instance_count; ++i)
+    {
+        bounds[i] = get_instance_bounds(scene, scene.instances[i]);
+        centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+        instance_indices[i] = i;
+    }
+
+    nodes.reserve(instance_count * 2);
+    BvhBuilder builder(bounds, centroids, instance_indices, get_parallel_depth(thread_count),
+        tlas_max_leaf_size, tlas_max_leaf_size, tlas_traversal_cost);
+    builder.build(nodes, 0, instance_count, 0);
+    return get_nodes_area(nodes);
+}
+
+float refit_tlas(const Scene& scene, BvhNodeArray& nodes, const std::vector<unsigned>& instance_indices,
+    size_t& changed_first, size_t& changed_end)
+{
+    // children are stored after their parent, so walking backwards visits them first
+    changed_first = nodes.size();
+    changed_end = 0;
+    float area = 0.0f;
+    for(size_t i = nodes.size(); i-- > 0;)
+    {
+        BvhNode& node = nodes[i];
+        Aabb b;
+        if(node.count > 0)
+        {
+            for(unsigned k = node.offset; k < node.offset + node.count; ++k)
+                b.grow(get_instance_bounds(scene, scene.instances[instance_indices[k]]));
+        }
+        else
+        {
+            const BvhNode& left = nodes[i + 1];
+            const BvhNode& right = nodes[node.offset];
+            b.min = glm::min(left.bounds_min, right.bounds_min);
+            b.max = glm::max(left.bounds_max, right.bounds_max);
+        }
+        if(b.min != node.bounds_min || b.max != node.bounds_max)
+        {
+            node.bounds_min = b.min;
+            node.bounds_max = b.max;
+            changed_first = std::min(changed_first, i);
+            changed_end = std::max(changed_end, i + 1);
+        }
+        area += b.area();
+    }
+    if(changed_end == 0)
+        changed_first = 0;
+    return area;
+}
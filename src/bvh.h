@@ -0,0 +1,48 @@
+#ifndef __BVH__
+#define __BVH__
+
+#include <vector>
+#include <glm/vec3.hpp>
+
+#include "aligned_allocator.h"
+
+class Scene;
+
+// same std430 layout as BvhNode in ray_tracking.comp
+// nodes are stored depth first, the left child of an interior node is the next node
+struct alignas(32) BvhNode
+{
+    glm::vec3 bounds_min;
+    unsigned offset;  // interior node: index of the right child, leaf: first index into prim indices
+    glm::vec3 bounds_max;
+    unsigned count;  // primitives in a leaf, 0 for interior nodes
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode must match std430 layout of ray_tracking.comp");
+
+typedef std::vector<BvhNode, AlignedAllocator<BvhNode>> BvhNodeArray;
+
+// deepest leaf is at bvh_max_depth - 1, so a traversal stack of bvh_max_depth never overflows
+const int bvh_max_depth = 32;
+
+// binned SAH build over all primitives of the scene, subtrees are built in parallel
+// prim_indices is reordered so every leaf references a contiguous range, the values use the
+// same encoding as intersect() in ray_tracking.comp: sphere i is i, triangle i is sphere_count + i
+// the triangles of scene.meshes are left out of the tree rooted at node 0, every mesh gets a tree
+// of its own appended to nodes and prim_indices, in mesh space, mesh_roots gets their root nodes
+void build_bvh(const Scene& scene, BvhNodeArray& nodes, std::vector<unsigned>& prim_indices,
+    std::vector<unsigned>& mesh_roots, unsigned thread_count = 0);
+
+// the top level bvh over the world space bounds of scene.instances, the box of their mesh tree
+// moved by the instance transform, leaves are ranges of instance_indices
+// the meshes must have their trees built, return the summed surface area of the nodes
+float build_tlas(const Scene& scene, BvhNodeArray& nodes, std::vector<unsigned>& instance_indices,
+    unsigned thread_count = 0);
+
+// fit the node bounds to the current instance transforms bottom up, keeping the tree shape,
+// return the summed surface area of the nodes, it grows as the tree gets looser
+// [changed_first, changed_end) covers the nodes whose bounds changed, empty if none did
+float refit_tlas(const Scene& scene, BvhNodeArray& nodes, const std::vector<unsigned>& instance_indices,
+    size_t& changed_first, size_t& changed_end);
+
+
+#endif // __BVH__
@@ -0,0 +1,1052 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <glm/geometric.hpp>
+#include <glm/common.hpp>
+
+#include "cpu_renderer.h"
+#include "profiler.h"
+
+// the functions below mirror the ones in ray_tracking.comp line by line,
+// keep them in sync so both backends produce the same image
+
+static const float t_min = 0.001f;
+static const float t_max = 1.0e30f;
+static const float det_epsilon = 1.0e-8f;
+static const glm::vec3 luminance_weight(0.2126f, 0.7152f, 0.0722f);
+static const float error_epsilon = 0.05f;
+static const float aov_miss_depth = 1.0e4f;
+static const float reprojection_depth_tolerance = 0.05f;  // same as ray_tracking.comp
+static const float reprojection_normal_threshold = 0.9f;
+static const float pi = 3.14159265f;
+static const float shadow_epsilon = 1.0e-3f;  // shadow rays to a light stop this fraction short of it
+// shadow rays of a shading point at most: one sampling the environment map, one the cosine and one a light
+static const int max_shadow_rays = 3;
+
+static uint32_t pcg_hash(uint32_t v)
+{
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// [0, 1)
+static float random_float(uint32_t& seed)
+{
+    seed = pcg_hash(seed);
+    return float(seed >> 8u) * (1.0f / 16777216.0f);
+}
+
+// groups of up to 4 dimensions a sample takes, see get_sample in ray_tracking.comp for the layout
+static const uint32_t dimension_camera = 0u;
+static const uint32_t dimension_environment = 1u;
+static const uint32_t dimension_cosine = 2u;
+static const uint32_t dimension_light = 3u;
+
+// what a sample of pixel pos with index takes its random numbers from, the sampler is the one of the
+// render call, random takes one pcg hash after another from seed whatever the dimension
+struct SampleState
+{
+    const CpuSampler* sampler;
+    glm::ivec2 pos;
+    uint32_t index;
+    uint32_t seed;
+};
+
+// bitfieldReverse
+static uint32_t reverse_bits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x >> 8) & 0x00ff00ffu);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x >> 4) & 0x0f0f0f0fu);
+    x = ((x & 0x33333333u) << 2) | ((x >> 2) & 0x33333333u);
+    return ((x & 0x55555555u) << 1) | ((x >> 1) & 0x55555555u);
+}
+
+// dimension of point index of the Sobol sequence
+static uint32_t sobol(const SamplerTables& tables, uint32_t index, uint32_t dimension)
+{
+    uint32_t result = 0u;
+    for(uint32_t i = 0u; index != 0u; index >>= 1, ++i)
+        if(index & 1u)
+            result ^= tables.sobol_directions[i][dimension];
+    return result;
+}
+
+// Burley 2020, Practical Hash-based Owen Scrambling
+static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+static uint32_t hash_combine(uint32_t seed, uint32_t v)
+{
+    return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+// [0, 1), dimension of group, in call order for the random sampler
+static float get_sample(SampleState& s, uint32_t group, uint32_t dimension)
+{
+    const CpuSampler& sampler = *s.sampler;
+    if(sampler.type == SamplerType::RANDOM)
+        return random_float(s.seed);
+    const SamplerTables& tables = *sampler.tables;
+    uint32_t pixel = sampler.type == SamplerType::SOBOL ? uint32_t(s.pos.y * sampler.image_width + s.pos.x) : 0u;
+    uint32_t seed = pcg_hash(pixel ^ pcg_hash(group + 1u));
+    uint32_t x = nested_uniform_scramble(sobol(tables, nested_uniform_scramble(s.index, seed), dimension),
+        hash_combine(seed, dimension));
+    if(sampler.type == SamplerType::BLUE_NOISE)
+    {
+        const uint32_t size = SamplerTables::blue_noise_size;
+        uint32_t shift = pcg_hash(group * 4u + dimension);
+        uint32_t texel_x = (uint32_t(s.pos.x) + shift) % size;
+        uint32_t texel_y = (uint32_t(s.pos.y) + (shift >> 16)) % size;
+        x += uint32_t(tables.blue_noise[texel_y * size + texel_x]) << 18;
+    }
+    return float(x >> 8u) * (1.0f / 16777216.0f);
+}
+
+// relative standard error of the pixel mean
+static float pixel_error(const glm::vec4& sum, float moment)
+{
+    float n = sum.w;
+    if(n < 2.0f)
+        return t_max;
+    float mean = glm::dot(glm::vec3(sum), luminance_weight) / n;
+    float variance = std::max(moment / n - mean * mean, 0.0f) * n / (n - 1.0f);
+    return std::sqrt(variance / n) / (mean + error_epsilon);
+}
+
+// return distance along the ray, or -1 if missed
+static float hit_sphere(const Sphere& s, const glm::vec3& ro, const glm::vec3& rd, float t_near, float t_far)
+{
+    glm::vec3 oc = ro - s.center;
+    float a = glm::dot(rd, rd);
+    float half_b = glm::dot(oc, rd);
+    float c = glm::dot(oc, oc) - s.radius * s.radius;
+    float discriminant = half_b * half_b - a * c;
+    if(discriminant < 0.0f)
+        return -1.0f;
+    float sqrtd = std::sqrt(discriminant);
+    float t = (-half_b - sqrtd) / a;
+    if(t < t_near || t > t_far)
+    {
+        t = (-half_b + sqrtd) / a;
+        if(t < t_near || t > t_far)
+            return -1.0f;
+    }
+    return t;
+}
+
+// Moller-Trumbore, return distance along the ray, or -1 if missed
+static float hit_triangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2,
+    const glm::vec3& ro, const glm::vec3& rd, float t_near, float t_far)
+{
+    glm::vec3 e1 = v1 - v0;
+    glm::vec3 e2 = v2 - v0;
+    glm::vec3 p = glm::cross(rd, e2);
+    float det = glm::dot(e1, p);
+    if(std::abs(det) < det_epsilon)
+        return -1.0f;
+    float inv_det = 1.0f / det;
+    glm::vec3 s = ro - v0;
+    float u = glm::dot(s, p) * inv_det;
+    if(u < 0.0f || u > 1.0f)
+        return -1.0f;
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(rd, q) * inv_det;
+    if(v < 0.0f || u + v > 1.0f)
+        return -1.0f;
+    float t = glm::dot(e2, q) * inv_det;
+    if(t < t_near || t > t_far)
+        return -1.0f;
+    return t;
+}
+
+// entry distance of the ray into the box, t_max if missed
+static float hit_aabb(const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+    const glm::vec3& ro, const glm::vec3& inv_rd, float t_far)
+{
+    glm::vec3 t0 = (bounds_min - ro) * inv_rd;
+    glm::vec3 t1 = (bounds_max - ro) * inv_rd;
+    glm::vec3 t_small = glm::min(t0, t1);
+    glm::vec3 t_big = glm::max(t0, t1);
+    float t_enter = glm::max(glm::max(t_small.x, t_small.y), glm::max(t_small.z, t_min));
+    float t_exit = glm::min(glm::min(t_big.x, t_big.y), glm::min(t_big.z, t_far));
+    return t_enter <= t_exit ? t_enter : t_max;
+}
+
+static void intersect_prim(const SceneView& scene, unsigned prim_index, const glm::vec3& ro, const glm::vec3& rd,
+    float& closest, int& prim)
+{
+    const int sphere_count = int(scene.spheres.size());
+    int p = int(prim_index);
+    float t;
+    if(p < sphere_count)
+        t = hit_sphere(scene.spheres[p], ro, rd, t_min, closest);
+    else
+    {
+        const Triangle& tri = scene.triangles[p - sphere_count];
+        t = hit_triangle(glm::vec3(scene.vertices[tri.v0]), glm::vec3(scene.vertices[tri.v1]),
+            glm::vec3(scene.vertices[tri.v2]), ro, rd, t_min, closest);
+    }
+    if(t > 0.0f)
+    {
+        closest = t;
+        prim = p;
+    }
+}
+
+// closer hits than closest in the bvh at root of bvh_nodes
+static void intersect_bvh(const SceneView& scene, unsigned root, const glm::vec3& ro, const glm::vec3& rd,
+    float& closest, int& prim)
+{
+    const BvhNode* nodes = scene.bvh_nodes.data();
+    glm::vec3 inv_rd = 1.0f / rd;
+    if(hit_aabb(nodes[root].bounds_min, nodes[root].bounds_max, ro, inv_rd, closest) >= closest)
+        return;
+
+    // short stack traversal, the nearer child is visited first and the farther one pushed
+    unsigned stack[bvh_max_depth];
+    int stack_size = 0;
+    unsigned node_index = root;
+    while(true)
+    {
+        const BvhNode& node = nodes[node_index];
+        if(node.count > 0)
+        {
+            for(unsigned i = node.offset; i < node.offset + node.count; ++i)
+                intersect_prim(scene, scene.bvh_prim_indices[i], ro, rd, closest, prim);
+        }
+        else
+        {
+            unsigned near_index = node_index + 1;
+            unsigned far_index = node.offset;
+            float t_near = hit_aabb(nodes[near_index].bounds_min, nodes[near_index].bounds_max, ro, inv_rd, closest);
+            float t_far = hit_aabb(nodes[far_index].bounds_min, nodes[far_index].bounds_max, ro, inv_rd, closest);
+            if(t_far < t_near)
+            {
+                std::swap(near_index, far_index);
+                std::swap(t_near, t_far);
+            }
+            if(t_near < closest)
+            {
+                if(t_far < closest)
+                    stack[stack_size++] = far_index;
+                node_index = near_index;
+                continue;
+            }
+        }
+        if(stack_size == 0)
+            break;
+        node_index = stack[--stack_size];
+    }
+}
+
+static glm::vec3 transform_point(const glm::vec4 rows[3], const glm::vec3& p)
+{
+    return glm::vec3(glm::dot(rows[0], glm::vec4(p, 1.0f)), glm::dot(rows[1], glm::vec4(p, 1.0f)),
+        glm::dot(rows[2], glm::vec4(p, 1.0f)));
+}
+
+static glm::vec3 transform_vector(const glm::vec4 rows[3], const glm::vec3& v)
+{
+    return glm::vec3(glm::dot(glm::vec3(rows[0]), v), glm::dot(glm::vec3(rows[1]), v), glm::dot(glm::vec3(rows[2]), v));
+}
+
+// closer hits than closest among the instances, in the bvh of their mesh
+static void intersect_tlas(const SceneView& scene, const glm::vec3& ro, const glm::vec3& rd,
+    float& closest, int& prim, int& instance)
+{
+    const BvhNode* nodes = scene.tlas_nodes.data();
+    glm::vec3 inv_rd = 1.0f / rd;
+    if(hit_aabb(nodes[0].bounds_min, nodes[0].bounds_max, ro, inv_rd, closest) >= closest)
+        return;
+
+    // the same traversal as intersect_bvh, instances in a leaf are intersected in mesh space
+    unsigned stack[bvh_max_depth];
+    int stack_size = 0;
+    unsigned node_index = 0;
+    while(true)
+    {
+        const BvhNode& node = nodes[node_index];
+        if(node.count > 0)
+        {
+            for(unsigned i = node.offset; i < node.offset + node.count; ++i)
+            {
+                const unsigned index = scene.tlas_instance_indices[i];
+                const Instance& inst = scene.instances[index];
+                int hit = -1;
+                intersect_bvh(scene, inst.root, transform_point(inst.world_to_object, ro),
+                    transform_vector(inst.world_to_object, rd), closest, hit);
+                if(hit >= 0)
+                {
+                    prim = hit;
+                    instance = int(index);
+                }
+            }
+        }
+        else
+        {
+            unsigned near_index = node_index + 1;
+            unsigned far_index = node.offset;
+            float t_near = hit_aabb(nodes[near_index].bounds_min, nodes[near_index].bounds_max, ro, inv_rd, closest);
+            float t_far = hit_aabb(nodes[far_index].bounds_min, nodes[far_index].bounds_max, ro, inv_rd, closest);
+            if(t_far < t_near)
+            {
+                std::swap(near_index, far_index);
+                std::swap(t_near, t_far);
+            }
+            if(t_near < closest)
+            {
+                if(t_far < closest)
+                    stack[stack_size++] = far_index;
+                node_index = near_index;
+                continue;
+            }
+        }
+        if(stack_size == 0)
+            break;
+        node_index = stack[--stack_size];
+    }
+}
+
+// closest hit, prim in [0, sphere_count) is a sphere, sphere_count + i is triangle i, -1 is miss
+// instance is the one the triangle was hit in, -1 for the scene bvh
+static void intersect(const SceneView& scene, const glm::vec3& ro, const glm::vec3& rd, float& closest, int& prim,
+    int& instance)
+{
+    closest = t_max;
+    prim = -1;
+    instance = -1;
+    intersect_bvh(scene, 0, ro, rd, closest, prim);
+    if(!scene.tlas_nodes.empty())
+        intersect_tlas(scene, ro, rd, closest, prim, instance);
+}
+
+static glm::vec3 sky_color(const glm::vec3& rd)
+{
+    float k = 0.5f * (glm::normalize(rd).y + 1.0f);
+    return glm::mix(glm::vec3(1.0f), glm::vec3(0.5f, 0.7f, 1.0f), k);
+}
+
+// the texel of unit direction d, u goes around y from -x, v from +y to -y
+static glm::ivec2 get_environment_texel(const EnvironmentMap& map, const glm::vec3& d)
+{
+    float u = std::atan2(d.z, d.x) * (0.5f / pi) + 0.5f;
+    float v = std::acos(glm::clamp(d.y, -1.0f, 1.0f)) * (1.0f / pi);
+    return glm::clamp(glm::ivec2(glm::vec2(u, v) * glm::vec2(map.width, map.height)), glm::ivec2(0),
+        glm::ivec2(map.width, map.height) - 1);
+}
+
+static glm::vec3 get_environment_radiance(const EnvironmentMap& map, const glm::vec3& d)
+{
+    glm::ivec2 texel = get_environment_texel(map, d);
+    return glm::vec3(map.radiance[size_t(texel.y) * map.width + texel.x]);
+}
+
+// what a ray missing everything sees, the nearest texel like the piecewise constant sampling pdf
+static glm::vec3 environment_color(const SceneView& scene, const glm::vec3& rd)
+{
+    if(!scene.environment)
+        return sky_color(rd);
+    return get_environment_radiance(*scene.environment, glm::normalize(rd));
+}
+
+// solid angle pdf of sampling unit direction d from the map, radiance is the map there
+static float environment_pdf(const EnvironmentMap& map, const glm::vec3& d, const glm::vec3& radiance)
+{
+    float sin_theta = std::sqrt(std::max(1.0f - d.y * d.y, 0.0f));
+    if(sin_theta <= 0.0f)
+        return 0.0f;
+    float sin_center = std::sin((float(get_environment_texel(map, d).y) + 0.5f) / float(map.height) * pi);
+    return glm::dot(radiance, luminance_weight) * sin_center * map.pdf_scale / sin_theta;
+}
+
+// cosine distributed over the hemisphere of n, the basis of Duff et al. 2017
+static glm::vec3 cosine_direction(const glm::vec3& n, float u1, float u2)
+{
+    float s = n.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (s + n.z);
+    float b = n.x * n.y * a;
+    glm::vec3 t(1.0f + s * n.x * n.x * a, s * b, -s * n.x);
+    glm::vec3 bt(b, s + n.y * n.y * a, -n.y);
+    float r = std::sqrt(u1);
+    float phi = 2.0f * pi * u2;
+    return t * (r * std::cos(phi)) + bt * (r * std::sin(phi)) + n * std::sqrt(std::max(1.0f - u1, 0.0f));
+}
+
+static float power_heuristic(float pdf, float other_pdf)
+{
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// anything along d from p closer than distance, which hides the environment and lights, t_max for the environment
+static bool occluded(const SceneView& scene, const glm::vec3& p, const glm::vec3& d, float distance)
+{
+    float closest = distance;
+    int prim = -1;
+    int instance = -1;
+    intersect_bvh(scene, 0, p, d, closest, prim);
+    if(!scene.tlas_nodes.empty())
+        intersect_tlas(scene, p, d, closest, prim, instance);
+    return prim >= 0;
+}
+
+// the count cells of the alias table at offset, u in [0, 1)
+static unsigned sample_alias(const EnvironmentMap& map, size_t offset, unsigned count, float u)
+{
+    float scaled = u * float(count);
+    unsigned i = std::min(unsigned(scaled), count - 1u);
+    const EnvironmentAlias& cell = map.alias[offset + i];
+    return scaled - float(i) < cell.probability ? i : cell.alias;
+}
+
+// a unit direction by the luminance of the map, the row first, then the column, uniform in the texel
+static glm::vec3 sample_environment(const EnvironmentMap& map, SampleState& s)
+{
+    unsigned y = sample_alias(map, size_t(map.width) * map.height, map.height, get_sample(s, dimension_environment, 0u));
+    unsigned x = sample_alias(map, size_t(y) * map.width, map.width, get_sample(s, dimension_environment, 1u));
+    float phi = (float(x) + get_sample(s, dimension_environment, 2u)) / float(map.width) * 2.0f * pi - pi;
+    float theta = (float(y) + get_sample(s, dimension_environment, 3u)) / float(map.height) * pi;
+    return glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+}
+
+// a shadow ray of a shading point, the sample gets radiance (albedo included) when nothing is
+// within distance along direction
+struct ShadowRay
+{
+    glm::vec3 direction;
+    float distance;
+    glm::vec3 radiance;
+};
+
+// direct environment light on a diffuse surface with normal n and albedo color, appended to rays
+// one ray sampling the map and one sampling the cosine (bsdf), combined by the power heuristic
+static void environment_lighting(const SceneView& scene, const glm::vec3& n, const glm::vec3& color, SampleState& s,
+    ShadowRay* rays, int& count)
+{
+    const EnvironmentMap& map = *scene.environment;
+    if(map.pdf_scale > 0.0f)
+    {
+        glm::vec3 d = sample_environment(map, s);
+        float cos_theta = glm::dot(n, d);
+        if(cos_theta > 0.0f)
+        {
+            glm::vec3 radiance = get_environment_radiance(map, d);
+            float light_pdf = environment_pdf(map, d, radiance);
+            if(light_pdf > 0.0f)
+                rays[count++] = {d, t_max,
+                    color * (radiance * (cos_theta / pi / light_pdf * power_heuristic(light_pdf, cos_theta / pi)))};
+        }
+    }
+
+    // bsdf * cos / pdf is 1 for cosine samples
+    float u1 = get_sample(s, dimension_cosine, 0u);
+    float u2 = get_sample(s, dimension_cosine, 1u);
+    glm::vec3 d = cosine_direction(n, u1, u2);
+    float cos_theta = glm::dot(n, d);
+    if(cos_theta > 0.0f)
+    {
+        glm::vec3 radiance = get_environment_radiance(map, d);
+        float light_pdf = map.pdf_scale > 0.0f ? environment_pdf(map, d, radiance) : 0.0f;
+        rays[count++] = {d, t_max, color * (radiance * power_heuristic(cos_theta / pi, light_pdf))};
+    }
+}
+
+// cosine and sine of angle a minus angle b, 0 if b is larger, both in [0, pi] given by their sine and cosine
+static float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+    return cos_a > cos_b ? 1.0f : cos_a * cos_b + sin_a * sin_b;
+}
+
+static float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+    return cos_a > cos_b ? 0.0f : sin_a * cos_b - cos_a * sin_b;
+}
+
+// estimated upper bound of what the lights of node give p with normal n, Conty & Kulla 2018
+// power over squared distance times the cosines of the smallest emission and incident angles
+// any point of the bounding sphere can reach
+static float light_importance(const LightNode& node, const glm::vec3& p, const glm::vec3& n)
+{
+    glm::vec3 center = 0.5f * (node.bounds_min + node.bounds_max);
+    glm::vec3 to_p = p - center;
+    float d2 = glm::dot(to_p, to_p);
+    float radius2 = 0.25f * glm::dot(node.bounds_max - node.bounds_min, node.bounds_max - node.bounds_min);
+    // every direction is possible inside the bounding sphere
+    if(d2 <= radius2)
+        return node.power / std::max(radius2, 1.0e-8f);
+    glm::vec3 wi = to_p / std::sqrt(d2);
+    float sin_b2 = radius2 / d2;
+    float sin_b = std::sqrt(sin_b2);
+    float cos_b = std::sqrt(1.0f - sin_b2);
+
+    // angle between the cone axis and the direction to p, less the cone and the bounding sphere
+    float cos_w = glm::dot(node.axis, wi);
+    float sin_w = std::sqrt(std::max(1.0f - cos_w * cos_w, 0.0f));
+    float sin_o = std::sqrt(std::max(1.0f - node.cos_theta_o * node.cos_theta_o, 0.0f));
+    float cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, node.cos_theta_o);
+    float sin_x = sin_sub_clamped(sin_w, cos_w, sin_o, node.cos_theta_o);
+    float cos_emit = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+    if(cos_emit <= node.cos_theta_e)
+        return 0.0f;
+
+    // incident angle at p less the bounding sphere
+    float cos_i = -glm::dot(n, wi);
+    float sin_i = std::sqrt(std::max(1.0f - cos_i * cos_i, 0.0f));
+    float cos_incident = cos_sub_clamped(sin_i, cos_i, sin_b, cos_b);
+    return std::max(node.power * cos_emit * cos_incident / d2, 0.0f);
+}
+
+// walk down from the root choosing a child by importance, return the light, pmf is the chance
+// to pick it, -1 when no light reaches p
+static int sample_light_tree(const SceneView& scene, const glm::vec3& p, const glm::vec3& n, float u, float& pmf)
+{
+    pmf = 1.0f;
+    unsigned node_index = 0;
+    while(scene.light_nodes[node_index].count == 0)
+    {
+        unsigned left = node_index + 1;
+        unsigned right = scene.light_nodes[node_index].offset;
+        float left_importance = light_importance(scene.light_nodes[left], p, n);
+        float right_importance = light_importance(scene.light_nodes[right], p, n);
+        float total = left_importance + right_importance;
+        if(total <= 0.0f)
+            return -1;
+        // u is scaled back to [0, 1) for the next level
+        float p_left = left_importance / total;
+        if(u < p_left)
+        {
+            u = std::min(u / p_left, 0.99999994f);
+            pmf *= p_left;
+            node_index = left;
+        }
+        else
+        {
+            u = std::min((u - p_left) / (1.0f - p_left), 0.99999994f);
+            pmf *= 1.0f - p_left;
+            node_index = right;
+        }
+    }
+    return int(scene.light_nodes[node_index].offset);
+}
+
+// direct light of one light on a diffuse surface at p with albedo color, appended to rays, the light
+// picked by the light tree, triangles sampled uniformly by area
+static void light_lighting(const SceneView& scene, const glm::vec3& p, const glm::vec3& n, const glm::vec3& color,
+    SampleState& s, ShadowRay* rays, int& count)
+{
+    float pmf;
+    int index = sample_light_tree(scene, p, n, get_sample(s, dimension_light, 0u), pmf);
+    float u1 = get_sample(s, dimension_light, 1u);
+    float u2 = get_sample(s, dimension_light, 2u);
+    if(index < 0)
+        return;
+    const Light& light = scene.lights[index];
+    glm::vec3 target = light.position;
+    // a point light gives intensity / squared distance, a triangle its radiance times the area
+    // and the cosine at the light on top
+    float geometry = 1.0f;
+    if(light.type == light_triangle)
+    {
+        float r = std::sqrt(u1);
+        target += light.edge1 * (r * (1.0f - u2)) + light.edge2 * (r * u2);
+        glm::vec3 normal = glm::cross(light.edge1, light.edge2);
+        glm::vec3 d = target - p;
+        float cos_light = -glm::dot(normal, d);
+        if(cos_light <= 0.0f)
+            return;
+        // |normal| is twice the area, its and d's lengths cancel out
+        geometry = 0.5f * cos_light / glm::length(d);
+    }
+    glm::vec3 d = target - p;
+    float distance = glm::length(d);
+    d /= distance;
+    float cos_theta = glm::dot(n, d);
+    if(cos_theta > 0.0f)
+        rays[count++] = {d, distance * (1.0f - shadow_epsilon),
+            color * (light.emission * (cos_theta / pi * geometry / (distance * distance * pmf)))};
+}
+
+// normal and material at the hit, prim must not be -1, front if the hit is on the front face
+// ((v1 - v0) x (v2 - v0) side of triangles, outside of spheres)
+static void get_surface(const SceneView& scene, const glm::vec3& ro, const glm::vec3& rd, float t, int prim,
+    int instance, glm::vec3& n, unsigned& material, bool& front)
+{
+    const int sphere_count = int(scene.spheres.size());
+    if(prim < sphere_count)
+    {
+        const Sphere& s = scene.spheres[prim];
+        n = (ro + t * rd - s.center) / s.radius;
+        material = s.material;
+        front = glm::dot(n, rd) < 0.0f;
+    }
+    else
+    {
+        const Triangle& tri = scene.triangles[prim - sphere_count];
+        glm::vec3 v0(scene.vertices[tri.v0]);
+        n = glm::cross(glm::vec3(scene.vertices[tri.v1]) - v0, glm::vec3(scene.vertices[tri.v2]) - v0);
+        // back to world space by the transpose of world_to_object
+        if(instance >= 0)
+        {
+            const glm::vec4* rows = scene.instances[instance].world_to_object;
+            n = glm::vec3(rows[0]) * n.x + glm::vec3(rows[1]) * n.y + glm::vec3(rows[2]) * n.z;
+        }
+        n = glm::normalize(n);
+        front = glm::dot(n, rd) < 0.0f;
+        if(!front)
+            n = -n;
+        material = tri.material;
+    }
+}
+
+// s is only used with an environment map or lights
+// without them a built-in directional and ambient light, lights without a map are the only light
+static glm::vec3 shade(const SceneView& scene, const glm::vec3& ro, const glm::vec3& rd, float t, int prim,
+    int instance, SampleState s)
+{
+    if(prim < 0)
+        return environment_color(scene, rd);
+
+    glm::vec3 n;
+    unsigned material;
+    bool front;
+    get_surface(scene, ro, rd, t, prim, instance, n, material, front);
+    glm::vec3 p = ro + t * rd;
+    glm::vec3 color(scene.materials[material].color);
+    glm::vec3 emission = front ? glm::vec3(scene.materials[material].emission) : glm::vec3(0.0f);
+    if(!scene.environment && scene.lights.empty())
+    {
+        float diffuse = glm::max(glm::dot(n, glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f))), 0.0f);
+        return emission + color * (0.2f + 0.8f * diffuse);
+    }
+    // sampled first and traced after, in the order of the connect kernel of the wavefront mode
+    ShadowRay rays[max_shadow_rays];
+    int count = 0;
+    if(scene.environment)
+        environment_lighting(scene, n, color, s, rays, count);
+    if(!scene.lights.empty())
+        light_lighting(scene, p, n, color, s, rays, count);
+    glm::vec3 result = emission;
+    for(int i = 0; i < count; ++i)
+        if(!occluded(scene, p, rays[i].direction, rays[i].distance))
+            result += rays[i].radiance;
+    return result;
+}
+
+CpuRenderer::CpuRenderer(Texture& target, unsigned thread_count, SimdIsa isa):
+    Renderer(target),
+    m_scheduler(thread_count),
+    m_intersect_packet(get_intersect_packet_func(isa)),
+    m_sampler(),
+    m_sample_index(0)
+{
+    if(isa != SimdIsa::SCALAR && !m_intersect_packet)
+        std::cerr << "SIMD " << get_simd_isa_name(isa) << " not supported, use scalar kernel\n";
+}
+
+bool CpuRenderer::init(const SceneView& scene)
+{
+    if(scene.bvh_nodes.empty())
+    {
+        std::cerr << "Scene bvh is not built\n";
+        return false;
+    }
+    m_scene = scene;
+    apply_camera(scene.camera);
+    m_packet_scene.build(m_scene);
+    return true;
+}
+
+void CpuRenderer::reset()
+{
+    // sample 0 overwrites the accumulation, no need to clear it
+    m_accum.resize(size_t(m_width) * m_height);
+    m_moments.resize(size_t(m_width) * m_height);
+    m_pixels.resize(size_t(m_width) * m_height);
+    m_normal_depth.resize(is_aov_enabled() ? size_t(m_width) * m_height : 0);
+    m_albedo.resize(m_normal_depth.size());
+    m_denoised.resize(is_denoise_enabled() ? size_t(m_width) * m_height : 0);
+    m_tile_errors.resize(get_tile_count());
+    m_active_tiles.resize(get_tile_count());
+    for(unsigned i = 0; i < m_active_tiles.size(); ++i)
+        m_active_tiles[i] = i;
+    reset_progress();
+}
+
+void CpuRenderer::apply_camera(const Camera& camera)
+{
+    m_scene.camera = camera;
+    m_scene.camera.get_basis(m_lower_left, m_horizontal, m_vertical);
+}
+
+void CpuRenderer::reproject(const Camera& camera)
+{
+    const glm::mat4 previous_view_projection = m_scene.camera.get_view_projection();
+    const glm::vec3 previous_origin = m_scene.camera.position;
+    apply_camera(camera);
+
+    {
+        ProfileScope scope(m_profiler, "reproject");
+        m_history_accum = m_accum;
+        m_history_moments = m_moments;
+        m_history_normal_depth = m_normal_depth;
+        // the center ray of every pixel, like sample 0
+        m_sample_index = 0;
+        m_scheduler.run(m_width, m_height, tile_size_x, tile_size_y,
+            [&](const Tile& tile, unsigned) {
+                reproject_tile(tile, previous_view_projection, previous_origin);
+            });
+    }
+    m_active_tiles.resize(get_tile_count());
+    for(unsigned i = 0; i < m_active_tiles.size(); ++i)
+        m_active_tiles[i] = i;
+    // the filtered image replaces the target until the next render call denoises again
+    if(is_denoise_enabled())
+        denoise();
+    else
+        m_target.set_data(m_pixels.data(), 0, 0, m_width, m_height);
+}
+
+void CpuRenderer::apply_instances(const SceneView& scene, const InstanceUpdate&)
+{
+    // the arrays are used in place, only where they are may have changed
+    m_scene.instances = scene.instances;
+    m_scene.tlas_nodes = scene.tlas_nodes;
+    m_scene.tlas_instance_indices = scene.tlas_instance_indices;
+}
+
+void CpuRenderer::read_accumulation(unsigned x, unsigned y, unsigned width, unsigned height, glm::vec4* sums)
+{
+    for(unsigned row = 0; row < height; ++row)
+    {
+        const glm::vec4* source = m_accum.data() + size_t(y + row) * m_width + x;
+        std::copy(source, source + width, sums + size_t(row) * width);
+    }
+}
+
+void CpuRenderer::render_tiles(unsigned first_tile, unsigned tile_count, unsigned sample_index)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_sample_index = sample_index;
+    update_sampler();
+    m_scheduler.run(m_width, m_height, tile_size_x, tile_size_y, first_tile, tile_count,
+        [this](const Tile& tile, unsigned) {
+            if(m_intersect_packet)
+                render_tile_packet(tile);
+            else
+                render_tile(tile);
+        });
+
+    // denoise uploads the whole filtered image instead
+    const unsigned tiles_x = get_tiles_x();
+    const unsigned y_begin = first_tile / tiles_x * tile_size_y;
+    const unsigned y_end = std::min(((first_tile + tile_count - 1) / tiles_x + 1) * tile_size_y, m_height);
+    if(!is_denoise_enabled())
+    {
+        ProfileScope scope(m_profiler, "upload");
+        m_target.set_data(&m_pixels[size_t(y_begin) * m_width], 0, y_begin, m_width, y_end - y_begin);
+    }
+
+    std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+    add_tile_time(time.count(), tile_count);
+}
+
+void CpuRenderer::render_adaptive(float threshold)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const unsigned tiles_x = get_tiles_x();
+    m_scheduler.run(m_width, m_height, tile_size_x, tile_size_y,
+        [this, tiles_x](const Tile& tile, unsigned) {
+            m_tile_errors[tile.y / tile_size_y * tiles_x + tile.x / tile_size_x] = get_tile_error(tile);
+        });
+
+    m_active_tiles.clear();
+    for(unsigned i = 0; i < m_tile_errors.size(); ++i)
+        if(m_tile_errors[i] > threshold)
+            m_active_tiles.push_back(i);
+
+    m_sample_index = 1;
+    update_sampler();
+    m_scheduler.run(m_width, m_height, tile_size_x, tile_size_y, m_active_tiles,
+        [this](const Tile& tile, unsigned) {
+            if(m_intersect_packet)
+                render_tile_packet(tile);
+            else
+                render_tile(tile);
+        });
+    if(!m_active_tiles.empty() && !is_denoise_enabled())
+    {
+        ProfileScope scope(m_profiler, "upload");
+        m_target.set_data(m_pixels.data(), 0, 0, m_width, m_height);
+    }
+
+    std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+    add_tile_time(time.count(), unsigned(m_active_tiles.size()));
+}
+
+glm::vec3 CpuRenderer::get_ray_direction(int x, int y) const
+{
+    // sample 0 is the pixel center, the others are jittered inside the pixel
+    float offset_x = 0.5f;
+    float offset_y = 0.5f;
+    uint32_t n = m_sample_index > 0 ? uint32_t(m_accum[size_t(y) * m_width + x].w) : 0;
+    if(n > 0)
+    {
+        // the jittered samples start at the first Sobol point
+        SampleState s = {&m_sampler, glm::ivec2(x, y), n - 1, pcg_hash(uint32_t(y * int(m_width) + x) ^ pcg_hash(n))};
+        offset_x = get_sample(s, dimension_camera, 0u);
+        offset_y = get_sample(s, dimension_camera, 1u);
+    }
+
+    // row 0 is the top of the image
+    float u = (float(x) + offset_x) / float(m_width);
+    float v = 1.0f - (float(y) + offset_y) / float(m_height);
+    return m_lower_left + u * m_horizontal + v * m_vertical - m_scene.camera.position;
+}
+
+SampleState CpuRenderer::get_shade_sample(int x, int y) const
+{
+    uint32_t n = m_sample_index > 0 ? uint32_t(m_accum[size_t(y) * m_width + x].w) : 0;
+    SampleState s = {&m_sampler, glm::ivec2(x, y), n, pcg_hash(uint32_t(y * int(m_width) + x) ^ pcg_hash(n ^ 0x9e3779b9u))};
+    return s;
+}
+
+void CpuRenderer::update_sampler()
+{
+    m_sampler.type = get_sampler();
+    m_sampler.tables = m_sampler_tables;
+    m_sampler.image_width = int(m_width);
+}
+
+void CpuRenderer::add_sample(size_t index, const glm::vec3& color)
+{
+    glm::vec4& sum = m_accum[index];
+    float& moment = m_moments[index];
+    float luminance = glm::dot(color, luminance_weight);
+    if(m_sample_index > 0)
+    {
+        sum += glm::vec4(color, 1.0f);
+        moment += luminance * luminance;
+    }
+    else
+    {
+        sum = glm::vec4(color, 1.0f);
+        moment = luminance * luminance;
+    }
+    m_pixels[index] = glm::vec4(glm::vec3(sum) / sum.w, 1.0f);
+}
+
+void CpuRenderer::add_aov(size_t index, const glm::vec3& rd, float t, int prim, int instance)
+{
+    if(m_normal_depth.empty())
+        return;
+    // the sample is already in the count, no hit has a zero normal and the environment as albedo
+    glm::vec4 normal_depth(0.0f, 0.0f, 0.0f, aov_miss_depth);
+    glm::vec3 albedo = environment_color(m_scene, rd);
+    if(prim >= 0)
+    {
+        glm::vec3 normal;
+        unsigned material;
+        bool front;
+        get_surface(m_scene, m_scene.camera.position, rd, t, prim, instance, normal, material, front);
+        normal_depth = glm::vec4(normal, t * glm::length(rd));
+        albedo = glm::vec3(m_scene.materials[material].color);
+    }
+    const float n = m_accum[index].w;
+    if(n > 1.0f)
+    {
+        normal_depth = glm::mix(m_normal_depth[index], normal_depth, 1.0f / n);
+        albedo = glm::mix(glm::vec3(m_albedo[index]), albedo, 1.0f / n);
+    }
+    m_normal_depth[index] = normal_depth;
+    m_albedo[index] = glm::vec4(albedo, 1.0f);
+}
+
+void CpuRenderer::denoise()
+{
+    if(m_denoised.empty())
+        return;
+    ProfileScope scope(m_profiler, "denoise");
+    Denoiser::Input input;
+    input.width = m_width;
+    input.height = m_height;
+    input.accum = m_accum.data();
+    input.moments = m_moments.data();
+    input.normal_depth = m_normal_depth.data();
+    input.albedo = m_albedo.data();
+    m_denoiser.run(m_scheduler, input, m_denoised.data());
+    m_target.set_data(m_denoised.data(), 0, 0, m_width, m_height);
+}
+
+float CpuRenderer::get_tile_error(const Tile& tile) const
+{
+    // the largest pixel error, same as build_tile_list in ray_tracking.comp
+    float error = 0.0f;
+    for(int y = tile.y; y < tile.y + tile.height; ++y)
+        for(int x = tile.x; x < tile.x + tile.width; ++x)
+        {
+            size_t index = size_t(y) * m_width + x;
+            error = std::max(error, pixel_error(m_accum[index], m_moments[index]));
+        }
+    return error;
+}
+
+void CpuRenderer::render_tile(const Tile& tile)
+{
+    const glm::vec3& ro = m_scene.camera.position;
+    for(int y = tile.y; y < tile.y + tile.height; ++y)
+    {
+        const size_t row = size_t(y) * m_width;
+        for(int x = tile.x; x < tile.x + tile.width; ++x)
+        {
+            glm::vec3 rd = get_ray_direction(x, y);
+            float t;
+            int prim;
+            int instance;
+            intersect(m_scene, ro, rd, t, prim, instance);
+            add_sample(row + x, shade(m_scene, ro, rd, t, prim, instance, get_shade_sample(x, y)));
+            add_aov(row + x, rd, t, prim, instance);
+        }
+    }
+}
+
+void CpuRenderer::render_tile_packet(const Tile& tile)
+{
+    // one packet is ray_packet_size adjacent pixels of a row, the primary rays are coherent
+    const glm::vec3& ro = m_scene.camera.position;
+    RayPacket rays;
+    HitPacket hits;
+    for(int i = 0; i < ray_packet_size; ++i)
+    {
+        rays.ox[i] = ro.x;
+        rays.oy[i] = ro.y;
+        rays.oz[i] = ro.z;
+    }
+
+    for(int y = tile.y; y < tile.y + tile.height; ++y)
+    {
+        const size_t row = size_t(y) * m_width;
+        for(int x = tile.x; x < tile.x + tile.width; x += ray_packet_size)
+        {
+            const int count = std::min(ray_packet_size, tile.x + tile.width - x);
+            for(int i = 0; i < ray_packet_size; ++i)
+            {
+                // unused lanes repeat the last pixel with t_far 0, so they never hit
+                glm::vec3 rd = get_ray_direction(x + std::min(i, count - 1), y);
+                rays.dx[i] = rd.x;
+                rays.dy[i] = rd.y;
+                rays.dz[i] = rd.z;
+                rays.t_far[i] = i < count ? t_max : 0.0f;
+            }
+
+            m_intersect_packet(m_packet_scene.get_view(), rays, hits);
+
+            for(int i = 0; i < count; ++i)
+            {
+                glm::vec3 rd(rays.dx[i], rays.dy[i], rays.dz[i]);
+                // instances are traced per ray, behind the closest hit of the packet
+                int instance = -1;
+                if(!m_scene.tlas_nodes.empty())
+                    intersect_tlas(m_scene, ro, rd, hits.t[i], hits.prim[i], instance);
+                add_sample(row + x + i,
+                    shade(m_scene, ro, rd, hits.t[i], hits.prim[i], instance, get_shade_sample(x + i, y)));
+                add_aov(row + x + i, rd, hits.t[i], hits.prim[i], instance);
+            }
+        }
+    }
+}
+
+void CpuRenderer::reproject_tile(const Tile& tile, const glm::mat4& previous_view_projection, const glm::vec3& previous_origin)
+{
+    const glm::vec3& ro = m_scene.camera.position;
+    const int width = int(m_width);
+    const int height = int(m_height);
+    for(int y = tile.y; y < tile.y + tile.height; ++y)
+        for(int x = tile.x; x < tile.x + tile.width; ++x)
+        {
+            glm::vec3 rd = get_ray_direction(x, y);
+            float t;
+            int prim;
+            int instance;
+            intersect(m_scene, ro, rd, t, prim, instance);
+            glm::vec4 normal_depth(0.0f, 0.0f, 0.0f, aov_miss_depth);
+            glm::vec3 albedo = environment_color(m_scene, rd);
+            // a miss is projected as a direction
+            glm::vec4 clip = previous_view_projection * glm::vec4(rd, 0.0f);
+            float distance = 0.0f;
+            if(prim >= 0)
+            {
+                glm::vec3 normal;
+                unsigned material;
+                bool front;
+                get_surface(m_scene, ro, rd, t, prim, instance, normal, material, front);
+                normal_depth = glm::vec4(normal, t * glm::length(rd));
+                albedo = glm::vec3(m_scene.materials[material].color);
+                glm::vec3 p = ro + t * rd;
+                clip = previous_view_projection * glm::vec4(p, 1.0f);
+                distance = glm::length(p - previous_origin);
+            }
+
+            glm::vec4 sum(0.0f);
+            float moment = 0.0f;
+            if(clip.w > 0.0f)
+            {
+                // where the hit was in the image before, pixel centers at integers
+                glm::vec2 previous = glm::vec2(clip.x / clip.w * 0.5f + 0.5f, 0.5f - clip.y / clip.w * 0.5f)
+                    * glm::vec2(width, height) - 0.5f;
+                glm::ivec2 base = glm::ivec2(glm::floor(previous));
+                glm::vec2 f = previous - glm::vec2(base);
+                // bilinear weighted sums of the mean, the mean squared luminance and the count
+                float weight_sum = 0.0f;
+                glm::vec3 mean(0.0f);
+                float moment_mean = 0.0f;
+                float count = 0.0f;
+                for(int i = 0; i < 4; ++i)
+                {
+                    glm::ivec2 q = base + glm::ivec2(i & 1, i >> 1);
+                    if(q.x < 0 || q.y < 0 || q.x >= width || q.y >= height)
+                        continue;
+                    const size_t index = size_t(q.y) * m_width + q.x;
+                    const glm::vec4& h = m_history_accum[index];
+                    const glm::vec4& hn = m_history_normal_depth[index];
+                    bool valid = prim >= 0
+                        ? std::abs(hn.w - distance) <= reprojection_depth_tolerance * distance
+                            && glm::dot(glm::vec3(hn), glm::vec3(normal_depth)) >= reprojection_normal_threshold
+                        : hn.w >= 0.99f * aov_miss_depth;
+                    if(h.w < 1.0f || !valid)
+                        continue;
+                    float w = ((i & 1) != 0 ? f.x : 1.0f - f.x) * ((i >> 1) != 0 ? f.y : 1.0f - f.y);
+                    weight_sum += w;
+                    mean += w * glm::vec3(h) / h.w;
+                    moment_mean += w * m_history_moments[index] / h.w;
+                    count += w * h.w;
+                }
+                if(weight_sum > 0.0f)
+                {
+                    float n = std::floor(std::min(count / weight_sum, float(get_reprojection_samples())));
+                    sum = glm::vec4(mean / weight_sum * n, n);
+                    moment = moment_mean / weight_sum * n;
+                }
+            }
+            const size_t index = size_t(y) * m_width + x;
+            m_accum[index] = sum;
+            m_moments[index] = moment;
+            m_pixels[index] = sum.w > 0.0f ? glm::vec4(glm::vec3(sum) / sum.w, 1.0f) : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            m_normal_depth[index] = normal_depth;
+            m_albedo[index] = glm::vec4(albedo, 1.0f);
+        }
+}
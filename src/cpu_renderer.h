@@ -0,0 +1,92 @@
+#ifndef __CPU_RENDERER__
+#define __CPU_RENDERER__
+
+#include <vector>
+#include <cstdint>
+#include <glm/vec4.hpp>
+
+#include "renderer.h"
+#include "tile_scheduler.h"
+#include "ray_packet.h"
+#include "denoiser.h"
+#include "sampler.h"
+
+struct SampleState;
+
+// sampler_type, image_size.x and the sampler tables of ray_tracking.comp, for one render call
+struct CpuSampler
+{
+    SamplerType type;
+    const SamplerTables* tables;  // set unless RANDOM
+    int image_width;
+};
+
+// c++ port of ray_tracking.comp, runs on all cores and uploads the result to the target,
+// also serves as a reference to validate gpu output
+// rays are traced in SIMD packets when the cpu supports it, else one by one
+class CpuRenderer : public Renderer
+{
+public:
+    // thread_count 0 means one thread per hardware thread
+    CpuRenderer(Texture& target, unsigned thread_count = 0, SimdIsa isa = detect_simd_isa());
+
+    bool init(const SceneView& scene) override;
+    void reset() override;
+    void read_accumulation(unsigned x, unsigned y, unsigned width, unsigned height, glm::vec4* sums) override;
+
+    // RGBA32F average of the samples so far, row major, same layout Texture::set_data takes
+    const std::vector<glm::vec4>& get_pixels() const { return m_pixels; }
+
+protected:
+    // upload the rows the tiles cover to the target
+    void render_tiles(unsigned first_tile, unsigned tile_count, unsigned sample_index) override;
+    void render_adaptive(float threshold) override;
+    unsigned get_active_tile_count() override { return unsigned(m_active_tiles.size()); }
+    void denoise() override;
+    void apply_camera(const Camera& camera) override;
+    void reproject(const Camera& camera) override;
+    void apply_instances(const SceneView& scene, const InstanceUpdate& update) override;
+
+private:
+    // direction through pixel (x, y) jittered for its next sample
+    glm::vec3 get_ray_direction(int x, int y) const;
+    // random numbers of shading the next sample of pixel (x, y), unrelated to the jitter
+    SampleState get_shade_sample(int x, int y) const;
+    // take the sampler of the renderer for the render call
+    void update_sampler();
+    void add_sample(size_t index, const glm::vec3& color);
+    // after add_sample, a no-op unless denoising or reprojecting
+    void add_aov(size_t index, const glm::vec3& rd, float t, int prim, int instance);
+    float get_tile_error(const Tile& tile) const;
+    void render_tile(const Tile& tile);
+    void render_tile_packet(const Tile& tile);
+    // same as reproject in ray_tracking.comp, reads the m_history_ copies
+    void reproject_tile(const Tile& tile, const glm::mat4& previous_view_projection, const glm::vec3& previous_origin);
+
+private:
+    TileScheduler m_scheduler;
+    IntersectPacketFunc m_intersect_packet;  // nullptr for the scalar kernel
+    SceneView m_scene;
+    PacketSceneData m_packet_scene;
+    glm::vec3 m_lower_left;
+    glm::vec3 m_horizontal;
+    glm::vec3 m_vertical;
+    CpuSampler m_sampler;
+    unsigned m_sample_index;  // 0 restarts the accumulation of the tiles rendered
+    std::vector<glm::vec4> m_accum;  // rgb is the sum of samples, a the count
+    std::vector<float> m_moments;  // sum of squared sample luminance
+    std::vector<glm::vec4> m_pixels;
+    std::vector<glm::vec4> m_normal_depth;  // empty unless denoising or reprojecting
+    std::vector<glm::vec4> m_albedo;
+    std::vector<glm::vec4> m_denoised;  // empty unless denoising
+    // the accumulation and normal_depth before the camera moved
+    std::vector<glm::vec4> m_history_accum;
+    std::vector<float> m_history_moments;
+    std::vector<glm::vec4> m_history_normal_depth;
+    Denoiser m_denoiser;
+    std::vector<float> m_tile_errors;
+    std::vector<unsigned> m_active_tiles;  // tiles above the threshold, all tiles before adaptive sampling
+};
+
+
+#endif // __CPU_RENDERER__
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+#include <glm/common.hpp>
+
+#include "denoiser.h"
+
+// the functions below mirror the ones in denoise.comp, keep them in sync
+
+static const int denoise_tile_size = 32;
+static const glm::vec3 luminance_weight(0.2126f, 0.7152f, 0.0722f);
+static const float kernel_weights[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+static const float gaussian_weights[2] = {1.0f / 2.0f, 1.0f / 4.0f};
+static const float albedo_epsilon = 0.01f;
+static const float unknown_variance = 1.0f;
+static const float normal_phi = 128.0f;
+static const float depth_phi = 0.05f;
+static const float luminance_phi = 4.0f;
+static const float luminance_epsilon = 1.0e-4f;
+
+static glm::vec3 get_albedo(const glm::vec4& albedo)
+{
+    return glm::max(glm::vec3(albedo), glm::vec3(albedo_epsilon));
+}
+
+// the pixels without a hit have a zero normal, 1 between them
+static float normal_weight(const glm::vec3& n_p, const glm::vec3& n_q)
+{
+    float length_p = glm::length(n_p);
+    float length_q = glm::length(n_q);
+    if(length_p == 0.0f || length_q == 0.0f)
+        return length_p == length_q ? 1.0f : 0.0f;
+    return std::pow(std::max(glm::dot(n_p / length_p, n_q / length_q), 0.0f), normal_phi);
+}
+
+// 3x3 gaussian of the variance
+static float get_blurred_variance(const glm::vec4* source, int width, int height, int x, int y)
+{
+    float sum = 0.0f;
+    float weight_sum = 0.0f;
+    for(int dy = -1; dy <= 1; ++dy)
+        for(int dx = -1; dx <= 1; ++dx)
+        {
+            int qx = x + dx;
+            int qy = y + dy;
+            if(qx < 0 || qy < 0 || qx >= width || qy >= height)
+                continue;
+            float w = gaussian_weights[std::abs(dx)] * gaussian_weights[std::abs(dy)];
+            sum += w * source[size_t(qy) * width + qx].w;
+            weight_sum += w;
+        }
+    return sum / weight_sum;
+}
+
+void Denoiser::run(TileScheduler& scheduler, const Input& input, glm::vec4* output)
+{
+    const size_t size = size_t(input.width) * input.height;
+    for(std::vector<glm::vec4>& buffer : m_buffers)
+        if(buffer.size() < size)
+            buffer.resize(size);
+
+    scheduler.run(input.width, input.height, denoise_tile_size, denoise_tile_size,
+        [this, &input](const Tile& tile, unsigned) { prepare(input, tile); });
+    for(int i = 0; i < iteration_count; ++i)
+    {
+        // the last iteration writes the result instead of the other buffer
+        const glm::vec4* source = m_buffers[i % 2].data();
+        glm::vec4* target = m_buffers[(i + 1) % 2].data();
+        glm::vec4* result = i + 1 == iteration_count ? output : nullptr;
+        scheduler.run(input.width, input.height, denoise_tile_size, denoise_tile_size,
+            [this, &input, i, source, target, result](const Tile& tile, unsigned) {
+                atrous_step(input, tile, 1 << i, source, target, result);
+            });
+    }
+}
+
+void Denoiser::prepare(const Input& input, const Tile& tile)
+{
+    for(int y = tile.y; y < tile.y + tile.height; ++y)
+        for(int x = tile.x; x < tile.x + tile.width; ++x)
+        {
+            const size_t index = size_t(y) * input.width + x;
+            const glm::vec4& sum = input.accum[index];
+            float n = std::max(sum.w, 1.0f);
+            glm::vec3 albedo = get_albedo(input.albedo[index]);
+            glm::vec3 color = glm::vec3(sum) / n;
+            float mean = glm::dot(color, luminance_weight);
+            float variance = unknown_variance;
+            if(sum.w >= 2.0f)
+            {
+                // variance of the mean, scaled to the illumination
+                float a = std::max(glm::dot(albedo, luminance_weight), albedo_epsilon);
+                variance = std::max(input.moments[index] / n - mean * mean, 0.0f) / (n - 1.0f) / (a * a);
+            }
+            m_buffers[0][index] = glm::vec4(color / albedo, variance);
+        }
+}
+
+void Denoiser::atrous_step(const Input& input, const Tile& tile, int step_size, const glm::vec4* source,
+    glm::vec4* target, glm::vec4* output)
+{
+    const int width = int(input.width);
+    const int height = int(input.height);
+    for(int y = tile.y; y < tile.y + tile.height; ++y)
+        for(int x = tile.x; x < tile.x + tile.width; ++x)
+        {
+            const size_t index = size_t(y) * width + x;
+            const glm::vec4& center = source[index];
+            const glm::vec4& normal_depth = input.normal_depth[index];
+            float luminance = glm::dot(glm::vec3(center), luminance_weight);
+            float variance = get_blurred_variance(source, width, height, x, y);
+            float sigma_l = luminance_phi * std::sqrt(std::max(variance, 0.0f)) + luminance_epsilon;
+            float sigma_z = depth_phi * float(step_size) * std::max(normal_depth.w, luminance_epsilon);
+
+            glm::vec3 color_sum(0.0f);
+            float variance_sum = 0.0f;
+            float weight_sum = 0.0f;
+            for(int dy = -2; dy <= 2; ++dy)
+                for(int dx = -2; dx <= 2; ++dx)
+                {
+                    int qx = x + dx * step_size;
+                    int qy = y + dy * step_size;
+                    if(qx < 0 || qy < 0 || qx >= width || qy >= height)
+                        continue;
+                    const size_t q = size_t(qy) * width + qx;
+                    const glm::vec4& c = source[q];
+                    float w = kernel_weights[std::abs(dx)] * kernel_weights[std::abs(dy)];
+                    if(dx != 0 || dy != 0)
+                    {
+                        const glm::vec4& nd = input.normal_depth[q];
+                        w *= normal_weight(glm::vec3(normal_depth), glm::vec3(nd));
+                        w *= std::exp(-std::abs(normal_depth.w - nd.w) / sigma_z);
+                        w *= std::exp(-std::abs(luminance - glm::dot(glm::vec3(c), luminance_weight)) / sigma_l);
+                    }
+                    color_sum += w * glm::vec3(c);
+                    variance_sum += w * w * c.w;
+                    weight_sum += w;
+                }
+
+            // the center weight is never 0
+            glm::vec4 result(color_sum / weight_sum, variance_sum / (weight_sum * weight_sum));
+            if(output)
+                output[index] = glm::vec4(glm::vec3(result) * get_albedo(input.albedo[index]), 1.0f);
+            else
+                target[index] = result;
+        }
+}
@@ -0,0 +1,44 @@
+#ifndef __DENOISER__
+#define __DENOISER__
+
+#include <vector>
+#include <glm/vec4.hpp>
+
+#include "tile_scheduler.h"
+
+// c++ port of denoise.comp, an edge-avoiding a-trous wavelet filter guided by the normal, depth and
+// albedo of the first hits, see there for the weights
+// the noisy average is divided by the albedo, filtered, and multiplied back
+class Denoiser
+{
+public:
+    // a-trous iterations, the step doubles from 1 so the last one reaches 2^iteration_count pixels away
+    static const int iteration_count = 5;
+
+    // width x height row major images as the renderers accumulate them
+    struct Input
+    {
+        unsigned width;
+        unsigned height;
+        const glm::vec4* accum;  // rgb is the sum of samples, a the count
+        const float* moments;  // sum of squared sample luminance
+        const glm::vec4* normal_depth;  // mean first hit normal and distance
+        const glm::vec4* albedo;  // mean first hit albedo
+    };
+
+public:
+    // write the filtered average color into output, width x height RGBA32F
+    void run(TileScheduler& scheduler, const Input& input, glm::vec4* output);
+
+private:
+    void prepare(const Input& input, const Tile& tile);
+    // output null writes target, else the remodulated color goes to output
+    void atrous_step(const Input& input, const Tile& tile, int step_size, const glm::vec4* source,
+        glm::vec4* target, glm::vec4* output);
+
+private:
+    std::vector<glm::vec4> m_buffers[2];  // rgb is the illumination, a its luminance variance
+};
+
+
+#endif // __DENOISER__
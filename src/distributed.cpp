@@ -0,0 +1,598 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <GL/glew.h>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "distributed.h"
+#include "socket.h"
+#include "headless.h"
+#include "renderer.h"
+#include "texture.h"
+#include "image_writer.h"
+
+// consecutive tiles of a job, 128x128 pixels worth
+static const unsigned job_tile_count = 16;
+// jobs sent to a worker before the first one comes back, it never waits for the network
+static const size_t jobs_in_flight = 2;
+// a worker started before the coordinator keeps trying this long
+static const int connect_timeout_ms = 10000;
+static const int connect_retry_ms = 200;
+static const int poll_ms = 1000;
+// workers are waited for to close after the image is done
+static const int quit_timeout_ms = 2000;
+
+static const uint32_t message_magic = 0x31545452;  // "RTT1"
+
+enum MessageType : uint32_t
+{
+    message_setup = 1,  // coordinator -> worker, SetupMessage then the scene path
+    message_ready,  // worker -> coordinator, the renderer is ready, a description of it follows
+    message_job,  // coordinator -> worker, JobMessage
+    message_result,  // worker -> coordinator, JobMessage then the sums of every tile
+    message_quit,  // coordinator -> worker
+};
+
+struct MessageHeader
+{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t size;  // bytes after the header
+};
+
+// followed by the scene path, then the environment path
+struct SetupMessage
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t samples_per_pixel;
+    uint32_t sampler;  // SamplerType, tiles of different workers must draw the same sequence
+    uint32_t scene_path_size;
+};
+
+struct JobMessage
+{
+    uint32_t job;
+    uint32_t first_tile;
+    uint32_t tile_count;
+};
+
+static bool send_message(Socket& socket, MessageType type, const void* data = nullptr, size_t size = 0,
+    const void* extra = nullptr, size_t extra_size = 0)
+{
+    MessageHeader header = {message_magic, uint32_t(type), uint32_t(size + extra_size)};
+    return socket.send_all(&header, sizeof(header))
+        && (size == 0 || socket.send_all(data, size))
+        && (extra_size == 0 || socket.send_all(extra, extra_size));
+}
+
+// blocks until the whole message is there, false when the peer is gone or talks nonsense
+static bool recv_message(Socket& socket, MessageType& type, std::vector<char>& payload)
+{
+    // the largest message is the result of a job
+    static const size_t max_payload = sizeof(JobMessage)
+        + size_t(job_tile_count) * Renderer::tile_size_x * Renderer::tile_size_y * sizeof(glm::vec4);
+    MessageHeader header;
+    if(!socket.recv_all(&header, sizeof(header)))
+        return false;
+    if(header.magic != message_magic || header.size > max_payload)
+    {
+        std::cerr << "Invalid message\n";
+        socket.close();
+        return false;
+    }
+    type = MessageType(header.type);
+    payload.resize(header.size);
+    return header.size == 0 || socket.recv_all(payload.data(), header.size);
+}
+
+// pixel rectangle of a tile, clipped by the image
+struct TileRect
+{
+    unsigned x;
+    unsigned y;
+    unsigned width;
+    unsigned height;
+};
+
+// tiles covering the image, numbered in scan order
+static unsigned get_tile_count(unsigned image_width, unsigned image_height)
+{
+    const unsigned tiles_x = (image_width + Renderer::tile_size_x - 1) / Renderer::tile_size_x;
+    const unsigned tiles_y = (image_height + Renderer::tile_size_y - 1) / Renderer::tile_size_y;
+    return tiles_x * tiles_y;
+}
+
+static TileRect get_tile_rect(unsigned tile, unsigned image_width, unsigned image_height)
+{
+    const unsigned tiles_x = (image_width + Renderer::tile_size_x - 1) / Renderer::tile_size_x;
+    TileRect rect;
+    rect.x = tile % tiles_x * Renderer::tile_size_x;
+    rect.y = tile / tiles_x * Renderer::tile_size_y;
+    rect.width = std::min<unsigned>(Renderer::tile_size_x, image_width - rect.x);
+    rect.height = std::min<unsigned>(Renderer::tile_size_y, image_height - rect.y);
+    return rect;
+}
+
+// pixels in the result of a job
+static size_t get_job_pixels(const JobMessage& job, unsigned image_width, unsigned image_height)
+{
+    size_t pixels = 0;
+    for(unsigned i = job.first_tile; i < job.first_tile + job.tile_count; ++i)
+    {
+        TileRect rect = get_tile_rect(i, image_width, image_height);
+        pixels += size_t(rect.width) * rect.height;
+    }
+    return pixels;
+}
+
+class Coordinator
+{
+public:
+    explicit Coordinator(const Options& options);
+    int run();
+
+private:
+    struct Worker
+    {
+        Socket socket;
+        unsigned id;
+        std::string name;  // empty until it is ready
+        std::deque<unsigned> queue;  // owned jobs not sent yet
+        std::vector<unsigned> in_flight;  // sent, no result yet
+        unsigned done_count;
+    };
+
+    void accept_worker();
+    // false when the worker has to be dropped
+    bool handle_message(Worker& worker);
+    void add_result(const JobMessage& job, const glm::vec4* sums);
+    // its queue and the jobs no one else is running go back to the pending ones
+    void drop_worker(Worker& worker);
+    // top up the jobs in flight of every ready worker
+    void issue_jobs();
+    bool take_job(Worker& worker, unsigned& job);
+    bool is_in_flight(unsigned job, const Worker* except) const;
+    JobMessage get_job(unsigned job) const;
+    bool save() const;
+
+private:
+    const Options& m_options;
+    unsigned m_width;
+    unsigned m_height;
+    unsigned m_tile_count;
+    unsigned m_job_count;
+    Socket m_listener;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    unsigned m_next_worker_id;
+    std::deque<unsigned> m_pending;  // owned by no worker
+    std::vector<bool> m_done;
+    unsigned m_done_count;
+    std::vector<glm::vec4> m_sums;  // rgb is the sum of samples, a the count
+};
+
+Coordinator::Coordinator(const Options& options):
+    m_options(options),
+    m_width(unsigned(options.width)),
+    m_height(unsigned(options.height)),
+    m_next_worker_id(0),
+    m_done_count(0)
+{
+    m_tile_count = get_tile_count(m_width, m_height);
+    m_job_count = (m_tile_count + job_tile_count - 1) / job_tile_count;
+    for(unsigned i = 0; i < m_job_count; ++i)
+        m_pending.push_back(i);
+    m_done.resize(m_job_count, false);
+    m_sums.resize(size_t(m_width) * m_height, glm::vec4(0.0f));
+}
+
+int Coordinator::run()
+{
+    if(!m_listener.listen((unsigned short)m_options.coordinator_port))
+        return EXIT_FAILURE;
+    std::cout << "coordinator on port " << m_options.coordinator_port << ": " << m_width << " X " << m_height
+        << " with " << m_options.samples_per_pixel << " spp, " << m_job_count << " jobs of "
+        << job_tile_count << " tiles\n";
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned reported = 0;
+    while(m_done_count < m_job_count)
+    {
+        std::vector<Socket*> sockets(1, &m_listener);
+        for(std::unique_ptr<Worker>& worker : m_workers)
+            sockets.push_back(&worker->socket);
+        for(size_t i : Socket::wait_readable(sockets, poll_ms))
+        {
+            if(i == 0)
+                accept_worker();
+            else if(!handle_message(*m_workers[i - 1]))
+                drop_worker(*m_workers[i - 1]);
+        }
+        m_workers.erase(std::remove_if(m_workers.begin(), m_workers.end(),
+            [](const std::unique_ptr<Worker>& worker) { return !worker->socket.is_open(); }), m_workers.end());
+        issue_jobs();
+
+        // every 10%
+        if(m_done_count * 10 / m_job_count > reported)
+        {
+            reported = m_done_count * 10 / m_job_count;
+            std::cout << m_done_count << " / " << m_job_count << " jobs done\n";
+        }
+    }
+    std::chrono::duration<double, std::milli> render_time = std::chrono::steady_clock::now() - start;
+
+    for(std::unique_ptr<Worker>& worker : m_workers)
+    {
+        std::cout << "worker " << worker->id << " (" << worker->name << "): " << worker->done_count << " jobs\n";
+        send_message(worker->socket, message_quit);
+    }
+    double samples = double(m_width) * m_height * m_options.samples_per_pixel;
+    std::cout << "rendered " << m_width << " X " << m_height << " with " << m_options.samples_per_pixel
+        << " spp in " << render_time.count() << " ms, " << samples / render_time.count() * 1.0e-3 << " Msamples/s\n";
+
+    if(!save())
+    {
+        std::cerr << "Save image failed: " << m_options.output_path << "\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "image saved: " << m_options.output_path << "\n";
+
+    // closing with results of duplicates unread resets the connection, the quit may get lost with it
+    std::chrono::steady_clock::time_point quit_time = std::chrono::steady_clock::now();
+    while(std::chrono::steady_clock::now() - quit_time < std::chrono::milliseconds(quit_timeout_ms))
+    {
+        std::vector<Socket*> sockets;
+        for(std::unique_ptr<Worker>& worker : m_workers)
+            if(worker->socket.is_open())
+                sockets.push_back(&worker->socket);
+        if(sockets.empty())
+            break;
+        MessageType type;
+        std::vector<char> payload;
+        for(size_t i : Socket::wait_readable(sockets, connect_retry_ms))
+            recv_message(*sockets[i], type, payload);
+    }
+    return EXIT_SUCCESS;
+}
+
+void Coordinator::accept_worker()
+{
+    std::unique_ptr<Worker> worker(new Worker);
+    worker->socket = m_listener.accept();
+    if(!worker->socket.is_open())
+        return;
+    worker->id = m_next_worker_id++;
+    worker->done_count = 0;
+
+    SetupMessage setup = {m_width, m_height, uint32_t(m_options.samples_per_pixel), uint32_t(m_options.sampler),
+        uint32_t(m_options.scene_path.size())};
+    const std::string paths = m_options.scene_path + m_options.environment_path;
+    if(send_message(worker->socket, message_setup, &setup, sizeof(setup), paths.data(), paths.size()))
+        m_workers.push_back(std::move(worker));
+}
+
+bool Coordinator::handle_message(Worker& worker)
+{
+    MessageType type;
+    std::vector<char> payload;
+    if(!recv_message(worker.socket, type, payload))
+        return false;
+
+    if(type == message_ready)
+    {
+        worker.name.assign(payload.begin(), payload.end());
+        if(worker.name.empty())
+            worker.name = "unknown";
+        std::cout << "worker " << worker.id << " ready: " << worker.name << "\n";
+        return true;
+    }
+    if(type != message_result || payload.size() < sizeof(JobMessage))
+    {
+        std::cerr << "Unexpected message from worker " << worker.id << "\n";
+        return false;
+    }
+
+    JobMessage job;
+    std::memcpy(&job, payload.data(), sizeof(job));
+    std::vector<unsigned>::iterator it = std::find(worker.in_flight.begin(), worker.in_flight.end(), job.job);
+    const JobMessage expected = get_job(it != worker.in_flight.end() ? job.job : 0);
+    if(it == worker.in_flight.end() || std::memcmp(&job, &expected, sizeof(job)) != 0
+        || payload.size() != sizeof(job) + get_job_pixels(job, m_width, m_height) * sizeof(glm::vec4))
+    {
+        std::cerr << "Unexpected result from worker " << worker.id << "\n";
+        return false;
+    }
+    worker.in_flight.erase(it);
+    ++worker.done_count;
+    // a duplicate of a job already done
+    if(m_done[job.job])
+        return true;
+
+    // payload is only char aligned
+    std::vector<glm::vec4> sums(get_job_pixels(job, m_width, m_height));
+    std::memcpy(sums.data(), payload.data() + sizeof(job), sums.size() * sizeof(glm::vec4));
+    add_result(job, sums.data());
+    return true;
+}
+
+void Coordinator::add_result(const JobMessage& job, const glm::vec4* sums)
+{
+    for(unsigned i = job.first_tile; i < job.first_tile + job.tile_count; ++i)
+    {
+        TileRect rect = get_tile_rect(i, m_width, m_height);
+        for(unsigned y = rect.y; y < rect.y + rect.height; ++y)
+            for(unsigned x = rect.x; x < rect.x + rect.width; ++x)
+                m_sums[size_t(y) * m_width + x] += *sums++;
+    }
+    m_done[job.job] = true;
+    ++m_done_count;
+}
+
+void Coordinator::drop_worker(Worker& worker)
+{
+    worker.socket.close();
+    std::cout << "worker " << worker.id << " lost, " << worker.in_flight.size() + worker.queue.size()
+        << " jobs reissued\n";
+    // the ones it was rendering first, they are the oldest
+    for(std::vector<unsigned>::reverse_iterator it = worker.in_flight.rbegin(); it != worker.in_flight.rend(); ++it)
+        if(!m_done[*it] && !is_in_flight(*it, &worker))
+            m_pending.push_front(*it);
+    m_pending.insert(m_pending.end(), worker.queue.begin(), worker.queue.end());
+    worker.in_flight.clear();
+    worker.queue.clear();
+}
+
+void Coordinator::issue_jobs()
+{
+    for(std::unique_ptr<Worker>& worker : m_workers)
+    {
+        unsigned job;
+        while(!worker->name.empty() && worker->socket.is_open() && worker->in_flight.size() < jobs_in_flight
+            && take_job(*worker, job))
+        {
+            JobMessage message = get_job(job);
+            worker->in_flight.push_back(job);
+            if(!send_message(worker->socket, message_job, &message, sizeof(message)))
+                drop_worker(*worker);
+        }
+    }
+}
+
+bool Coordinator::take_job(Worker& worker, unsigned& job)
+{
+    // jobs done by a duplicate may still be queued
+    while(!worker.queue.empty())
+    {
+        job = worker.queue.front();
+        worker.queue.pop_front();
+        if(!m_done[job])
+            return true;
+    }
+
+    // steal the back half of the longest queue, the pending jobs count as one
+    std::deque<unsigned>* victim = m_pending.empty() ? nullptr : &m_pending;
+    for(std::unique_ptr<Worker>& other : m_workers)
+        if(other->socket.is_open() && (!victim || other->queue.size() > victim->size()))
+            victim = &other->queue;
+    if(victim && !victim->empty())
+    {
+        const size_t count = (victim->size() + 1) / 2;
+        worker.queue.assign(victim->end() - count, victim->end());
+        victim->erase(victim->end() - count, victim->end());
+        return take_job(worker, job);
+    }
+
+    // nothing is queued, help with the oldest job only running on another worker
+    for(std::unique_ptr<Worker>& other : m_workers)
+        if(other.get() != &worker && other->socket.is_open())
+            for(unsigned running : other->in_flight)
+                if(!m_done[running] && !is_in_flight(running, other.get()))
+                {
+                    job = running;
+                    return true;
+                }
+    return false;
+}
+
+bool Coordinator::is_in_flight(unsigned job, const Worker* except) const
+{
+    for(const std::unique_ptr<Worker>& worker : m_workers)
+        if(worker.get() != except && worker->socket.is_open()
+            && std::find(worker->in_flight.begin(), worker->in_flight.end(), job) != worker->in_flight.end())
+            return true;
+    return false;
+}
+
+JobMessage Coordinator::get_job(unsigned job) const
+{
+    JobMessage message;
+    message.job = job;
+    message.first_tile = job * job_tile_count;
+    message.tile_count = std::min(job_tile_count, m_tile_count - message.first_tile);
+    return message;
+}
+
+bool Coordinator::save() const
+{
+    std::vector<glm::vec4> pixels(m_sums.size());
+    for(size_t i = 0; i < m_sums.size(); ++i)
+        pixels[i] = glm::vec4(glm::vec3(m_sums[i]) / std::max(m_sums[i].a, 1.0f), 1.0f);
+    return write_image(m_options.output_path, &pixels[0].x, m_width, m_height);
+}
+
+int run_coordinator(const Options& options)
+{
+    if(options.adaptive_threshold > 0.0f || options.denoise)
+        std::cout << "adaptive sampling and denoising are not distributed, rendering without\n";
+    Coordinator coordinator(options);
+    return coordinator.run();
+}
+
+static bool connect_coordinator(const std::string& address, Socket& socket)
+{
+    std::string host;
+    unsigned short port;
+    if(!parse_address(address, host, port))
+    {
+        std::cerr << "Invalid coordinator address: " << address << "\n";
+        return false;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while(!socket.connect(host, port))
+    {
+        if(std::chrono::steady_clock::now() - start > std::chrono::milliseconds(connect_timeout_ms))
+        {
+            std::cerr << "Connect to coordinator failed: " << address << "\n";
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(connect_retry_ms));
+    }
+    return true;
+}
+
+static int work(const Options& options, Socket& socket)
+{
+    MessageType type;
+    std::vector<char> payload;
+    SetupMessage setup = {};
+    if(recv_message(socket, type, payload) && type == message_setup && payload.size() >= sizeof(SetupMessage))
+        std::memcpy(&setup, payload.data(), sizeof(setup));
+    if(setup.width == 0 || setup.height == 0 || payload.size() - sizeof(setup) < setup.scene_path_size
+        || setup.sampler > uint32_t(SamplerType::BLUE_NOISE))
+    {
+        std::cerr << "No setup from coordinator\n";
+        return EXIT_FAILURE;
+    }
+    // the backend options are this worker's own, what is rendered the coordinator's
+    Options job_options = options;
+    job_options.width = int(setup.width);
+    job_options.height = int(setup.height);
+    job_options.samples_per_pixel = int(setup.samples_per_pixel);
+    job_options.sampler = SamplerType(setup.sampler);
+    const std::vector<char>::const_iterator paths = payload.begin() + sizeof(setup);
+    job_options.scene_path.assign(paths, paths + setup.scene_path_size);
+    job_options.environment_path.assign(paths + setup.scene_path_size, payload.cend());
+    job_options.adaptive_threshold = 0.0f;
+    job_options.denoise = false;
+
+    Texture picture(setup.width, setup.height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT, nullptr);
+    picture.activate(0);
+    picture.set_access_for_shader(Texture::Access::READ_WRITE);
+
+    Scene scene;
+    SceneFile scene_file;
+    SceneView view;
+    if(!load_scene(job_options, float(setup.width) / setup.height, scene, scene_file, view))
+    {
+        std::cerr << "Load scene failed\n";
+        return EXIT_FAILURE;
+    }
+    std::unique_ptr<Renderer> renderer = create_renderer(job_options, picture);
+    if(!renderer || !renderer->init(view))
+    {
+        std::cerr << "Renderer init failed\n";
+        return EXIT_FAILURE;
+    }
+
+    std::string name = job_options.backend == Options::Backend::CPU ? std::string("cpu")
+        : std::string("gpu ") + reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    if(!send_message(socket, message_ready, name.data(), name.size()))
+        return EXIT_FAILURE;
+    std::cout << "rendering " << setup.width << " X " << setup.height << " with " << setup.samples_per_pixel
+        << " spp\n";
+
+    const unsigned tile_count = get_tile_count(setup.width, setup.height);
+    std::vector<glm::vec4> rows;
+    std::vector<glm::vec4> result;
+    std::deque<JobMessage> jobs;
+    unsigned job_count = 0;
+    std::vector<Socket*> sockets(1, &socket);
+    while(true)
+    {
+        // take everything arrived so far before the next job, the quit comes after jobs
+        // the coordinator no longer needs
+        bool quit = false;
+        while(!quit && (jobs.empty() || !Socket::wait_readable(sockets, 0).empty()))
+        {
+            if(!recv_message(socket, type, payload))
+            {
+                std::cerr << "Coordinator connection lost\n";
+                return EXIT_FAILURE;
+            }
+            JobMessage job;
+            quit = type == message_quit;
+            if(!quit && (type != message_job || payload.size() != sizeof(job)))
+            {
+                std::cerr << "Unexpected message from coordinator\n";
+                return EXIT_FAILURE;
+            }
+            if(!quit)
+            {
+                std::memcpy(&job, payload.data(), sizeof(job));
+                // within the image and small enough for the result to fit a message, like the coordinator's
+                if(job.tile_count == 0 || job.tile_count > job_tile_count || job.first_tile >= tile_count
+                    || job.tile_count > tile_count - job.first_tile)
+                {
+                    std::cerr << "Invalid job from coordinator\n";
+                    return EXIT_FAILURE;
+                }
+                jobs.push_back(job);
+            }
+        }
+        if(quit)
+            break;
+
+        JobMessage job = jobs.front();
+        jobs.pop_front();
+        renderer->render_tile_range(job.first_tile, job.tile_count, job_options.samples_per_pixel);
+
+        // read the full rows the tiles are in at once, then cut the tiles out
+        TileRect first = get_tile_rect(job.first_tile, setup.width, setup.height);
+        TileRect last = get_tile_rect(job.first_tile + job.tile_count - 1, setup.width, setup.height);
+        const unsigned row_count = last.y + last.height - first.y;
+        rows.resize(size_t(setup.width) * row_count);
+        renderer->read_accumulation(0, first.y, setup.width, row_count, rows.data());
+        result.clear();
+        for(unsigned i = job.first_tile; i < job.first_tile + job.tile_count; ++i)
+        {
+            TileRect rect = get_tile_rect(i, setup.width, setup.height);
+            for(unsigned y = rect.y; y < rect.y + rect.height; ++y)
+            {
+                const glm::vec4* row = rows.data() + size_t(y - first.y) * setup.width + rect.x;
+                result.insert(result.end(), row, row + rect.width);
+            }
+        }
+        if(!send_message(socket, message_result, &job, sizeof(job), result.data(), result.size() * sizeof(glm::vec4)))
+        {
+            std::cerr << "Coordinator connection lost\n";
+            return EXIT_FAILURE;
+        }
+        ++job_count;
+    }
+    std::cout << job_count << " jobs rendered\n";
+    return EXIT_SUCCESS;
+}
+
+int run_worker(const Options& options)
+{
+    Socket socket;
+    if(!connect_coordinator(options.worker_address, socket))
+        return EXIT_FAILURE;
+    if(!create_headless_context())
+        return EXIT_FAILURE;
+
+    // all GL objects must be released before the context goes away
+    int ret = work(options, socket);
+
+    destroy_headless_context();
+    return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef __DISTRIBUTED__
+#define __DISTRIBUTED__
+
+#include "options.h"
+
+// one image rendered by worker processes over TCP, both sides return the process exit code
+//
+// the coordinator needs no OpenGL, it splits the image into jobs of consecutive 32x32 tiles in scan
+// order and sends the size, samples per pixel and scene path to every worker that connects, workers
+// render with their own backend options, so cpu and gpu ones can be mixed
+// every worker owns a queue of jobs, an idle one takes the front of its own or steals the back half
+// of the longest other queue, jobs of a worker that disconnects go back to be taken by the others,
+// and once nothing is queued idle workers duplicate the jobs still running elsewhere, the first
+// result wins, so a stalled worker only slows the end down
+// results are the accumulated rgb sums and sample counts, merged by adding them and saved
+// as their average to options.output_path
+// every tile gets the samples a single process render would give it, so the image is the same
+//
+// messages are little endian structs, fine for the x86 / arm machines this runs on
+int run_coordinator(const Options& options);
+
+// connect to options.worker_address, render the jobs it sends until it quits
+int run_worker(const Options& options);
+
+
+#endif // __DISTRIBUTED__
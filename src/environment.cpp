@@ -0,0 +1,325 @@
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <cmath>
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+
+#include "environment.h"
+#include "mapped_file.h"
+
+static const double pi = 3.14159265358979323846;
+static const glm::vec3 luminance_weight(0.2126f, 0.7152f, 0.0722f);  // same as ray_tracking.comp
+
+// work(begin, end) over [0, count) split into thread_count ranges
+static void run_parallel(unsigned count, unsigned thread_count, const std::function<void(unsigned, unsigned)>& work)
+{
+    thread_count = std::max(1u, std::min(thread_count, count));
+    std::vector<std::thread> threads;
+    for(unsigned t = 1; t < thread_count; ++t)
+        threads.emplace_back(work, unsigned(uint64_t(count) * t / thread_count),
+            unsigned(uint64_t(count) * (t + 1) / thread_count));
+    work(0, unsigned(uint64_t(count) / thread_count));
+    for(std::thread& t : threads)
+        t.join();
+}
+
+// one scanline of rgbe at p into out, return the byte after it, nullptr when it is broken
+static const unsigned char* read_hdr_scanline(const unsigned char* p, const unsigned char* end, unsigned width,
+    unsigned char* out)
+{
+    // run length encoded, each of the four channels on its own
+    if(width >= 8 && width < 32768 && end - p >= 4 && p[0] == 2 && p[1] == 2 && !(p[2] & 0x80))
+    {
+        if((unsigned(p[2]) << 8 | p[3]) != width)
+            return nullptr;
+        p += 4;
+        for(unsigned c = 0; c < 4; ++c)
+            for(unsigned x = 0; x < width;)
+            {
+                if(p == end)
+                    return nullptr;
+                unsigned count = *p++;
+                const bool run = count > 128;
+                if(run)
+                    count -= 128;
+                if(count == 0 || count > width - x || size_t(end - p) < (run ? 1 : count))
+                    return nullptr;
+                for(; count > 0; --count, ++x)
+                    out[x * 4 + c] = run ? *p : *p++;
+                if(run)
+                    ++p;
+            }
+        return p;
+    }
+
+    // flat pixels, where 1 1 1 n repeats the pixel before n times, shifted 8 bits more each time in a row
+    unsigned shift = 0;
+    for(unsigned x = 0; x < width; p += 4)
+    {
+        if(end - p < 4)
+            return nullptr;
+        if(p[0] == 1 && p[1] == 1 && p[2] == 1)
+        {
+            size_t count = shift < 32 ? size_t(p[3]) << shift : 0;
+            if(x == 0 || count > width - x)
+                return nullptr;
+            for(; count > 0; --count, ++x)
+                std::memcpy(out + x * 4, out + (x - 1) * 4, 4);
+            shift += 8;
+        }
+        else
+        {
+            std::memcpy(out + x * 4, p, 4);
+            ++x;
+            shift = 0;
+        }
+    }
+    return p;
+}
+
+static bool read_hdr(const MappedFile& file, const std::string& path, EnvironmentMap& map, unsigned thread_count)
+{
+    const char* data = reinterpret_cast<const char*>(file.get_data());
+    const size_t size = file.get_size();
+    if(size < 2 || data[0] != '#' || data[1] != '?')
+    {
+        std::cerr << "Not a radiance hdr file: " << path << "\n";
+        return false;
+    }
+    // header lines up to an empty one, then the resolution line
+    size_t pos = 0;
+    std::string line;
+    bool header = true;
+    while(true)
+    {
+        const char* line_end = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+        if(!line_end)
+        {
+            std::cerr << "Bad hdr header: " << path << "\n";
+            return false;
+        }
+        line.assign(data + pos, line_end);
+        pos = size_t(line_end - data) + 1;
+        if(!header)
+            break;
+        if(line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe")
+        {
+            std::cerr << "Unsupported hdr " << line << ": " << path << "\n";
+            return false;
+        }
+        header = !line.empty();
+    }
+    char y_sign = 0;
+    char x_axis[3] = {0};
+    int height = 0;
+    int width = 0;
+    if(std::sscanf(line.c_str(), "%cY %d %2s %d", &y_sign, &height, x_axis, &width) != 4
+        || (y_sign != '-' && y_sign != '+') || std::strcmp(x_axis, "+X") != 0 || width <= 0 || height <= 0)
+    {
+        std::cerr << "Unsupported hdr orientation \"" << line << "\": " << path << "\n";
+        return false;
+    }
+
+    // a run packs at most 127 bytes of a channel into 2, so no more pixels than that fit in the data,
+    // checked before the header values size any allocation
+    const size_t max_pixels = (size - pos) / 2 * 127 / 4;
+    if(size_t(width) > max_pixels / size_t(height))
+    {
+        std::cerr << "Hdr data too short for " << width << " X " << height << ": " << path << "\n";
+        return false;
+    }
+
+    // scanlines have to be decoded in order to find where the next one starts, the floats in parallel
+    map.width = unsigned(width);
+    map.height = unsigned(height);
+    std::vector<unsigned char> rgbe(size_t(width) * height * 4);
+    const unsigned char* p = file.get_data() + pos;
+    const unsigned char* end = file.get_data() + size;
+    for(int y = 0; y < height && p; ++y)
+    {
+        // -Y is top to bottom
+        const int row = y_sign == '-' ? y : height - 1 - y;
+        p = read_hdr_scanline(p, end, unsigned(width), &rgbe[size_t(row) * width * 4]);
+    }
+    if(!p)
+    {
+        std::cerr << "Bad hdr scanline: " << path << "\n";
+        return false;
+    }
+    map.radiance.resize(size_t(width) * height);
+    run_parallel(map.height, thread_count, [&](unsigned first, unsigned end_row) {
+        for(size_t i = size_t(first) * map.width; i < size_t(end_row) * map.width; ++i)
+        {
+            const unsigned char* c = &rgbe[i * 4];
+            const float scale = c[3] != 0 ? std::ldexp(1.0f, int(c[3]) - (128 + 8)) : 0.0f;
+            map.radiance[i] = glm::vec4(c[0] * scale, c[1] * scale, c[2] * scale, 1.0f);
+        }
+    });
+    return true;
+}
+
+static bool read_pfm(const MappedFile& file, const std::string& path, EnvironmentMap& map, unsigned thread_count)
+{
+    // PF (rgb) or Pf (gray), width, height and scale separated by white space, then a single one
+    const char* data = reinterpret_cast<const char*>(file.get_data());
+    const size_t size = file.get_size();
+    std::string tokens[4];
+    size_t pos = 0;
+    for(std::string& token : tokens)
+    {
+        while(pos < size && std::isspace((unsigned char)data[pos]))
+            ++pos;
+        while(pos < size && !std::isspace((unsigned char)data[pos]) && token.size() < 32)
+            token += data[pos++];
+    }
+    ++pos;
+    const int channels = tokens[0] == "PF" ? 3 : tokens[0] == "Pf" ? 1 : 0;
+    const long width = std::strtol(tokens[1].c_str(), nullptr, 10);
+    const long height = std::strtol(tokens[2].c_str(), nullptr, 10);
+    const double scale = std::strtod(tokens[3].c_str(), nullptr);
+    // divided instead of multiplied, so huge header values cannot wrap past the check
+    if(channels == 0 || width <= 0 || height <= 0 || (unsigned long)width > UINT_MAX
+        || (unsigned long)height > UINT_MAX || scale == 0.0 || pos > size
+        || size_t(width) > (size - pos) / sizeof(float) / size_t(channels) / size_t(height))
+    {
+        std::cerr << "Bad pfm header: " << path << "\n";
+        return false;
+    }
+
+    // negative scale is little endian, the rows go from the bottom up
+    const bool swap = scale > 0.0;
+    const unsigned char* pixels = file.get_data() + pos;
+    map.width = unsigned(width);
+    map.height = unsigned(height);
+    map.radiance.resize(size_t(width) * height);
+    run_parallel(map.height, thread_count, [&](unsigned first, unsigned end_row) {
+        for(unsigned y = first; y < end_row; ++y)
+        {
+            const unsigned char* row = pixels + size_t(map.height - 1 - y) * map.width * channels * sizeof(float);
+            for(unsigned x = 0; x < map.width; ++x)
+            {
+                float value[3];
+                for(int c = 0; c < channels; ++c)
+                {
+                    unsigned char bytes[4];
+                    const unsigned char* v = row + (size_t(x) * channels + c) * sizeof(float);
+                    for(int i = 0; i < 4; ++i)
+                        bytes[i] = swap ? v[3 - i] : v[i];
+                    std::memcpy(&value[c], bytes, sizeof(float));
+                }
+                map.radiance[size_t(y) * map.width + x] = channels == 3 ?
+                    glm::vec4(value[0], value[1], value[2], 1.0f) : glm::vec4(value[0], value[0], value[0], 1.0f);
+            }
+        }
+    });
+    return true;
+}
+
+// Vose's alias method over weights[0, count) summing to sum, the cells of zero weight are never taken
+static void build_alias_table(const double* weights, unsigned count, double sum, EnvironmentAlias* table,
+    std::vector<double>& scaled, std::vector<unsigned>& small, std::vector<unsigned>& large)
+{
+    small.clear();
+    large.clear();
+    scaled.resize(count);
+    for(unsigned i = 0; i < count; ++i)
+    {
+        scaled[i] = sum > 0.0 ? weights[i] * count / sum : 1.0;
+        if(scaled[i] < 1.0)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+    // a small cell is filled up by a large one, which is small itself once it drops below 1
+    while(!small.empty() && !large.empty())
+    {
+        const unsigned s = small.back();
+        small.pop_back();
+        const unsigned l = large.back();
+        table[s] = {float(scaled[s]), l};
+        scaled[l] -= 1.0 - scaled[s];
+        if(scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // the rest is 1 up to rounding
+    for(unsigned i : large)
+        table[i] = {1.0f, i};
+    for(unsigned i : small)
+        table[i] = {1.0f, i};
+}
+
+bool EnvironmentMap::load(const std::string& path, unsigned thread_count)
+{
+    if(thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return char(std::tolower(c)); });
+    if(extension != "hdr" && extension != "pfm")
+    {
+        std::cerr << "Unknown environment map format, expect .hdr or .pfm: " << path << "\n";
+        return false;
+    }
+
+    MappedFile file;
+    if(!file.open(path))
+        return false;
+    *this = EnvironmentMap();
+    if(!(extension == "hdr" ? read_hdr(file, path, *this, thread_count) : read_pfm(file, path, *this, thread_count)))
+    {
+        *this = EnvironmentMap();
+        return false;
+    }
+    build_alias_tables(thread_count);
+    return true;
+}
+
+void EnvironmentMap::build_alias_tables(unsigned thread_count)
+{
+    if(thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    alias.assign(size_t(width) * height + height, EnvironmentAlias());
+    std::vector<double> row_sums(height);
+    // the rows are independent, the weight of a texel is its luminance times the sine of its center
+    // (the solid angle of equirectangular texels)
+    run_parallel(height, thread_count, [&](unsigned first, unsigned end) {
+        std::vector<double> weights(width);
+        std::vector<double> scaled;
+        std::vector<unsigned> small;
+        std::vector<unsigned> large;
+        for(unsigned y = first; y < end; ++y)
+        {
+            const float sin_theta = std::sin((float(y) + 0.5f) / float(height) * float(pi));
+            double sum = 0.0;
+            for(unsigned x = 0; x < width; ++x)
+            {
+                const float weight = glm::dot(glm::vec3(radiance[size_t(y) * width + x]), luminance_weight) * sin_theta;
+                // negative or not finite pfm values are never sampled
+                weights[x] = weight > 0.0f && std::isfinite(weight) ? weight : 0.0;
+                sum += weights[x];
+            }
+            row_sums[y] = sum;
+            build_alias_table(weights.data(), width, sum, &alias[size_t(y) * width], scaled, small, large);
+        }
+    });
+
+    double total = 0.0;
+    for(double sum : row_sums)
+        total += sum;
+    std::vector<double> scaled;
+    std::vector<unsigned> small;
+    std::vector<unsigned> large;
+    build_alias_table(row_sums.data(), height, total, &alias[size_t(width) * height], scaled, small, large);
+    // a texel is picked with weight / total over a width x height grid covering 2 pi x pi
+    pdf_scale = total > 0.0 ? float(double(width) * height / (2.0 * pi * pi * total)) : 0.0f;
+}
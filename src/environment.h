@@ -0,0 +1,39 @@
+#ifndef __ENVIRONMENT__
+#define __ENVIRONMENT__
+
+#include <vector>
+#include <string>
+#include <glm/vec4.hpp>
+
+// a cell of an alias table: its own index is taken when the second random number is below probability,
+// else alias, both inside the same table
+struct EnvironmentAlias
+{
+    float probability;
+    unsigned alias;
+};
+
+// equirectangular HDR radiance around the scene, lighting it in place of the built-in sky
+// row 0 looks up (+y), u goes around y from -x, see get_environment_texel in ray_tracking.comp
+// texels are importance sampled by luminance times their solid angle: the alias table of the
+// row sums picks a row, that row's own table a column, so a sample takes two lookups for any size
+class EnvironmentMap
+{
+public:
+    // .hdr (radiance rgbe) or .pfm, then build_alias_tables, false if the file could not be read
+    bool load(const std::string& path, unsigned thread_count = 0);
+    // tables of the radiance, the rows on thread_count threads, 0 means one per hardware thread
+    void build_alias_tables(unsigned thread_count = 0);
+
+public:
+    unsigned width = 0;  // 0 without a map
+    unsigned height = 0;
+    std::vector<glm::vec4> radiance;  // RGBA32F, a is 1, the first row is the top
+    std::vector<EnvironmentAlias> alias;  // width cells per row, then height cells picking the row
+    // solid angle pdf of a direction is luminance * sin(theta at the texel center) * pdf_scale / sin(theta),
+    // 0 when the map is black and only cosine sampling finds it
+    float pdf_scale = 0.0f;
+};
+
+
+#endif // __ENVIRONMENT__
@@ -0,0 +1,773 @@
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstddef>
+#include <cstdio>
+#include <chrono>
+
+#include "gpu_renderer.h"
+#include "profiler.h"
+#include "denoiser.h"
+
+// group sizes tried by the tuner, all divide the 32x32 tile
+static const glm::ivec2 group_size_candidates[] = {
+    {8, 8}, {16, 8}, {16, 16}, {32, 2}, {32, 4}, {32, 8}, {32, 16}, {32, 32},
+};
+// timed samples per candidate, after one not counted
+static const unsigned tuning_samples = 4;
+// the tuner renders at most this much of the target
+static const unsigned tuning_size = 512;
+
+// std140 offsets of frame_params in ray_tracking.comp
+static_assert(offsetof(FrameParams, camera_origin) == 0 && offsetof(FrameParams, sphere_count) == 12, "std140 layout");
+static_assert(offsetof(FrameParams, camera_lower_left) == 16 && offsetof(FrameParams, tiles_x) == 28, "std140 layout");
+static_assert(offsetof(FrameParams, camera_horizontal) == 32 && offsetof(FrameParams, sample_index) == 44, "std140 layout");
+static_assert(offsetof(FrameParams, camera_vertical) == 48 && offsetof(FrameParams, adaptive_threshold) == 60, "std140 layout");
+static_assert(offsetof(FrameParams, image_size) == 64 && offsetof(FrameParams, write_aovs) == 72, "std140 layout");
+static_assert(offsetof(FrameParams, instance_count) == 76, "std140 layout");
+static_assert(offsetof(FrameParams, environment_size) == 80 && offsetof(FrameParams, environment_pdf_scale) == 88, "std140 layout");
+static_assert(offsetof(FrameParams, light_count) == 92 && offsetof(FrameParams, sampler_type) == 96, "std140 layout");
+static_assert(offsetof(FrameParams, reprojection_samples) == 100, "std140 layout");
+static_assert(offsetof(FrameParams, previous_camera_origin) == 112 && offsetof(FrameParams, previous_view_projection) == 128, "std140 layout");
+static_assert(sizeof(FrameParams) == 192, "std140 layout");
+
+// denoise.comp local size
+static const unsigned denoise_group_size = 16;
+
+// the tuned group size file has a "<x> <y> <GL_RENDERER>" line per renderer
+static bool load_group_size(const std::string& path, const std::string& renderer, glm::ivec2& size)
+{
+    std::ifstream is(path);
+    std::string line;
+    while(std::getline(is, line))
+    {
+        std::istringstream ss(line);
+        glm::ivec2 value;
+        std::string name;
+        if(ss >> value.x >> value.y && std::getline(ss >> std::ws, name) && name == renderer)
+        {
+            size = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool store_group_size(const std::string& path, const std::string& renderer, const glm::ivec2& size)
+{
+    // keep the other renderers, write aside and rename like the program cache
+    std::vector<std::string> lines;
+    {
+        std::ifstream is(path);
+        std::string line;
+        while(std::getline(is, line))
+        {
+            std::istringstream ss(line);
+            int x, y;
+            std::string name;
+            if(ss >> x >> y && std::getline(ss >> std::ws, name) && name != renderer)
+                lines.push_back(line);
+        }
+    }
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream os(temp_path, std::ios::trunc);
+        for(const std::string& line : lines)
+            os << line << "\n";
+        os << size.x << " " << size.y << " " << renderer << "\n";
+        if(!os)
+        {
+            std::cerr << "Write group size failed: " << temp_path << "\n";
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    if(std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+GpuRenderer::GpuRenderer(Texture& target, const std::string& shader_path, const std::string& cache_path):
+    Renderer(target),
+    m_shader_path(shader_path),
+    m_program_cache(cache_path),
+    m_tuning_path(m_program_cache.is_enabled() ? cache_path + "/group_size.txt" : ""),
+    m_group_size(0, 0),
+    m_max_group_count(65535),
+    m_timer_queries(),
+    m_timer_tiles(),
+    m_timer_first(0),
+    m_timer_pending(0),
+    m_timer_current(-1),
+    m_active_counts(nullptr),
+    m_active_fences(),
+    m_active_first(0),
+    m_active_pending(0),
+    m_active_tiles(0),
+    m_params(),
+    m_wavefront(false),
+    m_sort_by_material(false),
+    m_generate_program(0),
+    m_extend_program(0),
+    m_scan_program(0),
+    m_scatter_program(0),
+    m_shade_program(0),
+    m_connect_program(0),
+    m_wave_capacity(0)
+{
+}
+
+GpuRenderer::~GpuRenderer()
+{
+    glDeleteQueries(timer_query_count * 2, &m_timer_queries[0][0]);
+    for(GLsync fence : m_active_fences)
+        glDeleteSync(fence);
+}
+
+void GpuRenderer::set_wavefront(bool enabled, bool sort_by_material)
+{
+    m_wavefront = enabled;
+    m_sort_by_material = sort_by_material;
+}
+
+bool GpuRenderer::init(const SceneView& scene)
+{
+    if(scene.bvh_nodes.empty())
+    {
+        std::cerr << "Scene bvh is not built\n";
+        return false;
+    }
+    if(!m_frame_params)
+    {
+        m_frame_params.reset(new UniformBlock<FrameParams>(frame_params_count));
+        if(!m_frame_params->init())
+        {
+            m_frame_params.reset();
+            return false;
+        }
+    }
+
+    apply_camera(scene.camera);
+
+    m_spheres.reset(new Buffer(scene.spheres.size() * sizeof(Sphere), scene.spheres.data()));
+    m_materials.reset(new Buffer(scene.materials.size() * sizeof(Material), scene.materials.data()));
+    m_vertices.reset(new Buffer(scene.vertices.size() * sizeof(glm::vec4), scene.vertices.data()));
+    m_triangles.reset(new Buffer(scene.triangles.size() * sizeof(Triangle), scene.triangles.data()));
+    m_bvh_nodes.reset(new Buffer(scene.bvh_nodes.size() * sizeof(BvhNode), scene.bvh_nodes.data()));
+    // the tlas instance indices go after the prim indices, the shader is at the storage block limit
+    const size_t prims_size = scene.bvh_prim_indices.size() * sizeof(unsigned);
+    m_bvh_prims.reset(new Buffer(prims_size + scene.tlas_instance_indices.size() * sizeof(unsigned)));
+    m_bvh_prims->set_data(scene.bvh_prim_indices.data(), prims_size);
+    m_bvh_prims->set_data(scene.tlas_instance_indices.data(), scene.tlas_instance_indices.size() * sizeof(unsigned), prims_size);
+    m_params.sphere_count = int(scene.spheres.size());
+    m_instances.reset(new Buffer(scene.instances.size() * sizeof(Instance), scene.instances.data()));
+    m_tlas_nodes.reset(new Buffer(scene.tlas_nodes.size() * sizeof(BvhNode), scene.tlas_nodes.data()));
+    m_params.instance_count = int(scene.instances.size());
+    const EnvironmentMap* environment = scene.environment;
+    if(environment)
+    {
+        m_environment.reset(new Texture(environment->width, environment->height, Texture::ChannelType::RGBA,
+            Texture::DataType::FLOAT, const_cast<glm::vec4*>(environment->radiance.data())));
+        m_environment_alias.reset(new Buffer(environment->alias.size() * sizeof(EnvironmentAlias), environment->alias.data()));
+        m_params.environment_size = glm::ivec2(environment->width, environment->height);
+        m_params.environment_pdf_scale = environment->pdf_scale;
+    }
+    else
+    {
+        glm::vec4 black(0.0f);
+        m_environment.reset(new Texture(1, 1, Texture::ChannelType::RGBA, Texture::DataType::FLOAT, &black));
+        m_environment_alias.reset(new Buffer(0));
+        m_params.environment_size = glm::ivec2(0);
+        m_params.environment_pdf_scale = 0.0f;
+    }
+    m_lights.reset(new Buffer(scene.lights.size() * sizeof(Light), scene.lights.data()));
+    m_light_nodes.reset(new Buffer(scene.light_nodes.size() * sizeof(LightNode), scene.light_nodes.data()));
+    m_params.light_count = int(scene.lights.size());
+    // the shader reads the tables only when get_sampler() is not RANDOM, which needs them
+    if(m_sampler_tables)
+    {
+        const unsigned size = SamplerTables::blue_noise_size;
+        std::vector<float> ranks(m_sampler_tables->blue_noise.begin(), m_sampler_tables->blue_noise.end());
+        m_sobol_directions.reset(new Buffer(sizeof(m_sampler_tables->sobol_directions), m_sampler_tables->sobol_directions));
+        m_blue_noise.reset(new Texture(size, size, Texture::ChannelType::GRAY, Texture::DataType::FLOAT, ranks.data()));
+    }
+    else
+    {
+        float zero = 0.0f;
+        m_sobol_directions.reset(new Buffer(sizeof(SamplerTables::sobol_directions)));
+        m_blue_noise.reset(new Texture(1, 1, Texture::ChannelType::GRAY, Texture::DataType::FLOAT, &zero));
+    }
+    // a count per material and one for the rays missing everything
+    m_material_counts.reset(new Buffer((scene.materials.size() + 1) * sizeof(unsigned)));
+    m_wave_state.reset(new Buffer(8 * sizeof(unsigned)));
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &m_max_group_count);
+
+    // the tuner renders the scene, so it runs once the buffers are there
+    if(m_group_size == glm::ivec2(0, 0))
+        choose_group_size();
+    if(!is_valid_group_size(m_group_size))
+    {
+        std::cerr << "Bad work group size " << m_group_size.x << "x" << m_group_size.y << "\n";
+        return false;
+    }
+    m_shader.add_define("GROUP_SIZE_X", std::to_string(m_group_size.x));
+    m_shader.add_define("GROUP_SIZE_Y", std::to_string(m_group_size.y));
+    if(m_wavefront)
+    {
+        m_generate_program = m_shader.add_program("WAVEFRONT_GENERATE");
+        m_extend_program = m_shader.add_program("WAVEFRONT_EXTEND");
+        m_scan_program = m_shader.add_program("WAVEFRONT_SCAN");
+        m_scatter_program = m_shader.add_program("WAVEFRONT_SCATTER");
+        m_shade_program = m_shader.add_program("WAVEFRONT_SHADE");
+        m_connect_program = m_shader.add_program("WAVEFRONT_CONNECT");
+    }
+    if(!m_shader.add_compute_shader(m_shader_path) || !m_shader.build_shader(&m_program_cache))
+    {
+        std::cerr << "Build compute shader failed: " << m_shader_path << "\n";
+        return false;
+    }
+
+    // the driver may pad the block end, but the members must be where FrameParams puts them
+    const GLint block_size = m_shader.get_uniform_block_size("frame_params");
+    if(block_size < 0 || size_t(block_size) > sizeof(FrameParams))
+    {
+        std::cerr << "Uniform block frame_params does not match FrameParams\n";
+        return false;
+    }
+    m_shader.set_uniform("sort_by_material", int(m_sort_by_material));
+
+    // denoise.comp is next to the path tracing shader, built even when not denoising as it can be turned on later
+    const size_t slash = m_shader_path.find_last_of("/\\");
+    const std::string denoise_path = (slash == std::string::npos ? std::string() : m_shader_path.substr(0, slash + 1))
+        + "denoise.comp";
+    if(!m_denoise_shader.add_compute_shader(denoise_path) || !m_denoise_shader.build_shader(&m_program_cache))
+    {
+        std::cerr << "Build compute shader failed: " << denoise_path << "\n";
+        return false;
+    }
+
+    if(!m_timer_queries[0][0])
+        glCreateQueries(GL_TIMESTAMP, timer_query_count * 2, &m_timer_queries[0][0]);
+
+    const GLbitfield readback_flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    m_active_readback.reset(new Buffer(active_readback_count * sizeof(unsigned), nullptr, readback_flags));
+    m_active_counts = static_cast<const unsigned*>(m_active_readback->map(readback_flags));
+    return m_active_counts != nullptr;
+}
+
+void GpuRenderer::reset()
+{
+    // sample 0 overwrites the accumulation, the storage follows the target, not the rendered size,
+    // so changing the resolution reuses it
+    unsigned target_width, target_height;
+    m_target.get_size(&target_width, &target_height);
+    unsigned width = 0, height = 0;
+    if(m_accum)
+        m_accum->get_size(&width, &height);
+    if(!m_accum || width != target_width || height != target_height)
+    {
+        m_accum.reset(new Texture(target_width, target_height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT));
+        m_moments.reset(new Texture(target_width, target_height, Texture::ChannelType::GRAY, Texture::DataType::FLOAT));
+        m_normal_depth.reset();
+        m_denoise_images[0].reset();
+        m_history_accum.reset();
+    }
+    if(is_aov_enabled() && !m_normal_depth)
+    {
+        m_normal_depth.reset(new Texture(target_width, target_height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT));
+        m_albedo.reset(new Texture(target_width, target_height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT));
+    }
+    else if(!is_aov_enabled())
+    {
+        m_normal_depth.reset();
+        m_albedo.reset();
+    }
+    if(is_denoise_enabled() && !m_denoise_images[0])
+    {
+        for(std::unique_ptr<Texture>& image : m_denoise_images)
+            image.reset(new Texture(target_width, target_height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT));
+    }
+    else if(!is_denoise_enabled())
+    {
+        for(std::unique_ptr<Texture>& image : m_denoise_images)
+            image.reset();
+    }
+    if(get_reprojection_samples() == 0)
+        m_history_accum.reset();
+    if(!m_history_accum)
+    {
+        m_history_moments.reset();
+        m_history_normal_depth.reset();
+    }
+    const size_t list_size = (3 + get_tile_count()) * sizeof(unsigned);
+    if(!m_tile_list || m_tile_list->get_size() < list_size)
+        m_tile_list.reset(new Buffer(list_size));
+    // the tuner resets before the group size is known
+    const unsigned dispatch[3] = {0, m_group_size.x > 0 ? get_tile_groups() : 1, 1};
+    m_tile_list->set_data(dispatch, sizeof(dispatch));
+    const unsigned wave_capacity = std::min(get_tile_count(), max_wave_tiles) * tile_size_x * tile_size_y;
+    if(m_wavefront && m_wave_capacity < wave_capacity)
+    {
+        m_wave_capacity = wave_capacity;
+        m_ray_origins.reset(new Buffer(wave_capacity * sizeof(glm::vec4)));
+        m_ray_directions.reset(new Buffer(wave_capacity * sizeof(glm::vec4)));
+        m_ray_hits.reset(new Buffer(wave_capacity * sizeof(glm::ivec4)));
+        m_shade_queue.reset(new Buffer(wave_capacity * sizeof(unsigned)));
+    }
+    // every ray has up to max_shadow_rays, only with something to cast shadows from
+    const bool direct_lighting = m_params.environment_size.x > 0 || m_params.light_count > 0;
+    const size_t shadow_size = direct_lighting ? size_t(m_wave_capacity) * max_shadow_rays * sizeof(glm::vec4) : 0;
+    if(m_wavefront && (!m_shadow_directions || m_shadow_directions->get_size() < shadow_size))
+    {
+        m_shadow_directions.reset(new Buffer(shadow_size));
+        m_shadow_contributions.reset(new Buffer(shadow_size));
+    }
+
+    // counts still in flight belong to the old accumulation
+    drain_active_tiles();
+    m_active_tiles = get_tile_count();
+    reset_progress();
+}
+
+void GpuRenderer::apply_camera(const Camera& camera)
+{
+    camera.get_basis(m_params.camera_lower_left, m_params.camera_horizontal, m_params.camera_vertical);
+    m_params.camera_origin = camera.position;
+    m_camera = camera;
+}
+
+void GpuRenderer::reproject(const Camera& camera)
+{
+    m_params.previous_camera_origin = m_camera.position;
+    m_params.previous_view_projection = m_camera.get_view_projection();
+    apply_camera(camera);
+
+    // the pass reads the history while it writes the accumulation, the copies keep the target size
+    unsigned target_width, target_height;
+    m_accum->get_size(&target_width, &target_height);
+    if(!m_history_accum)
+    {
+        m_history_accum.reset(new Texture(target_width, target_height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT));
+        m_history_moments.reset(new Texture(target_width, target_height, Texture::ChannelType::GRAY, Texture::DataType::FLOAT));
+        m_history_normal_depth.reset(new Texture(target_width, target_height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT));
+    }
+    const Texture* sources[3] = {m_accum.get(), m_moments.get(), m_normal_depth.get()};
+    const Texture* copies[3] = {m_history_accum.get(), m_history_moments.get(), m_history_normal_depth.get()};
+    for(int i = 0; i < 3; ++i)
+        glCopyImageSubData(sources[i]->get_id(), GL_TEXTURE_2D, 0, 0, 0, 0, copies[i]->get_id(), GL_TEXTURE_2D, 0, 0, 0, 0,
+            m_width, m_height, 1);
+
+    bind_resources(1);
+    glBindTextureUnit(3, m_history_accum->get_id());
+    glBindTextureUnit(4, m_history_moments->get_id());
+    glBindTextureUnit(5, m_history_normal_depth->get_id());
+    m_shader.set_uniform("render_mode", 3);
+    {
+        ProfileScope scope(m_profiler, "reproject");
+        dispatch_tiles(0, get_tile_count(), get_tile_groups());
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    }
+
+    // counts still in flight belong to the old accumulation
+    drain_active_tiles();
+    m_active_tiles = get_tile_count();
+}
+
+void GpuRenderer::apply_instances(const SceneView& scene, const InstanceUpdate& update)
+{
+    // leaves hold one instance, so a rebuild gives the same node count unless the depth limit merged some
+    if(scene.tlas_nodes.size() * sizeof(BvhNode) > m_tlas_nodes->get_size())
+        m_tlas_nodes.reset(new Buffer(scene.tlas_nodes.size() * sizeof(BvhNode), scene.tlas_nodes.data()));
+    else if(update.rebuilt)
+        m_tlas_nodes->set_data(scene.tlas_nodes.data(), scene.tlas_nodes.size() * sizeof(BvhNode));
+    else if(update.node_first < update.node_end)
+        m_tlas_nodes->set_data(scene.tlas_nodes.data() + update.node_first,
+            (update.node_end - update.node_first) * sizeof(BvhNode), update.node_first * sizeof(BvhNode));
+    // one index per instance, so they keep their place at the end of the prim indices
+    if(update.rebuilt)
+        m_bvh_prims->set_data(scene.tlas_instance_indices.data(), scene.tlas_instance_indices.size() * sizeof(unsigned),
+            scene.bvh_prim_indices.size() * sizeof(unsigned));
+    m_instances->set_data(scene.instances.data() + update.instance_first,
+        (update.instance_end - update.instance_first) * sizeof(Instance), update.instance_first * sizeof(Instance));
+}
+
+void GpuRenderer::read_accumulation(unsigned x, unsigned y, unsigned width, unsigned height, glm::vec4* sums)
+{
+    // render_tiles made the accumulation visible to reads already
+    glGetTextureSubImage(m_accum->get_id(), 0, x, y, 0, width, height, 1, GL_RGBA, GL_FLOAT,
+        GLsizei(size_t(width) * height * sizeof(glm::vec4)), sums);
+}
+
+void GpuRenderer::render_tiles(unsigned first_tile, unsigned tile_count, unsigned sample_index)
+{
+    collect_timer_queries();
+    bind_resources(sample_index);
+    m_shader.set_uniform("render_mode", 0);
+
+    ProfileScope scope(m_profiler, "dispatch");
+    begin_timer_query(tile_count);
+    if(m_wavefront)
+        render_wavefront(first_tile, tile_count);
+    else
+        dispatch_tiles(first_tile, tile_count, get_tile_groups());
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    end_timer_query();
+}
+
+void GpuRenderer::render_adaptive(float threshold)
+{
+    collect_timer_queries();
+    collect_active_tiles(m_active_pending == active_readback_count);
+    // still full after the wait, this pass goes without a readback and the count stays as it is
+    const bool readback = m_active_pending < active_readback_count;
+    bind_resources(1, threshold);
+    m_tile_list->bind_base(GL_SHADER_STORAGE_BUFFER, 7);
+
+    // the time is spent on the tiles still active, the count known now is the best guess
+    begin_timer_query(m_active_tiles);
+
+    {
+        ProfileScope scope(m_profiler, "tile list");
+        const GLuint zero = 0;
+        glClearNamedBufferSubData(m_tile_list->get_id(), GL_R32UI, 0, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        m_shader.set_uniform("render_mode", 2);
+        dispatch_tiles(0, get_tile_count(), 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    {
+        ProfileScope scope(m_profiler, "dispatch");
+        m_shader.set_uniform("render_mode", 1);
+        if(m_wavefront)
+            render_wavefront(0, get_tile_count());
+        else
+        {
+            glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_tile_list->get_id());
+            glDispatchComputeIndirect(0);
+        }
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    }
+    end_timer_query();
+
+    if(!readback)
+        return;
+    assert(m_active_pending < active_readback_count);
+    const int slot = (m_active_first + m_active_pending) % active_readback_count;
+    glCopyNamedBufferSubData(m_tile_list->get_id(), m_active_readback->get_id(), 0, slot * sizeof(unsigned), sizeof(unsigned));
+    m_active_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++m_active_pending;
+}
+
+unsigned GpuRenderer::get_active_tile_count()
+{
+    collect_active_tiles(false);
+    return m_active_tiles;
+}
+
+void GpuRenderer::bind_resources(unsigned sample_index, float threshold)
+{
+    m_params.image_size = glm::ivec2(m_width, m_height);
+    m_params.tiles_x = int(get_tiles_x());
+    m_params.sample_index = int(sample_index);
+    m_params.adaptive_threshold = threshold;
+    m_params.write_aovs = m_normal_depth ? 1 : 0;
+    m_params.sampler_type = int(get_sampler());
+    m_params.reprojection_samples = int(get_reprojection_samples());
+    m_frame_params->update(m_params);
+    m_frame_params->bind(0);
+    m_sobol_directions->bind_base(GL_UNIFORM_BUFFER, 1);
+
+    m_shader.work();
+    m_spheres->bind_base(GL_SHADER_STORAGE_BUFFER, 1);
+    m_materials->bind_base(GL_SHADER_STORAGE_BUFFER, 2);
+    m_vertices->bind_base(GL_SHADER_STORAGE_BUFFER, 3);
+    m_triangles->bind_base(GL_SHADER_STORAGE_BUFFER, 4);
+    m_bvh_nodes->bind_base(GL_SHADER_STORAGE_BUFFER, 5);
+    m_bvh_prims->bind_base(GL_SHADER_STORAGE_BUFFER, 6);
+    m_instances->bind_base(GL_SHADER_STORAGE_BUFFER, 15);
+    m_tlas_nodes->bind_base(GL_SHADER_STORAGE_BUFFER, 16);
+    m_environment_alias->bind_base(GL_SHADER_STORAGE_BUFFER, 17);
+    m_lights->bind_base(GL_SHADER_STORAGE_BUFFER, 18);
+    m_light_nodes->bind_base(GL_SHADER_STORAGE_BUFFER, 19);
+    glBindTextureUnit(1, m_environment->get_id());
+    glBindTextureUnit(2, m_blue_noise->get_id());
+    glBindImageTexture(1, m_accum->get_id(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(2, m_moments->get_id(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+    if(m_normal_depth)
+    {
+        glBindImageTexture(3, m_normal_depth->get_id(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+        glBindImageTexture(4, m_albedo->get_id(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    }
+}
+
+void GpuRenderer::dispatch_tiles(unsigned first_tile, unsigned tile_count, unsigned tile_groups)
+{
+    // tiles are a 1d list of work groups in x, the groups of a tile go in y
+    for(unsigned first = first_tile; first < first_tile + tile_count; first += m_max_group_count)
+    {
+        unsigned count = std::min(first_tile + tile_count - first, unsigned(m_max_group_count));
+        m_shader.set_uniform("tile_start", int(first));
+        glDispatchCompute(count, tile_groups, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+}
+
+bool GpuRenderer::is_valid_group_size(const glm::ivec2& size) const
+{
+    GLint max_size[2] = {0, 0}, max_invocations = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &max_size[0]);
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &max_size[1]);
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+    // the divisors of the tile size are powers of two, which the tile error reduction needs
+    return size.x > 0 && size.y > 0 && tile_size_x % size.x == 0 && tile_size_y % size.y == 0
+        && size.x <= max_size[0] && size.y <= max_size[1] && size.x * size.y <= max_invocations;
+}
+
+void GpuRenderer::choose_group_size()
+{
+    const std::string renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    if(load_group_size(m_tuning_path, renderer, m_group_size) && is_valid_group_size(m_group_size))
+        return;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    m_group_size = tune_group_size();
+    std::chrono::duration<double, std::milli> tune_time = std::chrono::steady_clock::now() - start;
+    std::cout << "tuned work group size " << m_group_size.x << "x" << m_group_size.y
+        << " in " << tune_time.count() << " ms\n";
+    if(!m_tuning_path.empty())
+        store_group_size(m_tuning_path, renderer, m_group_size);
+}
+
+glm::ivec2 GpuRenderer::tune_group_size()
+{
+    // render into the top left of the target with the real accumulation,
+    // the size is set back so the first render resets it again
+    unsigned width, height;
+    m_target.get_size(&width, &height);
+    m_width = std::min(width, tuning_size);
+    m_height = std::min(height, tuning_size);
+    reset();
+    const unsigned tile_count = std::min(get_tile_count(), unsigned(m_max_group_count));
+
+    glm::ivec2 best(tile_size_x, tile_size_y);
+    double best_ms = 0.0;
+    for(const glm::ivec2& size : group_size_candidates)
+    {
+        if(!is_valid_group_size(size))
+            continue;
+        Shader shader;
+        shader.add_define("GROUP_SIZE_X", std::to_string(size.x));
+        shader.add_define("GROUP_SIZE_Y", std::to_string(size.y));
+        if(!shader.add_compute_shader(m_shader_path) || !shader.build_shader(&m_program_cache))
+            continue;
+
+        // wall time around glFinish, some drivers have no real timer queries, sample 0 is not counted
+        double ms = 0.0;
+        for(unsigned sample = 0; sample <= tuning_samples; ++sample)
+        {
+            bind_resources(sample);
+            shader.work();
+            shader.set_uniform("render_mode", 0);
+            shader.set_uniform("tile_start", 0);
+            glFinish();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            glDispatchCompute(tile_count, (tile_size_x / size.x) * (tile_size_y / size.y), 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            glFinish();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            if(sample > 0)
+                ms += elapsed.count();
+        }
+        std::cout << "work group " << size.x << "x" << size.y << ": " << ms / tuning_samples << " ms per sample\n";
+        if(best_ms <= 0.0 || ms < best_ms)
+        {
+            best = size;
+            best_ms = ms;
+        }
+    }
+    m_width = 0;
+    m_height = 0;
+    return best;
+}
+
+void GpuRenderer::render_wavefront(unsigned first_tile, unsigned tile_count)
+{
+    m_tile_list->bind_base(GL_SHADER_STORAGE_BUFFER, 7);
+    m_wave_state->bind_base(GL_SHADER_STORAGE_BUFFER, 8);
+    m_ray_origins->bind_base(GL_SHADER_STORAGE_BUFFER, 9);
+    m_ray_directions->bind_base(GL_SHADER_STORAGE_BUFFER, 10);
+    m_ray_hits->bind_base(GL_SHADER_STORAGE_BUFFER, 12);
+    m_shade_queue->bind_base(GL_SHADER_STORAGE_BUFFER, 13);
+    m_material_counts->bind_base(GL_SHADER_STORAGE_BUFFER, 14);
+    m_shadow_directions->bind_base(GL_SHADER_STORAGE_BUFFER, 11);
+    m_shadow_contributions->bind_base(GL_SHADER_STORAGE_BUFFER, 20);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_wave_state->get_id());
+
+    // in active mode the tiles are positions in the active list, generate skips those past its end
+    for(unsigned first = first_tile; first < first_tile + tile_count; first += max_wave_tiles)
+    {
+        const unsigned count = std::min(first_tile + tile_count - first, max_wave_tiles);
+        const unsigned state[8] = {0, 1, 1, 0, 0, 1, 1, 0};
+        m_wave_state->set_data(state, sizeof(state));
+        {
+            ProfileScope scope(m_profiler, "generate");
+            m_shader.use_program(m_generate_program);
+            dispatch_tiles(first, count, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        }
+        {
+            ProfileScope scope(m_profiler, "extend");
+            if(m_sort_by_material)
+            {
+                const GLuint zero = 0;
+                glClearNamedBufferData(m_material_counts->get_id(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+            }
+            m_shader.use_program(m_extend_program);
+            glDispatchComputeIndirect(0);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+        if(m_sort_by_material)
+        {
+            // counting sort, the counts come from extend
+            ProfileScope scope(m_profiler, "sort");
+            m_shader.use_program(m_scan_program);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            m_shader.use_program(m_scatter_program);
+            glDispatchComputeIndirect(0);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+        {
+            ProfileScope scope(m_profiler, "shade");
+            m_shader.use_program(m_shade_program);
+            glDispatchComputeIndirect(0);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        }
+        {
+            // the shadow rays shade queued, their dispatch arguments follow the ones of the rays
+            ProfileScope scope(m_profiler, "connect");
+            m_shader.use_program(m_connect_program);
+            glDispatchComputeIndirect(4 * sizeof(unsigned));
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        }
+    }
+    m_shader.work();
+}
+
+void GpuRenderer::denoise()
+{
+    if(!m_denoise_images[0])
+        return;
+    ProfileScope scope(m_profiler, "denoise");
+    // the target stays at unit 0, the accumulation and aovs keep their units from bind_resources
+    m_denoise_shader.work();
+    m_denoise_shader.set_uniform("image_size", glm::ivec2(m_width, m_height));
+    glBindImageTexture(1, m_accum->get_id(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(2, m_moments->get_id(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(3, m_normal_depth->get_id(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(4, m_albedo->get_id(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    const GLuint groups_x = (m_width + denoise_group_size - 1) / denoise_group_size;
+    const GLuint groups_y = (m_height + denoise_group_size - 1) / denoise_group_size;
+
+    m_denoise_shader.set_uniform("denoise_mode", 0);
+    glBindImageTexture(6, m_denoise_images[0]->get_id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glDispatchCompute(groups_x, groups_y, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    for(int i = 0; i < Denoiser::iteration_count; ++i)
+    {
+        // the last iteration writes the target instead of the other image
+        m_denoise_shader.set_uniform("denoise_mode", i + 1 == Denoiser::iteration_count ? 2 : 1);
+        m_denoise_shader.set_uniform("step_size", 1 << i);
+        glBindImageTexture(5, m_denoise_images[i % 2]->get_id(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+        glBindImageTexture(6, m_denoise_images[(i + 1) % 2]->get_id(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+        glDispatchCompute(groups_x, groups_y, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+void GpuRenderer::begin_timer_query(unsigned tile_count)
+{
+    // skip timing when every query is in flight, the estimate just updates a bit later
+    m_timer_current = -1;
+    if(m_timer_pending == timer_query_count)
+        return;
+    m_timer_current = (m_timer_first + m_timer_pending) % timer_query_count;
+    m_timer_tiles[m_timer_current] = tile_count;
+    glQueryCounter(m_timer_queries[m_timer_current][0], GL_TIMESTAMP);
+}
+
+void GpuRenderer::end_timer_query()
+{
+    if(m_timer_current < 0)
+        return;
+    glQueryCounter(m_timer_queries[m_timer_current][1], GL_TIMESTAMP);
+    ++m_timer_pending;
+    m_timer_current = -1;
+}
+
+void GpuRenderer::collect_timer_queries()
+{
+    while(m_timer_pending > 0)
+    {
+        const GLuint* queries = m_timer_queries[m_timer_first];
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            break;
+
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+        add_tile_time((end - begin) * 1.0e-6, m_timer_tiles[m_timer_first]);
+        m_timer_first = (m_timer_first + 1) % timer_query_count;
+        --m_timer_pending;
+    }
+}
+
+bool GpuRenderer::collect_active_tiles(bool wait)
+{
+    while(m_active_pending > 0)
+    {
+        GLsync& fence = m_active_fences[m_active_first];
+        // a second at most, the next call waits again if the gpu is that busy
+        GLenum status = glClientWaitSync(fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+        if(status == GL_WAIT_FAILED)
+        {
+            // no fence will ever signal (lost context), the counts in flight are dropped
+            std::cerr << "active tile readback wait failed" << std::endl;
+            for(int i = 0; i < m_active_pending; ++i)
+            {
+                GLsync& pending = m_active_fences[(m_active_first + i) % active_readback_count];
+                glDeleteSync(pending);
+                pending = nullptr;
+            }
+            m_active_pending = 0;
+            return false;
+        }
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync(fence);
+        fence = nullptr;
+        m_active_tiles = m_active_counts[m_active_first];
+        m_active_first = (m_active_first + 1) % active_readback_count;
+        --m_active_pending;
+        wait = false;
+    }
+    return true;
+}
+
+void GpuRenderer::drain_active_tiles()
+{
+    collect_active_tiles(false);
+    while(m_active_pending > 0)
+        if(!collect_active_tiles(true))
+            break;
+}
@@ -0,0 +1,188 @@
+#ifndef __GPU_RENDERER__
+#define __GPU_RENDERER__
+
+#include <string>
+#include <memory>
+
+#include "renderer.h"
+#include "shader.h"
+#include "buffer.h"
+#include "program_cache.h"
+#include "uniform_block.h"
+
+// std140 mirror of the frame_params block in ray_tracking.comp, offsets are checked in gpu_renderer.cpp
+// a scalar after a vec3 takes the 4th float of its 16 bytes
+struct FrameParams
+{
+    glm::vec3 camera_origin;
+    int sphere_count;
+    glm::vec3 camera_lower_left;
+    int tiles_x;
+    glm::vec3 camera_horizontal;
+    int sample_index;
+    glm::vec3 camera_vertical;
+    float adaptive_threshold;
+    glm::ivec2 image_size;
+    int write_aovs;
+    int instance_count;
+    glm::ivec2 environment_size;
+    float environment_pdf_scale;
+    int light_count;
+    int sampler_type;  // SamplerType
+    int reprojection_samples;
+    int padding0[2];
+    glm::vec3 previous_camera_origin;
+    float padding1;
+    glm::mat4 previous_view_projection;
+};
+
+// run ray_tracking.comp over tiles of the target texture, each tile split into work groups of the
+// group size, which is tuned on the first run and kept per GL_RENDERER in the shader cache directory
+// samples are summed in a RGBA32F texture bound to image unit 1, squared luminance in a R32F one at unit 2
+// adaptive passes build the list of tiles to render on the gpu and dispatch it indirectly,
+// the list length is read back a few passes later without stalling
+// parameters that hold for a whole render call go through a persistently mapped uniform block,
+// only tile_start and render_mode are set per dispatch
+// with denoising or reprojection the samples also average the first hit normal, depth and albedo into two more images
+// at units 3 and 4, which guide denoise.comp
+// an environment map is a float texture at texture unit 1, sampled through its alias tables
+// lights and their tree are storage buffers walked once per shading point
+// the Sobol direction numbers are uniform block 1, the blue noise mask a float texture at texture unit 2
+// reprojection copies the accumulation and aovs aside and reads them as textures at units 3 to 5
+// while the reproject mode of the kernel writes the new ones
+// in wavefront mode a sample is split into generate, extend and shade kernels passing rays through
+// queues in storage buffers, optionally sorted by material before shading, see ray_tracking.comp
+// shade queues the shadow rays of its light samples and a connect kernel traces them, so the bvh is
+// only traversed by the extend and connect kernels
+class GpuRenderer : public Renderer
+{
+public:
+    // cache_path is the ProgramCache directory, empty to always compile from source
+    GpuRenderer(Texture& target, const std::string& shader_path, const std::string& cache_path = "");
+    ~GpuRenderer();
+
+    // call before init, the wavefront kernels are only built when enabled
+    void set_wavefront(bool enabled, bool sort_by_material = false);
+    // call before init, powers of two dividing the tile size, 0 takes the tuned one
+    void set_group_size(int x, int y) { m_group_size = glm::ivec2(x, y); }
+
+    bool init(const SceneView& scene) override;
+    void reset() override;
+    void read_accumulation(unsigned x, unsigned y, unsigned width, unsigned height, glm::vec4* sums) override;
+
+protected:
+    // result is visible to texture fetch and read back when return
+    void render_tiles(unsigned first_tile, unsigned tile_count, unsigned sample_index) override;
+    void render_adaptive(float threshold) override;
+    unsigned get_active_tile_count() override;
+    void denoise() override;
+    void apply_camera(const Camera& camera) override;
+    void reproject(const Camera& camera) override;
+    // upload the changed ranges, the tlas buffers are only reallocated when a rebuild outgrew them
+    void apply_instances(const SceneView& scene, const InstanceUpdate& update) override;
+
+private:
+    // write the frame parameters into the next uniform block region and bind everything
+    void bind_resources(unsigned sample_index, float threshold = 0.0f);
+    // dispatch tile_count x tile_groups work groups from first_tile, split when longer than the dispatch limit
+    void dispatch_tiles(unsigned first_tile, unsigned tile_count, unsigned tile_groups);
+    unsigned get_tile_groups() const { return (tile_size_x / m_group_size.x) * (tile_size_y / m_group_size.y); }
+    bool is_valid_group_size(const glm::ivec2& size) const;
+    // the group size stored for this GL_RENDERER, tuned and stored when there is none
+    void choose_group_size();
+    // time a few samples with every candidate group size, return the fastest
+    glm::ivec2 tune_group_size();
+    // the wavefront kernels over the tiles, in waves of at most max_wave_tiles
+    void render_wavefront(unsigned first_tile, unsigned tile_count);
+    // hand finished timer queries to add_tile_time, never waits for the gpu
+    void collect_timer_queries();
+    void begin_timer_query(unsigned tile_count);
+    void end_timer_query();
+    // read back the finished active tile counts, wait for the oldest one if wait,
+    // false when the wait failed and the pending readbacks were dropped
+    bool collect_active_tiles(bool wait);
+    // collect every pending readback, waiting for the gpu until done or the wait fails
+    void drain_active_tiles();
+
+private:
+    // timestamp pairs around the dispatches still in flight
+    static const int timer_query_count = 8;
+    // adaptive passes the cpu may run ahead of the active tile count it knows
+    static const int active_readback_count = 4;
+    // a frame makes up to max_progressive_passes + 1 render calls, each one updates the block,
+    // so three frames in flight need this many regions
+    static const int frame_params_count = 32;
+    // tiles of rays in the wavefront queues at once, 1M rays take about 50MB, their shadow rays
+    // another 100MB in scenes with an environment map or lights
+    static const unsigned max_wave_tiles = 1024;
+    // max_shadow_rays in ray_tracking.comp
+    static const unsigned max_shadow_rays = 3;
+
+    std::string m_shader_path;
+    ProgramCache m_program_cache;
+    std::string m_tuning_path;  // tuned group sizes, empty when not kept
+    glm::ivec2 m_group_size;
+    int m_max_group_count;
+    std::unique_ptr<Texture> m_accum;
+    std::unique_ptr<Texture> m_moments;
+    Shader m_denoise_shader;
+    std::unique_ptr<Texture> m_normal_depth;  // only while denoising or reprojecting
+    std::unique_ptr<Texture> m_albedo;
+    std::unique_ptr<Texture> m_denoise_images[2];  // only while denoising
+    // the accumulation and normal_depth before the camera moved, allocated by the first reproject
+    std::unique_ptr<Texture> m_history_accum;
+    std::unique_ptr<Texture> m_history_moments;
+    std::unique_ptr<Texture> m_history_normal_depth;
+    Camera m_camera;  // the one the samples are taken with
+    std::unique_ptr<Buffer> m_tile_list;
+    GLuint m_timer_queries[timer_query_count][2];
+    unsigned m_timer_tiles[timer_query_count];
+    int m_timer_first;
+    int m_timer_pending;
+    int m_timer_current;  // -1 when the running dispatches are not timed
+
+    std::unique_ptr<Buffer> m_active_readback;  // persistently mapped
+    const unsigned* m_active_counts;
+    GLsync m_active_fences[active_readback_count];
+    int m_active_first;
+    int m_active_pending;
+    unsigned m_active_tiles;
+    Shader m_shader;
+    FrameParams m_params;
+    std::unique_ptr<UniformBlock<FrameParams>> m_frame_params;
+    std::unique_ptr<Buffer> m_spheres;
+    std::unique_ptr<Buffer> m_materials;
+    std::unique_ptr<Buffer> m_vertices;
+    std::unique_ptr<Buffer> m_triangles;
+    std::unique_ptr<Buffer> m_bvh_nodes;
+    std::unique_ptr<Buffer> m_bvh_prims;  // followed by the tlas instance indices
+    std::unique_ptr<Buffer> m_instances;
+    std::unique_ptr<Buffer> m_tlas_nodes;
+    std::unique_ptr<Texture> m_environment;  // 1x1 without a map, the sampler needs a texture
+    std::unique_ptr<Buffer> m_environment_alias;
+    std::unique_ptr<Buffer> m_lights;
+    std::unique_ptr<Buffer> m_light_nodes;
+    std::unique_ptr<Buffer> m_sobol_directions;
+    std::unique_ptr<Texture> m_blue_noise;  // ranks as floats, 1x1 without sampler tables
+
+    bool m_wavefront;
+    bool m_sort_by_material;
+    unsigned m_generate_program;
+    unsigned m_extend_program;
+    unsigned m_scan_program;
+    unsigned m_scatter_program;
+    unsigned m_shade_program;
+    unsigned m_connect_program;
+    unsigned m_wave_capacity;  // rays
+    std::unique_ptr<Buffer> m_wave_state;  // indirect dispatch arguments and counts of the rays and shadow rays
+    std::unique_ptr<Buffer> m_ray_origins;
+    std::unique_ptr<Buffer> m_ray_directions;
+    std::unique_ptr<Buffer> m_ray_hits;  // and the pixel of the ray
+    std::unique_ptr<Buffer> m_shade_queue;
+    std::unique_ptr<Buffer> m_material_counts;
+    std::unique_ptr<Buffer> m_shadow_directions;  // empty without an environment map and lights
+    std::unique_ptr<Buffer> m_shadow_contributions;
+};
+
+
+#endif // __GPU_RENDERER__
@@ -0,0 +1,213 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+#include <GL/glew.h>
+#if defined(_WIN32)
+#include <GLFW/glfw3.h>
+#else
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "headless.h"
+#include "texture.h"
+#include "renderer.h"
+#include "profiler.h"
+
+// an OpenGL 4.5 core context without any visible surface
+// use EGL surfaceless platform on linux, so no X server is needed on render nodes,
+// there is no EGL for desktop OpenGL on windows, use a hidden glfw window instead
+struct HeadlessContext
+{
+#if defined(_WIN32)
+    GLFWwindow* window = nullptr;
+#else
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+#if defined(_WIN32)
+static bool create_context(HeadlessContext& ctx)
+{
+    if(!glfwInit())
+        return false;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    ctx.window = glfwCreateWindow(1, 1, "ray tracking headless", NULL, NULL);
+    if(!ctx.window)
+    {
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(ctx.window);
+    return true;
+}
+
+static void destroy_context(HeadlessContext& ctx)
+{
+    glfwDestroyWindow(ctx.window);
+    glfwTerminate();
+    ctx.window = nullptr;
+}
+#else
+static bool create_context(HeadlessContext& ctx)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(get_platform_display)
+        ctx.display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if(ctx.display == EGL_NO_DISPLAY)
+        ctx.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(ctx.display == EGL_NO_DISPLAY || !eglInitialize(ctx.display, nullptr, nullptr))
+    {
+        std::cerr << "EGL display init failed: 0x" << std::hex << eglGetError() << std::dec << "\n";
+        return false;
+    }
+    if(!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cerr << "EGL does not support desktop OpenGL\n";
+        eglTerminate(ctx.display);
+        return false;
+    }
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    // EGL_KHR_no_config_context + EGL_KHR_surfaceless_context, nothing is drawn to a surface
+    ctx.context = eglCreateContext(ctx.display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attribs);
+    if(ctx.context == EGL_NO_CONTEXT
+        || !eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx.context))
+    {
+        std::cerr << "EGL context create failed: 0x" << std::hex << eglGetError() << std::dec << "\n";
+        if(ctx.context != EGL_NO_CONTEXT)
+            eglDestroyContext(ctx.display, ctx.context);
+        eglTerminate(ctx.display);
+        return false;
+    }
+    return true;
+}
+
+static void destroy_context(HeadlessContext& ctx)
+{
+    eglMakeCurrent(ctx.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(ctx.display, ctx.context);
+    eglTerminate(ctx.display);
+    ctx.context = EGL_NO_CONTEXT;
+    ctx.display = EGL_NO_DISPLAY;
+}
+#endif
+
+static int render(const Options& options)
+{
+    Texture picture(options.width, options.height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT, nullptr);
+    picture.set_data(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    picture.activate(0);
+    picture.set_access_for_shader(Texture::Access::READ_WRITE);
+
+    Scene scene;
+    SceneFile scene_file;
+    SceneView view;
+    if(!load_scene(options, float(options.width) / options.height, scene, scene_file, view))
+    {
+        std::cerr << "Load scene failed\n";
+        return EXIT_FAILURE;
+    }
+
+    // outlives the renderer timing into it
+    Profiler profiler;
+    profiler.set_enabled(!options.trace_path.empty());
+
+    std::unique_ptr<Renderer> renderer = create_renderer(options, picture);
+    if(!renderer || !renderer->init(view))
+    {
+        std::cerr << "Renderer init failed\n";
+        return EXIT_FAILURE;
+    }
+    renderer->set_profiler(&profiler);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // a frame per sample, so the trace shows each one, else one call so the denoiser runs once
+    const int frame_samples = options.trace_path.empty() && options.denoise ? options.samples_per_pixel : 1;
+    for(int i = 0; i < options.samples_per_pixel; i += frame_samples)
+    {
+        profiler.new_frame();
+        ProfileScope scope(&profiler, "render");
+        renderer->render(frame_samples);
+    }
+    glFinish();
+    std::chrono::duration<double, std::milli> render_time = std::chrono::steady_clock::now() - start;
+
+    double samples = double(options.width) * options.height * options.samples_per_pixel;
+    std::cout << "rendered " << options.width << " X " << options.height
+        << " with " << renderer->get_samples_per_pixel() << " spp in " << render_time.count() << " ms";
+    if(options.adaptive_threshold > 0.0f)
+        std::cout << (renderer->is_converged() ? ", converged\n" : ", not converged\n");
+    else
+        std::cout << ", " << samples / render_time.count() * 1.0e-3 << " Msamples/s\n";
+
+    if(!options.trace_path.empty())
+    {
+        profiler.flush();
+        for(const Profiler::Pass& pass : profiler.get_passes())
+            std::cout << pass.name << ": cpu " << pass.cpu_average << " ms, gpu " << pass.gpu_average << " ms per sample\n";
+        if(profiler.write_trace(options.trace_path))
+            std::cout << "trace saved: " << options.trace_path << "\n";
+    }
+
+    if(!picture.save(options.output_path))
+    {
+        std::cerr << "Save image failed: " << options.output_path << "\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "image saved: " << options.output_path << "\n";
+    return EXIT_SUCCESS;
+}
+
+static HeadlessContext headless_context;
+
+bool create_headless_context()
+{
+    if(!create_context(headless_context))
+    {
+        std::cerr << "Create headless OpenGL context failed\n";
+        return false;
+    }
+
+    glewExperimental = GL_TRUE;
+    GLenum err = glewInit();
+    // glew built for GLX reports no GLX display under EGL, entry points are loaded anyway
+    if(GLEW_OK != err && GLEW_ERROR_NO_GLX_DISPLAY != err)
+    {
+        std::cerr << "glew init error: " << glewGetErrorString(err) << '\n';
+        destroy_context(headless_context);
+        return false;
+    }
+    std::cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << '\n';
+    std::cout << "OpenGL version: " << glGetString(GL_VERSION) << '\n';
+    return true;
+}
+
+void destroy_headless_context()
+{
+    destroy_context(headless_context);
+}
+
+int run_headless(const Options& options)
+{
+    if(!create_headless_context())
+        return EXIT_FAILURE;
+
+    // all GL objects must be released before the context goes away
+    int ret = render(options);
+
+    destroy_headless_context();
+    return ret;
+}
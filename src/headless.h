@@ -0,0 +1,16 @@
+#ifndef __HEADLESS__
+#define __HEADLESS__
+
+#include "options.h"
+
+// render without window and ImGui, write the image to options.output_path,
+// return the process exit code
+int run_headless(const Options& options);
+
+// make an OpenGL 4.5 core context without any visible surface current on this thread and load glew,
+// one at a time, all GL objects must be released before it is destroyed
+bool create_headless_context();
+void destroy_headless_context();
+
+
+#endif // __HEADLESS__
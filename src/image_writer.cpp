@@ -0,0 +1,346 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <array>
+#include <algorithm>
+
+#include "image_writer.h"
+
+// NaN goes to 0
+static unsigned char to_byte(float v)
+{
+    v = v > 1.0f ? 1.0f : v > 0.0f ? v : 0.0f;
+    return (unsigned char)(v * 255.999f);
+}
+
+static void to_rgb8(const float* rgba, unsigned width, unsigned char* rgb)
+{
+    for(unsigned x = 0; x < width; ++x, rgba += 4)
+    {
+        *rgb++ = to_byte(rgba[0]);
+        *rgb++ = to_byte(rgba[1]);
+        *rgb++ = to_byte(rgba[2]);
+    }
+}
+
+static bool write_ppm(std::ofstream& fs, const float* pixels, unsigned width, unsigned height)
+{
+    fs << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<unsigned char> row(size_t(width) * 3);
+    for(unsigned y = 0; y < height; ++y)
+    {
+        to_rgb8(pixels + size_t(y) * width * 4, width, row.data());
+        fs.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+    return bool(fs);
+}
+
+static bool is_little_endian()
+{
+    const uint16_t v = 1;
+    return *reinterpret_cast<const unsigned char*>(&v) == 1;
+}
+
+static bool write_pfm(std::ofstream& fs, const float* pixels, unsigned width, unsigned height)
+{
+    // negative scale means little endian, rows go from the bottom up
+    fs << "PF\n" << width << " " << height << "\n" << (is_little_endian() ? "-1.0" : "1.0") << "\n";
+    std::vector<float> row(size_t(width) * 3);
+    for(unsigned y = height; y-- > 0;)
+    {
+        const float* src = pixels + size_t(y) * width * 4;
+        for(unsigned x = 0; x < width; ++x, src += 4)
+        {
+            row[x * 3] = src[0];
+            row[x * 3 + 1] = src[1];
+            row[x * 3 + 2] = src[2];
+        }
+        fs.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+    return bool(fs);
+}
+
+static std::array<uint32_t, 256> make_crc_table()
+{
+    std::array<uint32_t, 256> table;
+    for(uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t c = i;
+        for(int k = 0; k < 8; ++k)
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size)
+{
+    static const std::array<uint32_t, 256> table = make_crc_table();
+    crc = ~crc;
+    for(size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_u32_be(unsigned char* p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void write_png_chunk(std::ofstream& fs, const char* type, const unsigned char* data, size_t size)
+{
+    unsigned char header[8];
+    put_u32_be(header, uint32_t(size));
+    std::memcpy(header + 4, type, 4);
+    uint32_t crc = crc32(crc32(0, header + 4, 4), data, size);
+    unsigned char footer[4];
+    put_u32_be(footer, crc);
+    fs.write(reinterpret_cast<const char*>(header), sizeof(header));
+    fs.write(reinterpret_cast<const char*>(data), size);
+    fs.write(reinterpret_cast<const char*>(footer), sizeof(footer));
+}
+
+// the zlib stream is split into stored deflate blocks, one IDAT chunk each, so a row never
+// needs the whole image in memory
+class PngStoredWriter
+{
+public:
+    explicit PngStoredWriter(std::ofstream& fs):
+        m_fs(fs),
+        m_pending(0),
+        m_adler_a(1),
+        m_adler_b(0),
+        m_first(true)
+    {
+        m_data.reserve(max_block_size);
+        m_block.reserve(block_header_size + max_block_size + 2);
+    }
+
+    void write(const unsigned char* data, size_t size)
+    {
+        while(size > 0)
+        {
+            size_t n = std::min(size, max_block_size - m_pending);
+            m_data.insert(m_data.end(), data, data + n);
+            m_pending += n;
+            update_adler(data, n);
+            data += n;
+            size -= n;
+            if(m_pending == max_block_size)
+                flush_block(false);
+        }
+    }
+
+    void finish()
+    {
+        flush_block(true);
+        unsigned char adler[4];
+        put_u32_be(adler, (m_adler_b << 16) | m_adler_a);
+        write_png_chunk(m_fs, "IDAT", adler, sizeof(adler));
+    }
+
+private:
+    static const size_t max_block_size = 65535;
+    static const size_t block_header_size = 5;
+
+    void update_adler(const unsigned char* data, size_t size)
+    {
+        // 5552 bytes is the most that can be summed before the 32 bit sums overflow
+        while(size > 0)
+        {
+            size_t n = std::min<size_t>(size, 5552);
+            for(size_t i = 0; i < n; ++i)
+            {
+                m_adler_a += data[i];
+                m_adler_b += m_adler_a;
+            }
+            m_adler_a %= 65521;
+            m_adler_b %= 65521;
+            data += n;
+            size -= n;
+        }
+    }
+
+    void flush_block(bool last)
+    {
+        m_block.clear();
+        if(m_first)
+        {
+            // zlib header, deflate with 32K window and no preset dictionary
+            m_block.push_back(0x78);
+            m_block.push_back(0x01);
+            m_first = false;
+        }
+        const uint16_t len = uint16_t(m_pending);
+        m_block.push_back(last ? 1 : 0);
+        m_block.push_back((unsigned char)(len & 0xff));
+        m_block.push_back((unsigned char)(len >> 8));
+        m_block.push_back((unsigned char)(~len & 0xff));
+        m_block.push_back((unsigned char)((~len >> 8) & 0xff));
+        m_block.insert(m_block.end(), m_data.begin(), m_data.end());
+        write_png_chunk(m_fs, "IDAT", m_block.data(), m_block.size());
+        m_data.clear();
+        m_pending = 0;
+    }
+
+private:
+    std::ofstream& m_fs;
+    std::vector<unsigned char> m_data;
+    std::vector<unsigned char> m_block;
+    size_t m_pending;
+    uint32_t m_adler_a;
+    uint32_t m_adler_b;
+    bool m_first;
+};
+
+static bool write_png(std::ofstream& fs, const float* pixels, unsigned width, unsigned height)
+{
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fs.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    // 8 bit RGB, no interlace
+    unsigned char ihdr[13] = {0};
+    put_u32_be(ihdr, width);
+    put_u32_be(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = 2;
+    write_png_chunk(fs, "IHDR", ihdr, sizeof(ihdr));
+
+    // every row starts with filter type 0
+    PngStoredWriter idat(fs);
+    std::vector<unsigned char> row(1 + size_t(width) * 3);
+    for(unsigned y = 0; y < height; ++y)
+    {
+        row[0] = 0;
+        to_rgb8(pixels + size_t(y) * width * 4, width, row.data() + 1);
+        idat.write(row.data(), row.size());
+    }
+    idat.finish();
+
+    write_png_chunk(fs, "IEND", nullptr, 0);
+    return bool(fs);
+}
+
+ImageFormat get_image_format(const std::string& path)
+{
+    size_t dot = path.find_last_of('.');
+    if(dot == std::string::npos)
+        return ImageFormat::UNKNOWN;
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(std::tolower((unsigned char)c)); });
+    if(ext == "ppm")
+        return ImageFormat::PPM;
+    if(ext == "pfm")
+        return ImageFormat::PFM;
+    if(ext == "png")
+        return ImageFormat::PNG;
+    return ImageFormat::UNKNOWN;
+}
+
+bool write_image(const std::string& path, const float* pixels, unsigned width, unsigned height)
+{
+    ImageFormat format = get_image_format(path);
+    if(format == ImageFormat::UNKNOWN)
+    {
+        std::cerr << "Unknown image format: " << path << "\n";
+        return false;
+    }
+
+    std::ofstream fs(path, std::ios::binary | std::ios::out);
+    if(!fs)
+        return false;
+    switch(format)
+    {
+    case ImageFormat::PPM:
+        return write_ppm(fs, pixels, width, height);
+    case ImageFormat::PFM:
+        return write_pfm(fs, pixels, width, height);
+    case ImageFormat::PNG:
+        return write_png(fs, pixels, width, height);
+    default:
+        return false;
+    }
+}
+
+ImageWriter::ImageWriter():
+    m_busy(false),
+    m_quit(false)
+{
+    m_thread = std::thread(&ImageWriter::worker_loop, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_job_cv.notify_one();
+    m_thread.join();
+}
+
+void ImageWriter::push(const std::string& path, const float* pixels, unsigned width, unsigned height, DoneFunc done)
+{
+    Job job;
+    job.path = path;
+    job.pixels = pixels;
+    job.width = width;
+    job.height = height;
+    job.done = std::move(done);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_job_cv.notify_one();
+}
+
+bool ImageWriter::pop_result(Result& result)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_results.empty())
+        return false;
+    result = m_results.front();
+    m_results.pop_front();
+    return true;
+}
+
+void ImageWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle_cv.wait(lock, [this]() { return m_jobs.empty() && !m_busy; });
+}
+
+void ImageWriter::worker_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+        // jobs left at quit are still written
+        m_job_cv.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+        if(m_jobs.empty())
+            return;
+
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        m_busy = true;
+        lock.unlock();
+
+        bool success = write_image(job.path, job.pixels, job.width, job.height);
+        if(job.done)
+            job.done(success);
+
+        lock.lock();
+        m_busy = false;
+        Result result;
+        result.path = job.path;
+        result.success = success;
+        m_results.push_back(result);
+        m_idle_cv.notify_all();
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef __IMAGE_WRITER__
+#define __IMAGE_WRITER__
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// file format chosen by the extension of the path
+enum class ImageFormat
+{
+    UNKNOWN,
+    PPM,  // binary P6, 8 bit
+    PFM,  // little endian RGB float
+    PNG,  // 8 bit RGB, stored deflate blocks without compression
+};
+
+ImageFormat get_image_format(const std::string& path);
+
+// pixels are RGBA32F rows, the first row is the top of the image, same layout the renderers produce
+// 8 bit formats clamp the linear value to [0, 1], alpha is dropped
+bool write_image(const std::string& path, const float* pixels, unsigned width, unsigned height);
+
+// encodes and writes images on a background thread, in the order they are pushed
+class ImageWriter
+{
+public:
+    // called on the writer thread after the pixels are no longer used
+    typedef std::function<void(bool success)> DoneFunc;
+
+    struct Result
+    {
+        std::string path;
+        bool success;
+    };
+
+public:
+    ImageWriter();
+    // write everything pushed before return
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    // pixels must stay valid until done is called
+    void push(const std::string& path, const float* pixels, unsigned width, unsigned height, DoneFunc done = nullptr);
+    // a finished write, false if there is none
+    bool pop_result(Result& result);
+    // block until everything pushed is written
+    void flush();
+
+private:
+    struct Job
+    {
+        std::string path;
+        const float* pixels;
+        unsigned width;
+        unsigned height;
+        DoneFunc done;
+    };
+
+    void worker_loop();
+
+private:
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_job_cv;
+    std::condition_variable m_idle_cv;
+    std::deque<Job> m_jobs;
+    std::deque<Result> m_results;
+    bool m_busy;  // a job is being written
+    bool m_quit;
+};
+
+
+#endif // __IMAGE_WRITER__
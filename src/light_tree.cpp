@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "light_tree.h"
+#include "scene.h"
+
+static const float pi = 3.14159265f;
+static const glm::vec3 luminance_weight(0.2126f, 0.7152f, 0.0722f);  // same as ray_tracking.comp
+static const int bin_count = 12;
+// ranges deeper than this are split at the median, so walking down stays short even when the
+// heuristic peels off one light at a time
+static const int light_tree_max_depth = 48;
+
+// what a node stores about the lights below it, count 0 is empty
+struct LightBounds
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+    glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);
+    float cos_theta_o = 1.0f;
+    float cos_theta_e = 1.0f;
+    float power = 0.0f;
+    unsigned count = 0;
+
+    float area() const
+    {
+        glm::vec3 d = max - min;
+        if(d.x < 0.0f)
+            return 0.0f;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+static float safe_acos(float x)
+{
+    return std::acos(glm::clamp(x, -1.0f, 1.0f));
+}
+
+// smallest cone found by rotating the axis of a towards b until both fit
+static void unite_cones(const LightBounds& a, const LightBounds& b, glm::vec3& axis, float& cos_theta)
+{
+    const float theta_a = safe_acos(a.cos_theta_o);
+    const float theta_b = safe_acos(b.cos_theta_o);
+    const float theta_d = safe_acos(glm::dot(a.axis, b.axis));
+    axis = a.axis;
+    cos_theta = a.cos_theta_o;
+    if(std::min(theta_d + theta_b, pi) <= theta_a)
+        return;
+    if(std::min(theta_d + theta_a, pi) <= theta_b)
+    {
+        axis = b.axis;
+        cos_theta = b.cos_theta_o;
+        return;
+    }
+    const float theta_o = (theta_a + theta_d + theta_b) * 0.5f;
+    const glm::vec3 w = glm::cross(a.axis, b.axis);
+    if(theta_o >= pi || glm::dot(w, w) == 0.0f)
+    {
+        cos_theta = -1.0f;
+        return;
+    }
+    // k x axis_a is the direction towards axis_b, perpendicular to axis_a
+    const glm::vec3 k = glm::normalize(w);
+    const float angle = theta_o - theta_a;
+    axis = glm::normalize(a.axis * std::cos(angle) + glm::cross(k, a.axis) * std::sin(angle));
+    cos_theta = std::cos(theta_o);
+}
+
+static LightBounds unite(const LightBounds& a, const LightBounds& b)
+{
+    if(a.count == 0)
+        return b;
+    if(b.count == 0)
+        return a;
+    LightBounds result;
+    result.min = glm::min(a.min, b.min);
+    result.max = glm::max(a.max, b.max);
+    unite_cones(a, b, result.axis, result.cos_theta_o);
+    result.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    result.power = a.power + b.power;
+    result.count = a.count + b.count;
+    return result;
+}
+
+// power times the solid angle measure of the cone times the box area, Kr keeps the boxes from getting thin
+static float get_cost(const LightBounds& b, const glm::vec3& extent, int axis)
+{
+    const float theta_o = safe_acos(b.cos_theta_o);
+    const float theta_e = safe_acos(b.cos_theta_e);
+    const float theta_w = std::min(theta_o + theta_e, pi);
+    const float sin_theta_o = std::sqrt(std::max(1.0f - b.cos_theta_o * b.cos_theta_o, 0.0f));
+    const float m_omega = 2.0f * pi * (1.0f - b.cos_theta_o) + pi * 0.5f * (2.0f * theta_w * sin_theta_o
+        - std::cos(theta_o - 2.0f * theta_w) - 2.0f * theta_o * sin_theta_o + b.cos_theta_o);
+    const float k_r = std::max(extent.x, std::max(extent.y, extent.z)) / extent[axis];
+    return b.power * m_omega * k_r * b.area();
+}
+
+class LightTreeBuilder
+{
+public:
+    LightTreeBuilder(const std::vector<LightBounds>& bounds, std::vector<unsigned>& indices):
+        m_bounds(bounds),
+        m_indices(indices)
+    {
+    }
+
+    // append the subtree of indices [begin, end) to nodes in depth first order
+    void build(std::vector<LightNode>& nodes, unsigned begin, unsigned end, int depth)
+    {
+        LightBounds b;
+        glm::vec3 centroid_min(std::numeric_limits<float>::max());
+        glm::vec3 centroid_max(-std::numeric_limits<float>::max());
+        for(unsigned i = begin; i < end; ++i)
+        {
+            const LightBounds& light = m_bounds[m_indices[i]];
+            b = unite(b, light);
+            centroid_min = glm::min(centroid_min, (light.min + light.max) * 0.5f);
+            centroid_max = glm::max(centroid_max, (light.min + light.max) * 0.5f);
+        }
+
+        const unsigned node_index = unsigned(nodes.size());
+        LightNode node = {};
+        node.bounds_min = b.min;
+        node.bounds_max = b.max;
+        node.offset = m_indices[begin];
+        node.count = 1;
+        node.axis = b.axis;
+        node.cos_theta_o = b.cos_theta_o;
+        node.cos_theta_e = b.cos_theta_e;
+        node.power = b.power;
+        nodes.push_back(node);
+        if(end - begin == 1)
+            return;
+
+        const unsigned mid = split(b, centroid_min, centroid_max, begin, end, depth);
+        build(nodes, begin, mid, depth + 1);
+        nodes[node_index].offset = unsigned(nodes.size());
+        nodes[node_index].count = 0;
+        build(nodes, mid, end, depth + 1);
+    }
+
+private:
+    // partition [begin, end) by the cheapest binned plane, return the first index of the right part
+    unsigned split(const LightBounds& b, const glm::vec3& centroid_min, const glm::vec3& centroid_max,
+        unsigned begin, unsigned end, int depth)
+    {
+        const unsigned count = end - begin;
+        const glm::vec3 extent = b.max - b.min;
+        float best_cost = std::numeric_limits<float>::max();
+        int best_axis = -1;
+        int best_bin = 0;
+        for(int axis = 0; axis < 3 && depth < light_tree_max_depth; ++axis)
+        {
+            const float centroid_extent = centroid_max[axis] - centroid_min[axis];
+            if(centroid_extent <= 0.0f)
+                continue;
+            const float scale = bin_count / centroid_extent;
+
+            LightBounds bins[bin_count];
+            for(unsigned i = begin; i < end; ++i)
+            {
+                const LightBounds& light = m_bounds[m_indices[i]];
+                const float centroid = (light.min[axis] + light.max[axis]) * 0.5f;
+                const int bin = std::min(bin_count - 1, int((centroid - centroid_min[axis]) * scale));
+                bins[bin] = unite(bins[bin], light);
+            }
+
+            LightBounds right[bin_count];
+            right[bin_count - 1] = bins[bin_count - 1];
+            for(int i = bin_count - 2; i > 0; --i)
+                right[i] = unite(right[i + 1], bins[i]);
+            LightBounds left;
+            for(int i = 0; i < bin_count - 1; ++i)
+            {
+                left = unite(left, bins[i]);
+                if(left.count == 0 || left.count == count)
+                    continue;
+                const float cost = get_cost(left, extent, axis) + get_cost(right[i + 1], extent, axis);
+                if(cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = i;
+                }
+            }
+        }
+
+        unsigned* first = m_indices.data() + begin;
+        unsigned* last = m_indices.data() + end;
+        if(best_axis < 0)
+        {
+            // all centroids at one point, or too deep: the median along the widest centroid extent
+            const glm::vec3 centroid_extent = centroid_max - centroid_min;
+            const int axis = centroid_extent.x >= centroid_extent.y && centroid_extent.x >= centroid_extent.z ? 0
+                : centroid_extent.y >= centroid_extent.z ? 1 : 2;
+            std::nth_element(first, first + count / 2, last, [&](unsigned l, unsigned r) {
+                return m_bounds[l].min[axis] + m_bounds[l].max[axis] < m_bounds[r].min[axis] + m_bounds[r].max[axis];
+            });
+            return begin + count / 2;
+        }
+
+        const float min = centroid_min[best_axis];
+        const float scale = bin_count / (centroid_max[best_axis] - min);
+        unsigned* mid = std::partition(first, last, [&](unsigned light) {
+            const float centroid = (m_bounds[light].min[best_axis] + m_bounds[light].max[best_axis]) * 0.5f;
+            return std::min(bin_count - 1, int((centroid - min) * scale)) <= best_bin;
+        });
+        return unsigned(mid - m_indices.data());
+    }
+
+private:
+    const std::vector<LightBounds>& m_bounds;
+    std::vector<unsigned>& m_indices;
+};
+
+void build_light_tree(const Scene& scene, std::vector<Light>& lights, std::vector<LightNode>& nodes)
+{
+    lights.clear();
+    nodes.clear();
+    std::vector<LightBounds> bounds;
+
+    // a point light shines in every direction, 4 pi sr
+    for(const PointLight& point : scene.point_lights)
+    {
+        LightBounds b;
+        b.min = b.max = point.position;
+        b.cos_theta_o = -1.0f;
+        b.cos_theta_e = 0.0f;
+        b.power = 4.0f * pi * glm::dot(point.intensity, luminance_weight);
+        b.count = 1;
+        if(!(b.power > 0.0f))
+            continue;
+        Light light = {};
+        light.position = point.position;
+        light.type = light_point;
+        light.emission = point.intensity;
+        lights.push_back(light);
+        bounds.push_back(b);
+    }
+
+    // a lambertian emitter sends pi * area * radiance from its front face
+    std::vector<bool> in_mesh(scene.triangles.size(), false);
+    for(const Mesh& mesh : scene.meshes)
+        std::fill(in_mesh.begin() + mesh.first_triangle, in_mesh.begin() + mesh.first_triangle + mesh.triangle_count, true);
+    for(size_t i = 0; i < scene.triangles.size(); ++i)
+    {
+        const Triangle& tri = scene.triangles[i];
+        const glm::vec3 emission(scene.materials[tri.material].emission);
+        if(in_mesh[i] || glm::dot(emission, luminance_weight) <= 0.0f)
+            continue;
+        const glm::vec3 v0(scene.vertices[tri.v0]);
+        const glm::vec3 v1(scene.vertices[tri.v1]);
+        const glm::vec3 v2(scene.vertices[tri.v2]);
+        const glm::vec3 normal = glm::cross(v1 - v0, v2 - v0);
+        const float area = 0.5f * glm::length(normal);
+        if(!(area > 0.0f))
+            continue;
+        LightBounds b;
+        b.min = glm::min(v0, glm::min(v1, v2));
+        b.max = glm::max(v0, glm::max(v1, v2));
+        b.axis = glm::normalize(normal);
+        b.cos_theta_o = 1.0f;
+        b.cos_theta_e = 0.0f;
+        b.power = pi * area * glm::dot(emission, luminance_weight);
+        b.count = 1;
+        Light light = {};
+        light.position = v0;
+        light.type = light_triangle;
+        light.edge1 = v1 - v0;
+        light.edge2 = v2 - v0;
+        light.emission = emission;
+        lights.push_back(light);
+        bounds.push_back(b);
+    }
+
+    if(lights.empty())
+        return;
+    std::vector<unsigned> indices(lights.size());
+    for(unsigned i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+    nodes.reserve(lights.size() * 2 - 1);
+    LightTreeBuilder builder(bounds, indices);
+    builder.build(nodes, 0, unsigned(indices.size()), 0);
+}
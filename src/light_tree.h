@@ -0,0 +1,55 @@
+#ifndef __LIGHT_TREE__
+#define __LIGHT_TREE__
+
+#include <vector>
+#include <glm/vec3.hpp>
+
+class Scene;
+
+const unsigned light_point = 0;
+const unsigned light_triangle = 1;
+
+// same std430 layout as Light in ray_tracking.comp
+// what a leaf of the light tree samples, a point light or an emissive triangle of the scene bvh,
+// the triangle vertices are copied so sampling needs no vertex fetch
+struct Light
+{
+    glm::vec3 position;  // of the point light, v0 of the triangle
+    unsigned type;  // light_point or light_triangle
+    glm::vec3 edge1;  // v1 - v0, zero for a point light
+    float padding0;
+    glm::vec3 edge2;  // v2 - v0
+    float padding1;
+    glm::vec3 emission;  // point light: intensity (power per steradian), triangle: radiance of its front face
+    float padding2;
+};
+static_assert(sizeof(Light) == 64, "Light must match std430 layout of ray_tracking.comp");
+
+// same std430 layout as LightNode in ray_tracking.comp
+// nodes are stored depth first, the left child of an interior node is the next node
+// every node bounds the lights below it by position, total power and a cone of the directions
+// they emit in: the normals lie within acos(cos_theta_o) of axis, light leaves them by up to acos(cos_theta_e)
+struct LightNode
+{
+    glm::vec3 bounds_min;
+    unsigned offset;  // interior node: index of the right child, leaf: index into lights
+    glm::vec3 bounds_max;
+    unsigned count;  // 1 for a leaf, 0 for interior nodes
+    glm::vec3 axis;
+    float cos_theta_o;  // -1 for lights emitting in every direction
+    float cos_theta_e;  // 0 for points and one sided triangles, whose light leaves up to 90 degree off the normal
+    float power;  // luminance of the emitted power
+    float padding[2];
+};
+static_assert(sizeof(LightNode) == 64, "LightNode must match std430 layout of ray_tracking.comp");
+
+// collect the point lights and the emissive triangles of the scene bvh (the ones of meshes,
+// which only instances place, are not lights) and build a tree over them by the surface area
+// orientation heuristic of Conty & Kulla 2018, each leaf holds one light
+// a shading point picks a light by walking down from the root, choosing a child by its
+// importance, so the cost is logarithmic in the light count, see sample_light_tree in ray_tracking.comp
+// lights and nodes are empty without lights
+void build_light_tree(const Scene& scene, std::vector<Light>& lights, std::vector<LightNode>& nodes);
+
+
+#endif // __LIGHT_TREE__
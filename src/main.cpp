@@ -1,6 +1,11 @@
 #include <iostream>
 #include <memory>
 #include <chrono>
+#include <cstdio>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -8,12 +13,25 @@
 #include <imgui/imgui_impl_glfw.h>
 #include <imgui/imgui_impl_opengl3.h>
 #include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+#include <glm/common.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "texture.h"
-#include "shader.h"
-
-using namespace std::literals::chrono_literals; // for operator ""s and so on
+#include "options.h"
+#include "headless.h"
+#include "distributed.h"
+#include "render_service.h"
+#include "renderer.h"
+#include "image_writer.h"
+#include "texture_readback.h"
+#include "profiler.h"
+#include "render_thread.h"
+
+// frames drawn after an event before the ui waits for the next one
+static const int ui_settle_frames = 3;
+// s the ui waits for events at most, so the timed messages still go away
+static const double ui_idle_timeout = 0.5;
 
 void glfw_error_callback(int error, const char* description)
 {
@@ -102,7 +120,7 @@ GLFWwindow* init(const char* window_name, unsigned width, unsigned height)
     }
     /* Make the window's context current */
     glfwMakeContextCurrent(window);
-    // glfwSwapInterval(1); // Enable vsync
+    glfwSwapInterval(1); // Enable vsync
 
     glfwSetKeyCallback(window, key_callback);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
@@ -188,17 +206,46 @@ void print_env_info()
     std::cout << "max work group invovations: " << compute_shader_config[0] << '\n';
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
+    Options options;
+    if(!parse_options(argc, argv, options))
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(options.service_port > 0)
+        return run_service(options);
+    if(options.coordinator_port > 0)
+        return run_coordinator(options);
+    if(!options.worker_address.empty())
+        return run_worker(options);
+    if(options.headless)
+        return run_headless(options);
+
     int window_width = 1000;
     int window_height = 800;
-    int texture_width = 600;
+    int texture_width = options.width;
+    int texture_height = options.height;
     float zoom_level = 1.0f;  // zoom level for texture size
-    float aspect_ratio = 16.0f / 9.0f;
-    int texture_height = texture_width / aspect_ratio;
-
-    std::chrono::steady_clock::time_point texture_saved_time_point(0s);
+    float aspect_ratio = float(texture_width) / texture_height;
+    float frame_budget = 8.0f;  // ms the render thread renders before it publishes a frame
+    int max_samples = 1024;  // stop accumulating after this many samples per pixel
+    bool dynamic_resolution = false;  // render a full pass per frame at a resolution holding the target time
+    float target_frame_time = 16.0f;
+    int max_fps = options.max_fps;  // the ui draws at most this many frames per second, 0 for no cap
+    bool adaptive = options.adaptive_threshold > 0.0f;
+    float adaptive_threshold = adaptive ? options.adaptive_threshold : 0.02f;
+
+    std::chrono::steady_clock::time_point texture_saved_time_point(std::chrono::seconds(0));
     bool texture_save_success = true;
+    const char* save_formats[] = {"ppm", "pfm", "png"};
+    // in SamplerType order
+    const char* sampler_names[] = {"random", "sobol", "bluenoise"};
+    int save_format = 0;
+    std::chrono::steady_clock::time_point trace_saved_time_point(std::chrono::seconds(0));
+    bool trace_save_success = true;
+    bool profiling = true;
 
     GLFWwindow* window = init("ray tracking", window_width, window_height);
     if(!window)
@@ -214,33 +261,98 @@ int main(void)
 20.0f, nullptr, io.Fonts->GetGlyphRangesChineseFull());
     IM_ASSERT(font != nullptr);
 
-    Texture picture(texture_width, texture_height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT, nullptr);
-    picture.set_data(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-    picture.activate(0);
-    picture.set_access_for_shader(Texture::Access::READ_WRITE);
-
-    Shader shader;
-    shader.add_compute_shader("../src/ray_tracking.comp");
-    shader.build_shader();
-    shader.work();
-
-    const int patch_size_x = 32;
-    const int patch_size_y = 32;
+    // the render thread's context, it shares textures and fences with the window's
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* render_context = glfwCreateWindow(1, 1, "render", nullptr, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if(!render_context)
+    {
+        std::cerr << "Create render context failed\n";
+        clean(window);
+        return EXIT_FAILURE;
+    }
 
-    const int group_size_x = std::ceil(texture_width * 1.0 / patch_size_x);
-    const int group_size_y = std::ceil(texture_height * 1.0 / patch_size_y);
+    Scene scene;
+    SceneFile scene_file;
+    SceneView view;
+    if(!load_scene(options, aspect_ratio, scene, scene_file, view))
+    {
+        std::cerr << "Load scene failed\n";
+        glfwDestroyWindow(render_context);
+        clean(window);
+        return EXIT_FAILURE;
+    }
 
-    glDispatchCompute(group_size_x, group_size_y, 1);
+    // gpu timings come back a few frames late, the graphs lag the same
+    // the ui's passes are timed here, the renderer's by the render thread
+    Profiler profiler;
+    // the renderer works on the render thread, the ui posts changes to it and shows the frames it publishes
+    RenderThread render_thread;
+    RenderThread::Settings render_settings;
+    auto make_current = [render_context](bool current) {
+        glfwMakeContextCurrent(current ? render_context : nullptr);
+    };
+    if(!render_thread.start(options, view, texture_width, texture_height, make_current, glfwPostEmptyEvent))
+    {
+        std::cerr << "Renderer init failed\n";
+        glfwDestroyWindow(render_context);
+        clean(window);
+        return EXIT_FAILURE;
+    }
+    bool denoise = options.denoise;
+    int sampler = int(options.sampler);
+    // dragging the image orbits the camera around the point it looks at, the wheel moves it closer
+    Camera camera = view.camera;
+    int reprojection_samples = options.reprojection_samples > 0 ? options.reprojection_samples : 16;
+    bool reprojection = options.reprojection_samples > 0;
+
+    // images are read back and written in the background, the result shows up a few frames later
+    ImageWriter image_writer;
+    TextureReadback readback(image_writer);
+    // frames still drawn after an event, imgui needs a few to settle hover and layout changes
+    int settle_frames = ui_settle_frames;
+    std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
 
     /* Loop until the user closes the window */
     while (!glfwWindowShouldClose(window))
     {
-        glfwPollEvents();
+        // the render thread posts an empty event with every frame it publishes, so waiting for events
+        // also waits for the next frame, and takes no cpu once it is idle
         if(glfwGetWindowAttrib(window, GLFW_ICONIFIED) != 0)
         {
-            ImGui_ImplGlfw_Sleep(10);
+            glfwWaitEvents();
             continue;
         }
+        if(settle_frames > 0)
+        {
+            --settle_frames;
+            glfwPollEvents();
+        }
+        else
+        {
+            double wait_start = glfwGetTime();
+            glfwWaitEventsTimeout(ui_idle_timeout);
+            // the timeout only redraws the timed messages
+            settle_frames = glfwGetTime() - wait_start < ui_idle_timeout ? ui_settle_frames : 0;
+        }
+        // sleep off the rest of the frame interval of the cap
+        if(max_fps > 0)
+            std::this_thread::sleep_until(frame_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / max_fps);
+        frame_start = std::chrono::steady_clock::now();
+
+        profiler.new_frame();
+        RenderThread::Frame frame = render_thread.acquire_frame();
+        RenderThread::Status status = render_thread.get_status();
+        {
+            ProfileScope scope(&profiler, "readback");
+            readback.update();
+        }
+        ImageWriter::Result save_result;
+        while(image_writer.pop_result(save_result))
+        {
+            texture_saved_time_point = std::chrono::steady_clock::now();
+            texture_save_success = save_result.success;
+        }
 
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
@@ -281,7 +393,29 @@ int main(void)
             img_pos = pos;
 
         ImGui::SetCursorScreenPos(img_pos);
-        ImGui::Image((void*)picture.get_id(), ImVec2(texture_show_width, texture_show_height));
+        // the rendered part is stretched over the full size
+        int render_width = frame.texture ? int(frame.width) : texture_width;
+        int render_height = frame.texture ? int(frame.height) : texture_height;
+        if(frame.texture)
+            ImGui::Image((void*)frame.texture->get_id(), ImVec2(texture_show_width, texture_show_height), ImVec2(0.0f, 0.0f),
+                ImVec2(float(render_width) / texture_width, float(render_height) / texture_height));
+        else
+            ImGui::Dummy(ImVec2(texture_show_width, texture_show_height));
+        if(ImGui::IsItemHovered() && ((ImGui::IsMouseDown(ImGuiMouseButton_Left)
+            && (io.MouseDelta.x != 0.0f || io.MouseDelta.y != 0.0f)) || io.MouseWheel != 0.0f))
+        {
+            // y is up, a full drag across the shown image turns half around
+            const float radians_per_pixel = 3.14159265f / texture_show_width;
+            glm::vec3 offset = camera.position - camera.look_at;
+            float radius = glm::length(offset);
+            float yaw = std::atan2(offset.x, offset.z) - io.MouseDelta.x * radians_per_pixel;
+            float pitch = std::asin(glm::clamp(offset.y / radius, -1.0f, 1.0f)) + io.MouseDelta.y * radians_per_pixel;
+            pitch = glm::clamp(pitch, -1.5f, 1.5f);
+            radius *= std::pow(0.9f, io.MouseWheel);
+            camera.position = camera.look_at
+                + radius * glm::vec3(std::cos(pitch) * std::sin(yaw), std::sin(pitch), std::cos(pitch) * std::cos(yaw));
+            render_thread.post([camera](Renderer& renderer) { renderer.move_camera(camera); });
+        }
 
         ImDrawList* draw_list = ImGui::GetWindowDrawList();
         draw_list->AddRect(img_pos,
@@ -294,21 +428,88 @@ int main(void)
 
         ImGui::SeparatorText(u8"渲染数据");
         ImGui::Text(u8"渲染统计数据\n%.4f ms/frame\n%.4f FPS", 1000.0f / io.Framerate, io.Framerate);
-        ImGui::Text(u8"渲染图像大小：%d X %d", texture_width, texture_height);
+        ImGui::Text(u8"渲染图像大小：%d X %d (%.0f%%)", render_width, render_height, status.resolution_scale * 100.0f);
         ImGui::Text(u8"显示图像大小：%d X %d", texture_show_width, texture_show_height);
+        ImGui::Text(u8"采样数：%u spp", status.samples_per_pixel);
+        ImGui::Text(u8"采样速度：%.2f M samples/s", status.samples_per_second * 1.0e-6);
+        if(adaptive)
+            ImGui::Text(status.converged ? u8"已收敛" : u8"未收敛");
+        ImGui::Text(status.idle ? u8"渲染线程空闲" : u8"渲染线程工作中");
         ImGui::Dummy(ImGui::GetItemRectSize());  // keep an item sized empty space
 
         ImGui::SeparatorText(u8"配置项");
         ImGui::SliderFloat(u8"缩放", &zoom_level, 0.25, 8.0f);
         ImGui::SameLine();
         if(ImGui::Button("reset##zoom_level")) zoom_level = 1.0f;
+        ImGui::SliderInt(u8"帧率上限", &max_fps, 0, 240, max_fps > 0 ? "%d" : u8"无");
+        bool settings_changed = ImGui::SliderFloat(u8"每帧渲染时间(ms)", &frame_budget, 1.0f, 100.0f);
+        settings_changed |= ImGui::SliderInt(u8"最大采样数", &max_samples, 1, 16384, "%d", ImGuiSliderFlags_Logarithmic);
+        settings_changed |= ImGui::Checkbox(u8"动态分辨率", &dynamic_resolution);
+        if(dynamic_resolution)
+        {
+            ImGui::SameLine();
+            settings_changed |= ImGui::SliderFloat(u8"目标帧时间(ms)", &target_frame_time, 2.0f, 100.0f);
+        }
+        settings_changed |= ImGui::Checkbox(u8"暂停", &render_settings.paused);
+        if(settings_changed)
+        {
+            render_settings.budget_ms = frame_budget;
+            render_settings.max_samples = unsigned(max_samples);
+            render_settings.dynamic_resolution = dynamic_resolution;
+            render_settings.target_ms = target_frame_time;
+            render_thread.set_settings(render_settings);
+        }
+        bool adaptive_changed = ImGui::Checkbox(u8"自适应采样", &adaptive);
+        if(adaptive)
+        {
+            ImGui::SameLine();
+            adaptive_changed |= ImGui::SliderFloat(u8"误差阈值", &adaptive_threshold, 0.001f, 0.1f, "%.3f",
+                ImGuiSliderFlags_Logarithmic);
+        }
+        if(adaptive_changed)
+        {
+            const float threshold = adaptive ? adaptive_threshold : 0.0f;
+            const unsigned min_samples = unsigned(options.adaptive_min_samples);
+            render_thread.post([threshold, min_samples](Renderer& renderer) { renderer.set_adaptive(threshold, min_samples); });
+        }
+        if(ImGui::Checkbox(u8"降噪", &denoise))
+            render_thread.post([denoise](Renderer& renderer) { renderer.set_denoise(denoise); });
+        bool reprojection_changed = ImGui::Checkbox(u8"时域重投影", &reprojection);
+        if(reprojection)
+        {
+            ImGui::SameLine();
+            reprojection_changed |= ImGui::SliderInt(u8"历史样本数", &reprojection_samples, 1, 256, "%d",
+                ImGuiSliderFlags_Logarithmic);
+        }
+        if(reprojection_changed)
+        {
+            const unsigned samples = reprojection ? unsigned(reprojection_samples) : 0;
+            render_thread.post([samples](Renderer& renderer) { renderer.set_reprojection(samples); });
+        }
+        ImGui::SetNextItemWidth(ImGui::GetFontSize() * 6);
+        if(ImGui::Combo(u8"采样器", &sampler, sampler_names, IM_ARRAYSIZE(sampler_names)))
+        {
+            const SamplerType type = SamplerType(sampler);
+            const SamplerTables* tables = &get_sampler_tables(options.shader_cache_path);
+            render_thread.post([type, tables](Renderer& renderer) { renderer.set_sampler(type, tables); });
+        }
+        if(ImGui::Button(u8"重新渲染"))
+            render_thread.post([](Renderer& renderer) { renderer.reset(); });
+        ImGui::SetNextItemWidth(ImGui::GetFontSize() * 4);
+        ImGui::Combo(u8"格式", &save_format, save_formats, IM_ARRAYSIZE(save_formats));
+        ImGui::SameLine();
         if(ImGui::Button("保存图像"))
         {
-            texture_saved_time_point = std::chrono::steady_clock::now();
-            std::string filename = "texture.ppm";
-            texture_save_success = picture.save_as_ppm(filename);
+            std::string filename = std::string("texture.") + save_formats[save_format];
+            ProfileScope scope(&profiler, "readback");
+            if(!frame.texture || !readback.request(*frame.texture, filename, render_width, render_height))
+            {
+                // every readback slot is busy
+                texture_saved_time_point = std::chrono::steady_clock::now();
+                texture_save_success = false;
+            }
         }
-        if(std::chrono::steady_clock::now() - texture_saved_time_point < 3s)
+        if(std::chrono::steady_clock::now() - texture_saved_time_point < std::chrono::seconds(3))
         {
             ImGui::SameLine();
             if(texture_save_success)
@@ -317,6 +518,46 @@ int main(void)
                 ImGui::TextColored(ImVec4(0.8f, 0.0f, 0.0f, 1.0f), u8"文件保存失败");
         }
 
+        ImGui::SeparatorText(u8"性能分析");
+        if(ImGui::Checkbox(u8"启用", &profiling))
+        {
+            profiler.set_enabled(profiling);
+            render_thread.set_profiling(profiling);
+        }
+        ImGui::SameLine();
+        if(ImGui::Button(u8"导出trace"))
+        {
+            trace_saved_time_point = std::chrono::steady_clock::now();
+            trace_save_success = profiler.write_trace("trace.json");
+            // written on the render thread once it gets there, failures only go to the log
+            render_thread.write_trace("render_trace.json");
+        }
+        if(std::chrono::steady_clock::now() - trace_saved_time_point < std::chrono::seconds(3))
+        {
+            ImGui::SameLine();
+            if(trace_save_success)
+                ImGui::TextColored(ImVec4(0.0f, 0.8f, 0.0f, 1.0f), u8"trace.json保存成功");
+            else
+                ImGui::TextColored(ImVec4(0.8f, 0.0f, 0.0f, 1.0f), u8"trace.json保存失败");
+        }
+        // gpu ms per frame of each pass, the cpu time is in the overlay
+        // the render thread's frames are its steps, it times them with a profiler of its own
+        auto plot_passes = [](const char* id, const std::vector<Profiler::Pass>& passes, int history_offset) {
+            ImGui::PushID(id);
+            for(const Profiler::Pass& pass : passes)
+            {
+                char overlay[64];
+                std::snprintf(overlay, sizeof(overlay), "gpu %.2f ms  cpu %.2f ms", pass.gpu_average, pass.cpu_average);
+                ImGui::PlotLines(pass.name.c_str(), pass.gpu_ms, Profiler::history_size, history_offset,
+                    overlay, 0.0f, FLT_MAX, ImVec2(0.0f, ImGui::GetFontSize() * 2.5f));
+            }
+            ImGui::PopID();
+        };
+        ImGui::Text(u8"界面");
+        plot_passes("ui", profiler.get_passes(), profiler.get_history_offset());
+        ImGui::Text(u8"渲染线程");
+        plot_passes("render", status.passes, status.history_offset);
+
         ImGui::SetCursorPosY(ImGui::GetCursorPosY() + ImGui::GetContentRegionAvail().y - ImGui::GetFontSize() * 2);
         ImGui::Separator();
         static bool show_demo_window = false;
@@ -327,8 +568,11 @@ int main(void)
         ImGui::End();  // 渲染配置
 
         // Rendering
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            ProfileScope scope(&profiler, "imgui");
+            ImGui::Render();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
 
         // Update and Render additional Platform Windows
         // (Platform functions may change the current OpenGL context, so we save/restore it to make it easier to paste this code elsewhere.
@@ -340,10 +584,20 @@ int main(void)
             ImGui::RenderPlatformWindowsDefault();
             glfwMakeContextCurrent(backup_current_context);
         }
+        // the render thread may copy into the frame again once the gpu got past these draws
+        render_thread.release_frame();
 
-        glfwSwapBuffers(window);
+        {
+            ProfileScope scope(&profiler, "swap");
+            glfwSwapBuffers(window);
+        }
     }
 
+    // the readbacks still in flight need the context and the frame textures
+    readback.flush();
+    render_thread.stop();
+    glfwDestroyWindow(render_context);
+
     // Cleanup
     clean(window);
 
@@ -0,0 +1,119 @@
+#include <iostream>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mapped_file.h"
+
+MappedFile::MappedFile():
+    m_data(nullptr),
+    m_size(0),
+#if defined(_WIN32)
+    m_file(INVALID_HANDLE_VALUE),
+    m_mapping(nullptr)
+#else
+    m_fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#if defined(_WIN32)
+bool MappedFile::open(const std::string& path)
+{
+    close();
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(m_file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "Open file failed: " << path << "\n";
+        return false;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+    {
+        std::cerr << "Empty or unreadable file: " << path << "\n";
+        close();
+        return false;
+    }
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(m_mapping)
+        m_data = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!m_data)
+    {
+        std::cerr << "Map file failed: " << path << "\n";
+        close();
+        return false;
+    }
+    m_size = size_t(size.QuadPart);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if(m_data)
+        UnmapViewOfFile(m_data);
+    if(m_mapping)
+        CloseHandle(m_mapping);
+    if(m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+    m_data = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::open(const std::string& path)
+{
+    close();
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if(m_fd < 0)
+    {
+        std::cerr << "Open file failed: " << path << "\n";
+        return false;
+    }
+    struct stat st;
+    if(fstat(m_fd, &st) != 0 || st.st_size == 0)
+    {
+        std::cerr << "Empty or unreadable file: " << path << "\n";
+        close();
+        return false;
+    }
+    void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if(p == MAP_FAILED)
+    {
+        std::cerr << "Map file failed: " << path << "\n";
+        close();
+        return false;
+    }
+    // sections are read front to back exactly once, let the kernel read ahead aggressively
+    madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+    madvise(p, size_t(st.st_size), MADV_WILLNEED);
+    m_data = (const unsigned char*)p;
+    m_size = size_t(st.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if(m_data)
+        munmap((void*)m_data, m_size);
+    if(m_fd >= 0)
+        ::close(m_fd);
+    m_data = nullptr;
+    m_size = 0;
+    m_fd = -1;
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef __MAPPED_FILE__
+#define __MAPPED_FILE__
+
+#include <string>
+#include <cstddef>
+
+// read only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* get_data() const { return m_data; }
+    size_t get_size() const { return m_size; }
+
+private:
+    const unsigned char* m_data;
+    size_t m_size;
+#if defined(_WIN32)
+    void* m_file;
+    void* m_mapping;
+#else
+    int m_fd;
+#endif
+};
+
+
+#endif // __MAPPED_FILE__
@@ -0,0 +1,1045 @@
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <cmath>
+
+#include "mesh_import.h"
+#include "mapped_file.h"
+
+static const size_t min_chunk_size = 1 << 20;  // bytes of obj, smaller files are parsed by one thread
+static const size_t min_chunk_elements = 64 * 1024;  // of ply
+static const unsigned chunks_per_thread = 4;  // so uneven chunks still balance
+static const int absent_index = std::numeric_limits<int>::min();  // no uv / normal given
+
+// run work(i) for i in [0, count) on up to thread_count threads, each taking the next index when done
+static void parallel_for(size_t count, unsigned thread_count, const std::function<void(size_t)>& work)
+{
+    std::atomic<size_t> next(0);
+    auto run = [&]() {
+        for(size_t i = next++; i < count; i = next++)
+            work(i);
+    };
+    std::vector<std::thread> threads;
+    for(size_t t = 1; t < std::min<size_t>(thread_count, count); ++t)
+        threads.emplace_back(run);
+    run();
+    for(std::thread& t : threads)
+        t.join();
+}
+
+static bool has_extension(const std::string& path, const char* extension)
+{
+    const size_t n = std::strlen(extension);
+    if(path.size() < n)
+        return false;
+    for(size_t i = 0; i < n; ++i)
+        if(std::tolower((unsigned char)path[path.size() - n + i]) != extension[i])
+            return false;
+    return true;
+}
+
+// ---- obj ----
+
+// the strto* functions are slow and follow the locale, obj numbers are plain decimal
+static const char* parse_int(const char* p, const char* end, int& value)
+{
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if(p == end || *p < '0' || *p > '9')
+        return nullptr;
+    int64_t v = 0;
+    while(p < end && *p >= '0' && *p <= '9')
+    {
+        v = v * 10 + (*p++ - '0');
+        if(v > std::numeric_limits<int>::max())
+            return nullptr;
+    }
+    value = int(negative ? -v : v);
+    return p;
+}
+
+static const char* parse_float(const char* p, const char* end, float& value)
+{
+    // exact powers of ten in double, so dividing by them rounds the result once
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+    {
+        if(mantissa < 100000000000000000ull)
+            mantissa = mantissa * 10 + unsigned(*p - '0');
+        else
+            ++exponent;
+    }
+    if(p < end && *p == '.')
+    {
+        for(++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+        {
+            if(mantissa < 100000000000000000ull)
+            {
+                mantissa = mantissa * 10 + unsigned(*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if(digits == 0)
+        return nullptr;
+    if(p < end && (*p == 'e' || *p == 'E'))
+    {
+        int e = 0;
+        p = parse_int(p + 1, end, e);
+        if(!p)
+            return nullptr;
+        exponent += e;
+    }
+    double v = double(mantissa);
+    if(exponent >= 0 && exponent <= 22)
+        v *= powers[exponent];
+    else if(exponent < 0 && exponent >= -22)
+        v /= powers[-exponent];
+    else
+        v *= std::pow(10.0, exponent);
+    value = float(negative ? -v : v);
+    return p;
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char* skip_spaces(const char* p, const char* end)
+{
+    while(p < end && is_space(*p))
+        ++p;
+    return p;
+}
+
+// a face corner as written, positive indices are from the start of the file,
+// negative ones count back from the elements before the line
+struct ObjCorner
+{
+    int position;  // 0 based, relative ones are from the start of the chunk
+    int uv;  // absent_index when not given
+    int normal;
+    unsigned relative;  // bit 0 / 1 / 2 for position / uv / normal from the start of the chunk
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec4> normals;
+    std::vector<glm::vec2> uvs;
+    std::vector<ObjCorner> corners;  // three per triangle
+    std::vector<int> materials;  // per triangle into material_names, -1 for the one of the chunks before
+    std::vector<std::string> material_names;  // usemtl lines in order
+    std::string error;  // empty unless parsing failed
+
+    // elements of the chunks before
+    size_t position_base;
+    size_t uv_base;
+    size_t normal_base;
+    size_t triangle_base;
+    size_t vertex_base;  // deduplicated vertices first used by the chunks before
+};
+
+// index of v / vt / vn, 1 based or negative, return the 0 based one
+static bool get_obj_index(int value, size_t count, unsigned bit, int& index, unsigned& relative)
+{
+    if(value > 0)
+    {
+        index = value - 1;
+        return true;
+    }
+    if(value == 0)
+        return false;
+    index = int(count) + value;
+    relative |= bit;
+    return true;
+}
+
+static const char* parse_obj_corner(const char* p, const char* end, const ObjChunk& chunk, ObjCorner& corner)
+{
+    corner.uv = absent_index;
+    corner.normal = absent_index;
+    corner.relative = 0;
+    int value = 0;
+    p = parse_int(p, end, value);
+    if(!p || !get_obj_index(value, chunk.positions.size(), 1, corner.position, corner.relative))
+        return nullptr;
+    if(p < end && *p == '/')
+    {
+        ++p;
+        if(p < end && *p != '/')
+        {
+            p = parse_int(p, end, value);
+            if(!p || !get_obj_index(value, chunk.uvs.size(), 2, corner.uv, corner.relative))
+                return nullptr;
+        }
+        if(p < end && *p == '/')
+        {
+            p = parse_int(p + 1, end, value);
+            if(!p || !get_obj_index(value, chunk.normals.size(), 4, corner.normal, corner.relative))
+                return nullptr;
+        }
+    }
+    return p;
+}
+
+// parse the lines of a chunk, the elements referenced are resolved once all chunks are done
+static void parse_obj_chunk(ObjChunk& chunk)
+{
+    std::vector<ObjCorner> polygon;
+    int material = -1;
+    const char* end = chunk.end;
+    for(const char* line = chunk.begin; line < end;)
+    {
+        const char* line_end = static_cast<const char*>(std::memchr(line, '\n', size_t(end - line)));
+        if(!line_end)
+            line_end = end;
+        const char* p = skip_spaces(line, line_end);
+        const char* keyword = p;
+        while(p < line_end && !is_space(*p))
+            ++p;
+        const size_t keyword_size = size_t(p - keyword);
+        bool valid = true;
+
+        if(keyword_size == 1 && keyword[0] == 'v')
+        {
+            glm::vec4 v(0.0f, 0.0f, 0.0f, 1.0f);
+            for(int i = 0; i < 3 && valid; ++i)
+                valid = (p = parse_float(skip_spaces(p, line_end), line_end, v[i])) != nullptr;
+            chunk.positions.push_back(v);
+        }
+        else if(keyword_size == 2 && keyword[0] == 'v' && keyword[1] == 't')
+        {
+            // v is optional, 0 for 1d textures
+            glm::vec2 uv(0.0f);
+            valid = (p = parse_float(skip_spaces(p, line_end), line_end, uv.x)) != nullptr;
+            if(valid && skip_spaces(p, line_end) < line_end)
+                valid = (p = parse_float(skip_spaces(p, line_end), line_end, uv.y)) != nullptr;
+            chunk.uvs.push_back(uv);
+        }
+        else if(keyword_size == 2 && keyword[0] == 'v' && keyword[1] == 'n')
+        {
+            glm::vec4 n(0.0f);
+            for(int i = 0; i < 3 && valid; ++i)
+                valid = (p = parse_float(skip_spaces(p, line_end), line_end, n[i])) != nullptr;
+            chunk.normals.push_back(n);
+        }
+        else if(keyword_size == 1 && keyword[0] == 'f')
+        {
+            polygon.clear();
+            for(p = skip_spaces(p, line_end); p < line_end; p = skip_spaces(p, line_end))
+            {
+                ObjCorner corner;
+                p = parse_obj_corner(p, line_end, chunk, corner);
+                if(!p || (p < line_end && !is_space(*p)))
+                {
+                    valid = false;
+                    break;
+                }
+                polygon.push_back(corner);
+            }
+            valid = valid && polygon.size() >= 3;
+            for(size_t i = 1; valid && i + 1 < polygon.size(); ++i)
+            {
+                chunk.corners.push_back(polygon[0]);
+                chunk.corners.push_back(polygon[i]);
+                chunk.corners.push_back(polygon[i + 1]);
+                chunk.materials.push_back(material);
+            }
+        }
+        else if(keyword_size == 6 && std::memcmp(keyword, "usemtl", 6) == 0)
+        {
+            p = skip_spaces(p, line_end);
+            const char* name_end = line_end;
+            while(name_end > p && is_space(name_end[-1]))
+                --name_end;
+            chunk.material_names.push_back(std::string(p, name_end));
+            material = int(chunk.material_names.size() - 1);
+        }
+        // comments, groups, objects, smoothing groups, lines and points are not needed
+
+        if(!valid)
+        {
+            chunk.error = std::string(line, std::min(line_end, line + 80));
+            return;
+        }
+        line = line_end + 1;
+    }
+}
+
+// the three indices of a corner, absent ones are all ones
+struct VertexKey
+{
+    unsigned position;
+    unsigned uv;
+    unsigned normal;
+
+    bool operator==(const VertexKey& other) const
+    {
+        return position == other.position && uv == other.uv && normal == other.normal;
+    }
+};
+
+struct VertexKeyHash
+{
+    size_t operator()(const VertexKey& key) const
+    {
+        uint64_t h = key.position * 0x9E3779B97F4A7C15ull;
+        h ^= (key.uv + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2)) * 0xC2B2AE3D27D4EB4Full;
+        h ^= (key.normal + 0x94D049BB133111EBull + (h << 6) + (h >> 2)) * 0x165667B19E3779F9ull;
+        return size_t(h ^ (h >> 29));
+    }
+};
+
+// corner -> the first corner with the same indices, open addressing over corner numbers filled without
+// locks, a slot once taken only ever holds corners of that one key, so a key always probes to it
+class CornerTable
+{
+public:
+    explicit CornerTable(const std::vector<VertexKey>& keys):
+        m_keys(keys)
+    {
+        size_t size = 1;
+        while(size < keys.size() * 2)
+            size *= 2;
+        m_mask = size - 1;
+        m_slots.reset(new std::atomic<unsigned>[size]);
+        for(size_t i = 0; i < size; ++i)
+            m_slots[i].store(empty_slot, std::memory_order_relaxed);
+    }
+
+    // keep corner if it is the smallest with its key so far
+    void insert(unsigned corner)
+    {
+        const VertexKey& key = m_keys[corner];
+        for(size_t slot = VertexKeyHash()(key) & m_mask;; slot = (slot + 1) & m_mask)
+        {
+            unsigned current = m_slots[slot].load();
+            // on failure current is the corner that took the slot first
+            if(current == empty_slot && m_slots[slot].compare_exchange_strong(current, corner))
+                return;
+            if(!(m_keys[current] == key))
+                continue;
+            while(corner < current && !m_slots[slot].compare_exchange_weak(current, corner))
+            {
+            }
+            return;
+        }
+    }
+
+    // after all inserts, the smallest corner with the key of corner
+    unsigned find(unsigned corner) const
+    {
+        const VertexKey& key = m_keys[corner];
+        for(size_t slot = VertexKeyHash()(key) & m_mask;; slot = (slot + 1) & m_mask)
+        {
+            const unsigned current = m_slots[slot].load(std::memory_order_relaxed);
+            if(m_keys[current] == key)
+                return current;
+        }
+    }
+
+private:
+    static const unsigned empty_slot = ~0u;
+
+    const std::vector<VertexKey>& m_keys;
+    size_t m_mask;
+    std::unique_ptr<std::atomic<unsigned>[]> m_slots;
+};
+
+// turn the relative indices of the corners into ones from the start of the file and check them
+static bool resolve_obj_corners(ObjChunk& chunk, size_t position_count, size_t uv_count, size_t normal_count)
+{
+    for(ObjCorner& corner : chunk.corners)
+    {
+        if(corner.relative & 1)
+            corner.position += int(chunk.position_base);
+        if(corner.relative & 2)
+            corner.uv += int(chunk.uv_base);
+        if(corner.relative & 4)
+            corner.normal += int(chunk.normal_base);
+        if(corner.position < 0 || size_t(corner.position) >= position_count
+            || (corner.uv != absent_index && (corner.uv < 0 || size_t(corner.uv) >= uv_count))
+            || (corner.normal != absent_index && (corner.normal < 0 || size_t(corner.normal) >= normal_count)))
+        {
+            chunk.error = "face index out of range";
+            return false;
+        }
+    }
+    return true;
+}
+
+static VertexKey get_vertex_key(const ObjCorner& corner)
+{
+    return {unsigned(corner.position), unsigned(corner.uv == absent_index ? -1 : corner.uv),
+        unsigned(corner.normal == absent_index ? -1 : corner.normal)};
+}
+
+// usemtl names numbered in the order first used, triangles before any get an empty name
+static void resolve_obj_materials(std::vector<ObjChunk>& chunks, ImportedMesh& mesh, unsigned thread_count)
+{
+    std::unordered_map<std::string, unsigned> ids;
+    auto get_id = [&](const std::string& name) {
+        auto result = ids.emplace(name, unsigned(mesh.material_names.size()));
+        if(result.second)
+            mesh.material_names.push_back(name);
+        return result.first->second;
+    };
+
+    // the name chunks continue with, and the global id of every chunk local name
+    std::vector<unsigned> inherited(chunks.size());
+    std::vector<std::vector<unsigned>> local_ids(chunks.size());
+    int current = -1;
+    for(size_t c = 0; c < chunks.size(); ++c)
+    {
+        const ObjChunk& chunk = chunks[c];
+        if(current < 0 && std::find(chunk.materials.begin(), chunk.materials.end(), -1) != chunk.materials.end())
+            current = int(get_id(""));
+        inherited[c] = unsigned(std::max(current, 0));
+        for(const std::string& name : chunk.material_names)
+            local_ids[c].push_back(get_id(name));
+        if(!local_ids[c].empty())
+            current = int(local_ids[c].back());
+    }
+    if(mesh.material_names.empty())
+        mesh.material_names.push_back("");
+
+    parallel_for(chunks.size(), thread_count, [&](size_t c) {
+        const ObjChunk& chunk = chunks[c];
+        for(size_t i = 0; i < chunk.materials.size(); ++i)
+        {
+            const int local = chunk.materials[i];
+            mesh.materials[chunk.triangle_base + i] = local < 0 ? inherited[c] : local_ids[c][local];
+        }
+    });
+}
+
+// corners with the same indices share a vertex, numbered by their first corner in file order:
+// the table keeps the smallest corner of every key, those corners then take consecutive numbers chunk by chunk
+static void deduplicate_obj_vertices(std::vector<ObjChunk>& chunks, const ImportedMesh& elements,
+    ImportedMesh& mesh, size_t corner_count, unsigned thread_count)
+{
+    const bool has_uvs = !elements.uvs.empty();
+    const bool has_normals = !elements.normals.empty();
+    std::vector<VertexKey> keys(corner_count);
+    parallel_for(chunks.size(), thread_count, [&](size_t c) {
+        const ObjChunk& chunk = chunks[c];
+        for(size_t i = 0; i < chunk.corners.size(); ++i)
+            keys[chunk.triangle_base * 3 + i] = get_vertex_key(chunk.corners[i]);
+    });
+    CornerTable table(keys);
+    parallel_for(chunks.size(), thread_count, [&](size_t c) {
+        const ObjChunk& chunk = chunks[c];
+        for(size_t i = 0; i < chunk.corners.size(); ++i)
+            table.insert(unsigned(chunk.triangle_base * 3 + i));
+    });
+
+    std::vector<unsigned char> first_use(corner_count);
+    std::vector<size_t> vertex_counts(chunks.size());
+    parallel_for(chunks.size(), thread_count, [&](size_t c) {
+        const ObjChunk& chunk = chunks[c];
+        size_t count = 0;
+        for(size_t i = 0; i < chunk.corners.size(); ++i)
+        {
+            const unsigned corner = unsigned(chunk.triangle_base * 3 + i);
+            first_use[corner] = table.find(corner) == corner;
+            count += first_use[corner];
+        }
+        vertex_counts[c] = count;
+    });
+    size_t vertex_count = 0;
+    for(size_t c = 0; c < chunks.size(); ++c)
+    {
+        chunks[c].vertex_base = vertex_count;
+        vertex_count += vertex_counts[c];
+    }
+
+    mesh.positions.resize(vertex_count);
+    mesh.uvs.resize(has_uvs ? vertex_count : 0);
+    mesh.normals.resize(has_normals ? vertex_count : 0);
+    parallel_for(chunks.size(), thread_count, [&](size_t c) {
+        const ObjChunk& chunk = chunks[c];
+        unsigned vertex = unsigned(chunk.vertex_base);
+        for(size_t i = 0; i < chunk.corners.size(); ++i)
+        {
+            const size_t corner = chunk.triangle_base * 3 + i;
+            if(!first_use[corner])
+                continue;
+            const ObjCorner& k = chunk.corners[i];
+            mesh.positions[vertex] = elements.positions[k.position];
+            if(has_uvs)
+                mesh.uvs[vertex] = k.uv != absent_index ? elements.uvs[k.uv] : glm::vec2(0.0f);
+            if(has_normals)
+                mesh.normals[vertex] = k.normal != absent_index ? elements.normals[k.normal] : glm::vec4(0.0f);
+            mesh.indices[corner] = vertex++;
+        }
+    });
+    // the other corners take the number of the first one, written in the pass before
+    parallel_for(chunks.size(), thread_count, [&](size_t c) {
+        const ObjChunk& chunk = chunks[c];
+        for(size_t i = 0; i < chunk.corners.size(); ++i)
+        {
+            const unsigned corner = unsigned(chunk.triangle_base * 3 + i);
+            if(!first_use[corner])
+                mesh.indices[corner] = mesh.indices[table.find(corner)];
+        }
+    });
+}
+
+static bool import_obj(const MappedFile& file, const std::string& path, ImportedMesh& mesh, unsigned thread_count)
+{
+    // chunks end after a line break, the last one at the end of the file
+    const char* data = reinterpret_cast<const char*>(file.get_data());
+    const size_t size = file.get_size();
+    const size_t chunk_count = std::max<size_t>(1, std::min<size_t>(size / min_chunk_size, thread_count * chunks_per_thread));
+    std::vector<ObjChunk> chunks(chunk_count);
+    const char* begin = data;
+    for(size_t c = 0; c < chunk_count; ++c)
+    {
+        const char* end = data + size * (c + 1) / chunk_count;
+        if(end < begin)
+            end = begin;
+        const char* line_end = c + 1 < chunk_count ?
+            static_cast<const char*>(std::memchr(end, '\n', size_t(data + size - end))) : nullptr;
+        end = line_end ? line_end + 1 : data + size;
+        chunks[c].begin = begin;
+        chunks[c].end = end;
+        begin = end;
+    }
+    parallel_for(chunk_count, thread_count, [&](size_t c) { parse_obj_chunk(chunks[c]); });
+
+    ImportedMesh elements;
+    size_t position_count = 0, uv_count = 0, normal_count = 0, triangle_count = 0;
+    for(ObjChunk& chunk : chunks)
+    {
+        if(!chunk.error.empty())
+        {
+            std::cerr << "Bad obj line \"" << chunk.error << "\": " << path << "\n";
+            return false;
+        }
+        chunk.position_base = position_count;
+        chunk.uv_base = uv_count;
+        chunk.normal_base = normal_count;
+        chunk.triangle_base = triangle_count;
+        position_count += chunk.positions.size();
+        uv_count += chunk.uvs.size();
+        normal_count += chunk.normals.size();
+        triangle_count += chunk.materials.size();
+    }
+    if(position_count > std::numeric_limits<int>::max() || triangle_count * 3 > std::numeric_limits<unsigned>::max())
+    {
+        std::cerr << "Obj too large: " << path << "\n";
+        return false;
+    }
+
+    elements.positions.resize(position_count);
+    elements.uvs.resize(uv_count);
+    elements.normals.resize(normal_count);
+    std::atomic<bool> valid(true);
+    std::atomic<bool> has_attributes(false);
+    parallel_for(chunk_count, thread_count, [&](size_t c) {
+        ObjChunk& chunk = chunks[c];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), elements.positions.begin() + chunk.position_base);
+        std::copy(chunk.uvs.begin(), chunk.uvs.end(), elements.uvs.begin() + chunk.uv_base);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), elements.normals.begin() + chunk.normal_base);
+        if(!resolve_obj_corners(chunk, position_count, uv_count, normal_count))
+            valid = false;
+        for(const ObjCorner& corner : chunk.corners)
+            if(corner.uv != absent_index || corner.normal != absent_index)
+            {
+                has_attributes = true;
+                break;
+            }
+    });
+    if(!valid)
+    {
+        std::cerr << "Obj face index out of range: " << path << "\n";
+        return false;
+    }
+
+    mesh.indices.resize(triangle_count * 3);
+    mesh.materials.resize(triangle_count);
+    mesh.material_names.clear();
+    resolve_obj_materials(chunks, mesh, thread_count);
+    if(has_attributes)
+    {
+        // uvs and normals only exist per corner, only those actually used are kept
+        elements.uvs.resize(std::any_of(chunks.begin(), chunks.end(), [](const ObjChunk& chunk) {
+            return std::any_of(chunk.corners.begin(), chunk.corners.end(),
+                [](const ObjCorner& corner) { return corner.uv != absent_index; });
+        }) ? uv_count : 0);
+        elements.normals.resize(std::any_of(chunks.begin(), chunks.end(), [](const ObjChunk& chunk) {
+            return std::any_of(chunk.corners.begin(), chunk.corners.end(),
+                [](const ObjCorner& corner) { return corner.normal != absent_index; });
+        }) ? normal_count : 0);
+        deduplicate_obj_vertices(chunks, elements, mesh, triangle_count * 3, thread_count);
+    }
+    else
+    {
+        // positions only, a vertex per position as the file numbers them
+        mesh.positions.swap(elements.positions);
+        mesh.uvs.clear();
+        mesh.normals.clear();
+        parallel_for(chunk_count, thread_count, [&](size_t c) {
+            const ObjChunk& chunk = chunks[c];
+            for(size_t i = 0; i < chunk.corners.size(); ++i)
+                mesh.indices[chunk.triangle_base * 3 + i] = unsigned(chunk.corners[i].position);
+        });
+    }
+    return true;
+}
+
+// ---- ply ----
+
+enum class PlyType
+{
+    INT8,
+    UINT8,
+    INT16,
+    UINT16,
+    INT32,
+    UINT32,
+    FLOAT32,
+    FLOAT64,
+};
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type;  // of the items for a list
+    bool is_list;
+    PlyType count_type;
+    size_t offset;  // in the element, for elements without lists
+};
+
+struct PlyElement
+{
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+    size_t size;  // bytes of one element, 0 when it has lists
+};
+
+static bool get_ply_type(const std::string& name, PlyType& type)
+{
+    static const struct { const char* names[2]; PlyType type; } types[] = {
+        {{"char", "int8"}, PlyType::INT8}, {{"uchar", "uint8"}, PlyType::UINT8},
+        {{"short", "int16"}, PlyType::INT16}, {{"ushort", "uint16"}, PlyType::UINT16},
+        {{"int", "int32"}, PlyType::INT32}, {{"uint", "uint32"}, PlyType::UINT32},
+        {{"float", "float32"}, PlyType::FLOAT32}, {{"double", "float64"}, PlyType::FLOAT64},
+    };
+    for(const auto& t : types)
+        if(name == t.names[0] || name == t.names[1])
+        {
+            type = t.type;
+            return true;
+        }
+    return false;
+}
+
+static size_t get_ply_type_size(PlyType type)
+{
+    switch(type)
+    {
+    case PlyType::INT8:
+    case PlyType::UINT8:
+        return 1;
+    case PlyType::INT16:
+    case PlyType::UINT16:
+        return 2;
+    case PlyType::INT32:
+    case PlyType::UINT32:
+    case PlyType::FLOAT32:
+        return 4;
+    case PlyType::FLOAT64:
+        return 8;
+    }
+    return 0;
+}
+
+// values are read unaligned, big endian ones swapped, the hosts are little endian
+static double read_ply_value(const unsigned char* p, PlyType type, bool swap)
+{
+    unsigned char bytes[8];
+    const size_t size = get_ply_type_size(type);
+    for(size_t i = 0; i < size; ++i)
+        bytes[i] = swap ? p[size - 1 - i] : p[i];
+    switch(type)
+    {
+    case PlyType::INT8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+    case PlyType::UINT8: { uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+    case PlyType::INT16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PlyType::UINT16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PlyType::INT32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::UINT32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::FLOAT32: { float v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::FLOAT64: { double v; std::memcpy(&v, bytes, 8); return v; }
+    }
+    return 0.0;
+}
+
+// header lines up to end_header, data_offset is where the elements start
+static bool parse_ply_header(const MappedFile& file, std::vector<PlyElement>& elements, bool& swap,
+    size_t& data_offset, std::string& error)
+{
+    const char* data = reinterpret_cast<const char*>(file.get_data());
+    const size_t size = file.get_size();
+    size_t pos = 0;
+    bool format_found = false;
+    while(true)
+    {
+        const char* line_end = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+        if(!line_end)
+        {
+            error = "no end_header";
+            return false;
+        }
+        std::string line(data + pos, line_end);
+        pos = size_t(line_end - data) + 1;
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        std::vector<std::string> words;
+        for(size_t i = 0; i < line.size();)
+        {
+            size_t j = line.find(' ', i);
+            if(j == std::string::npos)
+                j = line.size();
+            if(j > i)
+                words.push_back(line.substr(i, j - i));
+            i = j + 1;
+        }
+        if(words.empty() || words[0] == "ply" || words[0] == "comment" || words[0] == "obj_info")
+            continue;
+        if(words[0] == "end_header")
+            break;
+
+        if(words[0] == "format" && words.size() >= 2)
+        {
+            if(words[1] == "ascii")
+            {
+                error = "ascii ply is not supported, only binary";
+                return false;
+            }
+            swap = words[1] == "binary_big_endian";
+            format_found = swap || words[1] == "binary_little_endian";
+        }
+        else if(words[0] == "element" && words.size() == 3)
+        {
+            PlyElement element;
+            element.name = words[1];
+            element.count = size_t(std::strtoull(words[2].c_str(), nullptr, 10));
+            element.size = 0;
+            elements.push_back(element);
+        }
+        else if(words[0] == "property" && !elements.empty())
+        {
+            PlyProperty property;
+            property.is_list = words.size() == 5 && words[1] == "list";
+            property.count_type = PlyType::UINT8;
+            property.offset = 0;
+            bool known = property.is_list ?
+                get_ply_type(words[2], property.count_type) && get_ply_type(words[3], property.type) :
+                words.size() == 3 && get_ply_type(words[1], property.type);
+            if(!known)
+            {
+                error = "bad property \"" + line + "\"";
+                return false;
+            }
+            property.name = words.back();
+            elements.back().properties.push_back(property);
+        }
+        else
+        {
+            error = "bad header line \"" + line + "\"";
+            return false;
+        }
+    }
+    if(!format_found)
+    {
+        error = "no binary format";
+        return false;
+    }
+
+    for(PlyElement& element : elements)
+    {
+        size_t offset = 0;
+        for(PlyProperty& property : element.properties)
+        {
+            if(property.is_list)
+            {
+                offset = 0;
+                break;
+            }
+            property.offset = offset;
+            offset += get_ply_type_size(property.type);
+        }
+        element.size = offset;
+    }
+    data_offset = pos;
+    return true;
+}
+
+// bytes of the element at p, 0 if it runs past end
+static size_t get_ply_element_size(const PlyElement& element, const unsigned char* p, const unsigned char* end, bool swap)
+{
+    const unsigned char* start = p;
+    for(const PlyProperty& property : element.properties)
+    {
+        if(!property.is_list)
+        {
+            p += get_ply_type_size(property.type);
+            continue;
+        }
+        const size_t count_size = get_ply_type_size(property.count_type);
+        if(p + count_size > end)
+            return 0;
+        const double count = read_ply_value(p, property.count_type, swap);
+        if(count < 0.0)
+            return 0;
+        p += count_size + size_t(count) * get_ply_type_size(property.type);
+    }
+    return p <= end ? size_t(p - start) : 0;
+}
+
+static const PlyProperty* find_ply_property(const PlyElement& element, const char* name, const char* other_name = nullptr)
+{
+    for(const PlyProperty& property : element.properties)
+        if(property.name == name || (other_name && property.name == other_name))
+            return &property;
+    return nullptr;
+}
+
+static bool import_ply(const MappedFile& file, const std::string& path, ImportedMesh& mesh, unsigned thread_count)
+{
+    std::vector<PlyElement> elements;
+    bool swap = false;
+    size_t offset = 0;
+    std::string error;
+    if(!parse_ply_header(file, elements, swap, offset, error))
+    {
+        std::cerr << "Bad ply header, " << error << ": " << path << "\n";
+        return false;
+    }
+
+    const unsigned char* data = file.get_data();
+    const unsigned char* end = data + file.get_size();
+    const PlyElement* vertex_element = nullptr;
+    const PlyElement* face_element = nullptr;
+    const unsigned char* vertex_data = nullptr;
+    // face element starts at every min_chunk_elements, found by walking the list lengths, and
+    // the triangles before each
+    std::vector<const unsigned char*> face_chunks;
+    std::vector<size_t> triangle_bases;
+    const PlyProperty* index_list = nullptr;
+    for(const PlyElement& element : elements)
+    {
+        const bool is_vertex = !vertex_element && element.name == "vertex";
+        const bool is_face = !face_element && element.name == "face";
+        if(is_vertex)
+        {
+            if(element.size == 0)
+            {
+                std::cerr << "Ply vertices with lists are not supported: " << path << "\n";
+                return false;
+            }
+            vertex_element = &element;
+            vertex_data = data + offset;
+        }
+        if(is_face)
+        {
+            face_element = &element;
+            index_list = find_ply_property(element, "vertex_indices", "vertex_index");
+            if(!index_list || !index_list->is_list)
+            {
+                std::cerr << "Ply faces have no vertex_indices list: " << path << "\n";
+                return false;
+            }
+        }
+
+        if(element.size > 0)
+        {
+            if(element.count > size_t(end - data - offset) / element.size)
+            {
+                std::cerr << "Ply truncated: " << path << "\n";
+                return false;
+            }
+            offset += element.count * element.size;
+            continue;
+        }
+        size_t triangle_count = 0;
+        for(size_t i = 0; i < element.count; ++i)
+        {
+            const unsigned char* p = data + offset;
+            if(is_face && i % min_chunk_elements == 0)
+            {
+                face_chunks.push_back(p);
+                triangle_bases.push_back(triangle_count);
+            }
+            const size_t size = get_ply_element_size(element, p, end, swap);
+            if(size == 0)
+            {
+                std::cerr << "Ply truncated: " << path << "\n";
+                return false;
+            }
+            if(is_face)
+            {
+                // the count is right before the items, find where the list is in this face
+                const unsigned char* q = p;
+                for(const PlyProperty& property : element.properties)
+                {
+                    if(&property == index_list)
+                        break;
+                    q += property.is_list ? get_ply_type_size(property.count_type)
+                        + size_t(read_ply_value(q, property.count_type, swap)) * get_ply_type_size(property.type)
+                        : get_ply_type_size(property.type);
+                }
+                const size_t corners = size_t(read_ply_value(q, index_list->count_type, swap));
+                triangle_count += corners >= 3 ? corners - 2 : 0;
+            }
+            offset += size;
+        }
+        if(is_face)
+            triangle_bases.push_back(triangle_count);
+    }
+    if(!vertex_element || !face_element)
+    {
+        std::cerr << "Ply has no vertex or face element: " << path << "\n";
+        return false;
+    }
+
+    const PlyProperty* coords[3] = {find_ply_property(*vertex_element, "x"), find_ply_property(*vertex_element, "y"),
+        find_ply_property(*vertex_element, "z")};
+    const PlyProperty* normal_coords[3] = {find_ply_property(*vertex_element, "nx"),
+        find_ply_property(*vertex_element, "ny"), find_ply_property(*vertex_element, "nz")};
+    const PlyProperty* uv_coords[2] = {find_ply_property(*vertex_element, "u", "s"),
+        find_ply_property(*vertex_element, "v", "t")};
+    if(!uv_coords[0])
+    {
+        uv_coords[0] = find_ply_property(*vertex_element, "texture_u");
+        uv_coords[1] = find_ply_property(*vertex_element, "texture_v");
+    }
+    if(!coords[0] || !coords[1] || !coords[2])
+    {
+        std::cerr << "Ply vertices have no x, y, z: " << path << "\n";
+        return false;
+    }
+    const bool has_normals = normal_coords[0] && normal_coords[1] && normal_coords[2];
+    const bool has_uvs = uv_coords[0] && uv_coords[1];
+
+    const size_t vertex_count = vertex_element->count;
+    if(vertex_count > std::numeric_limits<unsigned>::max() || triangle_bases.back() * 3 > std::numeric_limits<unsigned>::max())
+    {
+        std::cerr << "Ply too large: " << path << "\n";
+        return false;
+    }
+    mesh.positions.resize(vertex_count);
+    mesh.normals.resize(has_normals ? vertex_count : 0);
+    mesh.uvs.resize(has_uvs ? vertex_count : 0);
+    const size_t vertex_chunks = (vertex_count + min_chunk_elements - 1) / min_chunk_elements;
+    parallel_for(vertex_chunks, thread_count, [&](size_t c) {
+        const size_t last = std::min(vertex_count, (c + 1) * min_chunk_elements);
+        for(size_t i = c * min_chunk_elements; i < last; ++i)
+        {
+            const unsigned char* p = vertex_data + i * vertex_element->size;
+            glm::vec4& position = mesh.positions[i];
+            for(int k = 0; k < 3; ++k)
+                position[k] = float(read_ply_value(p + coords[k]->offset, coords[k]->type, swap));
+            position.w = 1.0f;
+            if(has_normals)
+                for(int k = 0; k < 3; ++k)
+                    mesh.normals[i][k] = float(read_ply_value(p + normal_coords[k]->offset, normal_coords[k]->type, swap));
+            if(has_uvs)
+                for(int k = 0; k < 2; ++k)
+                    mesh.uvs[i][k] = float(read_ply_value(p + uv_coords[k]->offset, uv_coords[k]->type, swap));
+        }
+    });
+
+    const size_t triangle_count = triangle_bases.back();
+    mesh.indices.resize(triangle_count * 3);
+    mesh.materials.assign(triangle_count, 0);
+    mesh.material_names.assign(1, "");
+    std::atomic<bool> valid(true);
+    parallel_for(face_chunks.size(), thread_count, [&](size_t c) {
+        const size_t count = std::min(face_element->count - c * min_chunk_elements, min_chunk_elements);
+        const unsigned char* p = face_chunks[c];
+        unsigned* indices = mesh.indices.data() + triangle_bases[c] * 3;
+        const size_t index_size = get_ply_type_size(index_list->type);
+        for(size_t i = 0; i < count; ++i)
+        {
+            for(const PlyProperty& property : face_element->properties)
+            {
+                if(!property.is_list)
+                {
+                    p += get_ply_type_size(property.type);
+                    continue;
+                }
+                const size_t n = size_t(read_ply_value(p, property.count_type, swap));
+                p += get_ply_type_size(property.count_type);
+                if(&property == index_list)
+                {
+                    // a fan over the polygon
+                    for(size_t k = 1; k + 1 < n; ++k)
+                    {
+                        const size_t corners[3] = {0, k, k + 1};
+                        for(size_t corner : corners)
+                        {
+                            const double index = read_ply_value(p + corner * index_size, property.type, swap);
+                            if(index < 0.0 || index >= double(vertex_count))
+                                valid = false;
+                            *indices++ = unsigned(index);
+                        }
+                    }
+                }
+                p += n * get_ply_type_size(property.type);
+            }
+        }
+    });
+    if(!valid)
+    {
+        std::cerr << "Ply face index out of range: " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool import_mesh(const std::string& path, ImportedMesh& mesh, unsigned thread_count)
+{
+    if(thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    const bool is_obj = has_extension(path, ".obj");
+    if(!is_mesh_path(path))
+    {
+        std::cerr << "Unknown mesh format, expect .obj or .ply: " << path << "\n";
+        return false;
+    }
+
+    MappedFile file;
+    if(!file.open(path))
+        return false;
+    mesh = ImportedMesh();
+    return is_obj ? import_obj(file, path, mesh, thread_count) : import_ply(file, path, mesh, thread_count);
+}
+
+bool is_mesh_path(const std::string& path)
+{
+    return has_extension(path, ".obj") || has_extension(path, ".ply");
+}
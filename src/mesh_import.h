@@ -0,0 +1,31 @@
+#ifndef __MESH_IMPORT__
+#define __MESH_IMPORT__
+
+#include <vector>
+#include <string>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+// triangles read from a mesh file, one array per attribute, each in the layout its storage buffer takes
+struct ImportedMesh
+{
+    std::vector<glm::vec4> positions;  // w is 1, same as Scene::vertices
+    std::vector<glm::vec4> normals;  // w is 0, empty when the file has none
+    std::vector<glm::vec2> uvs;  // empty when the file has none
+    std::vector<unsigned> indices;  // three vertices per triangle, polygons are split into fans
+    std::vector<unsigned> materials;  // per triangle, into material_names
+    std::vector<std::string> material_names;  // usemtl names of obj in the order first used, else one empty name
+};
+
+// read path, .obj or binary .ply by extension, from a memory mapping parsed in chunks on thread_count threads
+// (0 means one per hardware thread), obj chunks end at line ends, ply chunks are runs of elements
+// obj corners with the same position / uv / normal indices become one vertex, numbered in the order
+// of their first use, so the result is the same for any thread count
+// ply vertices are taken as they are, the first element named vertex and face are read, with
+// x / y / z, nx / ny / nz, u / v (or s / t) and the vertex_indices (or vertex_index) list
+bool import_mesh(const std::string& path, ImportedMesh& mesh, unsigned thread_count = 0);
+// path ends with .obj or .ply, in any case
+bool is_mesh_path(const std::string& path);
+
+
+#endif // __MESH_IMPORT__
@@ -0,0 +1,283 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include "options.h"
+
+Options::Options():
+    headless(false),
+    backend(Backend::GPU),
+    threads(0),
+    simd(detect_simd_isa()),
+    wavefront(false),
+    sort_by_material(false),
+    group_size_x(0),
+    group_size_y(0),
+    width(600),
+    height(int(600 / (16.0f / 9.0f))),
+    samples_per_pixel(1),
+    sampler(SamplerType::SOBOL),
+    denoise(false),
+    reprojection_samples(16),
+    max_fps(60),
+    adaptive_threshold(0.0f),
+    adaptive_min_samples(8),
+    output_path("texture.ppm"),
+    shader_path("../src/ray_tracking.comp"),
+    shader_cache_path("shader_cache"),
+    coordinator_port(0),
+    service_port(0),
+    cache_mb(1024)
+{
+}
+
+static bool parse_int(const char* name, const char* value, int min, int& result)
+{
+    char* end = nullptr;
+    long v = std::strtol(value, &end, 10);
+    if(end == value || *end != '\0' || v < min)
+    {
+        std::cerr << "Invalid value for " << name << ": " << value << "\n";
+        return false;
+    }
+    result = int(v);
+    return true;
+}
+
+static bool parse_float(const char* name, const char* value, float min, float& result)
+{
+    char* end = nullptr;
+    float v = std::strtof(value, &end);
+    if(end == value || *end != '\0' || !(v >= min))
+    {
+        std::cerr << "Invalid value for " << name << ": " << value << "\n";
+        return false;
+    }
+    result = v;
+    return true;
+}
+
+static bool takes_value(const char* arg)
+{
+    static const char* value_options[] = {
+        "--width", "--height", "--spp", "--sampler", "--output", "-o", "--shader", "--backend", "--threads", "--simd", "--scene",
+        "--environment",
+        "--adaptive", "--min-spp", "--reprojection", "--max-fps", "--shader-cache", "--trace", "--wavefront", "--group-size",
+        "--coordinator", "--worker", "--serve", "--cache-mb",
+    };
+    for(const char* name : value_options)
+        if(std::strcmp(arg, name) == 0)
+            return true;
+    return false;
+}
+
+bool parse_options(int argc, char** argv, Options& options)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if(std::strcmp(arg, "--headless") == 0)
+        {
+            options.headless = true;
+            continue;
+        }
+        if(std::strcmp(arg, "--denoise") == 0)
+        {
+            options.denoise = true;
+            continue;
+        }
+        if(std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0)
+            return false;
+
+        // the rest options all need a value
+        if(!takes_value(arg))
+        {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return false;
+        }
+        if(i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+        const char* value = argv[++i];
+        if(std::strcmp(arg, "--width") == 0)
+        {
+            if(!parse_int(arg, value, 1, options.width))
+                return false;
+        }
+        else if(std::strcmp(arg, "--height") == 0)
+        {
+            if(!parse_int(arg, value, 1, options.height))
+                return false;
+        }
+        else if(std::strcmp(arg, "--spp") == 0)
+        {
+            if(!parse_int(arg, value, 1, options.samples_per_pixel))
+                return false;
+        }
+        else if(std::strcmp(arg, "--adaptive") == 0)
+        {
+            if(!parse_float(arg, value, 0.0f, options.adaptive_threshold))
+                return false;
+        }
+        else if(std::strcmp(arg, "--min-spp") == 0)
+        {
+            if(!parse_int(arg, value, 2, options.adaptive_min_samples))
+                return false;
+        }
+        else if(std::strcmp(arg, "--reprojection") == 0)
+        {
+            if(!parse_int(arg, value, 0, options.reprojection_samples))
+                return false;
+        }
+        else if(std::strcmp(arg, "--max-fps") == 0)
+        {
+            if(!parse_int(arg, value, 0, options.max_fps))
+                return false;
+        }
+        else if(std::strcmp(arg, "--output") == 0 || std::strcmp(arg, "-o") == 0)
+            options.output_path = value;
+        else if(std::strcmp(arg, "--shader") == 0)
+            options.shader_path = value;
+        else if(std::strcmp(arg, "--shader-cache") == 0)
+            options.shader_cache_path = value;
+        else if(std::strcmp(arg, "--scene") == 0)
+            options.scene_path = value;
+        else if(std::strcmp(arg, "--environment") == 0)
+            options.environment_path = value;
+        else if(std::strcmp(arg, "--trace") == 0)
+            options.trace_path = value;
+        else if(std::strcmp(arg, "--coordinator") == 0)
+        {
+            if(!parse_int(arg, value, 1, options.coordinator_port) || options.coordinator_port > 65535)
+                return false;
+        }
+        else if(std::strcmp(arg, "--worker") == 0)
+            options.worker_address = value;
+        else if(std::strcmp(arg, "--serve") == 0)
+        {
+            if(!parse_int(arg, value, 1, options.service_port) || options.service_port > 65535)
+                return false;
+        }
+        else if(std::strcmp(arg, "--cache-mb") == 0)
+        {
+            if(!parse_int(arg, value, 1, options.cache_mb))
+                return false;
+        }
+        else if(std::strcmp(arg, "--wavefront") == 0)
+        {
+            if(std::strcmp(value, "off") != 0 && std::strcmp(value, "on") != 0 && std::strcmp(value, "sorted") != 0)
+            {
+                std::cerr << "Unknown wavefront mode: " << value << "\n";
+                return false;
+            }
+            options.wavefront = std::strcmp(value, "off") != 0;
+            options.sort_by_material = std::strcmp(value, "sorted") == 0;
+        }
+        else if(std::strcmp(arg, "--group-size") == 0)
+        {
+            // auto or <x>x<y>, GpuRenderer checks the size fits the tile and the driver
+            int x = 0, y = 0;
+            char end = '\0';
+            if(std::strcmp(value, "auto") != 0 && (std::sscanf(value, "%dx%d%c", &x, &y, &end) != 2 || x <= 0 || y <= 0))
+            {
+                std::cerr << "Invalid value for " << arg << ": " << value << "\n";
+                return false;
+            }
+            options.group_size_x = x;
+            options.group_size_y = y;
+        }
+        else if(std::strcmp(arg, "--sampler") == 0)
+        {
+            if(std::strcmp(value, "random") == 0)
+                options.sampler = SamplerType::RANDOM;
+            else if(std::strcmp(value, "sobol") == 0)
+                options.sampler = SamplerType::SOBOL;
+            else if(std::strcmp(value, "bluenoise") == 0)
+                options.sampler = SamplerType::BLUE_NOISE;
+            else
+            {
+                std::cerr << "Unknown sampler: " << value << "\n";
+                return false;
+            }
+        }
+        else if(std::strcmp(arg, "--backend") == 0)
+        {
+            if(std::strcmp(value, "gpu") == 0)
+                options.backend = Options::Backend::GPU;
+            else if(std::strcmp(value, "cpu") == 0)
+                options.backend = Options::Backend::CPU;
+            else
+            {
+                std::cerr << "Unknown backend: " << value << "\n";
+                return false;
+            }
+        }
+        else if(std::strcmp(arg, "--threads") == 0)
+        {
+            int threads;
+            if(!parse_int(arg, value, 0, threads))
+                return false;
+            options.threads = unsigned(threads);
+        }
+        else if(std::strcmp(arg, "--simd") == 0)
+        {
+            if(std::strcmp(value, "auto") == 0)
+                options.simd = detect_simd_isa();
+            else if(std::strcmp(value, "scalar") == 0)
+                options.simd = SimdIsa::SCALAR;
+            else if(std::strcmp(value, "sse") == 0)
+                options.simd = SimdIsa::SSE;
+            else if(std::strcmp(value, "avx2") == 0)
+                options.simd = SimdIsa::AVX2;
+            else
+            {
+                std::cerr << "Unknown simd: " << value << "\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void print_usage(const char* program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+        << "  --headless          render without window and ImGui, save the image and exit\n"
+        << "  --width <n>         render image width, default 600\n"
+        << "  --height <n>        render image height, default width / (16 / 9)\n"
+        << "  --spp <n>           samples per pixel, the most a pixel gets with --adaptive, default 1\n"
+        << "  --adaptive <error>  stop sampling tiles once their relative error is below this, default 0 (off)\n"
+        << "  --min-spp <n>       samples every pixel gets before adaptive sampling, default 8\n"
+        << "  --sampler <name>    random (pcg hash), sobol (Owen scrambled) or bluenoise (sobol shifted per pixel\n"
+        << "                      by a blue noise mask), tables kept in the shader cache directory, default sobol\n"
+        << "  --denoise           filter the image with the first hit normal, depth and albedo, cpu or gpu\n"
+        << "  --reprojection <n>  samples a pixel keeps when the camera is moved in the window, taken from where\n"
+        << "                      its surface was before, 0 restarts the accumulation instead, default 16\n"
+        << "  --max-fps <n>       frames per second the window draws at most, rendering goes on in between on a\n"
+        << "                      thread of its own, 0 for no cap, default 60\n"
+        << "  -o, --output <path> output image of headless mode, .ppm, .pfm or .png, default texture.ppm\n"
+        << "  --shader <path>     compute shader path, default ../src/ray_tracking.comp\n"
+        << "  --shader-cache <dir> directory caching linked shader binaries, \"\" disables, default shader_cache\n"
+        << "  --scene <path>      .rtscene file written by scene_convert, or an .obj / binary .ply mesh imported\n"
+        << "                      and its bvh built at startup, default the built-in scene\n"
+        << "  --environment <path> equirectangular .hdr / .pfm lighting the scene by importance sampling, in place\n"
+        << "                      of the sky, direct light only, default none\n"
+        << "  --trace <path>      write cpu / gpu pass timings of headless mode as Chrome trace json\n"
+        << "  --coordinator <port> render headless by the workers connecting to port, the scene and environment\n"
+        << "                      paths must be valid on them, no adaptive sampling or denoising\n"
+        << "  --worker <host:port> render tiles for the coordinator at host:port with the backend options given\n"
+        << "  --serve <port>      keep running, rendering the jobs sent to port from this machine, the request\n"
+        << "                      \"render <options>\" takes the options here, see render_service.h\n"
+        << "  --cache-mb <n>      memory --serve keeps loaded scenes and renderers in, default 1024\n"
+        << "  --backend <name>    gpu (compute shader) or cpu (multithreaded reference), default gpu\n"
+        << "  --wavefront <mode>  gpu backend kernels: off (one per sample), on (generate / extend / shade / connect queues)\n"
+        << "                      or sorted (rays sorted by material before shading), default off\n"
+        << "  --group-size <size> gpu work group <x>x<y> dividing the 32x32 tile, or auto to time the candidates\n"
+        << "                      once per GPU, kept in the shader cache directory, default auto\n"
+        << "  --threads <n>       threads for the cpu backend, default 0 means all hardware threads\n"
+        << "  --simd <isa>        ray packet kernel of the cpu backend: auto, scalar, sse or avx2, default auto\n"
+        << "  -h, --help          show this message\n";
+}
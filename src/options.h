@@ -0,0 +1,53 @@
+#ifndef __OPTIONS__
+#define __OPTIONS__
+
+#include <string>
+
+#include "ray_packet.h"
+#include "sampler.h"
+
+// command line options, see print_usage for the meaning of each one
+struct Options
+{
+    enum class Backend
+    {
+        GPU,
+        CPU,
+    };
+
+    bool headless;
+    Backend backend;
+    unsigned threads;  // cpu backend threads, 0 means all hardware threads
+    SimdIsa simd;  // cpu backend ray packet instruction set
+    bool wavefront;  // gpu backend runs the wavefront kernels instead of the single one
+    bool sort_by_material;  // wavefront rays are sorted by material before shading
+    int group_size_x;  // gpu work group size, 0 takes the tuned one
+    int group_size_y;
+    int width;
+    int height;
+    int samples_per_pixel;
+    SamplerType sampler;  // where the samples take their random numbers from
+    bool denoise;  // filter the image guided by the first hit normal, depth and albedo
+    int reprojection_samples;  // samples a pixel keeps when the camera moves in the window, 0 restarts instead
+    int max_fps;  // frames per second the window draws at most, 0 for no cap
+    float adaptive_threshold;  // relative error a tile stops sampling at, 0 samples all tiles the same
+    int adaptive_min_samples;  // samples every pixel gets before adaptive sampling starts
+    std::string output_path;
+    std::string shader_path;
+    std::string shader_cache_path;  // directory of linked program binaries, empty disables the cache
+    std::string scene_path;  // .rtscene written by scene_convert, empty for the built-in scene
+    std::string environment_path;  // HDR environment map, empty for the built-in sky
+    std::string trace_path;  // Chrome trace json of the headless render, empty for none
+    int coordinator_port;  // distribute the headless render to workers connecting here, 0 for none
+    std::string worker_address;  // host:port of a coordinator to render for, empty for none
+    int service_port;  // serve render jobs on this port, 0 for none
+    int cache_mb;  // memory the service keeps scenes and renderers in
+
+    Options();
+};
+
+bool parse_options(int argc, char** argv, Options& options);
+void print_usage(const char* program);
+
+
+#endif // __OPTIONS__
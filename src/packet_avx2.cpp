@@ -0,0 +1,57 @@
+// AVX2 packet kernel, this file alone is compiled with AVX2 enabled (see CMakeLists.txt),
+// it is only called after detect_simd_isa() found AVX2 on the running cpu
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#include "packet_kernel.h"
+
+struct Float8
+{
+    static const int width = 8;
+    __m256 v;
+
+    Float8(__m256 value) : v(value) {}
+
+    static Float8 load(const float* p) { return _mm256_load_ps(p); }
+    static Float8 broadcast(float f) { return _mm256_set1_ps(f); }
+    static Float8 from_int(int i) { return _mm256_castsi256_ps(_mm256_set1_epi32(i)); }
+    static void store(float* p, Float8 a) { _mm256_store_ps(p, a.v); }
+    static void store_int(int* p, Float8 a) { _mm256_store_si256((__m256i*)p, _mm256_castps_si256(a.v)); }
+
+    static Float8 sqrt(Float8 a) { return _mm256_sqrt_ps(a.v); }
+    static Float8 min(Float8 a, Float8 b) { return _mm256_min_ps(a.v, b.v); }
+    static Float8 max(Float8 a, Float8 b) { return _mm256_max_ps(a.v, b.v); }
+    static Float8 abs(Float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    // bits of a where mask is set, else bits of b
+    static Float8 select(Float8 mask, Float8 a, Float8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+    // ~a & b
+    static Float8 andnot(Float8 a, Float8 b) { return _mm256_andnot_ps(a.v, b.v); }
+    static bool any(Float8 mask) { return _mm256_movemask_ps(mask.v) != 0; }
+    // lanes set in mask
+    static int count(Float8 mask)
+    {
+        int bits = _mm256_movemask_ps(mask.v);
+        int n = 0;
+        for(; bits; bits &= bits - 1)
+            ++n;
+        return n;
+    }
+
+    friend Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.v, b.v); }
+    friend Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.v, b.v); }
+    friend Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.v, b.v); }
+    friend Float8 operator/(Float8 a, Float8 b) { return _mm256_div_ps(a.v, b.v); }
+    friend Float8 operator&(Float8 a, Float8 b) { return _mm256_and_ps(a.v, b.v); }
+    friend Float8 operator|(Float8 a, Float8 b) { return _mm256_or_ps(a.v, b.v); }
+    friend Float8 operator<(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    friend Float8 operator<=(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    friend Float8 operator>=(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+};
+
+void intersect_packet_avx2(const PacketScene& scene, const RayPacket& rays, HitPacket& hits)
+{
+    intersect_packet<Float8>(scene, rays, hits);
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef __PACKET_KERNEL__
+#define __PACKET_KERNEL__
+
+#include "ray_packet.h"
+
+// packet version of intersect() in ray_tracking.comp, included by one source file per
+// instruction set, F is the SIMD float wrapper of that file, providing:
+//   width, load, broadcast, from_int, arithmetic, min / max, comparison masks, select, any,
+//   count, store
+// everything here must stay templated on F, a non-template inline function would be compiled
+// once per instruction set and the linker could pick the AVX copy for the SSE path
+
+// F::width rays and their closest hits so far
+template<class F>
+struct PacketLanes
+{
+    F ox, oy, oz;
+    F dx, dy, dz;
+    F inv_dx, inv_dy, inv_dz;
+    F a;  // dot(d, d)
+    F closest;
+    F prim;  // int bits
+};
+
+template<class F>
+void intersect_sphere_lanes(const PacketScene& scene, int i, PacketLanes<F>& r)
+{
+    const F t_near = F::broadcast(0.001f);
+    const F zero = F::broadcast(0.0f);
+
+    F ocx = r.ox - F::broadcast(scene.sphere_cx[i]);
+    F ocy = r.oy - F::broadcast(scene.sphere_cy[i]);
+    F ocz = r.oz - F::broadcast(scene.sphere_cz[i]);
+    F half_b = ocx * r.dx + ocy * r.dy + ocz * r.dz;
+    F c = ocx * ocx + ocy * ocy + ocz * ocz - F::broadcast(scene.sphere_r2[i]);
+    F discriminant = half_b * half_b - r.a * c;
+    F mask = discriminant >= zero;
+    if(!F::any(mask))
+        return;
+    F sqrtd = F::sqrt(F::select(mask, discriminant, zero));
+    F t0 = (zero - half_b - sqrtd) / r.a;
+    F t1 = (zero - half_b + sqrtd) / r.a;
+    F hit0 = mask & (t0 >= t_near) & (t0 <= r.closest);
+    F hit1 = F::andnot(hit0, mask & (t1 >= t_near) & (t1 <= r.closest));
+    F hit = hit0 | hit1;
+    r.closest = F::select(hit, F::select(hit0, t0, t1), r.closest);
+    r.prim = F::select(hit, F::from_int(i), r.prim);
+}
+
+template<class F>
+void intersect_triangle_lanes(const PacketScene& scene, int i, PacketLanes<F>& r)
+{
+    const F t_near = F::broadcast(0.001f);
+    const F det_epsilon = F::broadcast(1.0e-8f);
+    const F zero = F::broadcast(0.0f);
+    const F one = F::broadcast(1.0f);
+
+    F e1x = F::broadcast(scene.e1x[i]);
+    F e1y = F::broadcast(scene.e1y[i]);
+    F e1z = F::broadcast(scene.e1z[i]);
+    F e2x = F::broadcast(scene.e2x[i]);
+    F e2y = F::broadcast(scene.e2y[i]);
+    F e2z = F::broadcast(scene.e2z[i]);
+    // p = cross(d, e2)
+    F px = r.dy * e2z - r.dz * e2y;
+    F py = r.dz * e2x - r.dx * e2z;
+    F pz = r.dx * e2y - r.dy * e2x;
+    F det = e1x * px + e1y * py + e1z * pz;
+    F mask = F::abs(det) >= det_epsilon;
+    if(!F::any(mask))
+        return;
+    F inv_det = one / det;
+    F sx = r.ox - F::broadcast(scene.v0x[i]);
+    F sy = r.oy - F::broadcast(scene.v0y[i]);
+    F sz = r.oz - F::broadcast(scene.v0z[i]);
+    F u = (sx * px + sy * py + sz * pz) * inv_det;
+    mask = mask & (u >= zero) & (u <= one);
+    if(!F::any(mask))
+        return;
+    // q = cross(s, e1)
+    F qx = sy * e1z - sz * e1y;
+    F qy = sz * e1x - sx * e1z;
+    F qz = sx * e1y - sy * e1x;
+    F v = (r.dx * qx + r.dy * qy + r.dz * qz) * inv_det;
+    F t = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+    mask = mask & (v >= zero) & (u + v <= one) & (t >= t_near) & (t <= r.closest);
+    r.closest = F::select(mask, t, r.closest);
+    r.prim = F::select(mask, F::from_int(scene.sphere_count + i), r.prim);
+}
+
+// entry distance of every lane into the node box, t_max where missed
+template<class F>
+F hit_aabb_lanes(const BvhNode& node, const PacketLanes<F>& r)
+{
+    F t0x = (F::broadcast(node.bounds_min.x) - r.ox) * r.inv_dx;
+    F t0y = (F::broadcast(node.bounds_min.y) - r.oy) * r.inv_dy;
+    F t0z = (F::broadcast(node.bounds_min.z) - r.oz) * r.inv_dz;
+    F t1x = (F::broadcast(node.bounds_max.x) - r.ox) * r.inv_dx;
+    F t1y = (F::broadcast(node.bounds_max.y) - r.oy) * r.inv_dy;
+    F t1z = (F::broadcast(node.bounds_max.z) - r.oz) * r.inv_dz;
+    F t_enter = F::max(F::max(F::min(t0x, t1x), F::min(t0y, t1y)),
+        F::max(F::min(t0z, t1z), F::broadcast(0.001f)));
+    F t_exit = F::min(F::min(F::max(t0x, t1x), F::max(t0y, t1y)),
+        F::min(F::max(t0z, t1z), r.closest));
+    return F::select(t_enter <= t_exit, t_enter, F::broadcast(1.0e30f));
+}
+
+template<class F>
+void intersect_packet_lanes(const PacketScene& scene, const RayPacket& rays, HitPacket& hits, int base)
+{
+    const F one = F::broadcast(1.0f);
+
+    PacketLanes<F> r = {
+        F::load(rays.ox + base), F::load(rays.oy + base), F::load(rays.oz + base),
+        F::load(rays.dx + base), F::load(rays.dy + base), F::load(rays.dz + base),
+        F::broadcast(0.0f), F::broadcast(0.0f), F::broadcast(0.0f), F::broadcast(0.0f),
+        F::load(rays.t_far + base), F::from_int(-1)
+    };
+    r.inv_dx = one / r.dx;
+    r.inv_dy = one / r.dy;
+    r.inv_dz = one / r.dz;
+    r.a = r.dx * r.dx + r.dy * r.dy + r.dz * r.dz;
+
+    // masked traversal: a node is entered when any active lane hits its box,
+    // lanes that miss it keep their closest hit untouched by the leaf tests
+    const BvhNode* nodes = scene.nodes;
+    if(F::any(hit_aabb_lanes(nodes[0], r) < r.closest))
+    {
+        unsigned stack[bvh_max_depth];
+        int stack_size = 0;
+        unsigned node_index = 0;
+        while(true)
+        {
+            const BvhNode& node = nodes[node_index];
+            if(node.count > 0)
+            {
+                for(unsigned i = node.offset; i < node.offset + node.count; ++i)
+                {
+                    int p = int(scene.prim_indices[i]);
+                    if(p < scene.sphere_count)
+                        intersect_sphere_lanes(scene, p, r);
+                    else
+                        intersect_triangle_lanes(scene, p - scene.sphere_count, r);
+                }
+            }
+            else
+            {
+                unsigned near_index = node_index + 1;
+                unsigned far_index = node.offset;
+                F t_near = hit_aabb_lanes(nodes[near_index], r);
+                F t_far = hit_aabb_lanes(nodes[far_index], r);
+                bool hit_near = F::any(t_near < r.closest);
+                bool hit_far = F::any(t_far < r.closest);
+                if(hit_near && hit_far)
+                {
+                    // the child most lanes enter first goes first
+                    if(F::count(t_far < t_near) > F::count(t_near < t_far))
+                    {
+                        unsigned index = near_index;
+                        near_index = far_index;
+                        far_index = index;
+                    }
+                    stack[stack_size++] = far_index;
+                    node_index = near_index;
+                    continue;
+                }
+                if(hit_near || hit_far)
+                {
+                    node_index = hit_near ? near_index : far_index;
+                    continue;
+                }
+            }
+            if(stack_size == 0)
+                break;
+            node_index = stack[--stack_size];
+        }
+    }
+
+    F::store(hits.t + base, r.closest);
+    F::store_int(hits.prim + base, r.prim);
+}
+
+template<class F>
+void intersect_packet(const PacketScene& scene, const RayPacket& rays, HitPacket& hits)
+{
+    for(int base = 0; base < ray_packet_size; base += F::width)
+        intersect_packet_lanes<F>(scene, rays, hits, base);
+}
+
+
+#endif // __PACKET_KERNEL__
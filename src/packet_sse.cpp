@@ -0,0 +1,59 @@
+// SSE2 packet kernel, SSE2 is always there on x86-64 so no special compile flag is needed
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include <emmintrin.h>
+
+#include "packet_kernel.h"
+
+struct Float4
+{
+    static const int width = 4;
+    __m128 v;
+
+    Float4(__m128 value) : v(value) {}
+
+    static Float4 load(const float* p) { return _mm_load_ps(p); }
+    static Float4 broadcast(float f) { return _mm_set1_ps(f); }
+    static Float4 from_int(int i) { return _mm_castsi128_ps(_mm_set1_epi32(i)); }
+    static void store(float* p, Float4 a) { _mm_store_ps(p, a.v); }
+    static void store_int(int* p, Float4 a) { _mm_store_si128((__m128i*)p, _mm_castps_si128(a.v)); }
+
+    static Float4 sqrt(Float4 a) { return _mm_sqrt_ps(a.v); }
+    static Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+    static Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+    static Float4 abs(Float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+    // bits of a where mask is set, else bits of b
+    static Float4 select(Float4 mask, Float4 a, Float4 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+    }
+    // ~a & b
+    static Float4 andnot(Float4 a, Float4 b) { return _mm_andnot_ps(a.v, b.v); }
+    static bool any(Float4 mask) { return _mm_movemask_ps(mask.v) != 0; }
+    // lanes set in mask
+    static int count(Float4 mask)
+    {
+        int bits = _mm_movemask_ps(mask.v);
+        int n = 0;
+        for(; bits; bits &= bits - 1)
+            ++n;
+        return n;
+    }
+
+    friend Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+    friend Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+    friend Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+    friend Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+    friend Float4 operator&(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+    friend Float4 operator|(Float4 a, Float4 b) { return _mm_or_ps(a.v, b.v); }
+    friend Float4 operator<(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+    friend Float4 operator<=(Float4 a, Float4 b) { return _mm_cmple_ps(a.v, b.v); }
+    friend Float4 operator>=(Float4 a, Float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+};
+
+void intersect_packet_sse(const PacketScene& scene, const RayPacket& rays, HitPacket& hits)
+{
+    intersect_packet<Float4>(scene, rays, hits);
+}
+
+#endif
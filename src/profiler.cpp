@@ -0,0 +1,226 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include <algorithm>
+
+#include "profiler.h"
+
+Profiler::Profiler():
+    m_enabled(true),
+    m_frame(0),
+    m_history_frame(0),
+    m_history_next(0),
+    m_history_count(0),
+    m_query_count(0),
+    m_start(std::chrono::steady_clock::now()),
+    m_gpu_start(0)
+{
+    glGetInteger64v(GL_TIMESTAMP, &m_gpu_start);
+}
+
+Profiler::~Profiler()
+{
+    // queries of pending scopes are deleted with them
+    for(const Event& event : m_pending)
+        if(event.queries[0])
+            m_free_queries.insert(m_free_queries.end(), event.queries, event.queries + 2);
+    for(const Event& event : m_open)
+        if(event.queries[0])
+            m_free_queries.insert(m_free_queries.end(), event.queries, event.queries + 2);
+    if(!m_free_queries.empty())
+        glDeleteQueries(GLsizei(m_free_queries.size()), m_free_queries.data());
+}
+
+void Profiler::new_frame()
+{
+    while(!m_pending.empty() && resolve(m_pending.front(), false))
+    {
+        add_event(m_pending.front());
+        m_pending.pop_front();
+    }
+    ++m_frame;
+}
+
+void Profiler::flush()
+{
+    while(!m_pending.empty())
+    {
+        resolve(m_pending.front(), true);
+        add_event(m_pending.front());
+        m_pending.pop_front();
+    }
+    // the last frame is complete too
+    if(m_history_frame != m_frame)
+        end_history_frame();
+    m_history_frame = m_frame;
+}
+
+void Profiler::begin(const char* name)
+{
+    if(!m_enabled)
+        return;
+    Event event;
+    event.pass = get_pass(name);
+    event.frame = m_frame;
+    event.queries[0] = get_query();
+    event.queries[1] = event.queries[0] ? get_query() : 0;
+    if(event.queries[0] && !event.queries[1])
+    {
+        m_free_queries.push_back(event.queries[0]);
+        event.queries[0] = 0;
+    }
+    event.gpu_begin = -1.0;
+    event.gpu_end = -1.0;
+    if(event.queries[0])
+        glQueryCounter(event.queries[0], GL_TIMESTAMP);
+    event.cpu_begin = get_cpu_time();
+    event.cpu_end = event.cpu_begin;
+    m_open.push_back(event);
+}
+
+void Profiler::end()
+{
+    // a scope begun while disabled has nothing to end
+    if(m_open.empty())
+        return;
+    Event event = m_open.back();
+    m_open.pop_back();
+    event.cpu_end = get_cpu_time();
+    if(event.queries[1])
+        glQueryCounter(event.queries[1], GL_TIMESTAMP);
+    m_pending.push_back(event);
+}
+
+bool Profiler::write_trace(const std::string& path) const
+{
+    std::ofstream fs(path, std::ios::out | std::ios::trunc);
+    if(!fs)
+    {
+        std::cerr << "Open trace file failed: " << path << "\n";
+        return false;
+    }
+    // ts and dur are in us
+    fs << std::fixed << std::setprecision(3);
+    fs << "{\"traceEvents\":[\n";
+    fs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"cpu\"}},\n";
+    fs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"gpu\"}}";
+    for(const Event& event : m_trace)
+    {
+        const std::string& name = m_passes[event.pass].name;
+        fs << ",\n{\"name\":\"" << name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":"
+            << event.cpu_begin << ",\"dur\":" << event.cpu_end - event.cpu_begin
+            << ",\"args\":{\"frame\":" << event.frame << "}}";
+        if(event.gpu_begin >= 0.0)
+            fs << ",\n{\"name\":\"" << name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":1,\"ts\":"
+                << event.gpu_begin << ",\"dur\":" << event.gpu_end - event.gpu_begin
+                << ",\"args\":{\"frame\":" << event.frame << "}}";
+    }
+    fs << "\n]}\n";
+    return bool(fs);
+}
+
+double Profiler::get_cpu_time() const
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+int Profiler::get_pass(const char* name)
+{
+    // a handful of passes, a linear search is fine
+    for(size_t i = 0; i < m_passes.size(); ++i)
+        if(m_passes[i].name == name)
+            return int(i);
+
+    m_passes.emplace_back();
+    Pass& pass = m_passes.back();
+    pass.name = name;
+    std::memset(pass.cpu_ms, 0, sizeof(pass.cpu_ms));
+    std::memset(pass.gpu_ms, 0, sizeof(pass.gpu_ms));
+    pass.cpu_average = 0.0f;
+    pass.gpu_average = 0.0f;
+    m_cpu_sums.push_back(0.0f);
+    m_gpu_sums.push_back(0.0f);
+    return int(m_passes.size() - 1);
+}
+
+GLuint Profiler::get_query()
+{
+    if(m_free_queries.empty())
+    {
+        // too many in flight means the gpu is far behind, the scope goes without gpu time
+        const int count = std::min(32, max_query_count - m_query_count);
+        if(count <= 0)
+            return 0;
+        m_free_queries.resize(count);
+        glGenQueries(count, m_free_queries.data());
+        m_query_count += count;
+    }
+    GLuint query = m_free_queries.back();
+    m_free_queries.pop_back();
+    return query;
+}
+
+bool Profiler::resolve(Event& event, bool wait)
+{
+    if(!event.queries[0])
+        return true;
+    if(!wait)
+    {
+        // the end query is later in the command stream, once it is there so is the begin query
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(event.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            return false;
+    }
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(event.queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(event.queries[1], GL_QUERY_RESULT, &end);
+    event.gpu_begin = (GLint64(begin) - m_gpu_start) * 1.0e-3;
+    event.gpu_end = (GLint64(end) - m_gpu_start) * 1.0e-3;
+    m_free_queries.insert(m_free_queries.end(), event.queries, event.queries + 2);
+    event.queries[0] = 0;
+    event.queries[1] = 0;
+    return true;
+}
+
+void Profiler::add_event(const Event& event)
+{
+    // scopes come in frame order, the first one of a later frame closes the frame before
+    if(event.frame != m_history_frame)
+    {
+        end_history_frame();
+        m_history_frame = event.frame;
+    }
+    m_cpu_sums[event.pass] += float(event.cpu_end - event.cpu_begin) * 1.0e-3f;
+    if(event.gpu_begin >= 0.0)
+        m_gpu_sums[event.pass] += float(event.gpu_end - event.gpu_begin) * 1.0e-3f;
+
+    m_trace.push_back(event);
+    if(m_trace.size() > max_trace_events)
+        m_trace.pop_front();
+}
+
+void Profiler::end_history_frame()
+{
+    m_history_count = std::min(m_history_count + 1, history_size);
+    for(size_t i = 0; i < m_passes.size(); ++i)
+    {
+        Pass& pass = m_passes[i];
+        pass.cpu_ms[m_history_next] = m_cpu_sums[i];
+        pass.gpu_ms[m_history_next] = m_gpu_sums[i];
+        m_cpu_sums[i] = 0.0f;
+        m_gpu_sums[i] = 0.0f;
+
+        // frames never filled are 0 in the ring, they are left out
+        float cpu = 0.0f, gpu = 0.0f;
+        for(int k = 0; k < history_size; ++k)
+        {
+            cpu += pass.cpu_ms[k];
+            gpu += pass.gpu_ms[k];
+        }
+        pass.cpu_average = cpu / m_history_count;
+        pass.gpu_average = gpu / m_history_count;
+    }
+    m_history_next = (m_history_next + 1) % history_size;
+}
@@ -0,0 +1,127 @@
+#ifndef __PROFILER__
+#define __PROFILER__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <GL/glew.h>
+
+// cpu and gpu time of named passes, summed per frame
+// the gpu side of a scope is a pair of GL_TIMESTAMP queries, read back once the gpu got there,
+// a few frames later, never waiting for it
+// scopes nest and may repeat in a frame, a pass is the sum of every scope with its name
+// all calls are on the gl thread
+class Profiler
+{
+public:
+    // frames kept for the graphs
+    static const int history_size = 128;
+
+    struct Pass
+    {
+        std::string name;
+        // ms per frame, a ring starting at get_history_offset()
+        float cpu_ms[history_size];
+        float gpu_ms[history_size];
+        float cpu_average;
+        float gpu_average;
+    };
+
+public:
+    Profiler();
+    ~Profiler();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // disabled, begin / end do nothing, the results are kept
+    void set_enabled(bool enabled) { m_enabled = enabled; }
+    bool is_enabled() const { return m_enabled; }
+
+    // collect the finished scopes, call once at the start of a frame
+    void new_frame();
+    // wait for every scope, for a last look before exit
+    void flush();
+    void begin(const char* name);
+    // close the innermost scope
+    void end();
+
+    const std::vector<Pass>& get_passes() const { return m_passes; }
+    int get_history_offset() const { return m_history_next; }
+
+    // the latest scopes as Chrome trace event json, for chrome://tracing or ui.perfetto.dev,
+    // cpu and gpu are two threads of one process
+    bool write_trace(const std::string& path) const;
+
+private:
+    struct Event
+    {
+        int pass;
+        unsigned frame;
+        GLuint queries[2];  // 0 when the pool ran out, the scope then has no gpu time
+        double cpu_begin;  // us since the profiler was created
+        double cpu_end;
+        double gpu_begin;  // us on the cpu time line
+        double gpu_end;
+    };
+
+    double get_cpu_time() const;
+    int get_pass(const char* name);
+    GLuint get_query();
+    // true when the gpu time is known, or there is none, wait blocks until it is
+    bool resolve(Event& event, bool wait);
+    void add_event(const Event& event);
+    void end_history_frame();
+
+private:
+    // queries in flight at most, about a dozen frames of a few dozen scopes
+    static const int max_query_count = 1024;
+    // scopes kept for write_trace
+    static const size_t max_trace_events = 16384;
+
+    bool m_enabled;
+    unsigned m_frame;
+    unsigned m_history_frame;  // frame the pass sums are for
+    int m_history_next;
+    int m_history_count;  // frames in the ring
+    std::vector<Pass> m_passes;
+    std::vector<float> m_cpu_sums;
+    std::vector<float> m_gpu_sums;
+
+    std::vector<Event> m_open;  // stack of begun scopes
+    std::deque<Event> m_pending;  // ended, gpu time not known yet, in end order
+    std::deque<Event> m_trace;
+    std::vector<GLuint> m_free_queries;
+    int m_query_count;
+
+    std::chrono::steady_clock::time_point m_start;
+    // gpu timestamp at m_start, ns, maps gpu times onto the cpu time line
+    GLint64 m_gpu_start;
+};
+
+// begin in the constructor, end in the destructor, a null profiler is fine
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler* profiler, const char* name):
+        m_profiler(profiler)
+    {
+        if(m_profiler)
+            m_profiler->begin(name);
+    }
+    ~ProfileScope()
+    {
+        if(m_profiler)
+            m_profiler->end();
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    Profiler* m_profiler;
+};
+
+
+#endif // __PROFILER__
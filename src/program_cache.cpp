@@ -0,0 +1,152 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include "program_cache.h"
+
+static const char cache_magic[8] = {'R', 'T', 'P', 'R', 'O', 'G', '\0', '\0'};
+
+struct CacheHeader
+{
+    char magic[8];
+    uint64_t key;  // guards against a file renamed or copied by hand
+    uint32_t format;
+    uint32_t length;
+};
+
+bool make_directory(const std::string& path)
+{
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t hash_string(const std::string& s, uint64_t hash)
+{
+    // the length keeps "ab" + "c" apart from "a" + "bc"
+    uint64_t size = s.size();
+    hash = hash_bytes(&size, sizeof(size), hash);
+    return hash_bytes(s.data(), s.size(), hash);
+}
+
+ProgramCache::ProgramCache(const std::string& directory):
+    m_directory(directory),
+    m_enabled(false)
+{
+    if(m_directory.empty())
+        return;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if(formats <= 0)
+    {
+        std::cout << "Program binary not supported by the driver, shader cache disabled\n";
+        return;
+    }
+    if(!make_directory(m_directory))
+    {
+        std::cerr << "Create shader cache directory failed: " << m_directory << "\n";
+        return;
+    }
+    m_enabled = true;
+}
+
+void ProgramCache::prepare(GLuint program) const
+{
+    if(m_enabled)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+bool ProgramCache::load(GLuint program, uint64_t key) const
+{
+    if(!m_enabled)
+        return false;
+    std::ifstream fs(get_path(key), std::ios::binary | std::ios::ate);
+    if(!fs)
+        return false;
+    const std::streamoff file_size = fs.tellg();
+    fs.seekg(0);
+
+    CacheHeader header;
+    if(!fs.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.key != key)
+        return false;
+    // a torn or corrupt entry is a miss, never an allocation of whatever length it claims
+    if(header.length == 0 || std::streamoff(header.length) != file_size - std::streamoff(sizeof(header)))
+        return false;
+    std::vector<char> binary(header.length);
+    if(!fs.read(binary.data(), binary.size()))
+        return false;
+
+    // a driver update may reject the binary, the caller then compiles from source
+    glProgramBinary(program, header.format, binary.data(), GLsizei(binary.size()));
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success == GL_TRUE;
+}
+
+bool ProgramCache::store(GLuint program, uint64_t key) const
+{
+    if(!m_enabled)
+        return false;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return false;
+
+    CacheHeader header;
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.key = key;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+    header.format = format;
+    header.length = uint32_t(length);
+
+    // write aside and rename, so a crash or a second instance never leaves a torn entry
+    const std::string path = get_path(key);
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream fs(temp_path, std::ios::binary | std::ios::trunc);
+        if(!fs.write(reinterpret_cast<const char*>(&header), sizeof(header)) || !fs.write(binary.data(), binary.size()))
+        {
+            std::cerr << "Write shader cache failed: " << temp_path << "\n";
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    if(std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string ProgramCache::get_path(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return m_directory + "/" + name;
+}
@@ -0,0 +1,38 @@
+#ifndef __PROGRAM_CACHE__
+#define __PROGRAM_CACHE__
+
+#include <string>
+#include <cstdint>
+#include <GL/glew.h>
+
+// linked program binaries on disk, one file per key in the cache directory
+// the key must cover everything the binary depends on, see Shader::build_shader
+class ProgramCache
+{
+public:
+    // empty directory disables the cache
+    explicit ProgramCache(const std::string& directory);
+
+    bool is_enabled() const { return m_enabled; }
+    // set before linking so the driver keeps the binary retrievable
+    void prepare(GLuint program) const;
+    // false when there is no entry or the driver rejects it, the program is then left unlinked
+    bool load(GLuint program, uint64_t key) const;
+    bool store(GLuint program, uint64_t key) const;
+
+private:
+    std::string get_path(uint64_t key) const;
+
+private:
+    std::string m_directory;
+    bool m_enabled;
+};
+
+// 64 bit FNV-1a, chain calls by passing the previous result as hash
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+uint64_t hash_string(const std::string& s, uint64_t hash = 14695981039346656037ull);
+// one level, true if it exists already
+bool make_directory(const std::string& path);
+
+
+#endif // __PROGRAM_CACHE__
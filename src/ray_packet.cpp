@@ -0,0 +1,127 @@
+#include "ray_packet.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_X64
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+void intersect_packet_sse(const PacketScene& scene, const RayPacket& rays, HitPacket& hits);
+#ifdef SIMD_AVX2
+void intersect_packet_avx2(const PacketScene& scene, const RayPacket& rays, HitPacket& hits);
+#endif
+
+static bool cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    // the os must also save the ymm registers on context switch
+    if(!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // x64
+
+SimdIsa detect_simd_isa()
+{
+#ifdef SIMD_X64
+#ifdef SIMD_AVX2
+    if(cpu_has_avx2())
+        return SimdIsa::AVX2;
+#endif
+    return SimdIsa::SSE;
+#else
+    return SimdIsa::SCALAR;
+#endif
+}
+
+const char* get_simd_isa_name(SimdIsa isa)
+{
+    switch(isa)
+    {
+    case SimdIsa::SCALAR:
+        return "scalar";
+    case SimdIsa::SSE:
+        return "sse";
+    case SimdIsa::AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+IntersectPacketFunc get_intersect_packet_func(SimdIsa isa)
+{
+    switch(isa)
+    {
+#ifdef SIMD_X64
+    case SimdIsa::SSE:
+        return intersect_packet_sse;
+#ifdef SIMD_AVX2
+    case SimdIsa::AVX2:
+        return cpu_has_avx2() ? intersect_packet_avx2 : nullptr;
+#endif
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+void PacketSceneData::build(const SceneView& scene)
+{
+    m_view.nodes = scene.bvh_nodes.data();
+    m_view.prim_indices = scene.bvh_prim_indices.data();
+
+    const size_t spheres = scene.spheres.size();
+    const size_t triangles = scene.triangles.size();
+    m_data.resize(spheres * 4 + triangles * 9);
+
+    float* p = m_data.data();
+    m_view.sphere_count = int(spheres);
+    m_view.sphere_cx = p;
+    m_view.sphere_cy = p + spheres;
+    m_view.sphere_cz = p + spheres * 2;
+    m_view.sphere_r2 = p + spheres * 3;
+    for(size_t i = 0; i < spheres; ++i)
+    {
+        const Sphere& s = scene.spheres[i];
+        p[i] = s.center.x;
+        p[spheres + i] = s.center.y;
+        p[spheres * 2 + i] = s.center.z;
+        p[spheres * 3 + i] = s.radius * s.radius;
+    }
+
+    p += spheres * 4;
+    float* arrays[9];
+    for(int k = 0; k < 9; ++k)
+        arrays[k] = p + triangles * k;
+    m_view.triangle_count = int(triangles);
+    m_view.v0x = arrays[0];
+    m_view.v0y = arrays[1];
+    m_view.v0z = arrays[2];
+    m_view.e1x = arrays[3];
+    m_view.e1y = arrays[4];
+    m_view.e1z = arrays[5];
+    m_view.e2x = arrays[6];
+    m_view.e2y = arrays[7];
+    m_view.e2z = arrays[8];
+    for(size_t i = 0; i < triangles; ++i)
+    {
+        const Triangle& tri = scene.triangles[i];
+        glm::vec3 v0(scene.vertices[tri.v0]);
+        glm::vec3 e1 = glm::vec3(scene.vertices[tri.v1]) - v0;
+        glm::vec3 e2 = glm::vec3(scene.vertices[tri.v2]) - v0;
+        const float values[9] = {v0.x, v0.y, v0.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z};
+        for(int k = 0; k < 9; ++k)
+            arrays[k][i] = values[k];
+    }
+}
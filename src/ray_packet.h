@@ -0,0 +1,86 @@
+#ifndef __RAY_PACKET__
+#define __RAY_PACKET__
+
+#include <vector>
+
+#include "scene.h"
+
+// rays of adjacent pixels traced together, data is SoA so every field loads into one register
+const int ray_packet_size = 8;
+
+struct alignas(32) RayPacket
+{
+    float ox[ray_packet_size];
+    float oy[ray_packet_size];
+    float oz[ray_packet_size];
+    float dx[ray_packet_size];
+    float dy[ray_packet_size];
+    float dz[ray_packet_size];
+    // lanes not in use must set t_far to 0, so they never hit anything
+    float t_far[ray_packet_size];
+};
+
+// prim encoding is the same as intersect() in ray_tracking.comp:
+// [0, sphere_count) is a sphere, sphere_count + i is triangle i, -1 is miss
+struct alignas(32) HitPacket
+{
+    float t[ray_packet_size];
+    int prim[ray_packet_size];
+};
+
+// SoA view of the scene geometry for the packet kernels
+// packet kernels are compiled with different instruction sets, they only see plain floats here
+struct PacketScene
+{
+    int sphere_count;
+    const float* sphere_cx;
+    const float* sphere_cy;
+    const float* sphere_cz;
+    const float* sphere_r2;  // squared radius
+
+    int triangle_count;
+    const float* v0x;
+    const float* v0y;
+    const float* v0z;
+    const float* e1x;  // v1 - v0
+    const float* e1y;
+    const float* e1z;
+    const float* e2x;  // v2 - v0
+    const float* e2y;
+    const float* e2z;
+
+    const BvhNode* nodes;  // Scene::bvh_nodes
+    const unsigned* prim_indices;  // Scene::bvh_prim_indices
+};
+
+// owns the arrays a PacketScene points to, except the bvh ones which point into the scene,
+// so the scene must outlive it
+class PacketSceneData
+{
+public:
+    void build(const SceneView& scene);
+    const PacketScene& get_view() const { return m_view; }
+
+private:
+    std::vector<float> m_data;
+    PacketScene m_view;
+};
+
+enum class SimdIsa
+{
+    SCALAR,
+    SSE,
+    AVX2,
+};
+
+// closest hit for every lane of rays
+typedef void (*IntersectPacketFunc)(const PacketScene& scene, const RayPacket& rays, HitPacket& hits);
+
+// best instruction set supported by both the build and the running cpu
+SimdIsa detect_simd_isa();
+const char* get_simd_isa_name(SimdIsa isa);
+// nullptr for SimdIsa::SCALAR or an isa not compiled in, caller falls back to the scalar kernel
+IntersectPacketFunc get_intersect_packet_func(SimdIsa isa);
+
+
+#endif // __RAY_PACKET__
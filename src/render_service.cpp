@@ -0,0 +1,492 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <deque>
+#include <list>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <GL/glew.h>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "render_service.h"
+#include "socket.h"
+#include "headless.h"
+#include "renderer.h"
+#include "texture.h"
+#include "image_writer.h"
+
+static const int poll_ms = 1000;
+// a request line longer than this closes the connection
+static const size_t max_line = 4096;
+// jobs for the renderer just used taken ahead of older ones in a row
+static const unsigned max_batch = 8;
+// estimated bytes per pixel of a renderer: target, accumulation and moments
+static const size_t pixel_bytes = 16 + 16 + 4;
+// normal / depth, albedo and the two denoise images on top
+static const size_t denoise_pixel_bytes = 4 * 16;
+
+struct ServiceJob
+{
+    unsigned client;
+    Options options;
+    std::string key;  // renderers are shared by the jobs with the same one
+    bool has_camera;
+    glm::vec3 position;
+    glm::vec3 look_at;
+    float vfov;  // 0 keeps the one of the scene
+};
+
+// the options a renderer depends on, the rest is set per job
+static std::string get_renderer_key(const Options& options)
+{
+    std::ostringstream key;
+    key << int(options.backend) << ' ' << options.threads << ' ' << int(options.simd) << ' '
+        << options.wavefront << ' ' << options.sort_by_material << ' '
+        << options.group_size_x << 'x' << options.group_size_y << ' ' << options.shader_path << '\n'
+        << options.scene_path << '\n' << options.environment_path;
+    return key.str();
+}
+
+// split at white space, "" quote arguments with spaces
+static std::vector<std::string> split_arguments(const std::string& line)
+{
+    std::vector<std::string> arguments;
+    std::string argument;
+    bool quoted = false;
+    bool has_argument = false;
+    for(char c : line)
+    {
+        if(c == '"')
+        {
+            quoted = !quoted;
+            has_argument = true;
+        }
+        else if(!quoted && (c == ' ' || c == '\t'))
+        {
+            if(has_argument)
+                arguments.push_back(argument);
+            argument.clear();
+            has_argument = false;
+        }
+        else
+        {
+            argument += c;
+            has_argument = true;
+        }
+    }
+    if(has_argument)
+        arguments.push_back(argument);
+    return arguments;
+}
+
+class RenderService
+{
+public:
+    explicit RenderService(const Options& options);
+    int run();
+
+private:
+    struct Client
+    {
+        Socket socket;
+        unsigned id;
+        std::string input;  // received, not a full line yet
+    };
+
+    // a scene with a renderer initialized for it
+    struct CacheEntry
+    {
+        std::string key;
+        Scene scene;
+        SceneFile scene_file;
+        SceneView view;
+        size_t scene_bytes;
+        // the renderer refers to the target, it is declared after to be destroyed first
+        std::unique_ptr<Texture> target;
+        std::unique_ptr<Renderer> renderer;
+    };
+
+    void accept_client();
+    void read_client(Client& client);
+    void handle_request(Client& client, const std::string& line);
+    bool parse_job(const std::vector<std::string>& arguments, ServiceJob& job, std::string& error) const;
+    // index of the job to run next
+    size_t take_next_job();
+    void run_job(const ServiceJob& job);
+    // the renderer of job with a target of at least its size, null when the scene or renderer failed
+    CacheEntry* get_entry(const ServiceJob& job);
+    // drop the least recently used entries over the budget, except keep
+    void evict(const CacheEntry* keep);
+    size_t get_entry_bytes(const CacheEntry& entry) const;
+    size_t get_cache_bytes() const;
+    void reply(unsigned client, const std::string& line);
+
+private:
+    const Options& m_options;
+    Socket m_listener;
+    std::vector<std::unique_ptr<Client>> m_clients;
+    unsigned m_next_client_id;
+    std::deque<ServiceJob> m_jobs;
+    std::list<std::unique_ptr<CacheEntry>> m_cache;  // most recently used first
+    std::string m_last_key;
+    int m_last_width;
+    int m_last_height;
+    unsigned m_batch;  // jobs in a row for the last renderer and size
+    bool m_shutdown;
+    unsigned m_shutdown_client;
+};
+
+RenderService::RenderService(const Options& options):
+    m_options(options),
+    m_next_client_id(0),
+    m_last_width(0),
+    m_last_height(0),
+    m_batch(0),
+    m_shutdown(false),
+    m_shutdown_client(0)
+{
+}
+
+int RenderService::run()
+{
+    if(!m_listener.listen((unsigned short)m_options.service_port, true))
+        return EXIT_FAILURE;
+    std::cout << "serving render jobs on port " << m_options.service_port << ", " << m_options.cache_mb
+        << " MB cache\n";
+
+    while(!m_shutdown || !m_jobs.empty())
+    {
+        // only look for requests when there is nothing to render
+        std::vector<Socket*> sockets(1, &m_listener);
+        for(std::unique_ptr<Client>& client : m_clients)
+            sockets.push_back(&client->socket);
+        for(size_t i : Socket::wait_readable(sockets, m_jobs.empty() ? poll_ms : 0))
+        {
+            if(i == 0)
+                accept_client();
+            else
+                read_client(*m_clients[i - 1]);
+        }
+
+        // the jobs of a client gone are not wanted anymore
+        for(const std::unique_ptr<Client>& client : m_clients)
+            if(!client->socket.is_open())
+                m_jobs.erase(std::remove_if(m_jobs.begin(), m_jobs.end(),
+                    [&client](const ServiceJob& job) { return job.client == client->id; }), m_jobs.end());
+        m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(),
+            [](const std::unique_ptr<Client>& client) { return !client->socket.is_open(); }), m_clients.end());
+
+        if(!m_jobs.empty())
+        {
+            size_t i = take_next_job();
+            ServiceJob job = m_jobs[i];
+            m_jobs.erase(m_jobs.begin() + i);
+            run_job(job);
+        }
+    }
+    reply(m_shutdown_client, "ok");
+    std::cout << "service shut down\n";
+    return EXIT_SUCCESS;
+}
+
+void RenderService::accept_client()
+{
+    std::unique_ptr<Client> client(new Client);
+    client->socket = m_listener.accept();
+    client->id = m_next_client_id++;
+    if(client->socket.is_open())
+        m_clients.push_back(std::move(client));
+}
+
+void RenderService::read_client(Client& client)
+{
+    char buffer[1024];
+    size_t size = client.socket.recv_some(buffer, sizeof(buffer));
+    client.input.append(buffer, size);
+    size_t end;
+    while(client.socket.is_open() && (end = client.input.find('\n')) != std::string::npos)
+    {
+        std::string line = client.input.substr(0, end);
+        client.input.erase(0, end + 1);
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        handle_request(client, line);
+    }
+    if(client.input.size() > max_line)
+    {
+        reply(client.id, "error request too long");
+        client.socket.close();
+    }
+}
+
+void RenderService::handle_request(Client& client, const std::string& line)
+{
+    std::vector<std::string> arguments = split_arguments(line);
+    if(arguments.empty())
+        return;
+    if(m_shutdown)
+    {
+        reply(client.id, "error shutting down");
+        return;
+    }
+
+    const std::string& command = arguments[0];
+    if(command == "render")
+    {
+        ServiceJob job;
+        std::string error;
+        if(!parse_job(arguments, job, error))
+        {
+            reply(client.id, "error " + error);
+            return;
+        }
+        job.client = client.id;
+        m_jobs.push_back(job);
+    }
+    else if(command == "status")
+    {
+        std::ostringstream status;
+        status << "ok " << m_jobs.size() << " queued, " << m_cache.size() << " renderers, "
+            << get_cache_bytes() / (1024 * 1024) << " MB cached";
+        reply(client.id, status.str());
+    }
+    else if(command == "shutdown")
+    {
+        m_shutdown = true;
+        m_shutdown_client = client.id;
+    }
+    else
+        reply(client.id, "error unknown request " + command);
+}
+
+bool RenderService::parse_job(const std::vector<std::string>& arguments, ServiceJob& job, std::string& error) const
+{
+    // parse_options takes argv, the request name stands in for the program
+    std::vector<char*> argv;
+    job.has_camera = false;
+    job.vfov = 0.0f;
+    for(size_t i = 0; i < arguments.size(); ++i)
+    {
+        if(arguments[i] != "--camera")
+        {
+            argv.push_back(const_cast<char*>(arguments[i].c_str()));
+            continue;
+        }
+        char end = '\0';
+        int count = i + 1 < arguments.size() ? std::sscanf(arguments[i + 1].c_str(), "%f,%f,%f,%f,%f,%f,%f%c",
+            &job.position.x, &job.position.y, &job.position.z, &job.look_at.x, &job.look_at.y, &job.look_at.z,
+            &job.vfov, &end) : 0;
+        if(count != 6 && count != 7)
+        {
+            error = "invalid camera";
+            return false;
+        }
+        job.has_camera = true;
+        ++i;
+    }
+
+    job.options = m_options;
+    if(!parse_options(int(argv.size()), argv.data(), job.options))
+    {
+        error = "invalid options";
+        return false;
+    }
+    if(job.options.service_port != m_options.service_port || job.options.coordinator_port > 0
+        || !job.options.worker_address.empty())
+    {
+        error = "not a render option";
+        return false;
+    }
+    if(get_image_format(job.options.output_path) == ImageFormat::UNKNOWN)
+    {
+        error = "unknown image format " + job.options.output_path;
+        return false;
+    }
+    job.key = get_renderer_key(job.options);
+    return true;
+}
+
+size_t RenderService::take_next_job()
+{
+    size_t next = 0;
+    if(m_batch < max_batch)
+        for(size_t i = 0; i < m_jobs.size(); ++i)
+            if(m_jobs[i].key == m_last_key && m_jobs[i].options.width == m_last_width
+                && m_jobs[i].options.height == m_last_height)
+            {
+                next = i;
+                break;
+            }
+
+    const Options& options = m_jobs[next].options;
+    if(m_jobs[next].key == m_last_key && options.width == m_last_width && options.height == m_last_height)
+        ++m_batch;
+    else
+        m_batch = 0;
+    m_last_key = m_jobs[next].key;
+    m_last_width = options.width;
+    m_last_height = options.height;
+    return next;
+}
+
+void RenderService::run_job(const ServiceJob& job)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const Options& options = job.options;
+    CacheEntry* entry = get_entry(job);
+    if(!entry)
+    {
+        reply(job.client, "error scene or renderer init failed");
+        return;
+    }
+
+    // the target of the last job may be bound to the image unit
+    Texture& target = *entry->target;
+    target.activate(0);
+    target.set_access_for_shader(Texture::Access::READ_WRITE);
+
+    Renderer& renderer = *entry->renderer;
+    renderer.set_resolution(unsigned(options.width), unsigned(options.height));
+    renderer.set_adaptive(options.adaptive_threshold, unsigned(options.adaptive_min_samples));
+    renderer.set_denoise(options.denoise);
+    renderer.set_sampler(options.sampler, &get_sampler_tables(options.shader_cache_path));
+    Camera camera = entry->view.camera;
+    if(job.has_camera)
+    {
+        camera.position = job.position;
+        camera.look_at = job.look_at;
+        if(job.vfov > 0.0f)
+            camera.vfov = job.vfov;
+    }
+    camera.aspect_ratio = float(options.width) / options.height;
+    // restarts the accumulation
+    renderer.set_camera(camera);
+    renderer.render(options.samples_per_pixel);
+
+    std::vector<glm::vec4> pixels(size_t(options.width) * options.height);
+    target.get_data(pixels.data(), int(pixels.size() * sizeof(glm::vec4)), 0, 0, options.width, options.height);
+    if(!write_image(options.output_path, &pixels[0].x, unsigned(options.width), unsigned(options.height)))
+    {
+        reply(job.client, "error save image failed " + options.output_path);
+        return;
+    }
+
+    std::chrono::duration<double, std::milli> job_time = std::chrono::steady_clock::now() - start;
+    std::cout << "rendered " << options.output_path << " " << options.width << " X " << options.height
+        << " with " << renderer.get_samples_per_pixel() << " spp in " << job_time.count() << " ms\n";
+    std::ostringstream line;
+    line << "ok " << job_time.count() << " " << options.output_path;
+    reply(job.client, line.str());
+}
+
+RenderService::CacheEntry* RenderService::get_entry(const ServiceJob& job)
+{
+    const unsigned width = unsigned(job.options.width);
+    const unsigned height = unsigned(job.options.height);
+    std::list<std::unique_ptr<CacheEntry>>::iterator it = m_cache.begin();
+    while(it != m_cache.end() && (*it)->key != job.key)
+        ++it;
+    if(it != m_cache.end())
+        m_cache.splice(m_cache.begin(), m_cache, it);
+    else
+    {
+        std::unique_ptr<CacheEntry> entry(new CacheEntry);
+        entry->key = job.key;
+        if(!load_scene(job.options, float(width) / height, entry->scene, entry->scene_file, entry->view))
+            return nullptr;
+        const SceneView& view = entry->view;
+        entry->scene_bytes = view.materials.size() * sizeof(Material) + view.spheres.size() * sizeof(Sphere)
+            + view.vertices.size() * sizeof(glm::vec4) + view.triangles.size() * sizeof(Triangle)
+            + view.bvh_nodes.size() * sizeof(BvhNode) + view.bvh_prim_indices.size() * sizeof(unsigned)
+            + view.instances.size() * sizeof(Instance) + view.tlas_nodes.size() * sizeof(BvhNode)
+            + view.tlas_instance_indices.size() * sizeof(unsigned) + view.lights.size() * sizeof(Light)
+            + view.light_nodes.size() * sizeof(LightNode);
+        if(view.environment)
+            entry->scene_bytes += view.environment->radiance.size() * sizeof(glm::vec4)
+                + view.environment->alias.size() * sizeof(EnvironmentAlias);
+        m_cache.push_front(std::move(entry));
+    }
+
+    // a larger target is kept, the renderer renders into its top left
+    CacheEntry& entry = *m_cache.front();
+    unsigned target_width = 0, target_height = 0;
+    if(entry.target)
+        entry.target->get_size(&target_width, &target_height);
+    if(!entry.renderer || target_width < width || target_height < height)
+    {
+        entry.renderer.reset();
+        entry.target.reset(new Texture(std::max(target_width, width), std::max(target_height, height),
+            Texture::ChannelType::RGBA, Texture::DataType::FLOAT, nullptr));
+        entry.renderer = create_renderer(job.options, *entry.target);
+        if(!entry.renderer || !entry.renderer->init(entry.view))
+        {
+            m_cache.pop_front();
+            return nullptr;
+        }
+    }
+    evict(&entry);
+    return &entry;
+}
+
+void RenderService::evict(const CacheEntry* keep)
+{
+    const size_t budget = size_t(m_options.cache_mb) * 1024 * 1024;
+    size_t bytes = get_cache_bytes();
+    while(bytes > budget && m_cache.back().get() != keep)
+    {
+        const std::string& key = m_cache.back()->key;
+        const std::string scene = key.substr(key.find('\n') + 1);
+        std::cout << "evicted the renderer of " << (scene.empty() ? "the built-in scene" : scene) << "\n";
+        bytes -= get_entry_bytes(*m_cache.back());
+        m_cache.pop_back();
+    }
+}
+
+size_t RenderService::get_entry_bytes(const CacheEntry& entry) const
+{
+    unsigned width = 0, height = 0;
+    if(entry.target)
+        entry.target->get_size(&width, &height);
+    const bool denoise = entry.renderer && entry.renderer->is_denoise_enabled();
+    return entry.scene_bytes + size_t(width) * height * (pixel_bytes + (denoise ? denoise_pixel_bytes : 0));
+}
+
+size_t RenderService::get_cache_bytes() const
+{
+    size_t bytes = 0;
+    for(const std::unique_ptr<CacheEntry>& entry : m_cache)
+        bytes += get_entry_bytes(*entry);
+    return bytes;
+}
+
+void RenderService::reply(unsigned client, const std::string& line)
+{
+    for(std::unique_ptr<Client>& c : m_clients)
+        if(c->id == client)
+        {
+            std::string message = line + "\n";
+            c->socket.send_all(message.data(), message.size());
+            return;
+        }
+}
+
+int run_service(const Options& options)
+{
+    if(!create_headless_context())
+        return EXIT_FAILURE;
+
+    // the cached renderers must be released before the context goes away
+    int ret;
+    {
+        RenderService service(options);
+        ret = service.run();
+    }
+
+    destroy_headless_context();
+    return ret;
+}
@@ -0,0 +1,22 @@
+#ifndef __RENDER_SERVICE__
+#define __RENDER_SERVICE__
+
+#include "options.h"
+
+// a long running headless renderer taking jobs on options.service_port, from this machine only,
+// return the process exit code
+//
+// requests and replies are lines of text:
+//   render <options>  queue a render, the options are the command line ones applied over those the
+//                     service started with, plus --camera <x>,<y>,<z>,<look x>,<look y>,<look z>[,<vfov>],
+//                     replies "ok <ms> <output path>" once the image is written, or "error <reason>"
+//   status            replies "ok <jobs> queued, <renderers> renderers, <MB> MB cached"
+//   shutdown          finish the queued jobs, reply "ok" and exit
+// scenes stay loaded and their renderers initialized, with the scene uploaded and the programs linked,
+// the least recently used ones are dropped once their estimated memory is over options.cache_mb
+// queued jobs for the renderer and image size just used go ahead of older ones, a few in a row,
+// they render into the same target and accumulation without allocating anything
+int run_service(const Options& options);
+
+
+#endif // __RENDER_SERVICE__
@@ -0,0 +1,287 @@
+#include <future>
+#include <utility>
+
+#include "render_thread.h"
+#include "resolution_scaler.h"
+
+// glClientWaitSync timeout, the wait loops until the fence signals
+static const GLuint64 fence_wait_ns = 1000000000;
+
+RenderThread::RenderThread():
+    m_stopping(false),
+    m_settings_changed(false),
+    m_back(0),
+    m_ready(1),
+    m_front(2),
+    m_new_frame(false),
+    m_pacing(nullptr),
+    m_profiler(nullptr)
+{
+    for(Slot& slot : m_slots)
+    {
+        slot.width = 0;
+        slot.height = 0;
+        slot.copied = nullptr;
+        slot.drawn = nullptr;
+    }
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+}
+
+bool RenderThread::start(const Options& options, const SceneView& scene, unsigned width, unsigned height,
+    std::function<void(bool)> make_current, std::function<void()> wake)
+{
+    stop();
+    m_make_current = make_current;
+    m_wake = wake;
+    m_stopping = false;
+
+    std::promise<bool> started;
+    std::future<bool> result = started.get_future();
+    m_thread = std::thread([this, options, &scene, width, height, &started]() {
+        m_make_current(true);
+        run(options, scene, width, height, started);
+        m_make_current(false);
+    });
+    if(result.get())
+        return true;
+    m_thread.join();
+    return false;
+}
+
+void RenderThread::stop()
+{
+    if(!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+void RenderThread::post(Command command)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_commands.push_back(std::move(command));
+    }
+    m_condition.notify_one();
+}
+
+void RenderThread::set_settings(const Settings& settings)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_settings = settings;
+        m_settings_changed = true;
+    }
+    m_condition.notify_one();
+}
+
+void RenderThread::set_profiling(bool enabled)
+{
+    post([this, enabled](Renderer&) {
+        m_profiler->set_enabled(enabled);
+    });
+}
+
+void RenderThread::write_trace(const std::string& path)
+{
+    post([this, path](Renderer&) {
+        m_profiler->write_trace(path);
+    });
+}
+
+RenderThread::Frame RenderThread::acquire_frame()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_new_frame)
+        {
+            std::swap(m_front, m_ready);
+            m_new_frame = false;
+        }
+    }
+    Slot& front = m_slots[m_front];
+    if(front.copied)
+    {
+        // a gpu side wait, the caller goes on at once
+        glWaitSync(front.copied, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(front.copied);
+        front.copied = nullptr;
+    }
+    Frame frame;
+    if(front.width > 0)
+    {
+        frame.texture = front.texture.get();
+        frame.width = front.width;
+        frame.height = front.height;
+    }
+    return frame;
+}
+
+void RenderThread::release_frame()
+{
+    Slot& front = m_slots[m_front];
+    if(front.drawn)
+        glDeleteSync(front.drawn);
+    front.drawn = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // the thread waits for it on another context, it has to reach the gpu
+    glFlush();
+}
+
+RenderThread::Status RenderThread::get_status() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_status;
+}
+
+void RenderThread::run(const Options& options, const SceneView& scene, unsigned width, unsigned height,
+    std::promise<bool>& started)
+{
+    Profiler profiler;
+    m_profiler = &profiler;
+    // image unit 0 is per context, the target is bound here
+    Texture target(width, height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT, nullptr);
+    target.set_data(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    target.activate(0);
+    target.set_access_for_shader(Texture::Access::READ_WRITE);
+    for(Slot& slot : m_slots)
+        slot.texture.reset(new Texture(width, height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT, nullptr));
+
+    std::unique_ptr<Renderer> renderer = create_renderer(options, target);
+    const bool initialized = renderer && renderer->init(scene);
+    if(initialized)
+    {
+        renderer->set_profiler(&profiler);
+        renderer->set_reprojection(unsigned(options.reprojection_samples));
+    }
+    // the ui uses the slot textures once start returns
+    glFinish();
+    started.set_value(initialized);
+
+    ResolutionScaler resolution_scaler(width, height);
+    bool dynamic_resolution = false;
+    bool idle = false;
+    while(initialized)
+    {
+        std::vector<Command> commands;
+        Settings settings;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [&]() { return m_stopping || !m_commands.empty() || m_settings_changed || !idle; });
+            if(m_stopping)
+                break;
+            commands.swap(m_commands);
+            settings = m_settings;
+            m_settings_changed = false;
+        }
+
+        profiler.new_frame();
+        for(Command& command : commands)
+            command(*renderer);
+        bool changed = !commands.empty();
+        if(dynamic_resolution && !settings.dynamic_resolution)
+        {
+            resolution_scaler.reset();
+            renderer->set_resolution(0, 0);
+        }
+        dynamic_resolution = settings.dynamic_resolution;
+
+        if(!settings.paused && renderer->get_samples_per_pixel() < settings.max_samples && !renderer->is_converged())
+        {
+            ProfileScope scope(&profiler, "render");
+            if(settings.dynamic_resolution)
+            {
+                if(resolution_scaler.update(renderer->get_frame_time(), settings.target_ms))
+                    renderer->set_resolution(resolution_scaler.get_width(), resolution_scaler.get_height());
+                renderer->render(1);
+            }
+            else
+                renderer->render_progressive(settings.budget_ms);
+            changed = true;
+        }
+        if(changed && renderer->get_width() > 0)
+        {
+            ProfileScope scope(&profiler, "publish");
+            publish(target, renderer->get_width(), renderer->get_height());
+        }
+
+        const bool converged = renderer->is_converged();
+        idle = settings.paused || renderer->get_samples_per_pixel() >= settings.max_samples || converged;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_status.resolution_scale = resolution_scaler.get_scale();
+            m_status.samples_per_pixel = renderer->get_samples_per_pixel();
+            m_status.samples_per_second = renderer->get_samples_per_second();
+            m_status.converged = converged;
+            m_status.idle = idle;
+            m_status.passes = profiler.get_passes();
+            m_status.history_offset = profiler.get_history_offset();
+        }
+    }
+
+    // everything here belongs to this context, the ui has stopped drawing the slots
+    renderer.reset();
+    for(Slot& slot : m_slots)
+    {
+        if(slot.copied)
+            glDeleteSync(slot.copied);
+        if(slot.drawn)
+            glDeleteSync(slot.drawn);
+        slot.copied = nullptr;
+        slot.drawn = nullptr;
+        slot.width = 0;
+        slot.height = 0;
+        slot.texture.reset();
+    }
+    if(m_pacing)
+        glDeleteSync(m_pacing);
+    m_pacing = nullptr;
+    m_profiler = nullptr;
+}
+
+void RenderThread::publish(Texture& target, unsigned width, unsigned height)
+{
+    Slot& back = m_slots[m_back];
+    // the ui may still be drawing the texture, the gpu waits for that, not the thread
+    if(back.drawn)
+    {
+        glWaitSync(back.drawn, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(back.drawn);
+        back.drawn = nullptr;
+    }
+    // published before and replaced before the ui took it
+    if(back.copied)
+        glDeleteSync(back.copied);
+
+    // the last pass wrote the target as an image
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glCopyImageSubData(target.get_id(), GL_TEXTURE_2D, 0, 0, 0, 0, back.texture->get_id(), GL_TEXTURE_2D, 0, 0, 0, 0,
+        width, height, 1);
+    back.width = width;
+    back.height = height;
+    back.copied = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // the ui waits for it on another context, it has to reach the gpu
+    glFlush();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(m_back, m_ready);
+        m_new_frame = true;
+    }
+    m_wake();
+
+    // stay at most a step ahead of the gpu, so the ui's draws do not queue up behind many dispatches
+    if(m_pacing)
+    {
+        while(glClientWaitSync(m_pacing, GL_SYNC_FLUSH_COMMANDS_BIT, fence_wait_ns) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(m_pacing);
+    }
+    m_pacing = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
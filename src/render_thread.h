@@ -0,0 +1,134 @@
+#ifndef __RENDER_THREAD__
+#define __RENDER_THREAD__
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <GL/glew.h>
+
+#include "renderer.h"
+#include "texture.h"
+#include "profiler.h"
+#include "options.h"
+
+// runs the renderer on a thread of its own, on a gl context shared with the ui, so a long dispatch
+// never holds up the event loop
+// the renderer only lives on the thread: the ui changes it through post() and sees it through get_status()
+// finished frames are copied from the target into a triple buffer of display textures, a fence after
+// the copy is waited for by the ui on the gpu before it draws the frame, and a fence after the ui drew
+// a frame is waited for by the thread before it copies into that texture again
+// the thread sleeps once the image has max_samples, converged or is paused, until the next post
+class RenderThread
+{
+public:
+    // what the thread renders each step, changed with set_settings
+    struct Settings
+    {
+        double budget_ms = 8.0;  // ms of progressive rendering per step, a frame is published after each
+        unsigned max_samples = 1024;  // stop accumulating after this many samples per pixel
+        bool dynamic_resolution = false;  // render a full pass per step at a resolution holding target_ms
+        double target_ms = 16.0;
+        bool paused = false;
+    };
+
+    // the renderer as of the latest step
+    struct Status
+    {
+        float resolution_scale = 1.0f;
+        unsigned samples_per_pixel = 0;
+        double samples_per_second = 0.0;
+        bool converged = false;
+        bool idle = false;  // sleeping until the next post
+        std::vector<Profiler::Pass> passes;  // of the thread's profiler
+        int history_offset = 0;
+    };
+
+    // a published frame, the rendered part is the top left width x height of texture
+    struct Frame
+    {
+        Texture* texture = nullptr;  // null before the first frame
+        unsigned width = 0;
+        unsigned height = 0;
+    };
+
+    using Command = std::function<void(Renderer&)>;
+
+public:
+    RenderThread();
+    // stop
+    ~RenderThread();
+
+    RenderThread(const RenderThread&) = delete;
+    RenderThread& operator=(const RenderThread&) = delete;
+
+    // start the thread, make_current(true) makes a context shared with the caller's one current on it,
+    // make_current(false) releases it before the thread ends
+    // the thread creates the renderer of options and a width x height target, then inits the renderer
+    // with scene, which must outlive the thread; false when that failed
+    // wake is called from the thread after every published frame, to get the ui out of its event wait
+    bool start(const Options& options, const SceneView& scene, unsigned width, unsigned height,
+        std::function<void(bool)> make_current, std::function<void()> wake);
+    // finish the running step and join, the textures are gone after
+    void stop();
+
+    // run command on the thread before its next step, commands run in the order they are posted
+    void post(Command command);
+    void set_settings(const Settings& settings);
+    // time the thread's passes, write_trace dumps them as Chrome trace json from the thread
+    void set_profiling(bool enabled);
+    void write_trace(const std::string& path);
+
+    // on the ui thread: take the newest frame if one was published since, its texture stays valid
+    // until the next acquire; the gpu waits for the copy before the next commands of the caller
+    Frame acquire_frame();
+    // on the ui thread, after the commands drawing or reading the acquired frame
+    void release_frame();
+    Status get_status() const;
+
+private:
+    struct Slot
+    {
+        std::unique_ptr<Texture> texture;
+        unsigned width;
+        unsigned height;
+        GLsync copied;  // after the thread's copy, waited for and deleted by the ui
+        GLsync drawn;  // after the ui's draws, waited for and deleted by the thread
+    };
+
+    // the thread, everything gl it creates is deleted before it returns
+    void run(const Options& options, const SceneView& scene, unsigned width, unsigned height, std::promise<bool>& started);
+    // copy the rendered part of target into the back slot and swap it with the ready one
+    void publish(Texture& target, unsigned width, unsigned height);
+
+private:
+    std::function<void(bool)> m_make_current;
+    std::function<void()> m_wake;
+    std::thread m_thread;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+    std::vector<Command> m_commands;
+    Settings m_settings;
+    bool m_settings_changed;
+    Status m_status;
+
+    // triple buffer: the thread copies into m_back, m_ready is the newest published, the ui draws m_front,
+    // m_back and m_front only change on their own thread, swaps with m_ready hold the mutex
+    Slot m_slots[3];
+    int m_back;
+    int m_ready;
+    int m_front;
+    bool m_new_frame;  // m_ready was published after the ui last took it
+    GLsync m_pacing;  // after the previous publish, the thread stays at most one step ahead of the gpu
+
+    Profiler* m_profiler;  // created on the thread, it owns gl queries
+};
+
+
+#endif // __RENDER_THREAD__
@@ -0,0 +1,340 @@
+#include <iostream>
+#include <algorithm>
+
+#include "renderer.h"
+#include "gpu_renderer.h"
+#include "cpu_renderer.h"
+#include "mesh_import.h"
+
+// a progressive call never renders more than this many full passes, so a bad estimate can not freeze a frame
+static const unsigned max_progressive_passes = 8;
+// weight of a new measurement in the ms per tile moving average
+static const double tile_time_weight = 0.2;
+// samples per second is averaged over this window
+static const double statistics_window = 0.5;
+
+Renderer::Renderer(Texture& target):
+    m_target(target),
+    m_width(0),
+    m_height(0),
+    m_profiler(nullptr),
+    m_sampler_tables(nullptr),
+    m_samples_per_pixel(0),
+    m_next_tile(0),
+    m_ms_per_tile(0.0),
+    m_adaptive_threshold(0.0f),
+    m_adaptive_min_samples(0),
+    m_denoise(false),
+    m_reprojection_samples(0),
+    m_sampler(SamplerType::RANDOM),
+    m_resolution_width(0),
+    m_resolution_height(0),
+    m_samples_per_second(0.0),
+    m_window_samples(0),
+    m_window_start(std::chrono::steady_clock::now())
+{
+}
+
+void Renderer::render(int samples)
+{
+    check_size();
+    // a full pass from the current tile gives every pixel one more sample
+    bool rendered = false;
+    for(int i = 0; i < samples; ++i)
+    {
+        if(!is_adaptive())
+            add_tiles(get_tile_count());
+        else if(!is_converged())
+            add_adaptive_pass();
+        else
+            break;
+        rendered = true;
+    }
+    if(rendered && m_denoise)
+        denoise();
+}
+
+void Renderer::render_progressive(double budget_ms)
+{
+    check_size();
+    if(is_adaptive())
+    {
+        // a pass covers the tiles still active, as far as the backend knows
+        unsigned active = get_active_tile_count();
+        if(active == 0)
+            return;
+        double passes = m_ms_per_tile > 0.0 ? budget_ms / (m_ms_per_tile * active) : 1.0;
+        passes = std::min(std::max(passes, 1.0), double(max_progressive_passes));
+        for(unsigned i = 0; i < unsigned(passes); ++i)
+            add_adaptive_pass();
+        if(m_denoise)
+            denoise();
+        return;
+    }
+
+    const unsigned tile_count = get_tile_count();
+    // one tile until the first time measurement comes back
+    double tiles = m_ms_per_tile > 0.0 ? budget_ms / m_ms_per_tile : 1.0;
+    tiles = std::min(std::max(tiles, 1.0), double(tile_count) * max_progressive_passes);
+    add_tiles(unsigned(tiles));
+    if(m_denoise)
+        denoise();
+}
+
+void Renderer::render_tile_range(unsigned first_tile, unsigned tile_count, int samples)
+{
+    check_size();
+    tile_count = std::min(tile_count, get_tile_count() - std::min(first_tile, get_tile_count()));
+    if(tile_count == 0)
+        return;
+    for(int i = 0; i < samples; ++i)
+        render_tiles(first_tile, tile_count, unsigned(i));
+}
+
+void Renderer::set_adaptive(float threshold, unsigned min_samples)
+{
+    m_adaptive_threshold = threshold;
+    // the variance needs two samples at least
+    m_adaptive_min_samples = std::max(min_samples, 2u);
+}
+
+void Renderer::set_denoise(bool enabled)
+{
+    if(enabled == m_denoise)
+        return;
+    m_denoise = enabled;
+    // the samples so far have no aovs, or the target shows the filtered image
+    if(m_width > 0)
+        reset();
+}
+
+void Renderer::set_reprojection(unsigned max_samples)
+{
+    const bool had_aovs = is_aov_enabled();
+    m_reprojection_samples = max_samples;
+    // the samples so far have no aovs to check the history against
+    if(is_aov_enabled() != had_aovs && m_width > 0)
+        reset();
+}
+
+void Renderer::set_sampler(SamplerType type, const SamplerTables* tables)
+{
+    if(type == m_sampler && tables == m_sampler_tables)
+        return;
+    m_sampler = type;
+    m_sampler_tables = tables;
+    if(m_width > 0)
+        reset();
+}
+
+void Renderer::set_camera(const Camera& camera)
+{
+    apply_camera(camera);
+    if(m_width > 0)
+        reset();
+}
+
+void Renderer::move_camera(const Camera& camera)
+{
+    check_size();
+    if(m_reprojection_samples == 0 || (m_samples_per_pixel == 0 && m_next_tile == 0))
+    {
+        set_camera(camera);
+        return;
+    }
+    reproject(camera);
+    // the reprojected pixels have up to m_reprojection_samples and the others none, continue with
+    // sample 1 so the next pass adds to the history instead of overwriting it
+    m_samples_per_pixel = 1;
+    m_next_tile = 0;
+}
+
+void Renderer::update_instances(const SceneView& scene, const InstanceUpdate& update)
+{
+    if(update.instance_first == update.instance_end && !update.rebuilt)
+        return;
+    apply_instances(scene, update);
+    if(m_width > 0)
+        reset();
+}
+
+void Renderer::set_resolution(unsigned width, unsigned height)
+{
+    m_resolution_width = width;
+    m_resolution_height = height;
+}
+
+bool Renderer::is_converged()
+{
+    return is_adaptive() && get_active_tile_count() == 0;
+}
+
+void Renderer::add_tile_time(double ms, unsigned tile_count)
+{
+    if(tile_count == 0)
+        return;
+    double ms_per_tile = ms / tile_count;
+    if(m_ms_per_tile <= 0.0)
+        m_ms_per_tile = ms_per_tile;
+    else
+        m_ms_per_tile += (ms_per_tile - m_ms_per_tile) * tile_time_weight;
+}
+
+void Renderer::reset_progress()
+{
+    m_samples_per_pixel = 0;
+    m_next_tile = 0;
+}
+
+void Renderer::check_size()
+{
+    unsigned width, height;
+    m_target.get_size(&width, &height);
+    if(m_resolution_width > 0 && m_resolution_height > 0)
+    {
+        width = std::min(width, m_resolution_width);
+        height = std::min(height, m_resolution_height);
+    }
+    if(width == m_width && height == m_height)
+        return;
+    m_width = width;
+    m_height = height;
+    reset();
+}
+
+bool Renderer::is_adaptive() const
+{
+    // a pass in progress is finished uniformly first
+    return m_adaptive_threshold > 0.0f && m_samples_per_pixel >= m_adaptive_min_samples && m_next_tile == 0;
+}
+
+void Renderer::add_tiles(unsigned count)
+{
+    const unsigned tile_count = get_tile_count();
+    if(tile_count == 0)
+        return;
+
+    // split at the end of the image, the tiles after it belong to the next sample
+    const unsigned tiles_x = get_tiles_x();
+    uint64_t samples = 0;
+    while(count > 0)
+    {
+        unsigned run = std::min(count, tile_count - m_next_tile);
+        render_tiles(m_next_tile, run, m_samples_per_pixel);
+        for(unsigned i = m_next_tile; i < m_next_tile + run; ++i)
+        {
+            unsigned x = i % tiles_x * tile_size_x;
+            unsigned y = i / tiles_x * tile_size_y;
+            samples += uint64_t(std::min<unsigned>(tile_size_x, m_width - x)) * std::min<unsigned>(tile_size_y, m_height - y);
+        }
+
+        count -= run;
+        m_next_tile += run;
+        if(m_next_tile == tile_count)
+        {
+            m_next_tile = 0;
+            ++m_samples_per_pixel;
+        }
+    }
+    update_statistics(samples);
+}
+
+void Renderer::add_adaptive_pass()
+{
+    // edge tiles are counted as full ones, close enough for a rate
+    uint64_t samples = uint64_t(get_active_tile_count()) * tile_size_x * tile_size_y;
+    render_adaptive(m_adaptive_threshold);
+    ++m_samples_per_pixel;
+    update_statistics(samples);
+}
+
+void Renderer::update_statistics(uint64_t samples)
+{
+    m_window_samples += samples;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - m_window_start;
+    if(elapsed.count() >= statistics_window)
+    {
+        m_samples_per_second = m_window_samples / elapsed.count();
+        m_window_samples = 0;
+        m_window_start = now;
+    }
+}
+
+// the geometry and camera of load_scene
+static bool load_geometry(const Options& options, float aspect_ratio, Scene& scene, SceneFile& scene_file, SceneView& view)
+{
+    if(options.scene_path.empty())
+    {
+        scene = Scene::create_default(aspect_ratio);
+        double bvh_time = scene.build_bvh(options.threads);
+        std::cout << "bvh built in " << bvh_time << " ms, " << scene.bvh_nodes.size() << " nodes\n";
+        view = scene.get_view();
+        return true;
+    }
+    if(is_mesh_path(options.scene_path))
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if(!Scene::create_from_mesh(options.scene_path, aspect_ratio, options.threads, scene))
+            return false;
+        std::chrono::duration<double, std::milli> import_time = std::chrono::steady_clock::now() - start;
+        double bvh_time = scene.build_bvh(options.threads);
+        std::cout << "mesh imported in " << import_time.count() << " ms, " << scene.triangles.size() << " triangles, "
+            << scene.vertices.size() << " vertices, bvh built in " << bvh_time << " ms\n";
+        view = scene.get_view();
+        return true;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(!scene_file.open(options.scene_path))
+        return false;
+    view = scene_file.get_view();
+    view.camera.aspect_ratio = aspect_ratio;
+    std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - start;
+    std::cout << "scene mapped in " << load_time.count() << " ms, " << view.triangles.size()
+        << " triangles, " << view.bvh_nodes.size() << " bvh nodes\n";
+    return true;
+}
+
+bool load_scene(const Options& options, float aspect_ratio, Scene& scene, SceneFile& scene_file, SceneView& view)
+{
+    if(!load_geometry(options, aspect_ratio, scene, scene_file, view))
+        return false;
+    if(options.environment_path.empty())
+        return true;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(!scene.environment.load(options.environment_path, options.threads))
+        return false;
+    view.environment = &scene.environment;
+    std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - start;
+    std::cout << "environment " << scene.environment.width << "x" << scene.environment.height
+        << " loaded with its sampling tables in " << load_time.count() << " ms\n";
+    return true;
+}
+
+std::unique_ptr<Renderer> create_renderer(const Options& options, Texture& target)
+{
+    std::unique_ptr<Renderer> renderer;
+    switch(options.backend)
+    {
+    case Options::Backend::GPU:
+    {
+        GpuRenderer* gpu_renderer = new GpuRenderer(target, options.shader_path, options.shader_cache_path);
+        gpu_renderer->set_wavefront(options.wavefront, options.sort_by_material);
+        gpu_renderer->set_group_size(options.group_size_x, options.group_size_y);
+        renderer.reset(gpu_renderer);
+        break;
+    }
+    case Options::Backend::CPU:
+        renderer.reset(new CpuRenderer(target, options.threads, options.simd));
+        break;
+    }
+    if(renderer)
+    {
+        renderer->set_adaptive(options.adaptive_threshold, options.adaptive_min_samples);
+        renderer->set_denoise(options.denoise);
+        renderer->set_sampler(options.sampler, &get_sampler_tables(options.shader_cache_path));
+    }
+    return renderer;
+}
@@ -0,0 +1,168 @@
+#ifndef __RENDERER__
+#define __RENDERER__
+
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <glm/vec4.hpp>
+
+#include "scene.h"
+#include "scene_file.h"
+#include "texture.h"
+#include "options.h"
+#include "sampler.h"
+
+class Profiler;
+
+// a backend producing RGBA32F pixels into a Texture
+// samples are summed in an accumulation buffer, the target always shows their average
+// the image is rendered in 32x32 tiles, progressive rendering walks them in scan order and
+// wraps to the next sample when the last tile is done
+// with adaptive sampling, once every pixel has the minimum samples only the tiles whose
+// estimated error is above the threshold get more, until none is left
+// with denoising the target shows the average filtered by Denoiser / denoise.comp instead
+// with reprojection a moving camera keeps the samples of the surfaces still in view
+class Renderer
+{
+public:
+    // patch_size_x / patch_size_y in ray_tracking.comp, split into work groups there
+    static const int tile_size_x = 32;
+    static const int tile_size_y = 32;
+
+public:
+    explicit Renderer(Texture& target);
+    virtual ~Renderer() {}
+
+    // upload / reference the scene, must be called before render,
+    // cpu backends keep pointing into the scene data so it must outlive the renderer
+    virtual bool init(const SceneView& scene) = 0;
+    // drop the accumulated samples, the next render starts again from sample 0
+    virtual void reset() = 0;
+    // add the given samples per pixel over the whole image, or over the tiles not converged
+    void render(int samples = 1);
+    // add as many tiles as are estimated to fit in budget_ms, continuing where the last call stopped
+    void render_progressive(double budget_ms);
+    // render tiles [first_tile, first_tile + tile_count) in scan order as samples 0 to samples - 1,
+    // they come out the same as in render(samples) after reset, for distributed rendering
+    // nothing else changes: no adaptive sampling, denoising or progress
+    void render_tile_range(unsigned first_tile, unsigned tile_count, int samples);
+    // copy the rgb sums and sample counts of a rectangle within the rendered size, row major
+    virtual void read_accumulation(unsigned x, unsigned y, unsigned width, unsigned height, glm::vec4* sums) = 0;
+
+    // threshold is the relative standard error of the pixel mean, the largest one of a tile decides,
+    // 0 turns adaptive sampling off
+    void set_adaptive(float threshold, unsigned min_samples);
+    // adaptive sampling found no tile above the threshold
+    bool is_converged();
+
+    // look through camera instead of the one of the scene init got, restarts the accumulation
+    void set_camera(const Camera& camera);
+    // like set_camera, but with reprojection on the accumulation is carried over: every pixel takes the
+    // samples of where its first hit was in the image before, when that still shows the same surface,
+    // then goes on accumulating, pixels that were hidden or outside start from 0
+    void move_camera(const Camera& camera);
+    // instances of the scene init got moved, scene is its view after Scene::update_instances returned
+    // update, only what changed is uploaded, restarts the accumulation
+    void update_instances(const SceneView& scene, const InstanceUpdate& update);
+
+    // filter the average after every render call, guided by the normal, depth and albedo the
+    // samples also write then, changing it restarts the accumulation
+    void set_denoise(bool enabled);
+    bool is_denoise_enabled() const { return m_denoise; }
+
+    // the samples a pixel keeps at most when move_camera reprojects the accumulation, fewer adapt faster
+    // to shading that changes with the view, 0 turns reprojection off
+    // reprojection needs the normal and depth of the samples, turning it on or off restarts the accumulation
+    void set_reprojection(unsigned max_samples);
+    unsigned get_reprojection_samples() const { return m_reprojection_samples; }
+
+    // where the samples take their random numbers from, tables must outlive the renderer and be set
+    // before init, changing the type restarts the accumulation
+    void set_sampler(SamplerType type, const SamplerTables* tables);
+    // RANDOM until there are tables
+    SamplerType get_sampler() const { return m_sampler_tables ? m_sampler : SamplerType::RANDOM; }
+
+    // render into the top left width x height of the target, the rest is left as is,
+    // 0 or anything larger than the target means the whole target
+    // changing the size restarts the accumulation but never reallocates the target
+    void set_resolution(unsigned width, unsigned height);
+    unsigned get_width() const { return m_width; }
+    unsigned get_height() const { return m_height; }
+    // estimated ms a full pass over the current resolution takes, 0 until measured
+    double get_frame_time() const { return m_ms_per_tile * get_tile_count(); }
+
+    // samples the most sampled pixels have got since reset
+    unsigned get_samples_per_pixel() const { return m_samples_per_pixel; }
+    // pixel samples per second, averaged over about half a second
+    double get_samples_per_second() const { return m_samples_per_second; }
+
+    // backends time their passes into profiler, null for none
+    void set_profiler(Profiler* profiler) { m_profiler = profiler; }
+
+protected:
+    // render tiles [first_tile, first_tile + tile_count) in scan order as sample sample_index
+    virtual void render_tiles(unsigned first_tile, unsigned tile_count, unsigned sample_index) = 0;
+    // estimate the error of every tile, then render one more sample in the ones above threshold
+    virtual void render_adaptive(float threshold) = 0;
+    // tiles above the threshold as of the latest render_adaptive the backend knows the result of,
+    // get_tile_count() before any
+    virtual unsigned get_active_tile_count() = 0;
+    // write the filtered average over the rendered size into the target
+    virtual void denoise() = 0;
+    // the primary rays of the next samples start from camera
+    virtual void apply_camera(const Camera& camera) = 0;
+    // take the instances and tlas of scene, update tells which parts changed
+    virtual void apply_instances(const SceneView& scene, const InstanceUpdate& update) = 0;
+    // apply camera and replace the accumulation by the one reprojected from the camera before,
+    // the target shows its average
+    virtual void reproject(const Camera& camera) = 0;
+    // the samples also write normal, depth and albedo, for denoising and reprojection
+    bool is_aov_enabled() const { return m_denoise || m_reprojection_samples > 0; }
+    // time the last render_tiles calls took, as soon as the backend knows it
+    void add_tile_time(double ms, unsigned tile_count);
+    // call from reset() after the backend dropped its accumulation
+    void reset_progress();
+    unsigned get_tiles_x() const { return (m_width + tile_size_x - 1) / tile_size_x; }
+    unsigned get_tile_count() const { return get_tiles_x() * ((m_height + tile_size_y - 1) / tile_size_y); }
+
+    Texture& m_target;
+    unsigned m_width;  // rendered size the accumulation is for
+    unsigned m_height;
+    Profiler* m_profiler;
+    const SamplerTables* m_sampler_tables;  // null until set_sampler
+
+private:
+    // follow the target and the resolution, restart the accumulation when the size changed
+    void check_size();
+    bool is_adaptive() const;
+    void add_tiles(unsigned tile_count);
+    void add_adaptive_pass();
+    void update_statistics(uint64_t samples);
+
+private:
+    unsigned m_samples_per_pixel;
+    unsigned m_next_tile;
+    double m_ms_per_tile;  // moving average, 0 until the first measurement
+    float m_adaptive_threshold;
+    unsigned m_adaptive_min_samples;
+    bool m_denoise;
+    unsigned m_reprojection_samples;
+    SamplerType m_sampler;
+    unsigned m_resolution_width;
+    unsigned m_resolution_height;
+
+    double m_samples_per_second;
+    uint64_t m_window_samples;
+    std::chrono::steady_clock::time_point m_window_start;
+};
+
+// the scene to render: options.scene_path mapped by scene_file, or the built-in scene with its
+// bvh built into scene, the camera aspect ratio is overridden by aspect_ratio
+// options.environment_path is loaded into scene.environment in either case
+bool load_scene(const Options& options, float aspect_ratio, Scene& scene, SceneFile& scene_file, SceneView& view);
+
+// create the backend chosen by options.backend, render into target
+std::unique_ptr<Renderer> create_renderer(const Options& options, Texture& target);
+
+
+#endif // __RENDERER__
@@ -0,0 +1,54 @@
+#include <cmath>
+#include <algorithm>
+
+#include "resolution_scaler.h"
+
+// relative change of the scale below which the resolution is kept
+static const float scale_hysteresis = 0.05f;
+// part of the way to the ideal scale taken per update, damps the noise of frame times
+static const float scale_step = 0.5f;
+// sizes are rounded to multiples of this
+static const unsigned size_alignment = 8;
+
+static unsigned scale_size(unsigned size, float scale)
+{
+    unsigned scaled = unsigned(size * scale + 0.5f) / size_alignment * size_alignment;
+    return std::min(size, std::max(scaled, size_alignment));
+}
+
+ResolutionScaler::ResolutionScaler(unsigned full_width, unsigned full_height, float min_scale):
+    m_full_width(full_width),
+    m_full_height(full_height),
+    m_min_scale(min_scale)
+{
+    reset();
+}
+
+bool ResolutionScaler::update(double frame_ms, double target_ms)
+{
+    if(frame_ms <= 0.0 || target_ms <= 0.0)
+        return false;
+
+    // frame time grows with the pixel count, the side scales with its square root
+    float ideal = m_scale * float(std::sqrt(target_ms / frame_ms));
+    float scale = m_scale + (ideal - m_scale) * scale_step;
+    scale = std::min(std::max(scale, m_min_scale), 1.0f);
+    if(std::abs(scale - m_scale) < m_scale * scale_hysteresis)
+        return false;
+
+    unsigned width = m_width, height = m_height;
+    apply_scale(scale);
+    return width != m_width || height != m_height;
+}
+
+void ResolutionScaler::reset()
+{
+    apply_scale(1.0f);
+}
+
+void ResolutionScaler::apply_scale(float scale)
+{
+    m_scale = scale;
+    m_width = scale < 1.0f ? scale_size(m_full_width, scale) : m_full_width;
+    m_height = scale < 1.0f ? scale_size(m_full_height, scale) : m_full_height;
+}
@@ -0,0 +1,35 @@
+#ifndef __RESOLUTION_SCALER__
+#define __RESOLUTION_SCALER__
+
+// picks a render resolution, as a scale of the full one, whose frame time stays near a target
+// the scale changes only when it is off by more than a few percent, every change restarts
+// the accumulation so it should not flicker between close sizes
+class ResolutionScaler
+{
+public:
+    ResolutionScaler(unsigned full_width, unsigned full_height, float min_scale = 0.25f);
+
+    // frame_ms is the measured time of a full frame at the current resolution,
+    // return true when the resolution changed
+    bool update(double frame_ms, double target_ms);
+    // back to the full resolution
+    void reset();
+
+    float get_scale() const { return m_scale; }
+    unsigned get_width() const { return m_width; }
+    unsigned get_height() const { return m_height; }
+
+private:
+    void apply_scale(float scale);
+
+private:
+    unsigned m_full_width;
+    unsigned m_full_height;
+    float m_min_scale;
+    float m_scale;
+    unsigned m_width;
+    unsigned m_height;
+};
+
+
+#endif // __RESOLUTION_SCALER__
@@ -0,0 +1,280 @@
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+#include "sampler.h"
+#include "program_cache.h"
+
+static const char sampler_cache_magic[8] = {'R', 'T', 'S', 'A', 'M', 'P', 'L', 'E'};
+// bump when the generated tables change
+static const uint32_t sampler_cache_version = 1;
+static const char* sampler_cache_name = "sampler_tables.bin";
+
+// void and cluster energy filter, wide enough that the rest of the gaussian is below 1e-3
+static const float blue_noise_sigma = 1.5f;
+static const int blue_noise_radius = 6;
+
+struct SamplerCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t sobol_dimensions;
+    uint32_t sobol_bits;
+    uint32_t blue_noise_size;
+};
+
+const char* get_sampler_name(SamplerType type)
+{
+    switch(type)
+    {
+    case SamplerType::RANDOM:
+        return "random";
+    case SamplerType::SOBOL:
+        return "sobol";
+    case SamplerType::BLUE_NOISE:
+        return "bluenoise";
+    }
+    return "unknown";
+}
+
+static uint32_t pcg_hash(uint32_t v)
+{
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// the first dimension is the bit reversed index, the others from the primitive polynomials of
+// Joe & Kuo's new-joe-kuo-6.21201: degree s, coefficients a and the initial m
+static void build_sobol_directions(uint32_t directions[SamplerTables::sobol_bits][SamplerTables::sobol_dimensions])
+{
+    struct Polynomial
+    {
+        unsigned s;
+        unsigned a;
+        uint32_t m[3];
+    };
+    static const Polynomial polynomials[SamplerTables::sobol_dimensions - 1] = {
+        {1, 0, {1}}, {2, 1, {1, 3}}, {3, 1, {1, 3, 1}},
+    };
+
+    for(unsigned i = 0; i < SamplerTables::sobol_bits; ++i)
+        directions[i][0] = 1u << (31 - i);
+    for(unsigned d = 1; d < SamplerTables::sobol_dimensions; ++d)
+    {
+        const Polynomial& p = polynomials[d - 1];
+        for(unsigned i = 0; i < SamplerTables::sobol_bits; ++i)
+        {
+            uint32_t v;
+            if(i < p.s)
+                v = p.m[i] << (31 - i);
+            else
+            {
+                v = directions[i - p.s][d] ^ (directions[i - p.s][d] >> p.s);
+                for(unsigned k = 1; k < p.s; ++k)
+                    if((p.a >> (p.s - 1 - k)) & 1u)
+                        v ^= directions[i - k][d];
+            }
+            directions[i][d] = v;
+        }
+    }
+}
+
+// binary pattern on a torus, energy is the sum of a gaussian of the distance to every set texel
+class BlueNoisePattern
+{
+public:
+    explicit BlueNoisePattern(unsigned size):
+        m_size(int(size)),
+        m_set(size_t(size) * size, 0),
+        m_energy(size_t(size) * size, 0.0f)
+    {
+        for(int y = -blue_noise_radius; y <= blue_noise_radius; ++y)
+            for(int x = -blue_noise_radius; x <= blue_noise_radius; ++x)
+                m_kernel.push_back(std::exp(-float(x * x + y * y) / (2.0f * blue_noise_sigma * blue_noise_sigma)));
+    }
+
+    bool is_set(unsigned i) const { return m_set[i] != 0; }
+
+    void set(unsigned i, bool value)
+    {
+        m_set[i] = value ? 1 : 0;
+        const float sign = value ? 1.0f : -1.0f;
+        const int cx = int(i % m_size);
+        const int cy = int(i / m_size);
+        const float* kernel = m_kernel.data();
+        for(int y = cy - blue_noise_radius; y <= cy + blue_noise_radius; ++y)
+        {
+            float* row = &m_energy[size_t((y + m_size) % m_size) * m_size];
+            for(int x = cx - blue_noise_radius; x <= cx + blue_noise_radius; ++x)
+                row[(x + m_size) % m_size] += sign * *kernel++;
+        }
+    }
+
+    // the set texel with the most energy
+    unsigned get_tightest_cluster() const
+    {
+        unsigned best = 0;
+        float best_energy = -1.0f;
+        for(unsigned i = 0; i < m_energy.size(); ++i)
+            if(m_set[i] && m_energy[i] > best_energy)
+            {
+                best = i;
+                best_energy = m_energy[i];
+            }
+        return best;
+    }
+
+    // the unset texel with the least energy
+    unsigned get_largest_void() const
+    {
+        unsigned best = 0;
+        float best_energy = 0.0f;
+        bool found = false;
+        for(unsigned i = 0; i < m_energy.size(); ++i)
+            if(!m_set[i] && (!found || m_energy[i] < best_energy))
+            {
+                best = i;
+                best_energy = m_energy[i];
+                found = true;
+            }
+        return best;
+    }
+
+private:
+    int m_size;
+    std::vector<unsigned char> m_set;
+    std::vector<float> m_energy;
+    std::vector<float> m_kernel;
+};
+
+// Ulichney's void and cluster: a tenth of the texels at random, relaxed until the tightest cluster is the
+// largest void, then ranked by taking them out cluster by cluster and filling up void by void
+// the unset texels with the most energy of the unset ones are the ones with the least of the set ones,
+// so the second half is ranked by the largest void as well
+static void build_blue_noise(std::vector<uint16_t>& ranks)
+{
+    const unsigned size = SamplerTables::blue_noise_size;
+    const unsigned count = size * size;
+    const unsigned initial_count = count / 10;
+    ranks.assign(count, 0);
+
+    BlueNoisePattern initial(size);
+    uint32_t seed = 0;
+    for(unsigned placed = 0; placed < initial_count;)
+    {
+        seed = pcg_hash(seed);
+        const unsigned i = seed % count;
+        if(initial.is_set(i))
+            continue;
+        initial.set(i, true);
+        ++placed;
+    }
+    for(unsigned i = 0; i < count; ++i)
+    {
+        const unsigned cluster = initial.get_tightest_cluster();
+        initial.set(cluster, false);
+        const unsigned void_index = initial.get_largest_void();
+        initial.set(void_index, true);
+        if(void_index == cluster)
+            break;
+    }
+
+    BlueNoisePattern pattern = initial;
+    for(unsigned rank = initial_count; rank-- > 0;)
+    {
+        const unsigned cluster = pattern.get_tightest_cluster();
+        pattern.set(cluster, false);
+        ranks[cluster] = uint16_t(rank);
+    }
+    pattern = initial;
+    for(unsigned rank = initial_count; rank < count; ++rank)
+    {
+        const unsigned void_index = pattern.get_largest_void();
+        pattern.set(void_index, true);
+        ranks[void_index] = uint16_t(rank);
+    }
+}
+
+static bool read_tables(const std::string& path, SamplerTables& tables)
+{
+    std::ifstream fs(path, std::ios::binary);
+    if(!fs)
+        return false;
+    SamplerCacheHeader header;
+    if(!fs.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, sampler_cache_magic, sizeof(sampler_cache_magic)) != 0
+        || header.version != sampler_cache_version || header.sobol_dimensions != SamplerTables::sobol_dimensions
+        || header.sobol_bits != SamplerTables::sobol_bits || header.blue_noise_size != SamplerTables::blue_noise_size)
+        return false;
+    tables.blue_noise.resize(size_t(SamplerTables::blue_noise_size) * SamplerTables::blue_noise_size);
+    return bool(fs.read(reinterpret_cast<char*>(tables.sobol_directions), sizeof(tables.sobol_directions))
+        && fs.read(reinterpret_cast<char*>(tables.blue_noise.data()), tables.blue_noise.size() * sizeof(uint16_t)));
+}
+
+static bool write_tables(const std::string& path, const SamplerTables& tables)
+{
+    SamplerCacheHeader header;
+    std::memcpy(header.magic, sampler_cache_magic, sizeof(sampler_cache_magic));
+    header.version = sampler_cache_version;
+    header.sobol_dimensions = SamplerTables::sobol_dimensions;
+    header.sobol_bits = SamplerTables::sobol_bits;
+    header.blue_noise_size = SamplerTables::blue_noise_size;
+
+    // write aside and rename like the program cache
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream fs(temp_path, std::ios::binary | std::ios::trunc);
+        if(!fs.write(reinterpret_cast<const char*>(&header), sizeof(header))
+            || !fs.write(reinterpret_cast<const char*>(tables.sobol_directions), sizeof(tables.sobol_directions))
+            || !fs.write(reinterpret_cast<const char*>(tables.blue_noise.data()), tables.blue_noise.size() * sizeof(uint16_t)))
+        {
+            std::cerr << "Write sampler tables failed: " << temp_path << "\n";
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    if(std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void SamplerTables::load(const std::string& cache_directory)
+{
+    const std::string path = cache_directory.empty() ? std::string() : cache_directory + "/" + sampler_cache_name;
+    if(!path.empty() && read_tables(path, *this))
+        return;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    build_sobol_directions(sobol_directions);
+    build_blue_noise(blue_noise);
+    std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start;
+    std::cout << "sampler tables generated in " << build_time.count() << " ms\n";
+    if(path.empty())
+        return;
+    if(!make_directory(cache_directory))
+        std::cerr << "Create sampler cache directory failed: " << cache_directory << "\n";
+    else
+        write_tables(path, *this);
+}
+
+const SamplerTables& get_sampler_tables(const std::string& cache_directory)
+{
+    static std::mutex mutex;
+    static std::unique_ptr<SamplerTables> tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!tables)
+    {
+        tables.reset(new SamplerTables());
+        tables->load(cache_directory);
+    }
+    return *tables;
+}
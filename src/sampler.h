@@ -0,0 +1,46 @@
+#ifndef __SAMPLER__
+#define __SAMPLER__
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// where a sample takes its random numbers from, same values as sampler_type in ray_tracking.comp
+// RANDOM: pcg hash per pixel and sample
+// SOBOL: Owen scrambled Sobol points, the index shuffled per pixel (Burley 2020)
+// BLUE_NOISE: the same scrambled Sobol points in every pixel, each pixel shifted by a blue noise mask,
+// so the error of low sample counts is spread as high frequency noise
+enum class SamplerType
+{
+    RANDOM,
+    SOBOL,
+    BLUE_NOISE,
+};
+
+const char* get_sampler_name(SamplerType type);
+
+// the tables of the SOBOL and BLUE_NOISE samplers, generated once and kept in a cache directory
+// the dimensions of a sample are taken in groups of up to sobol_dimensions, each group with its own
+// shuffle and scramble of the index, see get_sample in ray_tracking.comp for the layout
+struct SamplerTables
+{
+    static const unsigned sobol_dimensions = 4;
+    static const unsigned sobol_bits = 32;
+    static const unsigned blue_noise_size = 128;
+
+    // row i holds the direction numbers of index bit i, msb aligned, the first dimension is the
+    // van der Corput sequence, then Joe & Kuo's primitive polynomials
+    // same std140 layout as sobol_directions in ray_tracking.comp
+    uint32_t sobol_directions[sobol_bits][sobol_dimensions];
+    // blue_noise_size x blue_noise_size ranks from void and cluster, every rank once, row major, tiles seamlessly
+    std::vector<uint16_t> blue_noise;
+
+    // read the tables from cache_directory, or generate and store them there, empty generates only
+    void load(const std::string& cache_directory);
+};
+
+// the process wide tables, loaded by the first call, later ones return them whatever the directory
+const SamplerTables& get_sampler_tables(const std::string& cache_directory);
+
+
+#endif // __SAMPLER__
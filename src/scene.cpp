@@ -0,0 +1,483 @@
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <glm/geometric.hpp>
+#include <glm/trigonometric.hpp>
+#include <glm/matrix.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "scene.h"
+#include "mesh_import.h"
+
+void Camera::get_basis(glm::vec3& lower_left, glm::vec3& horizontal, glm::vec3& vertical) const
+{
+    float viewport_height = 2.0f * std::tan(glm::radians(vfov) / 2.0f);
+    float viewport_width = viewport_height * aspect_ratio;
+
+    glm::vec3 w = glm::normalize(position - look_at);
+    glm::vec3 u = glm::normalize(glm::cross(up, w));
+    glm::vec3 v = glm::cross(w, u);
+
+    horizontal = viewport_width * u;
+    vertical = viewport_height * v;
+    lower_left = position - horizontal / 2.0f - vertical / 2.0f - w;
+}
+
+glm::mat4 Camera::get_view_projection() const
+{
+    // the same basis as get_basis, the depth range only matters for z which nothing reads
+    return glm::perspective(glm::radians(vfov), aspect_ratio, 0.01f, 1000.0f) * glm::lookAt(position, look_at, up);
+}
+
+// pcg, the std distributions give different numbers on different standard libraries
+static float random_float(uint32_t& state)
+{
+    state = state * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return float(((word >> 22u) ^ word) >> 8) / 16777216.0f;
+}
+
+static glm::vec4 random_color(uint32_t& state)
+{
+    float r = random_float(state);
+    float g = random_float(state);
+    float b = random_float(state);
+    return glm::vec4(0.2f + 0.8f * r, 0.2f + 0.8f * g, 0.2f + 0.8f * b, 1.0f);
+}
+
+// 22 x 22 small spheres around three large ones on a huge ground sphere, about 500 spheres
+static Scene create_spheres(float aspect_ratio, unsigned seed)
+{
+    Scene scene;
+    scene.camera.position = glm::vec3(13.0f, 2.0f, 3.0f);
+    scene.camera.look_at = glm::vec3(0.0f, 0.0f, 0.0f);
+    scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+    scene.camera.vfov = 20.0f;
+    scene.camera.aspect_ratio = aspect_ratio;
+
+    uint32_t state = seed;
+    scene.materials.push_back({glm::vec4(0.5f, 0.5f, 0.5f, 1.0f)});
+    scene.spheres.push_back({glm::vec3(0.0f, -1000.0f, 0.0f), 1000.0f, 0});
+    for(int a = -11; a < 11; ++a)
+        for(int b = -11; b < 11; ++b)
+        {
+            glm::vec3 center(a + 0.9f * random_float(state), 0.2f, b + 0.9f * random_float(state));
+            scene.materials.push_back({random_color(state)});
+            scene.spheres.push_back({center, 0.2f, unsigned(scene.materials.size() - 1)});
+        }
+    const glm::vec3 large[3] = {glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(-4.0f, 1.0f, 0.0f), glm::vec3(4.0f, 1.0f, 0.0f)};
+    for(const glm::vec3& center : large)
+    {
+        scene.materials.push_back({random_color(state)});
+        scene.spheres.push_back({center, 1.0f, unsigned(scene.materials.size() - 1)});
+    }
+    return scene;
+}
+
+// a 128 x 128 quad height field, 32K triangles, with one sphere floating above it
+static Scene create_mesh(float aspect_ratio, unsigned seed)
+{
+    Scene scene;
+    scene.camera.position = glm::vec3(0.0f, 3.0f, 6.0f);
+    scene.camera.look_at = glm::vec3(0.0f, 0.0f, 0.0f);
+    scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+    scene.camera.vfov = 50.0f;
+    scene.camera.aspect_ratio = aspect_ratio;
+
+    uint32_t state = seed;
+    scene.materials.push_back({glm::vec4(0.3f, 0.5f, 0.2f, 1.0f)});
+    scene.materials.push_back({glm::vec4(0.6f, 0.5f, 0.4f, 1.0f)});
+    scene.materials.push_back({glm::vec4(0.9f, 0.9f, 0.9f, 1.0f)});
+    scene.materials.push_back({glm::vec4(0.7f, 0.3f, 0.3f, 1.0f)});
+
+    const int n = 128;
+    const float size = 8.0f;
+    const float phase = random_float(state) * 6.2831853f;
+    for(int z = 0; z <= n; ++z)
+        for(int x = 0; x <= n; ++x)
+        {
+            float px = (float(x) / n - 0.5f) * size;
+            float pz = (float(z) / n - 0.5f) * size;
+            float py = 0.4f * std::sin(px * 1.7f + phase) * std::cos(pz * 1.3f) + 0.05f * random_float(state);
+            scene.vertices.push_back(glm::vec4(px, py, pz, 1.0f));
+        }
+    for(int z = 0; z < n; ++z)
+        for(int x = 0; x < n; ++x)
+        {
+            unsigned v0 = unsigned(z * (n + 1) + x);
+            unsigned v1 = v0 + 1;
+            unsigned v2 = v0 + n + 1;
+            unsigned v3 = v2 + 1;
+            // height bands: grass, rock, snow
+            float height = scene.vertices[v0].y;
+            unsigned material = height < 0.0f ? 0 : height < 0.25f ? 1 : 2;
+            scene.triangles.push_back({v0, v2, v1, material});
+            scene.triangles.push_back({v1, v2, v3, material});
+        }
+    scene.spheres.push_back({glm::vec3(0.0f, 1.2f, 0.0f), 0.6f, 3});
+    return scene;
+}
+
+// mesh space shapes standing on y = 0 about 2 high, for create_instances
+static Mesh add_sphere_mesh(Scene& scene, unsigned material)
+{
+    const int rings = 12;
+    const int segments = 16;
+    const unsigned base = unsigned(scene.vertices.size());
+    for(int r = 0; r <= rings; ++r)
+        for(int s = 0; s <= segments; ++s)
+        {
+            float theta = 3.1415927f * r / rings;
+            float phi = 6.2831853f * s / segments;
+            scene.vertices.push_back(glm::vec4(std::sin(theta) * std::cos(phi), 1.0f + std::cos(theta),
+                std::sin(theta) * std::sin(phi), 1.0f));
+        }
+    Mesh mesh = {unsigned(scene.triangles.size()), 0, 0};
+    for(int r = 0; r < rings; ++r)
+        for(int s = 0; s < segments; ++s)
+        {
+            unsigned v0 = base + unsigned(r * (segments + 1) + s);
+            unsigned v1 = v0 + 1;
+            unsigned v2 = v0 + segments + 1;
+            unsigned v3 = v2 + 1;
+            scene.triangles.push_back({v0, v2, v1, material});
+            scene.triangles.push_back({v1, v2, v3, material});
+        }
+    mesh.triangle_count = unsigned(scene.triangles.size()) - mesh.first_triangle;
+    return mesh;
+}
+
+static Mesh add_box_mesh(Scene& scene, unsigned material)
+{
+    const unsigned base = unsigned(scene.vertices.size());
+    for(int i = 0; i < 8; ++i)
+        scene.vertices.push_back(glm::vec4(i & 1 ? 0.8f : -0.8f, i & 2 ? 1.6f : 0.0f, i & 4 ? 0.8f : -0.8f, 1.0f));
+    // two triangles per face, corners as bit masks of x, y, z
+    const unsigned faces[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}};
+    Mesh mesh = {unsigned(scene.triangles.size()), 12, 0};
+    for(const unsigned* f : faces)
+    {
+        scene.triangles.push_back({base + f[0], base + f[1], base + f[2], material});
+        scene.triangles.push_back({base + f[0], base + f[2], base + f[3], material});
+    }
+    return mesh;
+}
+
+static Mesh add_torus_mesh(Scene& scene, unsigned material)
+{
+    const int rings = 24;
+    const int sides = 12;
+    const unsigned base = unsigned(scene.vertices.size());
+    for(int r = 0; r <= rings; ++r)
+        for(int s = 0; s <= sides; ++s)
+        {
+            float u = 6.2831853f * r / rings;
+            float v = 6.2831853f * s / sides;
+            float d = 0.7f + 0.3f * std::cos(v);
+            scene.vertices.push_back(glm::vec4(d * std::cos(u), 1.0f + d * std::sin(u), 0.3f * std::sin(v), 1.0f));
+        }
+    Mesh mesh = {unsigned(scene.triangles.size()), 0, 0};
+    for(int r = 0; r < rings; ++r)
+        for(int s = 0; s < sides; ++s)
+        {
+            unsigned v0 = base + unsigned(r * (sides + 1) + s);
+            unsigned v1 = v0 + 1;
+            unsigned v2 = v0 + sides + 1;
+            unsigned v3 = v2 + 1;
+            scene.triangles.push_back({v0, v2, v1, material});
+            scene.triangles.push_back({v1, v2, v3, material});
+        }
+    mesh.triangle_count = unsigned(scene.triangles.size()) - mesh.first_triangle;
+    return mesh;
+}
+
+// 64 x 64 instances of three small meshes on a ground quad, 4K instances of 1K unique triangles
+static Scene create_instances(float aspect_ratio, unsigned seed)
+{
+    Scene scene;
+    scene.camera.position = glm::vec3(0.0f, 6.0f, 22.0f);
+    scene.camera.look_at = glm::vec3(0.0f, 0.0f, 4.0f);
+    scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+    scene.camera.vfov = 40.0f;
+    scene.camera.aspect_ratio = aspect_ratio;
+
+    uint32_t state = seed;
+    scene.materials.push_back({glm::vec4(0.5f, 0.5f, 0.5f, 1.0f)});
+    for(int i = 0; i < 3; ++i)
+        scene.materials.push_back({random_color(state)});
+
+    const float size = 40.0f;
+    scene.vertices.push_back(glm::vec4(-size, 0.0f, -size, 1.0f));
+    scene.vertices.push_back(glm::vec4(size, 0.0f, -size, 1.0f));
+    scene.vertices.push_back(glm::vec4(size, 0.0f, size, 1.0f));
+    scene.vertices.push_back(glm::vec4(-size, 0.0f, size, 1.0f));
+    scene.triangles.push_back({0, 1, 2, 0});
+    scene.triangles.push_back({0, 2, 3, 0});
+
+    scene.meshes.push_back(add_sphere_mesh(scene, 1));
+    scene.meshes.push_back(add_box_mesh(scene, 2));
+    scene.meshes.push_back(add_torus_mesh(scene, 3));
+
+    const int n = 64;
+    for(int z = 0; z < n; ++z)
+        for(int x = 0; x < n; ++x)
+        {
+            unsigned mesh = std::min(unsigned(random_float(state) * 3.0f), 2u);
+            glm::vec3 position((x - n / 2) * 0.8f + 0.3f * random_float(state), 0.0f,
+                (z - n / 2) * 0.8f + 0.3f * random_float(state));
+            float angle = 6.2831853f * random_float(state);
+            float scale = 0.15f + 0.15f * random_float(state);
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+            transform = glm::rotate(transform, angle, glm::vec3(0.0f, 1.0f, 0.0f));
+            transform = glm::scale(transform, glm::vec3(scale));
+            scene.add_instance(mesh, transform);
+        }
+    return scene;
+}
+
+// a room under a ceiling of 32 x 24 small emissive panels, 1536 light triangles, with 128 colored
+// point lights floating over spheres on the floor, lit only by them
+static Scene create_lights(float aspect_ratio, unsigned seed)
+{
+    Scene scene;
+    scene.camera.position = glm::vec3(0.0f, 1.6f, 1.8f);
+    scene.camera.look_at = glm::vec3(0.0f, 1.0f, -4.0f);
+    scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+    scene.camera.vfov = 60.0f;
+    scene.camera.aspect_ratio = aspect_ratio;
+
+    uint32_t state = seed;
+    scene.materials.push_back({glm::vec4(0.6f, 0.6f, 0.6f, 1.0f)});
+    scene.materials.push_back({glm::vec4(0.7f, 0.4f, 0.3f, 1.0f)});
+    // two triangles a b c, a c d, facing where (b - a) x (c - a) points
+    auto add_quad = [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d, unsigned material) {
+        const unsigned base = unsigned(scene.vertices.size());
+        for(const glm::vec3* v : {&a, &b, &c, &d})
+            scene.vertices.push_back(glm::vec4(*v, 1.0f));
+        scene.triangles.push_back({base, base + 1, base + 2, material});
+        scene.triangles.push_back({base, base + 2, base + 3, material});
+    };
+    // floor, ceiling, back and side walls, the front stays open for the camera
+    const float x0 = -4.0f, x1 = 4.0f, y1 = 3.0f, z0 = -6.0f, z1 = 2.0f;
+    add_quad(glm::vec3(x0, 0.0f, z0), glm::vec3(x1, 0.0f, z0), glm::vec3(x1, 0.0f, z1), glm::vec3(x0, 0.0f, z1), 0);
+    add_quad(glm::vec3(x0, y1, z0), glm::vec3(x1, y1, z0), glm::vec3(x1, y1, z1), glm::vec3(x0, y1, z1), 0);
+    add_quad(glm::vec3(x0, 0.0f, z0), glm::vec3(x1, 0.0f, z0), glm::vec3(x1, y1, z0), glm::vec3(x0, y1, z0), 0);
+    add_quad(glm::vec3(x0, 0.0f, z0), glm::vec3(x0, y1, z0), glm::vec3(x0, y1, z1), glm::vec3(x0, 0.0f, z1), 1);
+    add_quad(glm::vec3(x1, 0.0f, z0), glm::vec3(x1, y1, z0), glm::vec3(x1, y1, z1), glm::vec3(x1, 0.0f, z1), 0);
+
+    // panels just under the ceiling, wound so their front faces down
+    const int nx = 32;
+    const int nz = 24;
+    const float cell = 0.25f;
+    const float panel = 0.15f;
+    for(int z = 0; z < nz; ++z)
+        for(int x = 0; x < nx; ++x)
+        {
+            glm::vec3 color(random_color(state));
+            scene.materials.push_back({glm::vec4(1.0f), glm::vec4(color * 4.0f, 1.0f)});
+            const glm::vec3 p(x0 + (x + 0.5f) * cell - panel * 0.5f, y1 - 0.01f, z0 + (z + 0.5f) * cell - panel * 0.5f);
+            add_quad(p, p + glm::vec3(panel, 0.0f, 0.0f), p + glm::vec3(panel, 0.0f, panel), p + glm::vec3(0.0f, 0.0f, panel),
+                unsigned(scene.materials.size() - 1));
+        }
+
+    for(int i = 0; i < 24; ++i)
+    {
+        float radius = 0.2f + 0.3f * random_float(state);
+        float x = x0 + 0.5f + 7.0f * random_float(state);
+        float z = z0 + 0.5f + 6.0f * random_float(state);
+        glm::vec3 center(x, radius, z);
+        scene.materials.push_back({random_color(state)});
+        scene.spheres.push_back({center, radius, unsigned(scene.materials.size() - 1)});
+    }
+    for(int i = 0; i < 128; ++i)
+    {
+        float x = x0 + 8.0f * random_float(state);
+        float y = 1.2f + 1.4f * random_float(state);
+        float z = z0 + 7.0f * random_float(state);
+        glm::vec3 position(x, y, z);
+        scene.point_lights.push_back({position, glm::vec3(random_color(state)) * 0.3f});
+    }
+    return scene;
+}
+
+bool Scene::create_builtin(const std::string& name, float aspect_ratio, unsigned seed, Scene& scene)
+{
+    if(name == "default")
+        scene = create_default(aspect_ratio);
+    else if(name == "spheres")
+        scene = create_spheres(aspect_ratio, seed);
+    else if(name == "mesh")
+        scene = create_mesh(aspect_ratio, seed);
+    else if(name == "instances")
+        scene = create_instances(aspect_ratio, seed);
+    else if(name == "lights")
+        scene = create_lights(aspect_ratio, seed);
+    else
+        return false;
+    return true;
+}
+
+bool Scene::create_from_mesh(const std::string& path, float aspect_ratio, unsigned thread_count, Scene& scene)
+{
+    ImportedMesh mesh;
+    if(!import_mesh(path, mesh, thread_count))
+        return false;
+
+    scene = Scene();
+    // the same color for a name every time, gray for faces without a material
+    uint32_t state = 1;
+    for(const std::string& name : mesh.material_names)
+        scene.materials.push_back({name.empty() ? glm::vec4(0.7f, 0.7f, 0.7f, 1.0f) : random_color(state)});
+    scene.vertices.swap(mesh.positions);
+    scene.triangles.resize(mesh.materials.size());
+    for(size_t i = 0; i < scene.triangles.size(); ++i)
+        scene.triangles[i] = {mesh.indices[i * 3], mesh.indices[i * 3 + 1], mesh.indices[i * 3 + 2], mesh.materials[i]};
+
+    // from the front, a little above, far enough for the bounding sphere to fit the view
+    glm::vec3 lower(0.0f), upper(0.0f);
+    if(!scene.vertices.empty())
+    {
+        lower = upper = glm::vec3(scene.vertices[0]);
+        for(const glm::vec4& v : scene.vertices)
+        {
+            lower = glm::min(lower, glm::vec3(v));
+            upper = glm::max(upper, glm::vec3(v));
+        }
+    }
+    const glm::vec3 center = (lower + upper) * 0.5f;
+    const float radius = std::max(glm::length(upper - lower) * 0.5f, 1e-3f);
+    scene.camera.vfov = 40.0f;
+    scene.camera.aspect_ratio = aspect_ratio;
+    const float distance = radius / std::sin(glm::radians(scene.camera.vfov * 0.5f));
+    scene.camera.position = center + glm::normalize(glm::vec3(0.0f, 0.3f, 1.0f)) * distance;
+    scene.camera.look_at = center;
+    scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+    return true;
+}
+
+SceneView Scene::get_view() const
+{
+    SceneView view;
+    view.camera = camera;
+    view.materials = materials;
+    view.spheres = spheres;
+    view.vertices = vertices;
+    view.triangles = triangles;
+    view.bvh_nodes = bvh_nodes;
+    view.bvh_prim_indices = bvh_prim_indices;
+    view.instances = instances;
+    view.tlas_nodes = tlas_nodes;
+    view.tlas_instance_indices = tlas_instance_indices;
+    view.lights = lights;
+    view.light_nodes = light_nodes;
+    view.environment = environment.width > 0 ? &environment : nullptr;
+    return view;
+}
+
+double Scene::build_bvh(unsigned thread_count)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<unsigned> mesh_roots;
+    ::build_bvh(*this, bvh_nodes, bvh_prim_indices, mesh_roots, thread_count);
+    for(size_t i = 0; i < meshes.size(); ++i)
+        meshes[i].root = mesh_roots[i];
+    for(Instance& instance : instances)
+        instance.root = meshes[instance.mesh].root;
+    m_tlas_build_area = build_tlas(*this, tlas_nodes, tlas_instance_indices, thread_count);
+    build_light_tree(*this, lights, light_nodes);
+    m_moved_first = 0;
+    m_moved_end = 0;
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+size_t Scene::add_instance(unsigned mesh, const glm::mat4& object_to_world)
+{
+    Instance instance = {};
+    instance.mesh = mesh;
+    instance.root = meshes[mesh].root;
+    instances.push_back(instance);
+    set_instance_transform(instances.size() - 1, object_to_world);
+    return instances.size() - 1;
+}
+
+void Scene::set_instance_transform(size_t index, const glm::mat4& object_to_world)
+{
+    // glm is column major, the kernels take rows
+    const glm::mat4 world_to_object = glm::inverse(object_to_world);
+    Instance& instance = instances[index];
+    for(int r = 0; r < 3; ++r)
+    {
+        instance.object_to_world[r] = glm::vec4(object_to_world[0][r], object_to_world[1][r],
+            object_to_world[2][r], object_to_world[3][r]);
+        instance.world_to_object[r] = glm::vec4(world_to_object[0][r], world_to_object[1][r],
+            world_to_object[2][r], world_to_object[3][r]);
+    }
+    if(m_moved_first == m_moved_end)
+    {
+        m_moved_first = index;
+        m_moved_end = index + 1;
+    }
+    else
+    {
+        m_moved_first = std::min(m_moved_first, index);
+        m_moved_end = std::max(m_moved_end, index + 1);
+    }
+}
+
+InstanceUpdate Scene::update_instances(unsigned thread_count)
+{
+    // refitting keeps the tree but its boxes grow as instances drift apart, past this
+    // much more summed area than built with, building again pays off
+    const float rebuild_area_ratio = 1.5f;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    InstanceUpdate update = {};
+    update.instance_first = m_moved_first;
+    update.instance_end = m_moved_end;
+    m_moved_first = 0;
+    m_moved_end = 0;
+    if(update.instance_first != update.instance_end)
+    {
+        float area = refit_tlas(*this, tlas_nodes, tlas_instance_indices, update.node_first, update.node_end);
+        if(area > m_tlas_build_area * rebuild_area_ratio)
+        {
+            m_tlas_build_area = build_tlas(*this, tlas_nodes, tlas_instance_indices, thread_count);
+            update.node_first = 0;
+            update.node_end = tlas_nodes.size();
+            update.rebuilt = true;
+        }
+    }
+    update.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return update;
+}
+
+Scene Scene::create_default(float aspect_ratio)
+{
+    Scene scene;
+    scene.camera.position = glm::vec3(0.0f, 0.0f, 1.0f);
+    scene.camera.look_at = glm::vec3(0.0f, 0.0f, -1.0f);
+    scene.camera.up = glm::vec3(0.0f, 1.0f, 0.0f);
+    scene.camera.vfov = 60.0f;
+    scene.camera.aspect_ratio = aspect_ratio;
+
+    scene.materials.push_back({glm::vec4(0.8f, 0.8f, 0.0f, 1.0f)});
+    scene.materials.push_back({glm::vec4(0.1f, 0.2f, 0.5f, 1.0f)});
+    scene.materials.push_back({glm::vec4(0.8f, 0.8f, 0.8f, 1.0f)});
+    scene.materials.push_back({glm::vec4(0.8f, 0.6f, 0.2f, 1.0f)});
+    scene.materials.push_back({glm::vec4(0.7f, 0.3f, 0.3f, 1.0f)});
+
+    scene.spheres.push_back({glm::vec3(0.0f, -100.5f, -1.0f), 100.0f, 0});
+    scene.spheres.push_back({glm::vec3(0.0f, 0.0f, -1.2f), 0.5f, 1});
+    scene.spheres.push_back({glm::vec3(-1.0f, 0.0f, -1.0f), 0.5f, 2});
+    scene.spheres.push_back({glm::vec3(1.0f, 0.0f, -1.0f), 0.5f, 3});
+
+    // a wall behind the spheres
+    scene.vertices.push_back(glm::vec4(-2.5f, -0.5f, -2.5f, 1.0f));
+    scene.vertices.push_back(glm::vec4(2.5f, -0.5f, -2.5f, 1.0f));
+    scene.vertices.push_back(glm::vec4(2.5f, 1.0f, -2.5f, 1.0f));
+    scene.vertices.push_back(glm::vec4(-2.5f, 1.0f, -2.5f, 1.0f));
+    scene.triangles.push_back({0, 1, 2, 4});
+    scene.triangles.push_back({0, 2, 3, 4});
+    return scene;
+}
@@ -0,0 +1,192 @@
+#ifndef __SCENE__
+#define __SCENE__
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "bvh.h"
+#include "light_tree.h"
+#include "environment.h"
+
+// pinhole camera, shared by cpu and gpu kernels
+// primary ray of pixel (u, v) in [0, 1]: origin -> lower_left + u * horizontal + v * vertical
+struct Camera
+{
+    glm::vec3 position;
+    glm::vec3 look_at;
+    glm::vec3 up;
+    float vfov;  // vertical field of view in degree
+    float aspect_ratio;
+
+    void get_basis(glm::vec3& lower_left, glm::vec3& horizontal, glm::vec3& vertical) const;
+    // world to clip space, x / w and y / w run from -1 to 1 across the image from its left and bottom
+    // edge, w is the distance along the view direction
+    glm::mat4 get_view_projection() const;
+};
+
+// structs below have the same std430 layout as the ones in ray_tracking.comp
+struct Material
+{
+    glm::vec4 color;
+    glm::vec4 emission;  // rgb is the radiance leaving the front face of triangles, which makes them lights
+};
+static_assert(sizeof(Material) == 32, "Material must match std430 layout of ray_tracking.comp");
+
+struct Sphere
+{
+    glm::vec3 center;
+    float radius;
+    unsigned material;
+    unsigned padding[3];
+};
+static_assert(sizeof(Sphere) == 32, "Sphere must match std430 layout of ray_tracking.comp");
+
+// indices into Scene::vertices
+struct Triangle
+{
+    unsigned v0;
+    unsigned v1;
+    unsigned v2;
+    unsigned material;
+};
+static_assert(sizeof(Triangle) == 16, "Triangle must match std430 layout of ray_tracking.comp");
+
+// triangles [first_triangle, first_triangle + triangle_count) of Scene::triangles in mesh space,
+// drawn only where instances place them, any number of times while stored once
+struct Mesh
+{
+    unsigned first_triangle;
+    unsigned triangle_count;
+    unsigned root;  // its bvh in Scene::bvh_nodes, set by build_bvh
+};
+
+// a mesh placed in the world, rays are moved into mesh space to traverse its bvh
+struct Instance
+{
+    glm::vec4 object_to_world[3];  // rows of the affine transform
+    glm::vec4 world_to_object[3];  // rows of its inverse
+    unsigned mesh;
+    unsigned root;  // Mesh::root, copied by build_bvh so the kernels need no mesh array
+    unsigned padding[2];
+};
+static_assert(sizeof(Instance) == 112, "Instance must match std430 layout of ray_tracking.comp");
+
+// emits intensity (power per steradian) evenly in every direction
+struct PointLight
+{
+    glm::vec3 position;
+    glm::vec3 intensity;
+};
+
+// what Scene::update_instances changed, [first, end) ranges, empty when first == end
+struct InstanceUpdate
+{
+    size_t instance_first;
+    size_t instance_end;
+    size_t node_first;  // of tlas_nodes
+    size_t node_end;
+    bool rebuilt;  // the tlas was built again, its size and instance indices may differ too
+    double ms;  // refit or rebuild time
+};
+
+// read only array not owning its data, points into a Scene or a mapped scene file
+template<class T>
+struct ArrayView
+{
+    const T* ptr;
+    size_t count;
+
+    ArrayView(): ptr(nullptr), count(0) {}
+    ArrayView(const T* p, size_t n): ptr(p), count(n) {}
+    template<class Allocator>
+    ArrayView(const std::vector<T, Allocator>& v): ptr(v.data()), count(v.size()) {}
+
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+};
+
+// what the renderers consume, the owner (Scene or SceneFile) must outlive the view and renderers
+struct SceneView
+{
+    Camera camera;
+    ArrayView<Material> materials;
+    ArrayView<Sphere> spheres;
+    ArrayView<glm::vec4> vertices;
+    ArrayView<Triangle> triangles;
+    ArrayView<BvhNode> bvh_nodes;
+    ArrayView<unsigned> bvh_prim_indices;
+    ArrayView<Instance> instances;
+    ArrayView<BvhNode> tlas_nodes;  // empty without instances
+    ArrayView<unsigned> tlas_instance_indices;
+    ArrayView<Light> lights;  // empty without lights
+    ArrayView<LightNode> light_nodes;
+    const EnvironmentMap* environment = nullptr;  // lights the scene in place of the built-in sky
+};
+
+class Scene
+{
+public:
+    static Scene create_default(float aspect_ratio);
+    // built-in scenes by name: default, spheres (a field of small spheres), mesh (a triangle height field),
+    // instances (thousands of instances of a few meshes), lights (a room lit by thousands of emissive
+    // triangles and point lights)
+    // the same seed gives the same scene on every platform, false for an unknown name
+    static bool create_builtin(const std::string& name, float aspect_ratio, unsigned seed, Scene& scene);
+    // the triangles of an .obj or .ply file, see import_mesh(), a material per obj usemtl name
+    // and the camera looking at the whole mesh, false if the file could not be read
+    static bool create_from_mesh(const std::string& path, float aspect_ratio, unsigned thread_count, Scene& scene);
+
+    SceneView get_view() const;
+
+    // (re)build bvh_nodes / bvh_prim_indices, the tlas and the light tree after the geometry or lights changed,
+    // return build time in ms
+    double build_bvh(unsigned thread_count = 0);
+
+    // place mesh with object_to_world, which must be affine, return the index of the instance
+    // it is in the tlas after the next build_bvh
+    size_t add_instance(unsigned mesh, const glm::mat4& object_to_world);
+    // move an instance, the tlas follows in the next update_instances
+    void set_instance_transform(size_t index, const glm::mat4& object_to_world);
+    // refit the tlas to the instances moved since the last call, or build it again once refitting
+    // made it too loose, the mesh trees never change, build_bvh must have been called
+    // pass the result to Renderer::update_instances
+    InstanceUpdate update_instances(unsigned thread_count = 0);
+
+public:
+    Camera camera;
+    std::vector<Material> materials;
+    std::vector<Sphere> spheres;
+    std::vector<glm::vec4> vertices;  // xyz is position, w is unused, vec4 keeps std430 stride
+    std::vector<Triangle> triangles;
+    std::vector<PointLight> point_lights;
+
+    std::vector<Mesh> meshes;
+    std::vector<Instance> instances;
+
+    // acceleration structure over spheres and triangles, see build_bvh() in bvh.h
+    BvhNodeArray bvh_nodes;
+    std::vector<unsigned> bvh_prim_indices;
+    // over the instances, see build_tlas() in bvh.h
+    BvhNodeArray tlas_nodes;
+    std::vector<unsigned> tlas_instance_indices;
+    // over the point lights and emissive triangles, see build_light_tree() in light_tree.h
+    std::vector<Light> lights;
+    std::vector<LightNode> light_nodes;
+
+    // loaded by load_scene for the scene files too, which do not store one
+    EnvironmentMap environment;
+
+private:
+    size_t m_moved_first = 0;  // instances moved since the last update
+    size_t m_moved_end = 0;
+    float m_tlas_build_area = 0.0f;  // summed node area when the tlas was built
+};
+
+
+#endif // __SCENE__
@@ -0,0 +1,299 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "scene_file.h"
+
+static const char scene_file_magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+// version 2 added the instance sections, version 3 the emission of materials and the light sections,
+// the materials of older files do not fit Material any more, they have to be converted again
+static const uint32_t scene_file_version = 3;
+static const uint32_t scene_file_min_version = 3;
+// page size, so every section can also be mapped or read with direct io on its own
+static const uint64_t section_alignment = 4096;
+
+enum class SectionType : uint32_t
+{
+    CAMERA,
+    MATERIALS,
+    SPHERES,
+    VERTICES,
+    TRIANGLES,
+    BVH_NODES,
+    BVH_PRIM_INDICES,
+    INSTANCES,
+    TLAS_NODES,
+    TLAS_INSTANCE_INDICES,
+    LIGHTS,
+    LIGHT_NODES,
+    SECTION_TYPE_COUNT
+};
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t section_count;
+};
+
+struct FileSection
+{
+    uint32_t type;
+    uint32_t element_size;  // sizeof the struct when written, checked on load
+    uint64_t offset;  // from the start of the file
+    uint64_t count;
+};
+
+static uint64_t align_up(uint64_t value)
+{
+    return (value + section_alignment - 1) / section_alignment * section_alignment;
+}
+
+// interior nodes have their left child next and their right one after it, leaves a range of count
+// elements from offset within leaf_size, and no path is deeper than the traversal stacks
+static bool check_tree(const ArrayView<BvhNode>& nodes, size_t leaf_size)
+{
+    std::vector<unsigned> depths(nodes.size(), 0);
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        const BvhNode& node = nodes[i];
+        if(depths[i] >= unsigned(bvh_max_depth))
+            return false;
+        if(node.count > 0)
+        {
+            if(node.offset > leaf_size || node.count > leaf_size - node.offset)
+                return false;
+            continue;
+        }
+        if(i + 1 >= nodes.size() || node.offset <= i + 1 || node.offset >= nodes.size())
+            return false;
+        depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+        depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+    }
+    return true;
+}
+
+// every index the kernels follow stays within the array it points into, so a corrupt or hostile file
+// fails here instead of making them read past the mapping
+static bool check_indices(const SceneView& view)
+{
+    const size_t material_count = view.materials.size();
+    for(size_t i = 0; i < view.spheres.size(); ++i)
+        if(view.spheres[i].material >= material_count)
+            return false;
+    for(size_t i = 0; i < view.triangles.size(); ++i)
+    {
+        const Triangle& tri = view.triangles[i];
+        if(tri.v0 >= view.vertices.size() || tri.v1 >= view.vertices.size() || tri.v2 >= view.vertices.size()
+            || tri.material >= material_count)
+            return false;
+    }
+
+    const size_t prim_count = view.spheres.size() + view.triangles.size();
+    for(size_t i = 0; i < view.bvh_prim_indices.size(); ++i)
+        if(view.bvh_prim_indices[i] >= prim_count)
+            return false;
+    if(!check_tree(view.bvh_nodes, view.bvh_prim_indices.size()))
+        return false;
+
+    for(size_t i = 0; i < view.instances.size(); ++i)
+        if(view.instances[i].root >= view.bvh_nodes.size())
+            return false;
+    for(size_t i = 0; i < view.tlas_instance_indices.size(); ++i)
+        if(view.tlas_instance_indices[i] >= view.instances.size())
+            return false;
+    if(!check_tree(view.tlas_nodes, view.tlas_instance_indices.size()))
+        return false;
+
+    // the light tree is only walked down, one child at a time
+    for(size_t i = 0; i < view.light_nodes.size(); ++i)
+    {
+        const LightNode& node = view.light_nodes[i];
+        if(node.count > 0 ? node.offset >= view.lights.size()
+            : i + 1 >= view.light_nodes.size() || node.offset <= i + 1 || node.offset >= view.light_nodes.size())
+            return false;
+    }
+    return true;
+}
+
+bool SceneFile::save(const Scene& scene, const std::string& path)
+{
+    if(scene.bvh_nodes.empty())
+    {
+        std::cerr << "Scene bvh is not built\n";
+        return false;
+    }
+
+    struct Array
+    {
+        const void* data;
+        uint32_t element_size;
+        uint64_t count;
+    };
+    const Array arrays[size_t(SectionType::SECTION_TYPE_COUNT)] = {
+        {&scene.camera, sizeof(Camera), 1},
+        {scene.materials.data(), sizeof(Material), scene.materials.size()},
+        {scene.spheres.data(), sizeof(Sphere), scene.spheres.size()},
+        {scene.vertices.data(), sizeof(glm::vec4), scene.vertices.size()},
+        {scene.triangles.data(), sizeof(Triangle), scene.triangles.size()},
+        {scene.bvh_nodes.data(), sizeof(BvhNode), scene.bvh_nodes.size()},
+        {scene.bvh_prim_indices.data(), sizeof(unsigned), scene.bvh_prim_indices.size()},
+        {scene.instances.data(), sizeof(Instance), scene.instances.size()},
+        {scene.tlas_nodes.data(), sizeof(BvhNode), scene.tlas_nodes.size()},
+        {scene.tlas_instance_indices.data(), sizeof(unsigned), scene.tlas_instance_indices.size()},
+        {scene.lights.data(), sizeof(Light), scene.lights.size()},
+        {scene.light_nodes.data(), sizeof(LightNode), scene.light_nodes.size()},
+    };
+    const uint32_t section_count = uint32_t(SectionType::SECTION_TYPE_COUNT);
+
+    FileHeader header;
+    std::memcpy(header.magic, scene_file_magic, sizeof(header.magic));
+    header.version = scene_file_version;
+    header.section_count = section_count;
+
+    FileSection sections[size_t(SectionType::SECTION_TYPE_COUNT)];
+    uint64_t offset = align_up(sizeof(FileHeader) + sizeof(sections));
+    for(uint32_t i = 0; i < section_count; ++i)
+    {
+        sections[i].type = i;
+        sections[i].element_size = arrays[i].element_size;
+        sections[i].offset = offset;
+        sections[i].count = arrays[i].count;
+        offset = align_up(offset + arrays[i].element_size * arrays[i].count);
+    }
+
+    std::ofstream fs(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    if(!fs)
+    {
+        std::cerr << "Open scene file for write failed: " << path << "\n";
+        return false;
+    }
+    fs.write((const char*)&header, sizeof(header));
+    fs.write((const char*)sections, sizeof(sections));
+    static const char zeros[section_alignment] = {0};
+    uint64_t position = sizeof(header) + sizeof(sections);
+    for(uint32_t i = 0; i < section_count; ++i)
+    {
+        fs.write(zeros, std::streamsize(sections[i].offset - position));
+        uint64_t size = arrays[i].element_size * arrays[i].count;
+        fs.write((const char*)arrays[i].data, std::streamsize(size));
+        position = sections[i].offset + size;
+    }
+    // pad the tail too, so the last section is a whole number of pages
+    fs.write(zeros, std::streamsize(align_up(position) - position));
+    return bool(fs);
+}
+
+bool SceneFile::open(const std::string& path)
+{
+    close();
+    if(!m_file.open(path))
+        return false;
+
+    const unsigned char* data = m_file.get_data();
+    const size_t size = m_file.get_size();
+    const FileHeader* header = (const FileHeader*)data;
+    if(size < sizeof(FileHeader) || std::memcmp(header->magic, scene_file_magic, sizeof(header->magic)) != 0)
+    {
+        std::cerr << "Not a scene file: " << path << "\n";
+        close();
+        return false;
+    }
+    if(header->version < scene_file_min_version || header->version > scene_file_version)
+    {
+        std::cerr << "Scene file version " << header->version << " not supported, expect "
+            << scene_file_version << ", convert it again: " << path << "\n";
+        close();
+        return false;
+    }
+    if(size < sizeof(FileHeader) + header->section_count * sizeof(FileSection))
+    {
+        std::cerr << "Scene file truncated: " << path << "\n";
+        close();
+        return false;
+    }
+
+    static const uint32_t element_sizes[size_t(SectionType::SECTION_TYPE_COUNT)] = {
+        sizeof(Camera), sizeof(Material), sizeof(Sphere), sizeof(glm::vec4),
+        sizeof(Triangle), sizeof(BvhNode), sizeof(unsigned), sizeof(Instance), sizeof(BvhNode), sizeof(unsigned),
+        sizeof(Light), sizeof(LightNode),
+    };
+    const void* arrays[size_t(SectionType::SECTION_TYPE_COUNT)] = {nullptr};
+    size_t counts[size_t(SectionType::SECTION_TYPE_COUNT)] = {0};
+    const FileSection* sections = (const FileSection*)(data + sizeof(FileHeader));
+    for(uint32_t i = 0; i < header->section_count; ++i)
+    {
+        const FileSection& section = sections[i];
+        if(section.type >= uint32_t(SectionType::SECTION_TYPE_COUNT))
+            continue;  // written by a newer version, not needed here
+        if(section.element_size != element_sizes[section.type]
+            || section.offset % section_alignment != 0
+            || section.offset > size
+            || section.count > (size - section.offset) / section.element_size)
+        {
+            std::cerr << "Scene file section " << section.type << " is invalid: " << path << "\n";
+            close();
+            return false;
+        }
+        arrays[section.type] = data + section.offset;
+        counts[section.type] = size_t(section.count);
+    }
+    if(counts[size_t(SectionType::CAMERA)] != 1 || counts[size_t(SectionType::BVH_NODES)] == 0)
+    {
+        std::cerr << "Scene file misses camera or bvh: " << path << "\n";
+        close();
+        return false;
+    }
+
+    m_view.camera = *(const Camera*)arrays[size_t(SectionType::CAMERA)];
+    m_view.materials = ArrayView<Material>((const Material*)arrays[size_t(SectionType::MATERIALS)],
+        counts[size_t(SectionType::MATERIALS)]);
+    m_view.spheres = ArrayView<Sphere>((const Sphere*)arrays[size_t(SectionType::SPHERES)],
+        counts[size_t(SectionType::SPHERES)]);
+    m_view.vertices = ArrayView<glm::vec4>((const glm::vec4*)arrays[size_t(SectionType::VERTICES)],
+        counts[size_t(SectionType::VERTICES)]);
+    m_view.triangles = ArrayView<Triangle>((const Triangle*)arrays[size_t(SectionType::TRIANGLES)],
+        counts[size_t(SectionType::TRIANGLES)]);
+    m_view.bvh_nodes = ArrayView<BvhNode>((const BvhNode*)arrays[size_t(SectionType::BVH_NODES)],
+        counts[size_t(SectionType::BVH_NODES)]);
+    m_view.bvh_prim_indices = ArrayView<unsigned>((const unsigned*)arrays[size_t(SectionType::BVH_PRIM_INDICES)],
+        counts[size_t(SectionType::BVH_PRIM_INDICES)]);
+    m_view.instances = ArrayView<Instance>((const Instance*)arrays[size_t(SectionType::INSTANCES)],
+        counts[size_t(SectionType::INSTANCES)]);
+    m_view.tlas_nodes = ArrayView<BvhNode>((const BvhNode*)arrays[size_t(SectionType::TLAS_NODES)],
+        counts[size_t(SectionType::TLAS_NODES)]);
+    m_view.tlas_instance_indices = ArrayView<unsigned>((const unsigned*)arrays[size_t(SectionType::TLAS_INSTANCE_INDICES)],
+        counts[size_t(SectionType::TLAS_INSTANCE_INDICES)]);
+    m_view.lights = ArrayView<Light>((const Light*)arrays[size_t(SectionType::LIGHTS)],
+        counts[size_t(SectionType::LIGHTS)]);
+    m_view.light_nodes = ArrayView<LightNode>((const LightNode*)arrays[size_t(SectionType::LIGHT_NODES)],
+        counts[size_t(SectionType::LIGHT_NODES)]);
+    if(m_view.tlas_nodes.empty() != m_view.instances.empty())
+    {
+        std::cerr << "Scene file misses the instances or their bvh: " << path << "\n";
+        close();
+        return false;
+    }
+    if(m_view.light_nodes.size() != (m_view.lights.empty() ? 0 : m_view.lights.size() * 2 - 1))
+    {
+        std::cerr << "Scene file misses the lights or their tree: " << path << "\n";
+        close();
+        return false;
+    }
+    if(!check_indices(m_view))
+    {
+        std::cerr << "Scene file has indices out of range: " << path << "\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SceneFile::close()
+{
+    m_view = SceneView();
+    m_file.close();
+}
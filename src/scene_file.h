@@ -0,0 +1,32 @@
+#ifndef __SCENE_FILE__
+#define __SCENE_FILE__
+
+#include <string>
+
+#include "scene.h"
+#include "mapped_file.h"
+
+// binary scene container (.rtscene): header, section table, then every array of SceneView at
+// a page aligned offset, stored in the in-memory layout of the structs in scene.h / bvh.h,
+// so opening is a mmap and the arrays are used in place without parsing or copying,
+// only their sizes and the indices between them are checked once
+class SceneFile
+{
+public:
+    // the scene bvh must be built
+    static bool save(const Scene& scene, const std::string& path);
+
+public:
+    bool open(const std::string& path);
+    void close();
+
+    // points into the mapped file, valid until close
+    const SceneView& get_view() const { return m_view; }
+
+private:
+    MappedFile m_file;
+    SceneView m_view;
+};
+
+
+#endif // __SCENE_FILE__
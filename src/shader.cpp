@@ -1,20 +1,70 @@
 #include <fstream>
+#include <sstream>
 #include <iostream>
+#include <chrono>
 #include "shader.h"
+#include "program_cache.h"
+
+static const GLenum gl_shader_types[] = {
+    GL_VERTEX_SHADER,
+    GL_GEOMETRY_SHADER,
+    GL_FRAGMENT_SHADER,
+    GL_COMPUTE_SHADER,
+};
+
+static const int max_include_depth = 16;
+
+// read path and expand its #include "file" lines, the file is relative to the including one
+static bool load_source(const std::string& path, std::string& source, int depth = 0)
+{
+    if(depth > max_include_depth)
+    {
+        std::cerr << "Shader include too deep: " << path << "\n";
+        return false;
+    }
+    std::ifstream is(path, std::ios_base::binary);
+    if(!is)
+    {
+        std::cerr << "Open shader file failed: " << path << "\n";
+        return false;
+    }
+
+    const size_t slash = path.find_last_of("/\\");
+    const std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    std::string line;
+    while(std::getline(is, line))
+    {
+        size_t begin = line.find_first_not_of(" \t");
+        if(begin != std::string::npos && line.compare(begin, 8, "#include") == 0)
+        {
+            size_t open = line.find('"', begin + 8);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if(close == std::string::npos)
+            {
+                std::cerr << "Bad shader include in " << path << ": " << line << "\n";
+                return false;
+            }
+            if(!load_source(directory + line.substr(open + 1, close - open - 1), source, depth + 1))
+                return false;
+            continue;
+        }
+        source += line;
+        source += '\n';
+    }
+    return true;
+}
 
 Shader::Shader():
-    m_vertex_shader_id(0),
-    m_geometry_shader_id(0),
-    m_fragment_shader_id(0),
-    m_compute_shader_id(0),
-    m_program_id(0)
+    m_programs(1)
 {
+    m_programs[0].id = 0;
 }
 
 Shader::~Shader()
 {
-    if(m_program_id)
-        glDeleteProgram(m_program_id);
+    for(const Program& program : m_programs)
+        if(program.id)
+            glDeleteProgram(program.id);
 }
 
 bool Shader::add_vertex_shader(const std::string& path)
@@ -37,146 +87,222 @@ bool Shader::add_compute_shader(const std::string& path)
     return add_shader(ShaderType::COMPUTE_SHADER, path);
 }
 
-bool Shader::build_shader()
+void Shader::add_define(const std::string& name, const std::string& value)
 {
-    if(m_program_id)
-    {
-        std::cout << "Shader already built\n";
-        return true;
-    }
-    m_program_id = glCreateProgram();
-    if(!m_program_id)
+    m_defines.emplace_back(name, value);
+}
+
+unsigned Shader::add_program(const std::string& define)
+{
+    m_programs.emplace_back();
+    m_programs.back().define = define;
+    m_programs.back().id = 0;
+    return unsigned(m_programs.size() - 1);
+}
+
+bool Shader::build_shader(const ProgramCache* cache)
+{
+    for(Program& program : m_programs)
+        if(!program.id && !build_program(program, cache))
+            return false;
+    return true;
+}
+
+bool Shader::build_program(Program& program, const ProgramCache* cache)
+{
+    program.id = glCreateProgram();
+    if(!program.id)
     {
         std::cerr << "Create shader program failed\n";
         return false;
     }
-    if(m_vertex_shader_id)
-        glAttachShader(m_program_id, m_vertex_shader_id);
-    if(m_geometry_shader_id)
-        glAttachShader(m_program_id, m_geometry_shader_id);
-    if(m_fragment_shader_id)
-        glAttachShader(m_program_id, m_fragment_shader_id);
-    if(m_compute_shader_id)
-        glAttachShader(m_program_id, m_compute_shader_id);
-
-    glLinkProgram(m_program_id);
-    GLint success;
-    glGetProgramiv(m_program_id, GL_LINK_STATUS, &success);
-    if(!success)
-    {
-        char err_info[2048] = {0};
-        glGetProgramInfoLog(m_program_id, sizeof(err_info), NULL, err_info);
-        std::cerr << err_info << "\n";
-        if(m_vertex_shader_id)
-            glDetachShader(m_program_id, m_vertex_shader_id);
-        if(m_geometry_shader_id)
-            glDetachShader(m_program_id, m_geometry_shader_id);
-        if(m_fragment_shader_id)
-            glDetachShader(m_program_id, m_fragment_shader_id);
-        if(m_compute_shader_id)
-            glDetachShader(m_program_id, m_compute_shader_id);
-        glDeleteProgram(m_program_id);
-        m_program_id = 0;
-        return false;
-    }
 
-    if(m_vertex_shader_id)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::string name = program.define.empty() ? "program" : "program " + program.define;
+    const bool use_cache = cache && cache->is_enabled();
+    const uint64_t key = use_cache ? get_cache_key(program) : 0;
+    if(use_cache && cache->load(program.id, key))
     {
-        glDeleteShader(m_vertex_shader_id);
-        m_vertex_shader_id = 0;
+        std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - start;
+        std::cout << "shader cache hit, " << name << " loaded in " << load_time.count() << " ms\n";
+        return true;
     }
-    if(m_geometry_shader_id)
+    if(use_cache)
     {
-        glDeleteShader(m_geometry_shader_id);
-        m_geometry_shader_id = 0;
+        // a rejected binary may leave the program in any state, start over
+        glDeleteProgram(program.id);
+        program.id = glCreateProgram();
+        cache->prepare(program.id);
     }
-    if(m_fragment_shader_id)
+
+    if(!compile_and_link(program))
     {
-        glDeleteShader(m_fragment_shader_id);
-        m_fragment_shader_id = 0;
+        glDeleteProgram(program.id);
+        program.id = 0;
+        return false;
     }
-    if(m_compute_shader_id)
+    std::chrono::duration<double, std::milli> build_time = std::chrono::steady_clock::now() - start;
+    if(use_cache)
     {
-        glDeleteShader(m_compute_shader_id);
-        m_compute_shader_id = 0;
+        bool stored = cache->store(program.id, key);
+        std::cout << "shader cache miss, " << name << " built in " << build_time.count() << " ms"
+            << (stored ? "" : ", store failed") << "\n";
     }
-
     return true;
 }
 
 void Shader::work(bool b_work) const
 {
-    glUseProgram(b_work ? m_program_id : 0);
+    glUseProgram(b_work ? m_programs[0].id : 0);
+}
+
+void Shader::use_program(unsigned program) const
+{
+    glUseProgram(m_programs[program].id);
+}
+
+void Shader::set_uniform(const std::string& name, int value) const
+{
+    for(const Program& program : m_programs)
+        glProgramUniform1i(program.id, get_uniform_location(program, name), value);
+}
+
+void Shader::set_uniform(const std::string& name, float value) const
+{
+    for(const Program& program : m_programs)
+        glProgramUniform1f(program.id, get_uniform_location(program, name), value);
+}
+
+void Shader::set_uniform(const std::string& name, const glm::ivec2& value) const
+{
+    for(const Program& program : m_programs)
+        glProgramUniform2i(program.id, get_uniform_location(program, name), value.x, value.y);
+}
+
+void Shader::set_uniform(const std::string& name, const glm::vec3& value) const
+{
+    for(const Program& program : m_programs)
+        glProgramUniform3f(program.id, get_uniform_location(program, name), value.x, value.y, value.z);
+}
+
+GLint Shader::get_uniform_block_size(const std::string& name) const
+{
+    GLuint index = glGetUniformBlockIndex(m_programs[0].id, name.c_str());
+    if(index == GL_INVALID_INDEX)
+        return -1;
+    GLint size = 0;
+    glGetActiveUniformBlockiv(m_programs[0].id, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+    return size;
+}
+
+GLint Shader::get_uniform_location(const Program& program, const std::string& name) const
+{
+    auto it = program.mp.find(name);
+    if(it != program.mp.end())
+        return it->second;
+
+    // -1 is cached too, uniforms optimized out by the compiler are silently ignored by glUniform*
+    GLint location = glGetUniformLocation(program.id, name.c_str());
+    program.mp[name] = location;
+    return location;
 }
 
 bool Shader::add_shader(ShaderType type, const std::string& path)
 {
-    GLenum shader_type;
-    GLuint* shader_id_ptr;
-    switch(type)
-    {
-    case ShaderType::VETEX_SHADER:
-        shader_type = GL_VERTEX_SHADER;
-        shader_id_ptr = &m_vertex_shader_id;
-        break;
-    case ShaderType::GEOMETRY_SHADER:
-        shader_type = GL_GEOMETRY_SHADER;
-        shader_id_ptr = &m_geometry_shader_id;
-        break;
-    case ShaderType::FRAGMENT_SHADER:
-        shader_type = GL_FRAGMENT_SHADER;
-        shader_id_ptr = &m_fragment_shader_id;
-        break;
-    case ShaderType::COMPUTE_SHADER:
-        shader_type = GL_COMPUTE_SHADER;
-        shader_id_ptr = &m_compute_shader_id;
-        break;
-    default:
-        std::cerr << "Add shader failed, unknow shader type: " << int(type) << "\n";
+    std::string source;
+    if(!load_source(path, source))
         return false;
-    }
 
-    std::ifstream is(path, std::ios_base::binary);
-    if(!is)
-    {
-        std::cerr << "Open shader file failed: " << path << "\n";
-        return false;
-    }
-    std::streampos beg = is.tellg();
-    is.seekg(0, std::ios_base::end);
-    std::streampos end = is.tellg();
-    size_t size = end - beg;
-    is.seekg(0, std::ios_base::beg);
-    char* buffer = new char[size + 1];
-    is.read(buffer, size);
-    buffer[size] = '\0';
-
-    if(*shader_id_ptr)
-    {
-        std::cout << "Shader type " << int(shader_type) << " already added, "
+    std::string& slot = m_sources[size_t(type)];
+    if(!slot.empty())
+        std::cout << "Shader type " << gl_shader_types[size_t(type)] << " already added, "
             << "old one will be removed.\n";
-        glDeleteShader(*shader_id_ptr);
-    }
+    slot = std::move(source);
+    m_paths[size_t(type)] = path;
+    return true;
+}
+
+std::string Shader::get_source(ShaderType type, const Program& program) const
+{
+    const std::string& source = m_sources[size_t(type)];
+    if(m_defines.empty() && program.define.empty())
+        return source;
 
-    *shader_id_ptr = glCreateShader(shader_type);
-    glShaderSource(*shader_id_ptr, 1, &buffer, NULL);
-    glCompileShader(*shader_id_ptr);
-    GLint success;
-    glGetShaderiv(*shader_id_ptr, GL_COMPILE_STATUS, &success);
-    if(!success)
+    // #version must stay the first statement
+    std::ostringstream defines;
+    for(const std::pair<std::string, std::string>& define : m_defines)
+        defines << "#define " << define.first << " " << define.second << "\n";
+    if(!program.define.empty())
+        defines << "#define " << program.define << "\n";
+    size_t insert_at = 0;
+    size_t version = source.find("#version");
+    if(version != std::string::npos)
     {
-        char err_info[2048] = {0};
-        glGetShaderInfoLog(*shader_id_ptr, sizeof(err_info), NULL, err_info);
-        std::cerr << err_info << "\n";
-        delete[] buffer;
-        glDeleteShader(*shader_id_ptr);
-        *shader_id_ptr = 0;
-        return false;
+        size_t line_end = source.find('\n', version);
+        insert_at = line_end == std::string::npos ? source.size() : line_end + 1;
     }
+    return source.substr(0, insert_at) + defines.str() + source.substr(insert_at);
+}
 
-    delete[] buffer;
-    return true;
+uint64_t Shader::get_cache_key(const Program& program) const
+{
+    // a new driver or gpu produces different binaries
+    uint64_t key = hash_string(reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    key = hash_string(reinterpret_cast<const char*>(glGetString(GL_VERSION)), key);
+    for(size_t i = 0; i < size_t(ShaderType::SHADER_TYPE_COUNT); ++i)
+        key = hash_string(get_source(ShaderType(i), program), key);
+    return key;
 }
 
+bool Shader::compile_and_link(const Program& program)
+{
+    GLuint shader_ids[size_t(ShaderType::SHADER_TYPE_COUNT)] = {0};
+    bool success = true;
+    for(size_t i = 0; i < size_t(ShaderType::SHADER_TYPE_COUNT); ++i)
+    {
+        if(m_sources[i].empty())
+            continue;
+        const std::string source = get_source(ShaderType(i), program);
+        const char* text = source.c_str();
+        shader_ids[i] = glCreateShader(gl_shader_types[i]);
+        glShaderSource(shader_ids[i], 1, &text, NULL);
+        glCompileShader(shader_ids[i]);
+        GLint compiled;
+        glGetShaderiv(shader_ids[i], GL_COMPILE_STATUS, &compiled);
+        if(!compiled)
+        {
+            char err_info[2048] = {0};
+            glGetShaderInfoLog(shader_ids[i], sizeof(err_info), NULL, err_info);
+            std::cerr << m_paths[i] << ": " << err_info << "\n";
+            glDeleteShader(shader_ids[i]);
+            shader_ids[i] = 0;
+            success = false;
+            break;
+        }
+        glAttachShader(program.id, shader_ids[i]);
+    }
 
+    if(success)
+    {
+        glLinkProgram(program.id);
+        GLint linked;
+        glGetProgramiv(program.id, GL_LINK_STATUS, &linked);
+        if(!linked)
+        {
+            char err_info[2048] = {0};
+            glGetProgramInfoLog(program.id, sizeof(err_info), NULL, err_info);
+            std::cerr << err_info << "\n";
+            success = false;
+        }
+    }
 
+    // the program keeps what it needs after linking
+    for(GLuint id : shader_ids)
+    {
+        if(!id)
+            continue;
+        glDetachShader(program.id, id);
+        glDeleteShader(id);
+    }
+    return success;
+}
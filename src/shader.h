@@ -2,9 +2,19 @@
 #define __SHADER__
 
 #include <unordered_map>
+#include <vector>
 #include <string>
+#include <cstdint>
 #include <GL/glew.h>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
 
+class ProgramCache;
+
+// sources are read and their #include "file" lines expanded when added, they are compiled and
+// linked by build_shader, or the linked binary is taken from the cache when one is given
+// the same sources can be built into several programs, each with a define of its own selecting
+// an entry point, program 0 is the one without
 class Shader
 {
 public:
@@ -15,9 +25,24 @@ public:
     bool add_geometry_shader(const std::string& path);
     bool add_fragment_shader(const std::string& path);
     bool add_compute_shader(const std::string& path);
-    bool build_shader();
+    // inserted as "#define name value" after the #version line of every stage, call before build_shader
+    void add_define(const std::string& name, const std::string& value = "");
+    // one more program built with "#define define" added, call before build_shader, return its index
+    unsigned add_program(const std::string& define);
+    // the cache key hashes the expanded sources, the defines, GL_RENDERER and GL_VERSION
+    bool build_shader(const ProgramCache* cache = nullptr);
 
+    // use program 0
     void work(bool b_work = true) const;
+    void use_program(unsigned program) const;
+
+    // uniforms are set on every program having them directly, no need to call work() first
+    void set_uniform(const std::string& name, int value) const;
+    void set_uniform(const std::string& name, float value) const;
+    void set_uniform(const std::string& name, const glm::ivec2& value) const;
+    void set_uniform(const std::string& name, const glm::vec3& value) const;
+    // GL_UNIFORM_BLOCK_DATA_SIZE of the named block in program 0, -1 if it has no such block
+    GLint get_uniform_block_size(const std::string& name) const;
 
 private:
     enum struct ShaderType
@@ -26,18 +51,28 @@ private:
         GEOMETRY_SHADER,
         FRAGMENT_SHADER,
         COMPUTE_SHADER,
+        SHADER_TYPE_COUNT
+    };
+
+    struct Program
+    {
+        std::string define;  // empty for program 0
+        GLuint id;
+        mutable std::unordered_map<std::string, GLint> mp;  // uniform name -> uniform location
     };
 
     bool add_shader(ShaderType type, const std::string& path);
-    GLint get_uniform_location(const std::string& name) const;
+    bool build_program(Program& program, const ProgramCache* cache);
+    std::string get_source(ShaderType type, const Program& program) const;  // with the defines
+    uint64_t get_cache_key(const Program& program) const;
+    bool compile_and_link(const Program& program);
+    GLint get_uniform_location(const Program& program, const std::string& name) const;
 
 private:
-    GLuint m_vertex_shader_id;
-    GLuint m_geometry_shader_id;
-    GLuint m_fragment_shader_id;
-    GLuint m_compute_shader_id;
-    GLuint m_program_id;
-    mutable std::unordered_map<std::string, GLint> mp;  // uniform name -> uniform location
+    std::string m_sources[size_t(ShaderType::SHADER_TYPE_COUNT)];  // expanded, empty if not added
+    std::string m_paths[size_t(ShaderType::SHADER_TYPE_COUNT)];
+    std::vector<std::pair<std::string, std::string>> m_defines;
+    std::vector<Program> m_programs;
 };
 
 
@@ -0,0 +1,249 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+#include "socket.h"
+
+#ifdef _WIN32
+static const SocketHandle invalid_handle = SocketHandle(INVALID_SOCKET);
+
+// winsock needs starting once per process
+struct WinsockInit
+{
+    WinsockInit()
+    {
+        WSADATA data;
+        if(WSAStartup(MAKEWORD(2, 2), &data) != 0)
+            std::cerr << "WSAStartup failed\n";
+    }
+    ~WinsockInit() { WSACleanup(); }
+};
+static WinsockInit winsock_init;
+
+static void close_handle(SocketHandle handle)
+{
+    closesocket(SOCKET(handle));
+}
+#else
+static const SocketHandle invalid_handle = -1;
+
+static void close_handle(SocketHandle handle)
+{
+    ::close(handle);
+}
+#endif
+
+#ifdef MSG_NOSIGNAL
+static const int send_flags = MSG_NOSIGNAL;  // a closed peer is an error, not SIGPIPE
+#else
+static const int send_flags = 0;
+#endif
+
+Socket::Socket():
+    m_handle(invalid_handle)
+{
+}
+
+Socket::~Socket()
+{
+    close();
+}
+
+Socket::Socket(Socket&& other):
+    m_handle(other.m_handle)
+{
+    other.m_handle = invalid_handle;
+}
+
+Socket& Socket::operator=(Socket&& other)
+{
+    if(this != &other)
+    {
+        close();
+        m_handle = other.m_handle;
+        other.m_handle = invalid_handle;
+    }
+    return *this;
+}
+
+bool Socket::is_open() const
+{
+    return m_handle != invalid_handle;
+}
+
+bool Socket::connect(const std::string& host, unsigned short port)
+{
+    close();
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+    {
+        std::cerr << "Resolve address failed: " << host << "\n";
+        return false;
+    }
+    for(addrinfo* a = addresses; a; a = a->ai_next)
+    {
+        m_handle = SocketHandle(socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+        if(m_handle == invalid_handle)
+            continue;
+        if(::connect(m_handle, a->ai_addr, int(a->ai_addrlen)) == 0)
+            break;
+        close();
+    }
+    freeaddrinfo(addresses);
+    if(!is_open())
+        return false;
+
+    // results are large and sent at once, small messages should not wait for them
+    int no_delay = 1;
+    setsockopt(m_handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+    return true;
+}
+
+bool Socket::listen(unsigned short port, bool local_only)
+{
+    close();
+    m_handle = SocketHandle(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    if(m_handle == invalid_handle)
+        return false;
+    // restarting the coordinator must not wait for the old port to time out
+    int reuse = 1;
+    setsockopt(m_handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(local_only ? INADDR_LOOPBACK : INADDR_ANY);
+    address.sin_port = htons(port);
+    if(bind(m_handle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_handle, 16) != 0)
+    {
+        std::cerr << "Listen on port " << port << " failed\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+Socket Socket::accept()
+{
+    Socket socket;
+    socket.m_handle = SocketHandle(::accept(m_handle, nullptr, nullptr));
+    if(socket.is_open())
+    {
+        int no_delay = 1;
+        setsockopt(socket.m_handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+    }
+    return socket;
+}
+
+bool Socket::send_all(const void* data, size_t size)
+{
+    const char* p = static_cast<const char*>(data);
+    while(size > 0 && is_open())
+    {
+        // a few MB at a time, send takes an int length on windows
+        int chunk = int(std::min<size_t>(size, 1 << 22));
+        int sent = int(::send(m_handle, p, chunk, send_flags));
+        if(sent <= 0)
+        {
+            close();
+            return false;
+        }
+        p += sent;
+        size -= size_t(sent);
+    }
+    return is_open();
+}
+
+bool Socket::recv_all(void* data, size_t size)
+{
+    char* p = static_cast<char*>(data);
+    while(size > 0 && is_open())
+    {
+        int chunk = int(std::min<size_t>(size, 1 << 22));
+        int received = int(::recv(m_handle, p, chunk, 0));
+        if(received <= 0)
+        {
+            close();
+            return false;
+        }
+        p += received;
+        size -= size_t(received);
+    }
+    return is_open();
+}
+
+size_t Socket::recv_some(void* data, size_t size)
+{
+    if(!is_open())
+        return 0;
+    int received = int(::recv(m_handle, static_cast<char*>(data), int(std::min<size_t>(size, 1 << 22)), 0));
+    if(received <= 0)
+    {
+        close();
+        return 0;
+    }
+    return size_t(received);
+}
+
+void Socket::close()
+{
+    if(m_handle != invalid_handle)
+        close_handle(m_handle);
+    m_handle = invalid_handle;
+}
+
+std::vector<size_t> Socket::wait_readable(const std::vector<Socket*>& sockets, int timeout_ms)
+{
+    fd_set set;
+    FD_ZERO(&set);
+    SocketHandle max_handle = 0;
+    for(const Socket* socket : sockets)
+        if(socket->is_open())
+        {
+            FD_SET(socket->m_handle, &set);
+            max_handle = std::max(max_handle, socket->m_handle);
+        }
+
+    std::vector<size_t> readable;
+    timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    // the first argument is ignored by winsock
+    if(select(int(max_handle + 1), &set, nullptr, nullptr, &timeout) <= 0)
+        return readable;
+    for(size_t i = 0; i < sockets.size(); ++i)
+        if(sockets[i]->is_open() && FD_ISSET(sockets[i]->m_handle, &set))
+            readable.push_back(i);
+    return readable;
+}
+
+bool parse_address(const std::string& address, std::string& host, unsigned short& port)
+{
+    const size_t colon = address.find_last_of(':');
+    if(colon == std::string::npos || colon + 1 == address.size())
+        return false;
+    char* end = nullptr;
+    long value = std::strtol(address.c_str() + colon + 1, &end, 10);
+    if(*end != '\0' || value <= 0 || value > 65535)
+        return false;
+    host = colon == 0 ? std::string("localhost") : address.substr(0, colon);
+    port = (unsigned short)value;
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef __SOCKET__
+#define __SOCKET__
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+typedef uintptr_t SocketHandle;  // SOCKET
+#else
+typedef int SocketHandle;
+#endif
+
+// blocking TCP socket, winsock on windows, BSD sockets elsewhere
+// a closed peer or any error shows up as false from send_all / recv_all, the socket is then closed
+class Socket
+{
+public:
+    Socket();
+    ~Socket();
+
+    Socket(Socket&& other);
+    Socket& operator=(Socket&& other);
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    bool is_open() const;
+    // resolve host and connect to it
+    bool connect(const std::string& host, unsigned short port);
+    // listen on every interface, or only for connections from this machine
+    bool listen(unsigned short port, bool local_only = false);
+    // the next connection of a listening socket, not open on failure
+    Socket accept();
+    bool send_all(const void* data, size_t size);
+    bool recv_all(void* data, size_t size);
+    // what has arrived up to size bytes, blocks when nothing has, 0 when the peer is gone
+    size_t recv_some(void* data, size_t size);
+    void close();
+
+    // wait at most timeout_ms for some of the open sockets to be readable, or a listening one to have
+    // a connection waiting, return their indices
+    static std::vector<size_t> wait_readable(const std::vector<Socket*>& sockets, int timeout_ms);
+
+private:
+    SocketHandle m_handle;
+};
+
+// split "host:port", false when there is no valid port
+bool parse_address(const std::string& address, std::string& host, unsigned short& port);
+
+
+#endif // __SOCKET__
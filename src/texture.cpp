@@ -1,13 +1,9 @@
 #include <iostream>
-#include <fstream>
+#include <vector>
 #include <stdexcept>
 
 #include "texture.h"
-
-inline int saturate(int value, int min = 0, int max = 255)
-{
-    return value > max ? max : value < min ? min : value;
-}
+#include "image_writer.h"
 
 Texture::Texture(unsigned width, unsigned height, ChannelType channel_type, DataType data_type,
     void* data, ChannelType internal_channel_type, DataType internal_data_type) :
@@ -173,7 +169,7 @@ bool Texture::set_data(glm::vec4 color, int x, int y, int width, int height)
     float* buffer = new float[width * height * 4];
     for(int i = 0; i < width * height; ++i)
     {
-        int idx = i * 3;
+        int idx = i * 4;
         buffer[idx++] = color.r;
         buffer[idx++] = color.g;
         buffer[idx++] = color.b;
@@ -185,53 +181,15 @@ bool Texture::set_data(glm::vec4 color, int x, int y, int width, int height)
     return true;
 }
 
-// ppm p6 RGB 0-255
-bool Texture::save_as_ppm(const std::string& file_path)
+bool Texture::save(const std::string& file_path)
 {
     if(!m_id)
         return false;
 
-    std::ofstream fs(file_path, std::ios::binary | std::ios::out);
-    if(!fs)
-        return false;
-
-    int buffer_size = get_size();
-    int pixels = m_width * m_height;
-    void* buf = new char[buffer_size];
-
-    fs << "P6\n" << std::to_string(m_width) << " " << std::to_string(m_height) << "\n255\n";
-
-    // glGetTextureImage(m_id, 0, get_gl_channel_type(), get_gl_data_type(), buffer_size, buf);
-    get_data(buf, buffer_size);
-    if(DataType::UNSIGNED_BYTE == m_data_type)
-    {
-        unsigned char* pc = (unsigned char*)buf;
-        for(int i = 0; i < pixels; ++i)
-        {
-            fs << saturate(*pc++);
-            fs << saturate(*pc++);
-            fs << saturate(*pc++);
-            if(ChannelType::RGBA == m_channel_type)
-                pc++;
-        }
-    }
-    else if(DataType::FLOAT == m_data_type)
-    {
-        float* pf = (float*)buf;
-        for(int i = 0; i < pixels; ++i)
-        {
-            fs << char(saturate(int((*pf++) * 255.999f)));
-            fs << char(saturate(int((*pf++) * 255.999f)));
-            fs << char(saturate(int((*pf++) * 255.999f)));
-            if(ChannelType::RGBA == m_channel_type)
-                pf++;
-        }
-    }
-    else
-        return false;
-
-    delete[] buf;
-    return true;
+    // read as RGBA32F whatever the storage is, the writer converts to the file format
+    std::vector<float> pixels(size_t(m_width) * m_height * 4);
+    glGetTextureImage(m_id, 0, GL_RGBA, GL_FLOAT, GLsizei(pixels.size() * sizeof(float)), pixels.data());
+    return write_image(file_path, pixels.data(), m_width, m_height);
 }
 
 GLenum Texture::get_gl_channel_type()
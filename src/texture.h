@@ -45,7 +45,9 @@ public:
     bool get_data(void* buffer, int buffer_size, int x = -1, int y = -1, int width = -1, int height = -1);
     bool set_data(void* buffer, int x = -1, int y = -1, int width = -1, int height = -1);
     bool set_data(glm::vec4 color, int x = -1, int y = -1, int width = -1, int height = -1);
-    bool save_as_ppm(const std::string& file_path);
+    // synchronous, the format follows the extension, see write_image
+    // TextureReadback saves without stalling the render thread
+    bool save(const std::string& file_path);
 
 private:
     inline int get_internal_type(ChannelType ct, DataType dt)
@@ -0,0 +1,96 @@
+#include <iostream>
+
+#include "texture_readback.h"
+
+TextureReadback::TextureReadback(ImageWriter& writer, unsigned slot_count):
+    m_writer(writer)
+{
+    for(unsigned i = 0; i < slot_count; ++i)
+    {
+        m_slots.emplace_back(new Slot);
+        Slot& slot = *m_slots.back();
+        slot.data = nullptr;
+        slot.width = 0;
+        slot.height = 0;
+        slot.fence = nullptr;
+        slot.state = SlotState::FREE;
+    }
+}
+
+TextureReadback::~TextureReadback()
+{
+    flush();
+}
+
+bool TextureReadback::request(Texture& texture, const std::string& path, int width, int height)
+{
+    Slot* slot = nullptr;
+    for(std::unique_ptr<Slot>& s : m_slots)
+        if(s->state == SlotState::FREE)
+        {
+            slot = s.get();
+            break;
+        }
+    if(!slot)
+        return false;
+
+    unsigned texture_width, texture_height;
+    texture.get_size(&texture_width, &texture_height);
+    if(width < 0 || unsigned(width) > texture_width)
+        width = int(texture_width);
+    if(height < 0 || unsigned(height) > texture_height)
+        height = int(texture_height);
+    const size_t size = size_t(width) * height * 4 * sizeof(float);
+    if(!slot->buffer || slot->buffer->get_size() < size)
+    {
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        slot->buffer.reset(new Buffer(size, nullptr, flags));
+        slot->data = static_cast<const float*>(slot->buffer->map(flags));
+        if(!slot->data)
+        {
+            slot->buffer.reset();
+            return false;
+        }
+    }
+
+    // with a pack buffer bound the pointer is an offset into it, the call returns at once
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer->get_id());
+    glGetTextureSubImage(texture.get_id(), 0, 0, 0, 0, width, height, 1, GL_RGBA, GL_FLOAT, GLsizei(size), nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot->width = width;
+    slot->height = height;
+    slot->path = path;
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->state = SlotState::COPYING;
+    return true;
+}
+
+void TextureReadback::update()
+{
+    for(std::unique_ptr<Slot>& s : m_slots)
+    {
+        Slot* slot = s.get();
+        if(slot->state != SlotState::COPYING)
+            continue;
+        GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+
+        glDeleteSync(slot->fence);
+        slot->fence = nullptr;
+        slot->state = SlotState::WRITING;
+        m_writer.push(slot->path, slot->data, slot->width, slot->height,
+            [slot](bool) { slot->state = SlotState::FREE; });
+    }
+}
+
+void TextureReadback::flush()
+{
+    for(std::unique_ptr<Slot>& s : m_slots)
+        if(s->state == SlotState::COPYING)
+            while(glClientWaitSync(s->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+                ;
+    update();
+    m_writer.flush();
+}
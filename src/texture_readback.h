@@ -0,0 +1,61 @@
+#ifndef __TEXTURE_READBACK__
+#define __TEXTURE_READBACK__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include "texture.h"
+#include "buffer.h"
+#include "image_writer.h"
+
+// save textures without stalling the render thread
+// the texture is copied into a persistently mapped pixel pack buffer, a fence tells when the
+// copy is done, then the writer thread encodes straight from the mapped memory and frees the slot
+// all calls but the writer's are on the gl thread
+class TextureReadback
+{
+public:
+    // slot_count readbacks can be in flight at once
+    explicit TextureReadback(ImageWriter& writer, unsigned slot_count = 3);
+    // wait for every request to be written
+    ~TextureReadback();
+
+    TextureReadback(const TextureReadback&) = delete;
+    TextureReadback& operator=(const TextureReadback&) = delete;
+
+    // start copying the top left width x height of the texture as RGBA32F, -1 means the whole size,
+    // false when every slot is busy
+    bool request(Texture& texture, const std::string& path, int width = -1, int height = -1);
+    // hand the finished copies to the writer, call once a frame
+    void update();
+    // block until every request is written
+    void flush();
+
+private:
+    enum class SlotState
+    {
+        FREE,
+        COPYING,  // waiting for the fence
+        WRITING,  // owned by the writer thread
+    };
+
+    struct Slot
+    {
+        std::unique_ptr<Buffer> buffer;
+        const float* data;
+        unsigned width;
+        unsigned height;
+        std::string path;
+        GLsync fence;
+        std::atomic<SlotState> state;
+    };
+
+private:
+    ImageWriter& m_writer;
+    std::vector<std::unique_ptr<Slot>> m_slots;
+};
+
+
+#endif // __TEXTURE_READBACK__
@@ -0,0 +1,160 @@
+#include <algorithm>
+
+#include "tile_scheduler.h"
+
+static Tile get_tile(int index, int width, int height, int tile_width, int tile_height)
+{
+    const int tiles_x = (width + tile_width - 1) / tile_width;
+    Tile tile;
+    tile.x = (index % tiles_x) * tile_width;
+    tile.y = (index / tiles_x) * tile_height;
+    tile.width = std::min(tile_width, width - tile.x);
+    tile.height = std::min(tile_height, height - tile.y);
+    return tile;
+}
+
+TileScheduler::TileScheduler(unsigned thread_count):
+    m_generation(0),
+    m_busy(0),
+    m_quit(false),
+    m_func(nullptr)
+{
+    if(thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    for(unsigned i = 0; i < thread_count; ++i)
+        m_queues.emplace_back(new WorkQueue);
+    // worker 0 is the thread calling run()
+    for(unsigned i = 1; i < thread_count; ++i)
+        m_threads.emplace_back(&TileScheduler::worker_loop, this, i);
+}
+
+TileScheduler::~TileScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_start_cv.notify_all();
+    for(std::thread& t : m_threads)
+        t.join();
+}
+
+void TileScheduler::run(int width, int height, int tile_width, int tile_height, const TileFunc& func)
+{
+    const int tiles_x = (width + tile_width - 1) / tile_width;
+    const int tiles_y = (height + tile_height - 1) / tile_height;
+    run(width, height, tile_width, tile_height, 0, tiles_x * tiles_y, func);
+}
+
+void TileScheduler::run(int width, int height, int tile_width, int tile_height, int first_tile, int tile_count,
+    const TileFunc& func)
+{
+    if(tile_count <= 0 || width <= 0)
+        return;
+
+    // contiguous runs of tiles per worker keep neighbouring rows on the same core,
+    // stealing from the back takes the tiles farthest from what the owner is working on
+    const unsigned workers = get_thread_count();
+    for(unsigned w = 0; w < workers; ++w)
+    {
+        int begin = first_tile + int(size_t(tile_count) * w / workers);
+        int end = first_tile + int(size_t(tile_count) * (w + 1) / workers);
+        std::lock_guard<std::mutex> lock(m_queues[w]->mutex);
+        for(int i = begin; i < end; ++i)
+            m_queues[w]->tiles.push_back(get_tile(i, width, height, tile_width, tile_height));
+    }
+    start(func);
+}
+
+void TileScheduler::run(int width, int height, int tile_width, int tile_height, const std::vector<unsigned>& tile_indices,
+    const TileFunc& func)
+{
+    if(tile_indices.empty())
+        return;
+
+    const unsigned workers = get_thread_count();
+    const size_t tile_count = tile_indices.size();
+    for(unsigned w = 0; w < workers; ++w)
+    {
+        size_t begin = tile_count * w / workers;
+        size_t end = tile_count * (w + 1) / workers;
+        std::lock_guard<std::mutex> lock(m_queues[w]->mutex);
+        for(size_t i = begin; i < end; ++i)
+            m_queues[w]->tiles.push_back(get_tile(int(tile_indices[i]), width, height, tile_width, tile_height));
+    }
+    start(func);
+}
+
+void TileScheduler::start(const TileFunc& func)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_func = &func;
+        m_busy = unsigned(m_threads.size());
+        ++m_generation;
+    }
+    m_start_cv.notify_all();
+
+    process(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_cv.wait(lock, [this]() { return m_busy == 0; });
+    m_func = nullptr;
+}
+
+void TileScheduler::worker_loop(unsigned index)
+{
+    unsigned generation = 0;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start_cv.wait(lock, [&]() { return m_quit || m_generation != generation; });
+            if(m_quit)
+                return;
+            generation = m_generation;
+        }
+
+        process(index);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(--m_busy == 0)
+            m_done_cv.notify_one();
+    }
+}
+
+void TileScheduler::process(unsigned index)
+{
+    // no tile is added during a run, so empty queues everywhere means the run is finished
+    Tile tile;
+    while(pop(index, tile) || steal(index, tile))
+        (*m_func)(tile, index);
+}
+
+bool TileScheduler::pop(unsigned index, Tile& tile)
+{
+    WorkQueue& queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.tiles.empty())
+        return false;
+    tile = queue.tiles.front();
+    queue.tiles.pop_front();
+    return true;
+}
+
+bool TileScheduler::steal(unsigned index, Tile& tile)
+{
+    const unsigned workers = get_thread_count();
+    for(unsigned i = 1; i < workers; ++i)
+    {
+        WorkQueue& victim = *m_queues[(index + i) % workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(victim.tiles.empty())
+            continue;
+        tile = victim.tiles.back();
+        victim.tiles.pop_back();
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,75 @@
+#ifndef __TILE_SCHEDULER__
+#define __TILE_SCHEDULER__
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+struct Tile
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// persistent thread pool running a function over image tiles
+// every worker owns a deque of tiles, pops from its front and steals from the back of
+// the others when it runs out, so uneven tiles do not leave cores idle
+class TileScheduler
+{
+public:
+    // worker index passed to the function is in [0, get_thread_count())
+    typedef std::function<void(const Tile& tile, unsigned worker)> TileFunc;
+
+public:
+    // thread_count 0 means one worker per hardware thread, the calling thread is worker 0
+    explicit TileScheduler(unsigned thread_count = 0);
+    ~TileScheduler();
+
+    TileScheduler(const TileScheduler&) = delete;
+    TileScheduler& operator=(const TileScheduler&) = delete;
+
+    unsigned get_thread_count() const { return unsigned(m_queues.size()); }
+    // split width x height into tiles and run func on each of them, return when all done
+    void run(int width, int height, int tile_width, int tile_height, const TileFunc& func);
+    // same but only tiles [first_tile, first_tile + tile_count) of the row major tile list
+    void run(int width, int height, int tile_width, int tile_height, int first_tile, int tile_count,
+        const TileFunc& func);
+    // same but only the listed tiles
+    void run(int width, int height, int tile_width, int tile_height, const std::vector<unsigned>& tile_indices,
+        const TileFunc& func);
+
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Tile> tiles;
+    };
+
+    // wake the workers on the queued tiles and help them until all done
+    void start(const TileFunc& func);
+    void worker_loop(unsigned index);
+    void process(unsigned index);
+    bool pop(unsigned index, Tile& tile);
+    bool steal(unsigned index, Tile& tile);
+
+private:
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_start_cv;
+    std::condition_variable m_done_cv;
+    unsigned m_generation;  // increased for every run, wakes the workers
+    unsigned m_busy;  // workers still processing current run
+    bool m_quit;
+    const TileFunc* m_func;
+};
+
+
+#endif // __TILE_SCHEDULER__
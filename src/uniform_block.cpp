@@ -0,0 +1,65 @@
+#include <iostream>
+
+#include "uniform_block.h"
+
+UniformRing::UniformRing(size_t block_size, unsigned count):
+    m_data(nullptr),
+    m_block_size(block_size),
+    m_stride(block_size),
+    m_current(-1),
+    m_fences(count, nullptr)
+{
+}
+
+UniformRing::~UniformRing()
+{
+    for(GLsync fence : m_fences)
+        if(fence)
+            glDeleteSync(fence);
+}
+
+bool UniformRing::init()
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    m_stride = (m_block_size + alignment - 1) / alignment * alignment;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    m_buffer.reset(new Buffer(m_stride * m_fences.size(), nullptr, flags));
+    m_data = static_cast<unsigned char*>(m_buffer->map(flags));
+    if(!m_data)
+    {
+        std::cerr << "Map uniform ring failed\n";
+        m_buffer.reset();
+        return false;
+    }
+    return true;
+}
+
+void* UniformRing::next()
+{
+    // everything using the current region has been submitted by now
+    if(m_current >= 0)
+    {
+        if(m_fences[m_current])
+            glDeleteSync(m_fences[m_current]);
+        m_fences[m_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    m_current = (m_current + 1) % int(m_fences.size());
+    GLsync& fence = m_fences[m_current];
+    if(fence)
+    {
+        while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    return m_data + m_current * m_stride;
+}
+
+void UniformRing::bind(unsigned index) const
+{
+    if(m_current >= 0)
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, m_buffer->get_id(), m_current * m_stride, m_block_size);
+}
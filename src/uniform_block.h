@@ -0,0 +1,81 @@
+#ifndef __UNIFORM_BLOCK__
+#define __UNIFORM_BLOCK__
+
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <type_traits>
+#include <GL/glew.h>
+
+#include "buffer.h"
+
+// ring of uniform buffer regions in one persistently mapped, coherent buffer
+// a region is written only after the fence placed behind its last use has passed, so the
+// cpu never writes what the gpu is still reading, and with enough regions it never waits
+class UniformRing
+{
+public:
+    UniformRing(size_t block_size, unsigned count);
+    ~UniformRing();
+
+    UniformRing(const UniformRing&) = delete;
+    UniformRing& operator=(const UniformRing&) = delete;
+
+    // create and map the buffer, false when the driver could not map it, must succeed before next
+    bool init();
+    // fence the region in use, move to the next one and return it for writing
+    void* next();
+    // bind the current region
+    void bind(unsigned index) const;
+
+private:
+    std::unique_ptr<Buffer> m_buffer;
+    unsigned char* m_data;
+    size_t m_block_size;
+    size_t m_stride;  // block size rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    int m_current;  // -1 before the first next()
+    std::vector<GLsync> m_fences;
+};
+
+// a std140 uniform block mirrored by the c++ struct T
+// T holds 4 byte scalars, glm::ivec2/vec2 at 8 byte offsets, glm::vec3/vec4 at 16 byte offsets (a
+// scalar may follow a vec3 in the same 16 bytes) and glm::mat4 as four vec4 columns at a 16 byte
+// offset; padding arrays are fine where std140 pads, like int padding0[2] before a vec3 in FrameParams.
+// the offset static_asserts next to T are the real check
+template<typename T>
+class UniformBlock
+{
+    static_assert(std::is_trivially_copyable<T>::value && std::is_standard_layout<T>::value,
+        "uniform block must be a plain struct");
+    static_assert(sizeof(T) % 16 == 0, "std140 block size is a multiple of 16 bytes, pad the struct");
+
+public:
+    // count regions, more than one update per frame needs more than the default triple buffering
+    explicit UniformBlock(unsigned count = 3):
+        m_ring(sizeof(T), count)
+    {
+    }
+
+    // see UniformRing::init, before the first update
+    bool init()
+    {
+        return m_ring.init();
+    }
+
+    // a memcpy into the next region, no driver call unless the region is still in use
+    void update(const T& value)
+    {
+        std::memcpy(m_ring.next(), &value, sizeof(T));
+    }
+    // bind the last update to the uniform buffer binding index
+    void bind(unsigned index) const
+    {
+        m_ring.bind(index);
+    }
+
+private:
+    UniformRing m_ring;
+};
+
+
+#endif // __UNIFORM_BLOCK__
@@ -0,0 +1,422 @@
+// render the built-in scenes headless at a fixed size and spp, report the speed as json,
+// optionally against a stored baseline, runs on software OpenGL (Mesa llvmpipe) too
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+
+#include <GL/glew.h>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "headless.h"
+#include "renderer.h"
+#include "texture.h"
+
+struct BenchOptions
+{
+    int width = 320;
+    int height = 180;
+    int samples_per_pixel = 8;
+    int runs = 3;
+    unsigned seed = 1;
+    std::vector<std::string> scenes = {"default", "spheres", "mesh", "instances", "lights"};
+    std::vector<Options::Backend> backends = {Options::Backend::GPU, Options::Backend::CPU};
+    unsigned threads = 0;
+    std::string wavefront = "off";  // off, on or sorted, see --wavefront of ray_tracking
+    // fixed by default so reports stay comparable, auto tunes every case as there is no cache
+    std::string group_size = "32x32";
+    int group_size_x = 32;
+    int group_size_y = 32;
+    std::string shader_path = "../src/ray_tracking.comp";
+    std::string output_path = "bench.json";
+    std::string baseline_path;
+    double threshold = 0.05;
+};
+
+struct BenchResult
+{
+    std::string name;  // scene/backend[/wavefront mode][/group size], the key compare matches on
+    std::string scene;
+    std::string backend;
+    size_t spheres;
+    size_t triangles;
+    size_t instances;
+    size_t lights;
+    double bvh_build_ms;  // with the light tree
+    double init_ms;  // shader build and scene upload, or nothing for the cpu backend
+    double render_ms;  // median of the runs
+    double ms_per_spp;
+    double mrays_per_second;  // one primary ray per sample
+    double peak_memory_mb;  // of the process so far
+    // moving every instance: tlas refit (or rebuild), then the upload, medians, 0 without instances
+    double refit_ms;
+    double upload_ms;
+};
+
+static void print_bench_usage(const char* program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+        << "  --width <n>         image width, default 320\n"
+        << "  --height <n>        image height, default 180\n"
+        << "  --spp <n>           samples per pixel of a run, default 8\n"
+        << "  --runs <n>          timed runs per case, the median is reported, default 3\n"
+        << "  --seed <n>          layout of the random scenes, default 1\n"
+        << "  --scenes <a,b,..>   built-in scenes, default default,spheres,mesh,instances,lights\n"
+        << "  --backend <name>    gpu, cpu or all, default all\n"
+        << "  --threads <n>       threads for the cpu backend and bvh build, default 0 means all\n"
+        << "  --wavefront <mode>  gpu kernels: off, on or sorted, default off\n"
+        << "  --group-size <size> gpu work group <x>x<y> or auto (tuned in init), default 32x32\n"
+        << "  --shader <path>     compute shader path, default ../src/ray_tracking.comp\n"
+        << "  -o, --output <path> json report, default bench.json\n"
+        << "  --compare <path>    report of an earlier run, exit with 1 if a case got slower\n"
+        << "  --threshold <f>     relative Mrays/s drop counted as a regression, default 0.05\n"
+        << "  -h, --help          show this message\n";
+}
+
+static std::vector<std::string> split(const std::string& s, char separator)
+{
+    std::vector<std::string> parts;
+    std::stringstream ss(s);
+    std::string part;
+    while(std::getline(ss, part, separator))
+        if(!part.empty())
+            parts.push_back(part);
+    return parts;
+}
+
+static bool parse_bench_options(int argc, char** argv, BenchOptions& options)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if(std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0)
+            return false;
+        if(i + 1 >= argc)
+        {
+            std::cerr << "Unknown option or missing value: " << arg << "\n";
+            return false;
+        }
+        const char* value = argv[++i];
+        if(std::strcmp(arg, "--width") == 0)
+            options.width = std::atoi(value);
+        else if(std::strcmp(arg, "--height") == 0)
+            options.height = std::atoi(value);
+        else if(std::strcmp(arg, "--spp") == 0)
+            options.samples_per_pixel = std::atoi(value);
+        else if(std::strcmp(arg, "--runs") == 0)
+            options.runs = std::atoi(value);
+        else if(std::strcmp(arg, "--seed") == 0)
+            options.seed = unsigned(std::strtoul(value, nullptr, 10));
+        else if(std::strcmp(arg, "--scenes") == 0)
+            options.scenes = split(value, ',');
+        else if(std::strcmp(arg, "--backend") == 0)
+        {
+            options.backends.clear();
+            if(std::strcmp(value, "gpu") == 0 || std::strcmp(value, "all") == 0)
+                options.backends.push_back(Options::Backend::GPU);
+            if(std::strcmp(value, "cpu") == 0 || std::strcmp(value, "all") == 0)
+                options.backends.push_back(Options::Backend::CPU);
+        }
+        else if(std::strcmp(arg, "--threads") == 0)
+            options.threads = unsigned(std::strtoul(value, nullptr, 10));
+        else if(std::strcmp(arg, "--wavefront") == 0)
+            options.wavefront = value;
+        else if(std::strcmp(arg, "--group-size") == 0)
+        {
+            options.group_size = value;
+            options.group_size_x = options.group_size_y = 0;
+            if(options.group_size != "auto" && std::sscanf(value, "%dx%d", &options.group_size_x, &options.group_size_y) != 2)
+                options.group_size_x = -1;
+        }
+        else if(std::strcmp(arg, "--shader") == 0)
+            options.shader_path = value;
+        else if(std::strcmp(arg, "--output") == 0 || std::strcmp(arg, "-o") == 0)
+            options.output_path = value;
+        else if(std::strcmp(arg, "--compare") == 0)
+            options.baseline_path = value;
+        else if(std::strcmp(arg, "--threshold") == 0)
+            options.threshold = std::atof(value);
+        else
+        {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    if(options.width <= 0 || options.height <= 0 || options.samples_per_pixel <= 0 || options.runs <= 0
+        || options.scenes.empty() || options.backends.empty()
+        || (options.wavefront != "off" && options.wavefront != "on" && options.wavefront != "sorted")
+        || options.group_size_x < 0 || options.group_size_y < 0)
+    {
+        std::cerr << "Invalid bench options\n";
+        return false;
+    }
+    return true;
+}
+
+static double get_peak_memory_mb()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0.0;
+    return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+    // ru_maxrss is in KB on linux
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0.0;
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// every instance a little up or down from where it was built, as an animation frame would
+static double time_instance_update(const BenchOptions& options, Scene& scene, Renderer& renderer, double& upload_ms)
+{
+    std::vector<glm::mat4> transforms(scene.instances.size(), glm::mat4(1.0f));
+    for(size_t i = 0; i < scene.instances.size(); ++i)
+        for(int r = 0; r < 3; ++r)
+            for(int c = 0; c < 4; ++c)
+                transforms[i][c][r] = scene.instances[i].object_to_world[r][c];
+
+    std::vector<double> refit_times, upload_times;
+    for(int run = 0; run < options.runs; ++run)
+    {
+        for(size_t i = 0; i < transforms.size(); ++i)
+        {
+            glm::mat4 moved = transforms[i];
+            moved[3][1] += 0.05f * std::sin(float(run + 1) + float(i));
+            scene.set_instance_transform(i, moved);
+        }
+        InstanceUpdate update = scene.update_instances(options.threads);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        renderer.update_instances(scene.get_view(), update);
+        glFinish();
+        refit_times.push_back(update.ms);
+        upload_times.push_back(elapsed_ms(start));
+    }
+    std::sort(refit_times.begin(), refit_times.end());
+    std::sort(upload_times.begin(), upload_times.end());
+    upload_ms = upload_times[upload_times.size() / 2];
+    return refit_times[refit_times.size() / 2];
+}
+
+static bool run_case(const BenchOptions& options, const std::string& scene_name, Options::Backend backend,
+    BenchResult& result)
+{
+    Scene scene;
+    if(!Scene::create_builtin(scene_name, float(options.width) / options.height, options.seed, scene))
+    {
+        std::cerr << "Unknown scene: " << scene_name << "\n";
+        return false;
+    }
+    result.scene = scene_name;
+    result.backend = backend == Options::Backend::GPU ? "gpu" : "cpu";
+    result.name = result.scene + "/" + result.backend;
+    if(backend == Options::Backend::GPU && options.wavefront != "off")
+        result.name += "/wavefront-" + options.wavefront;
+    if(backend == Options::Backend::GPU && options.group_size != "32x32")
+        result.name += "/group-" + options.group_size;
+    result.spheres = scene.spheres.size();
+    result.triangles = scene.triangles.size();
+    result.instances = scene.instances.size();
+    result.bvh_build_ms = scene.build_bvh(options.threads);
+    result.lights = scene.lights.size();
+
+    Texture picture(options.width, options.height, Texture::ChannelType::RGBA, Texture::DataType::FLOAT, nullptr);
+    picture.activate(0);
+    picture.set_access_for_shader(Texture::Access::READ_WRITE);
+
+    // no shader cache, the init time is a cold build every time
+    Options renderer_options;
+    renderer_options.backend = backend;
+    renderer_options.threads = options.threads;
+    renderer_options.wavefront = options.wavefront != "off";
+    renderer_options.sort_by_material = options.wavefront == "sorted";
+    renderer_options.group_size_x = options.group_size_x;
+    renderer_options.group_size_y = options.group_size_y;
+    renderer_options.shader_path = options.shader_path;
+    renderer_options.shader_cache_path = "";
+    std::unique_ptr<Renderer> renderer = create_renderer(renderer_options, picture);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(!renderer || !renderer->init(scene.get_view()))
+    {
+        std::cerr << "Renderer init failed: " << result.name << "\n";
+        return false;
+    }
+    glFinish();
+    result.init_ms = elapsed_ms(start);
+
+    // the first run pays for lazy driver work and page faults, it is not counted
+    renderer->render(1);
+    glFinish();
+
+    std::vector<double> times;
+    for(int i = 0; i < options.runs; ++i)
+    {
+        renderer->reset();
+        start = std::chrono::steady_clock::now();
+        renderer->render(options.samples_per_pixel);
+        glFinish();
+        times.push_back(elapsed_ms(start));
+    }
+    std::sort(times.begin(), times.end());
+    result.render_ms = times[times.size() / 2];
+    result.ms_per_spp = result.render_ms / options.samples_per_pixel;
+    const double rays = double(options.width) * options.height * options.samples_per_pixel;
+    result.mrays_per_second = rays / result.render_ms * 1.0e-3;
+    result.peak_memory_mb = get_peak_memory_mb();
+    result.refit_ms = 0.0;
+    result.upload_ms = 0.0;
+    if(!scene.instances.empty())
+        result.refit_ms = time_instance_update(options, scene, *renderer, result.upload_ms);
+    return true;
+}
+
+static bool write_report(const BenchOptions& options, const std::vector<BenchResult>& results, std::ostream& os)
+{
+    os << std::fixed << std::setprecision(3);
+    os << "{\n"
+        << "  \"gl_renderer\": \"" << glGetString(GL_RENDERER) << "\",\n"
+        << "  \"gl_version\": \"" << glGetString(GL_VERSION) << "\",\n"
+        << "  \"width\": " << options.width << ",\n"
+        << "  \"height\": " << options.height << ",\n"
+        << "  \"spp\": " << options.samples_per_pixel << ",\n"
+        << "  \"runs\": " << options.runs << ",\n"
+        << "  \"seed\": " << options.seed << ",\n"
+        << "  \"results\": [\n";
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult& r = results[i];
+        os << "    {\"name\": \"" << r.name << "\", \"scene\": \"" << r.scene << "\", \"backend\": \"" << r.backend
+            << "\", \"spheres\": " << r.spheres << ", \"triangles\": " << r.triangles << ", \"instances\": " << r.instances
+            << ", \"lights\": " << r.lights
+            << ", \"bvh_build_ms\": " << r.bvh_build_ms << ", \"init_ms\": " << r.init_ms
+            << ", \"render_ms\": " << r.render_ms << ", \"ms_per_spp\": " << r.ms_per_spp
+            << ", \"mrays_per_s\": " << r.mrays_per_second << ", \"peak_memory_mb\": " << r.peak_memory_mb
+            << ", \"refit_ms\": " << r.refit_ms << ", \"upload_ms\": " << r.upload_ms << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    os << "  ]\n}\n";
+    return bool(os);
+}
+
+// name -> mrays_per_s of a report written by write_report, not a general json reader
+static bool read_baseline(const std::string& path, std::map<std::string, double>& baseline)
+{
+    std::ifstream fs(path);
+    if(!fs)
+    {
+        std::cerr << "Open baseline failed: " << path << "\n";
+        return false;
+    }
+    std::stringstream ss;
+    ss << fs.rdbuf();
+    const std::string text = ss.str();
+
+    static const std::string name_key = "\"name\": \"";
+    static const std::string speed_key = "\"mrays_per_s\": ";
+    for(size_t pos = text.find(name_key); pos != std::string::npos; pos = text.find(name_key, pos))
+    {
+        pos += name_key.size();
+        size_t name_end = text.find('"', pos);
+        size_t speed = text.find(speed_key, pos);
+        size_t next = text.find(name_key, pos);
+        if(name_end == std::string::npos || speed == std::string::npos || (next != std::string::npos && speed > next))
+            continue;
+        baseline[text.substr(pos, name_end - pos)] = std::atof(text.c_str() + speed + speed_key.size());
+    }
+    return !baseline.empty();
+}
+
+// print the change of every case, true when none dropped more than the threshold
+static bool compare(const std::vector<BenchResult>& results, const std::map<std::string, double>& baseline,
+    double threshold)
+{
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(2);
+    for(const BenchResult& r : results)
+    {
+        auto it = baseline.find(r.name);
+        if(it == baseline.end() || it->second <= 0.0)
+        {
+            std::cout << r.name << ": not in baseline\n";
+            continue;
+        }
+        double change = r.mrays_per_second / it->second - 1.0;
+        bool regressed = change < -threshold;
+        passed &= !regressed;
+        std::cout << r.name << ": " << it->second << " -> " << r.mrays_per_second << " Mrays/s ("
+            << (change >= 0.0 ? "+" : "") << change * 100.0 << "%)" << (regressed ? " REGRESSION" : "") << "\n";
+    }
+    return passed;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if(!parse_bench_options(argc, argv, options))
+    {
+        print_bench_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::map<std::string, double> baseline;
+    if(!options.baseline_path.empty() && !read_baseline(options.baseline_path, baseline))
+        return EXIT_FAILURE;
+
+    if(!create_headless_context())
+        return EXIT_FAILURE;
+
+    std::vector<BenchResult> results;
+    bool success = true;
+    for(const std::string& scene : options.scenes)
+        for(Options::Backend backend : options.backends)
+        {
+            BenchResult result;
+            if(!run_case(options, scene, backend, result))
+            {
+                success = false;
+                continue;
+            }
+            std::cout << result.name << ": " << result.mrays_per_second << " Mrays/s, " << result.ms_per_spp
+                << " ms/spp, bvh " << result.bvh_build_ms << " ms, init " << result.init_ms << " ms";
+            if(result.instances > 0)
+                std::cout << ", refit " << result.refit_ms << " ms, upload " << result.upload_ms << " ms";
+            std::cout << "\n";
+            results.push_back(result);
+        }
+
+    std::ofstream fs(options.output_path, std::ios::out | std::ios::trunc);
+    if(!fs || !write_report(options, results, fs))
+    {
+        std::cerr << "Write report failed: " << options.output_path << "\n";
+        success = false;
+    }
+    else
+        std::cout << "report saved: " << options.output_path << "\n";
+
+    if(!baseline.empty() && !compare(results, baseline, options.threshold))
+        success = false;
+
+    destroy_headless_context();
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,77 @@
+// build a scene and its bvh once, write it as .rtscene for ray_tracking --scene
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <chrono>
+
+#include "scene.h"
+#include "scene_file.h"
+#include "mesh_import.h"
+
+static void print_usage(const char* program)
+{
+    std::cout << "Usage: " << program << " [--threads <n>] [--seed <n>] <input> <output.rtscene>\n"
+        << "  input: a built-in scene, default, spheres, mesh, instances or lights, or an .obj / binary .ply file\n"
+        << "  --threads <n>  import and bvh build threads, default 0 means all hardware threads\n"
+        << "  --seed <n>     layout of the random built-in scenes, default 1\n";
+}
+
+int main(int argc, char** argv)
+{
+    unsigned threads = 0;
+    unsigned seed = 1;
+    std::string input;
+    std::string output;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = unsigned(std::strtoul(argv[++i], nullptr, 10));
+        else if(std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = unsigned(std::strtoul(argv[++i], nullptr, 10));
+        else if(input.empty())
+            input = argv[i];
+        else if(output.empty())
+            output = argv[i];
+        else
+        {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(input.empty() || output.empty())
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Scene scene;
+    if(is_mesh_path(input))
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if(!Scene::create_from_mesh(input, 16.0f / 9.0f, threads, scene))
+            return EXIT_FAILURE;
+        std::chrono::duration<double, std::milli> import_time = std::chrono::steady_clock::now() - start;
+        std::cout << scene.vertices.size() << " vertices, " << scene.materials.size() << " materials imported in "
+            << import_time.count() << " ms\n";
+    }
+    else if(!Scene::create_builtin(input, 16.0f / 9.0f, seed, scene))
+    {
+        std::cerr << "Unsupported input: " << input << "\n";
+        return EXIT_FAILURE;
+    }
+
+    double bvh_time = scene.build_bvh(threads);
+    std::cout << scene.spheres.size() << " spheres, " << scene.triangles.size() << " triangles, "
+        << scene.instances.size() << " instances of " << scene.meshes.size() << " meshes, " << scene.lights.size()
+        << " lights, " << scene.bvh_nodes.size() + scene.tlas_nodes.size() + scene.light_nodes.size()
+        << " bvh and light tree nodes built in " << bvh_time << " ms\n";
+
+    if(!SceneFile::save(scene, output))
+    {
+        std::cerr << "Write scene file failed: " << output << "\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "scene saved: " << output << "\n";
+    return EXIT_SUCCESS;
+}